@@ -9,6 +9,9 @@ c_double_p = ctypes.POINTER(ctypes.c_double)
 c_float_p = ctypes.POINTER(ctypes.c_float)
 c_bool_p = ctypes.POINTER(ctypes.c_bool)
 c_uint_p = ctypes.POINTER(ctypes.c_uint)
+c_ulong_p = ctypes.POINTER(ctypes.c_ulong)
+c_uint16_p = ctypes.POINTER(ctypes.c_uint16)
+c_uint8_p = ctypes.POINTER(ctypes.c_uint8)
 
 FastBDT_library =  ctypes.cdll.LoadLibrary(os.path.join(os.path.dirname(__file__),'libFastBDT_CInterface.so'))
 
@@ -16,14 +19,51 @@ FastBDT_library.Create.restype = ctypes.c_void_p
 FastBDT_library.Delete.argtypes = [ctypes.c_void_p]
 
 FastBDT_library.Load.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.Load.restype = ctypes.c_bool
+FastBDT_library.LoadPartial.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_ulong]
+FastBDT_library.LoadPartial.restype = ctypes.c_bool
+FastBDT_library.Recover.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.Recover.restype = ctypes.c_bool
 FastBDT_library.Save.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.Save.restype = ctypes.c_bool
+FastBDT_library.SaveBinary.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.SaveBinary.restype = ctypes.c_bool
+FastBDT_library.SaveMapped.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.SaveMapped.restype = ctypes.c_bool
+FastBDT_library.SaveCompact.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+FastBDT_library.SaveCompact.restype = ctypes.c_bool
+FastBDT_library.IsInferenceOnly.argtypes = [ctypes.c_void_p]
+FastBDT_library.IsInferenceOnly.restype = ctypes.c_bool
+
+FastBDT_library.LoadMapped.argtypes = [ctypes.c_char_p]
+FastBDT_library.LoadMapped.restype = ctypes.c_void_p
+FastBDT_library.DeleteMapped.argtypes = [ctypes.c_void_p]
+FastBDT_library.GetMappedNFeatures.argtypes = [ctypes.c_void_p]
+FastBDT_library.GetMappedNFeatures.restype = ctypes.c_ulong
+FastBDT_library.PredictMapped.argtypes = [ctypes.c_void_p, c_float_p]
+FastBDT_library.PredictMapped.restype = ctypes.c_float
+FastBDT_library.PredictArrayMapped.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, ctypes.c_ulong, ctypes.c_ulong]
 
 FastBDT_library.Fit.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, c_bool_p, ctypes.c_uint]
+FastBDT_library.FitStreaming.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, c_bool_p, ctypes.c_ulong, ctypes.c_ulong, ctypes.c_char_p]
+FastBDT_library.FitStreaming.restype = ctypes.c_bool
 
 FastBDT_library.Predict.argtypes = [ctypes.c_void_p, c_float_p]
 FastBDT_library.Predict.restype = ctypes.c_float
 
 FastBDT_library.PredictArray.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, ctypes.c_uint]
+FastBDT_library.PredictArrayThreaded.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, ctypes.c_ulong, ctypes.c_ulong]
+FastBDT_library.PredictArrayStrided.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, ctypes.c_ulong, ctypes.c_ulong, ctypes.c_ulong, ctypes.c_ulong]
+
+FastBDT_library.PredictAbove.argtypes = [ctypes.c_void_p, c_float_p, ctypes.c_float]
+FastBDT_library.PredictAbove.restype = ctypes.c_bool
+FastBDT_library.PredictArrayAbove.argtypes = [ctypes.c_void_p, c_float_p, c_bool_p, ctypes.c_ulong, ctypes.c_float]
+FastBDT_library.GetLeafIndicesArray.argtypes = [ctypes.c_void_p, c_float_p, c_uint16_p, ctypes.c_ulong]
+FastBDT_library.GetLeafIndicesArray.restype = ctypes.c_bool
+FastBDT_library.GetLeafIndicesArray8.argtypes = [ctypes.c_void_p, c_float_p, c_uint8_p, ctypes.c_ulong]
+FastBDT_library.GetLeafIndicesArray8.restype = ctypes.c_bool
+FastBDT_library.PredictArrayStaged.argtypes = [ctypes.c_void_p, c_float_p, c_float_p, ctypes.c_ulong, c_ulong_p, ctypes.c_ulong]
+FastBDT_library.PredictArrayStaged.restype = ctypes.c_bool
 
 FastBDT_library.SetSubsample.argtypes = [ctypes.c_void_p, ctypes.c_double]
 FastBDT_library.GetSubsample.argtypes = [ctypes.c_void_p]
@@ -40,6 +80,8 @@ FastBDT_library.GetFlatnessLoss.restypes = ctypes.c_double
 FastBDT_library.SetNTrees.argtypes = [ctypes.c_void_p, ctypes.c_uint]
 FastBDT_library.GetNTrees.argtypes = [ctypes.c_void_p]
 FastBDT_library.GetNTrees.restypes = ctypes.c_uint
+FastBDT_library.GetNLoadedTrees.argtypes = [ctypes.c_void_p]
+FastBDT_library.GetNLoadedTrees.restype = ctypes.c_ulong
 
 FastBDT_library.SetNumberOfFlatnessFeatures.argtypes = [ctypes.c_void_p, ctypes.c_uint]
 FastBDT_library.GetNumberOfFlatnessFeatures.argtypes = [ctypes.c_void_p]
@@ -60,6 +102,10 @@ FastBDT_library.SetSPlot.argtypes = [ctypes.c_void_p, ctypes.c_bool]
 FastBDT_library.GetSPlot.argtypes = [ctypes.c_void_p]
 FastBDT_library.GetSPlot.restypes = ctypes.c_bool
 
+FastBDT_library.SetNThreads.argtypes = [ctypes.c_void_p, ctypes.c_ulong]
+FastBDT_library.GetNThreads.argtypes = [ctypes.c_void_p]
+FastBDT_library.GetNThreads.restype = ctypes.c_ulong
+
 
 FastBDT_library.GetVariableRanking.argtypes = [ctypes.c_void_p]
 FastBDT_library.GetVariableRanking.restype = ctypes.c_void_p
@@ -71,6 +117,8 @@ FastBDT_library.ExtractImportanceOfVariableFromVariableRanking.restype = ctypes.
     
 FastBDT_library.GetIndividualVariableRanking.argtypes = [ctypes.c_void_p, c_float_p]
 FastBDT_library.GetIndividualVariableRanking.restype = ctypes.c_void_p
+FastBDT_library.GetIndividualVariableRankingArray.argtypes = [ctypes.c_void_p, c_float_p, c_double_p, ctypes.c_ulong]
+FastBDT_library.GetIndividualVariableRankingArray.restype = ctypes.c_bool
 
 
 def PrintVersion():
@@ -96,7 +144,7 @@ def calculate_roc_auc(p, t, w=None):
 
 
 class Classifier(object):
-    def __init__(self, binning=[], nTrees=100, depth=3, shrinkage=0.1, subsample=0.5, transform2probability=True, purityTransformation=[], sPlot=False, flatnessLoss=-1.0, numberOfFlatnessFeatures=0):
+    def __init__(self, binning=[], nTrees=100, depth=3, shrinkage=0.1, subsample=0.5, transform2probability=True, purityTransformation=[], sPlot=False, flatnessLoss=-1.0, numberOfFlatnessFeatures=0, nThreads=1):
         """
         @param binning list of numbers with the power N used for each feature binning e.g. 8 means 2^8 bins
         @param nTrees number of trees
@@ -107,6 +155,7 @@ class Classifier(object):
         @param sPlot special treatment of sPlot weights are used
         @param flatnessLoss if bigger than 0 a flatness boost against all flatnessFeatures
         @param numberOfFlatnessFeatures the number of flatness features, it is assumed that the last N features are the flatness features
+        @param nThreads number of threads used by predict, 0 means one thread per cpu core
         """
         self.binning = binning
         self.nTrees = nTrees
@@ -118,6 +167,7 @@ class Classifier(object):
         self.sPlot = sPlot
         self.flatnessLoss = flatnessLoss
         self.numberOfFlatnessFeatures = numberOfFlatnessFeatures
+        self.nThreads = nThreads
         self.forest = self.create_forest()
 
     def create_forest(self):
@@ -131,37 +181,173 @@ class Classifier(object):
         FastBDT_library.SetFlatnessLoss(forest, float(self.flatnessLoss))
         FastBDT_library.SetTransform2Probability(forest, bool(self.transform2probability))
         FastBDT_library.SetSPlot(forest, bool(self.sPlot))
+        FastBDT_library.SetNThreads(forest, int(self.nThreads))
         FastBDT_library.SetPurityTransformation(forest, np.array(self.purityTransformation).ctypes.data_as(c_uint_p), int(len(self.purityTransformation)))
         return forest
 
-    def fit(self, X, y, weights=None):
+    def fit(self, X, y, weights=None, weightfile=None):
+        """
+        @param X feature matrix with one event per row
+        @param y labels
+        @param weights event weights, None means all events have the weight one
+        @param weightfile if given, the text weightfile is written while the trees are built,
+                          the trees of an interrupted training can be loaded with recover
+        """
         X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
         y_temp = np.require(y, dtype=np.bool, requirements=['A', 'W', 'C', 'O'])
         if weights is not None:
             w_temp = np.require(weights, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
         numberOfEvents, numberOfFeatures = X_temp.shape
-        FastBDT_library.Fit(self.forest, X_temp.ctypes.data_as(c_float_p),
-                              w_temp.ctypes.data_as(c_float_p) if weights is not None else None,
-                              y_temp.ctypes.data_as(c_bool_p), int(numberOfEvents), int(numberOfFeatures))
+        if weightfile is not None:
+            if not FastBDT_library.FitStreaming(self.forest, X_temp.ctypes.data_as(c_float_p),
+                                                w_temp.ctypes.data_as(c_float_p) if weights is not None else None,
+                                                y_temp.ctypes.data_as(c_bool_p), int(numberOfEvents), int(numberOfFeatures),
+                                                bytes(weightfile, 'utf-8')):
+                raise RuntimeError("Could not write the weightfile " + weightfile)
+        else:
+            FastBDT_library.Fit(self.forest, X_temp.ctypes.data_as(c_float_p),
+                                  w_temp.ctypes.data_as(c_float_p) if weights is not None else None,
+                                  y_temp.ctypes.data_as(c_bool_p), int(numberOfEvents), int(numberOfFeatures))
         return self
 
-    def predict(self, X):
-        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+    def predict(self, X, nThreads=None):
+        """
+        @param X feature matrix with one event per row
+        @param nThreads number of threads, 0 means one thread per cpu core, None uses the nThreads of the classifier
+        The GIL is released during the prediction (ctypes.cdll releases it for every call)
+        Column-major (Fortran-order) and other strided float32 matrices are passed without copying them
+        """
+        X_temp = np.require(X, dtype=np.float32, requirements=['A'])
         N = len(X)
-        p = np.require(np.zeros(N), dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
-        FastBDT_library.PredictArray(self.forest, X_temp.ctypes.data_as(c_float_p), p.ctypes.data_as(c_float_p), int(X_temp.shape[0]))
+        p = np.empty(N, dtype=np.float32)
+        if nThreads is None:
+            nThreads = self.nThreads
+        rowStride, columnStride = X_temp.strides if X_temp.ndim == 2 else (0, 0)
+        itemsize = X_temp.itemsize
+        if not X_temp.flags['C_CONTIGUOUS'] and rowStride > 0 and columnStride > 0 and rowStride % itemsize == 0 and columnStride % itemsize == 0:
+            FastBDT_library.PredictArrayStrided(self.forest, X_temp.ctypes.data_as(c_float_p), p.ctypes.data_as(c_float_p), int(X_temp.shape[0]),
+                                                int(rowStride // itemsize), int(columnStride // itemsize), int(nThreads))
+            return p
+        X_temp = np.require(X_temp, requirements=['A', 'W', 'C', 'O'])
+        FastBDT_library.PredictArrayThreaded(self.forest, X_temp.ctypes.data_as(c_float_p), p.ctypes.data_as(c_float_p), int(X_temp.shape[0]), int(nThreads))
         return p
     
+    def predict_above(self, X, threshold):
+        """
+        Returns predict(X) > threshold for each event, the evaluation of an event stops as soon as the result is settled
+        @param X feature matrix with one event per row
+        @param threshold decision threshold on the output of predict
+        """
+        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+        N = len(X)
+        result = np.empty(N, dtype=np.bool_)
+        FastBDT_library.PredictArrayAbove(self.forest, X_temp.ctypes.data_as(c_float_p), result.ctypes.data_as(c_bool_p), int(X_temp.shape[0]), float(threshold))
+        return result
+
+    def predict_staged(self, X, checkpoints=None):
+        """
+        Returns the prediction after the first checkpoints[i] trees as a matrix with one event per row and one checkpoint per column,
+        all checkpoints are evaluated in one pass over the forest
+        @param X feature matrix with one event per row
+        @param checkpoints numbers of trees in increasing order, None uses every number of trees from 1 to the number of loaded trees
+        """
+        # The loaded forest may have fewer trees than configured (early termination, recover or a partial load)
+        nTrees = FastBDT_library.GetNLoadedTrees(self.forest)
+        if checkpoints is None:
+            checkpoints = range(1, nTrees + 1)
+        checkpoints = list(checkpoints)
+        if any(c < 0 or c > nTrees for c in checkpoints) or any(a > b for a, b in zip(checkpoints, checkpoints[1:])):
+            raise ValueError("The checkpoints must be increasing and between 0 and the number of loaded trees " + str(nTrees))
+        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+        c_temp = np.require(checkpoints, dtype=np.uint64, requirements=['A', 'W', 'C', 'O'])
+        N = len(X)
+        p = np.empty((N, len(c_temp)), dtype=np.float32)
+        if not FastBDT_library.PredictArrayStaged(self.forest, X_temp.ctypes.data_as(c_float_p), p.ctypes.data_as(c_float_p), int(X_temp.shape[0]),
+                                                  c_temp.ctypes.data_as(c_ulong_p), int(len(c_temp))):
+            raise ValueError("Invalid checkpoints for predict_staged")
+        return p
+
+    def apply(self, X, dtype=np.uint16):
+        """
+        Returns the node each event ends up in for all trees as a matrix with one event per row and one tree per column,
+        the result is written directly into the returned array
+        @param X feature matrix with one event per row
+        @param dtype np.uint16 or np.uint8 (for trees with a depth up to 7)
+        """
+        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+        N = len(X)
+        # The loaded forest may have fewer trees than configured (early termination, recover or a partial load)
+        nTrees = FastBDT_library.GetNLoadedTrees(self.forest)
+        if np.dtype(dtype) == np.uint8:
+            nodes = np.empty((N, nTrees), dtype=np.uint8)
+            success = FastBDT_library.GetLeafIndicesArray8(self.forest, X_temp.ctypes.data_as(c_float_p), nodes.ctypes.data_as(c_uint8_p), int(X_temp.shape[0]))
+        elif np.dtype(dtype) == np.uint16:
+            nodes = np.empty((N, nTrees), dtype=np.uint16)
+            success = FastBDT_library.GetLeafIndicesArray(self.forest, X_temp.ctypes.data_as(c_float_p), nodes.ctypes.data_as(c_uint16_p), int(X_temp.shape[0]))
+        else:
+            raise ValueError("dtype must be np.uint8 or np.uint16")
+        if not success:
+            raise ValueError("The node ids of the trees do not fit into " + str(np.dtype(dtype)) + ", use a wider dtype")
+        return nodes
+
     def predict_single(self, row):
         return FastBDT_library.Predict(self.forest, row.ctypes.data_as(c_float_p))
 
-    def save(self, weightfile):
-        FastBDT_library.Save(self.forest, bytes(weightfile, 'utf-8'))
+    def save(self, weightfile, binary=False, mapped=False, compact=False):
+        """
+        Saves the classifier
+        @param weightfile path to the weightfile
+        @param binary use the binary format, which is loaded much faster than the text format
+        @param mapped use the memory-mappable format, which can only be loaded by MappedClassifier
+        @param compact use the inference-only binary format, the loaded classifier cannot calculate feature importances
+        """
+        if mapped:
+            if not FastBDT_library.SaveMapped(self.forest, bytes(weightfile, 'utf-8')):
+                raise RuntimeError("Could not save the classifier to " + weightfile)
+        elif compact:
+            if not FastBDT_library.SaveCompact(self.forest, bytes(weightfile, 'utf-8')):
+                raise RuntimeError("Could not save the classifier to " + weightfile)
+        else:
+            if self.isInferenceOnly():
+                raise ValueError("An inference-only classifier can only be saved with compact=True or mapped=True")
+            save = FastBDT_library.SaveBinary if binary else FastBDT_library.Save
+            if not save(self.forest, bytes(weightfile, 'utf-8')):
+                raise RuntimeError("Could not save the classifier to " + weightfile)
+
+    def isInferenceOnly(self):
+        """
+        Returns True if the classifier was loaded from a compact weightfile (see save), it cannot be saved in the text
+        or binary format and cannot calculate feature importances
+        """
+        return FastBDT_library.IsInferenceOnly(self.forest)
 
-    def load(self, weightfile):
-        FastBDT_library.Load(self.forest, bytes(weightfile, 'utf-8'))
+    def _requireCompleteTrees(self):
+        if self.isInferenceOnly():
+            raise ValueError("The feature importances need the complete trees, but the classifier was loaded from a compact weightfile")
+
+    def load(self, weightfile, maxTrees=None):
+        """
+        Loads the classifier, text and binary weightfiles are detected automatically
+        @param weightfile path to the weightfile
+        @param maxTrees load only the first maxTrees trees, which trades accuracy for a faster prediction, None loads all trees
+        """
+        if maxTrees is None:
+            loaded = FastBDT_library.Load(self.forest, bytes(weightfile, 'utf-8'))
+        else:
+            loaded = FastBDT_library.LoadPartial(self.forest, bytes(weightfile, 'utf-8'), int(maxTrees))
+        if not loaded:
+            raise RuntimeError("Could not load the classifier from " + weightfile)
+
+    def recover(self, weightfile):
+        """
+        Loads the complete trees of a weightfile written by an interrupted fit with a weightfile
+        @param weightfile path to the weightfile
+        """
+        if not FastBDT_library.Recover(self.forest, bytes(weightfile, 'utf-8')):
+            raise RuntimeError("Could not recover the classifier from " + weightfile)
     
     def individualFeatureImportance(self, X):
+        self._requireCompleteTrees()
         X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
         _ranking = FastBDT_library.GetIndividualVariableRanking(self.forest, X_temp.ctypes.data_as(c_float_p))
         ranking = dict()
@@ -170,7 +356,21 @@ class Classifier(object):
         FastBDT_library.DeleteVariableRanking(_ranking)
         return ranking
 
+    def individualFeatureImportances(self, X):
+        """
+        Returns the individual feature importance of all events as a matrix with one event per row and one feature per column
+        @param X feature matrix with one event per row
+        """
+        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+        numberOfEvents, numberOfFeatures = X_temp.shape
+        self._requireCompleteTrees()
+        ranking = np.empty((numberOfEvents, numberOfFeatures), dtype=np.float64)
+        if not FastBDT_library.GetIndividualVariableRankingArray(self.forest, X_temp.ctypes.data_as(c_float_p), ranking.ctypes.data_as(c_double_p), int(numberOfEvents)):
+            raise RuntimeError("Could not calculate the individual feature importances")
+        return ranking
+
     def internFeatureImportance(self):
+        self._requireCompleteTrees()
         _ranking = FastBDT_library.GetVariableRanking(self.forest)
         ranking = dict()
         for i in range(FastBDT_library.ExtractNumberOfVariablesFromVariableRanking(_ranking)):
@@ -216,3 +416,33 @@ class Classifier(object):
 
     def __del__(self):
         FastBDT_library.Delete(self.forest)
+
+
+class MappedClassifier(object):
+    """
+    Classifier for the inference only, which predicts directly on a memory-mapped weightfile written by Classifier.save(weightfile, mapped=True).
+    Loading takes the same time for all model sizes and all processes which map the same file share its memory.
+    """
+    def __init__(self, weightfile):
+        self.mapped = FastBDT_library.LoadMapped(bytes(weightfile, 'utf-8'))
+        if self.mapped is None:
+            raise RuntimeError("Could not map the weightfile " + weightfile)
+        self.nFeatures = FastBDT_library.GetMappedNFeatures(self.mapped)
+
+    def predict(self, X, nThreads=1):
+        """
+        @param X feature matrix with one event per row
+        @param nThreads number of threads, 0 means one thread per cpu core
+        """
+        X_temp = np.require(X, dtype=np.float32, requirements=['A', 'W', 'C', 'O'])
+        N = len(X)
+        p = np.empty(N, dtype=np.float32)
+        FastBDT_library.PredictArrayMapped(self.mapped, X_temp.ctypes.data_as(c_float_p), p.ctypes.data_as(c_float_p), int(X_temp.shape[0]), int(nThreads))
+        return p
+
+    def predict_single(self, row):
+        return FastBDT_library.PredictMapped(self.mapped, row.ctypes.data_as(c_float_p))
+
+    def __del__(self):
+        if getattr(self, 'mapped', None) is not None:
+            FastBDT_library.DeleteMapped(self.mapped)
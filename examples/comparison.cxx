@@ -39,6 +39,7 @@
  */
 
 #include "FastBDT.h"
+#include "FastBDT_Loader.h"
 
 #include "xgboost/c_api.h"
 #include "xgboost/data.h"
@@ -69,37 +70,24 @@ class Data {
   public:
     Data(std::string datafile, unsigned long _numberOfFeatures, unsigned long _numberOfEvents) : numberOfFeatures(_numberOfFeatures), numberOfEvents(_numberOfEvents) {
 
-      X.reserve(numberOfEvents);
-      y.reserve(numberOfEvents);
-
-      std::fstream fs (datafile, std::fstream::in);
-      std::string line;
-
-      // Skip Header
-      std::getline(fs, line);
-
-      unsigned long iEvent = 0;
-      while(std::getline(fs, line)) {
-
-        std::istringstream sin(line);
-        std::vector<float> row;
-        float value = 0;
-        unsigned long iFeature = 0;
-        while(sin >> value) {
-          if(iFeature < numberOfFeatures)
-            row.push_back(value);
-          ++iFeature;
-        }
-        X.push_back(row);
-        y.push_back(static_cast<long>(value));
-
-        ++iEvent;
-        if(iEvent >= numberOfEvents) {
-          break;
-        }
+      // Skip Header, the last column contains the truth
+      std::vector<std::vector<float>> columns;
+      std::vector<bool> labels;
+      std::vector<float> weights;
+      FastBDT::loadTextData(datafile, columns, labels, weights, 1);
+
+      const unsigned long nEvents = std::min(numberOfEvents, static_cast<unsigned long>(labels.size()));
+      const unsigned long nFeatures = std::min(numberOfFeatures, static_cast<unsigned long>(columns.size()));
+      X.resize(nEvents);
+      y.resize(nEvents);
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+        X[iEvent].resize(nFeatures);
+        for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature)
+          X[iEvent][iFeature] = columns[iFeature][iEvent];
+        y[iEvent] = labels[iEvent] ? 1 : 0;
       }
 
-      std::cout << "Loaded " << iEvent << " Events" << std::endl;
+      std::cout << "Loaded " << nEvents << " Events" << std::endl;
     }
 
     unsigned long numberOfEvents = 0;
@@ -8,10 +8,16 @@
 
 #include "FastBDT.h"
 #include "FastBDT_IO.h"
+#include "FastBDT_Inference.h"
+#include "FastBDT_Parallel.h"
 
+#include <string>
 #include <vector>
 
 namespace FastBDT {
+
+class SampleCache;
+
 class Classifier {
 
   public:
@@ -23,37 +29,49 @@ class Classifier {
       Classifier(const Classifier&) = default;
       Classifier& operator=(const Classifier &) = default;
 
-      Classifier(std::istream& stream) {
-
-        stream >> m_version;
-        stream >> m_nTrees;
-        stream >> m_depth;
-        stream >> m_binning;
-        stream >> m_shrinkage;
-        stream >> m_subsample;
-        stream >> m_sPlot;
-        stream >> m_flatnessLoss;
-        stream >> m_purityTransformation;
-        stream >> m_transform2probability;
-        stream >> m_featureBinning;
-        stream >> m_purityBinning;
-        stream >> m_numberOfFeatures;
-        stream >> m_numberOfFinalFeatures;
-        stream >> m_numberOfFlatnessFeatures;
-        stream >> m_can_use_fast_forest;
-        m_fast_forest = readForestFromStream<float>(stream);
-        m_binned_forest = readForestFromStream<unsigned long>(stream);
-
-      }
+      /**
+       * Reads a classifier from a text or binary weightfile, the format is detected automatically
+       * @param stream input stream, should be opened in binary mode for binary weightfiles
+       * @param maxTrees only the first maxTrees trees of the forest are loaded, which trades accuracy for a faster prediction.
+       *                 The remaining trees are skipped without being decoded, GetNTrees() still returns the number of trained trees.
+       */
+      Classifier(std::istream& stream, unsigned long maxTrees = allTrees);
 
       friend std::ostream& operator<<(std::ostream& stream, const Classifier& classifier);
 
+      /**
+       * Writes the classifier in the binary weightfile format (see FastBDT_Binary.h),
+       * which is read much faster than the text format written by operator<<
+       * @param stream output stream, should be opened in binary mode
+       */
+      void SaveBinary(std::ostream& stream) const;
+
+      /**
+       * Writes the classifier in the mapped format, which is used by MappedClassifier (see FastBDT_Mapped.h)
+       * @param stream output stream, should be opened in binary mode
+       */
+      void SaveMapped(std::ostream& stream) const;
+
+      /**
+       * Writes the classifier in an inference-only binary weightfile, which contains only what the prediction needs:
+       * the used forest without the gains, purities and numbers of entries of the nodes, and not the unused forest.
+       * It is loaded like a binary weightfile by Classifier(std::istream&), see IsInferenceOnly.
+       * @param stream output stream, should be opened in binary mode
+       */
+      void SaveCompact(std::ostream& stream) const;
+
 			Classifier(unsigned long nTrees, unsigned long depth, std::vector<unsigned long> binning, double shrinkage = 0.1, double subsample = 1.0, bool sPlot = false, double flatnessLoss = -1.0, std::vector<bool> purityTransformation = {}, unsigned long numberOfFlatnessFeatures=0, bool transform2probability=true) :
         m_nTrees(nTrees), m_depth(depth), m_binning(binning), m_shrinkage(shrinkage), m_subsample(subsample), m_sPlot(sPlot), m_flatnessLoss(flatnessLoss), m_purityTransformation(purityTransformation), m_numberOfFlatnessFeatures(numberOfFlatnessFeatures), m_transform2probability(transform2probability), m_can_use_fast_forest(true) { }
 
       void Print();
 
       unsigned long GetNTrees() const { return m_nTrees; }
+
+      /**
+       * Returns the number of trees used by the prediction. It is smaller than GetNTrees() if the boosting terminated early,
+       * for a recovered classifier (see Recover) and after a partial load (see Classifier(std::istream&, unsigned long)).
+       */
+      unsigned long GetNLoadedTrees() const { return m_compiled_forest.GetNTrees(); }
       void SetNTrees(unsigned long nTrees) { m_nTrees = nTrees; }
       
       unsigned long GetDepth() const { return m_depth; }
@@ -76,6 +94,35 @@ class Classifier {
       bool GetTransform2Probability() const { return m_transform2probability; }
       void SetTransform2Probability(bool transform2probability) { m_transform2probability = transform2probability; }
       
+      /**
+       * Number of threads used by predict_batch, 0 means one thread per hardware thread.
+       * This is a runtime setting and is not stored in the weightfile.
+       */
+      unsigned long GetNThreads() const { return m_nThreads; }
+      void SetNThreads(unsigned long nThreads) { m_nThreads = nThreads; }
+
+      /**
+       * True if the classifier is evaluated with the forest on the original feature values (see GetFastForest)
+       */
+      bool GetCanUseFastForest() const { return m_can_use_fast_forest; }
+
+      /**
+       * Forest with the cuts on the original feature values, only meaningful if GetCanUseFastForest() is true
+       */
+      const Forest<float>& GetFastForest() const { return m_fast_forest; }
+
+      /**
+       * Forest with the cuts on the bins, only meaningful if GetCanUseFastForest() is false
+       */
+      const Forest<unsigned long>& GetBinnedForest() const { return m_binned_forest; }
+
+      /**
+       * True if the classifier was loaded from an inference-only weightfile (see SaveCompact).
+       * Its trees contain only the cuts and boost weights, so it cannot calculate variable rankings
+       * and can only be saved with SaveCompact and SaveMapped.
+       */
+      bool IsInferenceOnly() const { return m_inference_only; }
+
       std::vector<unsigned long> GetBinning() const { return m_binning; }
       void SetBinning(std::vector<unsigned long> binning) { m_binning = binning; }
 
@@ -87,16 +134,240 @@ class Classifier {
 			
       void fit(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w);
 
+      /**
+       * Same as fit, but writes the text weightfile (see operator<<) to the given stream while the forest is built.
+       * Each tree is written and flushed as soon as it is built, so the progress can be watched in the weightfile
+       * and the trees built before an interruption of the training can be loaded with Recover.
+       * The number of trees in the weightfile is corrected at the end if the stream is seekable (e.g. a file),
+       * otherwise it stays GetNTrees() and a forest which terminated early can only be loaded with Recover.
+       * @param weightfile output stream
+       */
+      void fit(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w, std::ostream &weightfile);
+
+      /**
+       * Reads a text weightfile which may end after any tree of the forest, like the weightfile of an interrupted fit.
+       * The loaded classifier contains all trees which were written completely.
+       * @param stream input stream
+       */
+      static Classifier Recover(std::istream& stream);
+
+      /**
+       * Bins the events like fit and writes them together with the feature binnings and purity transformations
+       * in the sample cache format (see FastBDT_Sample.h). Trainings with different hyperparameters can use the cache
+       * with fit(const SampleCache&) instead of binning the events again. The classifier itself is not changed.
+       * @param stream output stream, should be opened in binary mode
+       */
+      void SaveSampleCache(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w, std::ostream &stream) const;
+
+      /**
+       * Same as fit, but trains on the binned events of a sample cache written by SaveSampleCache.
+       * The binning, the purity transformations and the number of flatness features are taken from the cache,
+       * all other parameters (number of trees, depth, shrinkage, ...) from this classifier.
+       * @param cache sample cache, it is not changed and can be used for further trainings
+       */
+      void fit(const SampleCache &cache);
+
+      /**
+       * Same as fit(const SampleCache&), but writes the text weightfile while the forest is built (see fit above)
+       * @param weightfile output stream
+       */
+      void fit(const SampleCache &cache, std::ostream &weightfile);
+
       float predict(const std::vector<float> &X) const;
+
+      /**
+       * Predicts many events at once, without allocating memory for each event.
+       * The events are distributed on GetNThreads() threads.
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param out pointer to the output array, containing at least nRows entries
+       */
+      void predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out) const;
+
+      /**
+       * Same as predict_batch above, but the number of threads is given explicitly
+       * @param nThreads number of threads, 0 means one thread per hardware thread
+       */
+      void predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out, unsigned long nThreads) const;
       
+      /**
+       * Predicts many events stored with arbitrary strides, e.g. column-major (Fortran-order) matrices
+       * with rowStride = 1 and columnStride = nRows. The matrix is not copied, instead the features of each block
+       * of CompiledForest::blockSize events are gathered feature by feature into a small row-major buffer,
+       * which is evaluated by the same kernels as predict_batch. The events are distributed on GetNThreads() threads.
+       * @param X pointer to the first feature of the first event
+       * @param nRows number of events
+       * @param rowStride distance (in floats) between the same feature of two consecutive events
+       * @param columnStride distance (in floats) between two consecutive features of the same event
+       * @param out pointer to the output array, containing at least nRows entries
+       */
+      void predict_batch_strided(const float *X, unsigned long nRows, unsigned long rowStride, unsigned long columnStride, float *out) const;
+
+      /**
+       * Same as predict_batch_strided above, but the number of threads is given explicitly
+       * @param nThreads number of threads, 0 means one thread per hardware thread
+       */
+      void predict_batch_strided(const float *X, unsigned long nRows, unsigned long rowStride, unsigned long columnStride, float *out, unsigned long nThreads) const;
+
+      /**
+       * Returns predict(X) > threshold, the evaluation stops as soon as the result is settled (see CompiledForest::PredictAbove)
+       * @param X features of the event
+       * @param threshold decision threshold on the output of predict
+       */
+      bool predict_above(const std::vector<float> &X, float threshold) const;
+
+      /**
+       * Same as predict_above above for many events, the events are distributed on GetNThreads() threads
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param threshold decision threshold on the output of predict
+       * @param out pointer to the output array, containing at least nRows entries
+       */
+      void predict_above(const float *X, unsigned long nRows, unsigned long stride, float threshold, bool *out) const;
+      
+      /**
+       * Returns the prediction after the first checkpoints[i] trees for each checkpoint, all checkpoints are evaluated in one pass.
+       * The prediction after all trees is the same as predict(X).
+       * @param X features of the event
+       * @param checkpoints numbers of trees in increasing order, each at most GetNLoadedTrees()
+       */
+      std::vector<float> predict_staged(const std::vector<float> &X, const std::vector<unsigned long> &checkpoints) const;
+
+      /**
+       * Same as predict_staged above for many events, the events are distributed on GetNThreads() threads
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param checkpoints numbers of trees in increasing order, each at most GetNLoadedTrees()
+       * @param out pointer to the output array (row-major), containing at least nRows*checkpoints.size() entries
+       */
+      void predict_staged(const float *X, unsigned long nRows, unsigned long stride, const std::vector<unsigned long> &checkpoints, float *out) const;
+
+      /**
+       * Calculates the node each event ends up in for all trees (see CompiledForest::GetLeafIndices),
+       * the events are distributed on GetNThreads() threads
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param out pointer to the output array (row-major), containing at least nRows*GetNLoadedTrees() entries
+       */
+      void GetLeafIndices(const float *X, unsigned long nRows, unsigned long stride, uint16_t *out) const;
+
+      /**
+       * Same as GetLeafIndices above with 8bit node ids, throws if the trees are deeper than 7
+       */
+      void GetLeafIndices(const float *X, unsigned long nRows, unsigned long stride, uint8_t *out) const;
+
       std::map<unsigned long, double> GetVariableRanking() const;
       
       std::map<unsigned long, double> GetIndividualVariableRanking(const std::vector<float> &X) const;
 
+      /**
+       * Calculates the individual variable ranking of many events at once, the events are distributed on GetNThreads() threads.
+       * Row i of the output contains the ranking of event i for all original features, in contrast to the map returned
+       * by GetIndividualVariableRanking above, features which are not used by the event have a ranking of zero.
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param out pointer to the output array (row-major), containing at least nRows*GetNFeatures() entries
+       */
+      void GetIndividualVariableRanking(const float *X, unsigned long nRows, unsigned long stride, double *out) const;
+
       std::map<unsigned long, unsigned long> GetFeatureMapping() const;
   
       std::map<unsigned long, double> MapRankingToOriginalFeatures(std::map<unsigned long, double> ranking) const;
 
+  private:
+    /**
+     * Writes the compiled forest and the purity transformations in the mapped format
+     */
+    friend class MappedClassifier;
+
+    /**
+     * Reads the members stored in a text weightfile
+     * @param stream input stream
+     * @param allowTruncated if true the weightfile may end after any tree of the forest (see Recover)
+     * @param maxTrees number of trees of each forest which are read
+     */
+    void ReadText(std::istream& stream, bool allowTruncated = false, unsigned long maxTrees = allTrees);
+
+    /**
+     * Writes the members stored in front of the forests in a text weightfile
+     */
+    void WriteTextParameters(TextWriter &writer) const;
+
+    /**
+     * Determines the feature binnings and purity transformations of the given events and returns the binned events
+     */
+    EventSample BinEvents(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w);
+
+    /**
+     * Builds the forest on the binned events, the weightfile is written while the forest is built if it is not a nullptr
+     */
+    void Train(EventSample &eventSample, std::ostream *weightfile);
+
+    /**
+     * Writes the members determined by BinEvents, which are stored in a sample cache
+     */
+    std::string WritePreprocessing() const;
+
+    /**
+     * Reads the members written by WritePreprocessing from a sample cache
+     */
+    void ReadPreprocessing(const SampleCache &cache);
+
+    /**
+     * Reads the members stored in a binary weightfile
+     * @param maxTrees number of trees of each forest which are read
+     */
+    void ReadBinary(std::istream& stream, unsigned long maxTrees = allTrees);
+
+    /**
+     * Writes the sections of a binary weightfile in front of the forests
+     */
+    void WriteBinaryParameters(std::ostream& stream) const;
+
+    /**
+     * Throws if the classifier is inference-only, because the requested operation needs the complete trees
+     * @param operation name of the operation used in the error message
+     */
+    void RequireCompleteTrees(const std::string &operation) const;
+
+    /**
+     * Predicts the given events on the calling thread
+     */
+    void predict_batch_serial(const float *X, unsigned long nRows, unsigned long stride, float *out) const;
+
+    /**
+     * Fills the bins of the binned forest (including the purity transformed features) for the given event
+     */
+    void FillBins(const float *X, std::vector<unsigned long> &bins) const;
+
+    /**
+     * Builds m_compiled_forest from m_fast_forest, or (if purity transformations are used)
+     * from m_binned_forest with the cuts rewritten to the rows filled by FillPurityRow
+     */
+    void CompileForest();
+
+    /**
+     * Number of floats in a row filled by FillPurityRow
+     */
+    unsigned long GetPurityRowSize() const { return m_numberOfFeatures + m_purityBinning.size(); }
+
+    /**
+     * Fills the row evaluated by m_compiled_forest for a classifier with purity transformed features:
+     * the original feature values followed by the purity bins of the purity transformed features (NaN for missing values)
+     */
+    void FillPurityRow(const float *X, float *row) const;
+
+    /**
+     * Implementation of GetLeafIndices for the different node id types
+     */
+    template<typename NodeId>
+    void FillLeafIndices(const float *X, unsigned long nRows, unsigned long stride, NodeId *out) const;
+
   private:
     unsigned long m_version = 1;
     unsigned long m_nTrees = 100;
@@ -115,8 +386,12 @@ class Classifier {
     std::vector<PurityTransformation> m_purityBinning;
 
     bool m_can_use_fast_forest = true;
+    bool m_inference_only = false; /**< Loaded from an inference-only weightfile, not stored in the weightfile */
     Forest<float> m_fast_forest;
     Forest<unsigned long> m_binned_forest;
+    CompiledForest m_compiled_forest; /**< Flattened forest on float values used by predict, not stored in the weightfile */
+    std::vector<unsigned long> m_rankingColumns; /**< Original feature of each feature of m_compiled_forest, not stored in the weightfile */
+    unsigned long m_nThreads = 1; /**< Number of threads used by predict_batch, not stored in the weightfile */
 
 };
 
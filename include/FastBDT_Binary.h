@@ -0,0 +1,347 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Versioned binary weightfile format
+ */
+
+#pragma once
+
+#include "FastBDT.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Layout of a binary weightfile, all integers and floating point numbers are stored in little-endian byte order:
+   *
+   *   magic           8 bytes, see BinaryFormat::magic
+   *   version         uint32, version of the format, files with a newer version are rejected
+   *   nSections       uint32
+   *   nSections times:
+   *     id            uint32, see BinaryFormat::Section, unknown sections are skipped
+   *     size          uint64, number of bytes of the payload
+   *     payload       size bytes
+   *     checksum      uint32, CRC-32 of the payload
+   *
+   * Vectors in a payload are stored as their size (uint64) followed by the elements,
+   * the content of each section is defined by the readBinary and writeBinary functions below.
+   */
+  namespace BinaryFormat {
+
+    /**
+     * The first byte can never start a text weightfile, which is used to detect the format on load
+     */
+    const char magic[8] = {'\x89', 'F', 'B', 'D', 'T', '\r', '\n', '\x1a'};
+
+    const uint32_t version = 1;
+
+    enum Section : uint32_t {
+      parameters = 1, /**< Hyperparameters and number of features of the Classifier */
+      featureBinning = 2,
+      purityBinning = 3,
+      fastForest = 4, /**< Forest<float> with the cuts on the original feature values */
+      binnedForest = 5, /**< Forest<unsigned long> with the cuts on the bins */
+      compactForest = 6, /**< Used forest in the inference-only encoding (see writeCompactBinary), replaces fastForest and binnedForest */
+    };
+
+  }
+
+  /**
+   * Calculates the CRC-32 (the one used by zlib) of the given bytes
+   */
+  uint32_t crc32(const char *data, unsigned long size);
+
+  /**
+   * Returns true if the next bytes in the stream are the magic of a binary weightfile, the stream is not modified
+   */
+  bool isBinaryWeightfile(std::istream &stream);
+
+  /**
+   * Serializes values into a buffer in little-endian byte order
+   */
+  class BinaryWriter {
+
+    public:
+      void Write(bool value) { Write(static_cast<uint8_t>(value)); }
+      void Write(uint8_t value) { buffer.push_back(static_cast<char>(value)); }
+      void Write(uint32_t value) { WriteLittleEndian(value, 4); }
+      void Write(uint64_t value) { WriteLittleEndian(value, 8); }
+      void Write(float value) { uint32_t bits; std::memcpy(&bits, &value, sizeof(bits)); Write(bits); }
+      void Write(double value) { uint64_t bits; std::memcpy(&bits, &value, sizeof(bits)); Write(bits); }
+
+      template<class T>
+      void Write(const std::vector<T> &vector) {
+        Write(static_cast<uint64_t>(vector.size()));
+        for(const auto &value : vector)
+          Write(static_cast<T>(value));
+      }
+
+      const std::string& GetBuffer() const { return buffer; }
+
+    private:
+      void WriteLittleEndian(uint64_t value, unsigned int nBytes) {
+        for(unsigned int i = 0; i < nBytes; ++i)
+          buffer.push_back(static_cast<char>((value >> (8*i)) & 0xFF));
+      }
+
+    private:
+      std::string buffer;
+
+  };
+
+  /**
+   * Deserializes values written by the BinaryWriter, throws a runtime_error if the buffer is too short
+   */
+  class BinaryReader {
+
+    public:
+      BinaryReader(const char *data, unsigned long size) : data(reinterpret_cast<const unsigned char*>(data)), size(size) { }
+
+      void Read(bool &value) { uint8_t byte; Read(byte); value = byte != 0; }
+      void Read(uint8_t &value) { Require(1); value = data[position++]; }
+      void Read(uint32_t &value) { value = static_cast<uint32_t>(ReadLittleEndian(4)); }
+      void Read(uint64_t &value) { value = ReadLittleEndian(8); }
+      void Read(float &value) { uint32_t bits; Read(bits); std::memcpy(&value, &bits, sizeof(value)); }
+      void Read(double &value) { uint64_t bits; Read(bits); std::memcpy(&value, &bits, sizeof(value)); }
+
+      template<class T>
+      void Read(std::vector<T> &vector) {
+        uint64_t length;
+        Read(length);
+        // Every element takes at least one byte, so a corrupt size cannot trigger a huge allocation
+        Require(length);
+        vector.resize(length);
+        for(uint64_t i = 0; i < length; ++i) {
+          T value;
+          Read(value);
+          vector[i] = value;
+        }
+      }
+
+      template<class T>
+      T Read() {
+        T value;
+        Read(value);
+        return value;
+      }
+
+      bool AtEnd() const { return position == size; }
+
+    private:
+      void Require(uint64_t nBytes) const {
+        if(nBytes > size - position)
+          throw std::runtime_error("Binary weightfile is truncated");
+      }
+
+      uint64_t ReadLittleEndian(unsigned int nBytes) {
+        Require(nBytes);
+        uint64_t value = 0;
+        for(unsigned int i = 0; i < nBytes; ++i)
+          value |= static_cast<uint64_t>(data[position + i]) << (8*i);
+        position += nBytes;
+        return value;
+      }
+
+    private:
+      const unsigned char *data;
+      unsigned long size;
+      unsigned long position = 0;
+
+  };
+
+  /**
+   * Writes the header of a binary weightfile
+   * @param stream output stream, should be opened in binary mode
+   * @param nSections number of sections which follow the header
+   */
+  void writeBinaryHeader(std::ostream &stream, uint32_t nSections);
+
+  /**
+   * Writes a section (id, size, payload and checksum) of a binary weightfile
+   */
+  void writeBinarySection(std::ostream &stream, BinaryFormat::Section id, const BinaryWriter &payload);
+
+  /**
+   * Reads the header of a binary weightfile, throws a runtime_error if the magic or the version is wrong
+   * @return the number of sections
+   */
+  uint32_t readBinaryHeader(std::istream &stream);
+
+  /**
+   * Reads the next section of a binary weightfile, throws a runtime_error if the stream is truncated or the checksum is wrong
+   * @param stream input stream
+   * @param payload the payload of the section
+   * @return the id of the section
+   */
+  uint32_t readBinarySection(std::istream &stream, std::string &payload);
+
+  template<class T>
+  void writeBinary(BinaryWriter &writer, const Cut<T> &cut) {
+    writer.Write(static_cast<uint64_t>(cut.feature));
+    writer.Write(cut.index);
+    writer.Write(cut.valid);
+    writer.Write(cut.gain);
+  }
+
+  template<class T>
+  void readBinary(BinaryReader &reader, Cut<T> &cut) {
+    cut.feature = reader.Read<uint64_t>();
+    cut.index = reader.Read<T>();
+    cut.valid = reader.Read<bool>();
+    cut.gain = reader.Read<double>();
+  }
+
+  template<class T>
+  void writeBinary(BinaryWriter &writer, const Tree<T> &tree) {
+    const auto &cuts = tree.GetCuts();
+    writer.Write(static_cast<uint64_t>(cuts.size()));
+    for(const auto &cut : cuts)
+      writeBinary(writer, cut);
+    writer.Write(tree.GetBoostWeights());
+    writer.Write(tree.GetPurities());
+    writer.Write(tree.GetNEntries());
+  }
+
+  template<class T>
+  Tree<T> readTreeFromBinary(BinaryReader &reader) {
+    const uint64_t size = reader.Read<uint64_t>();
+    std::vector<Cut<T>> cuts;
+    for(uint64_t i = 0; i < size; ++i) {
+      Cut<T> cut;
+      readBinary(reader, cut);
+      cuts.push_back(cut);
+    }
+    const auto boost_weights = reader.Read<std::vector<Weight>>();
+    const auto purities = reader.Read<std::vector<Weight>>();
+    const auto nEntries = reader.Read<std::vector<Weight>>();
+    if(boost_weights.size() != 2*size + 1 or purities.size() != boost_weights.size() or nEntries.size() != boost_weights.size())
+      throw std::runtime_error("Tree of the binary forest has " + std::to_string(boost_weights.size()) + " boost weights, " + std::to_string(purities.size()) + " purities and " +
+                               std::to_string(nEntries.size()) + " numbers of entries for " + std::to_string(size) + " cuts");
+    return Tree<T>(cuts, nEntries, purities, boost_weights);
+  }
+
+  template<class T>
+  void writeBinary(BinaryWriter &writer, const Forest<T> &forest) {
+    writer.Write(forest.GetF0());
+    writer.Write(forest.GetShrinkage());
+    writer.Write(forest.GetTransform2Probability());
+    const auto &trees = forest.GetForest();
+    writer.Write(static_cast<uint64_t>(trees.size()));
+    for(const auto &tree : trees)
+      writeBinary(writer, tree);
+  }
+
+  /**
+   * Reads a forest written by writeBinary
+   * @param maxTrees only the first maxTrees trees are read, the remaining trees are not decoded
+   * @param nStoredTrees if given, the number of trees stored in the forest is written to it
+   */
+  template<class T>
+  Forest<T> readForestFromBinary(BinaryReader &reader, unsigned long maxTrees = allTrees, uint64_t *nStoredTrees = nullptr) {
+    const double F0 = reader.Read<double>();
+    const double shrinkage = reader.Read<double>();
+    const bool transform2probability = reader.Read<bool>();
+    Forest<T> forest(shrinkage, F0, transform2probability);
+    const uint64_t size = reader.Read<uint64_t>();
+    if(nStoredTrees != nullptr)
+      *nStoredTrees = size;
+    for(uint64_t i = 0; i < std::min<uint64_t>(size, maxTrees); ++i)
+      forest.AddTree(readTreeFromBinary<T>(reader));
+    return forest;
+  }
+
+  inline void writeCompactIndex(BinaryWriter &writer, float index) { writer.Write(index); }
+  inline void writeCompactIndex(BinaryWriter &writer, unsigned long index) { writer.Write(static_cast<uint32_t>(index)); }
+  inline void readCompactIndex(BinaryReader &reader, float &index) { reader.Read(index); }
+  inline void readCompactIndex(BinaryReader &reader, unsigned long &index) { index = reader.Read<uint32_t>(); }
+
+  /**
+   * Writes a forest in the inference-only encoding, which contains only what the prediction needs:
+   * the feature (uint32), validity and index (float for cuts on values, uint32 for cuts on bins) of each cut
+   * and the boost weights of the nodes. The gains, purities and numbers of entries are not stored.
+   */
+  template<class T>
+  void writeCompactBinary(BinaryWriter &writer, const Forest<T> &forest) {
+    writer.Write(forest.GetF0());
+    writer.Write(forest.GetShrinkage());
+    writer.Write(forest.GetTransform2Probability());
+    const auto &trees = forest.GetForest();
+    writer.Write(static_cast<uint64_t>(trees.size()));
+    for(const auto &tree : trees) {
+      const auto &cuts = tree.GetCuts();
+      writer.Write(static_cast<uint64_t>(cuts.size()));
+      for(const auto &cut : cuts) {
+        writer.Write(static_cast<uint32_t>(cut.feature));
+        writer.Write(cut.valid);
+        writeCompactIndex(writer, cut.index);
+      }
+      writer.Write(tree.GetBoostWeights());
+    }
+  }
+
+  /**
+   * Reads a forest written by writeCompactBinary, the gains of the cuts are zero
+   * and the trees have no purities and numbers of entries
+   * @param maxTrees only the first maxTrees trees are read, the remaining trees are not decoded
+   * @param nStoredTrees if given, the number of trees stored in the forest is written to it
+   */
+  template<class T>
+  Forest<T> readCompactForestFromBinary(BinaryReader &reader, unsigned long maxTrees = allTrees, uint64_t *nStoredTrees = nullptr) {
+    const double F0 = reader.Read<double>();
+    const double shrinkage = reader.Read<double>();
+    const bool transform2probability = reader.Read<bool>();
+    Forest<T> forest(shrinkage, F0, transform2probability);
+    const uint64_t nTrees = reader.Read<uint64_t>();
+    if(nStoredTrees != nullptr)
+      *nStoredTrees = nTrees;
+    for(uint64_t iTree = 0; iTree < std::min<uint64_t>(nTrees, maxTrees); ++iTree) {
+      const uint64_t nCuts = reader.Read<uint64_t>();
+      std::vector<Cut<T>> cuts;
+      for(uint64_t iCut = 0; iCut < nCuts; ++iCut) {
+        Cut<T> cut;
+        cut.feature = reader.Read<uint32_t>();
+        cut.valid = reader.Read<bool>();
+        readCompactIndex(reader, cut.index);
+        cuts.push_back(cut);
+      }
+      auto boost_weights = reader.Read<std::vector<Weight>>();
+      if(boost_weights.size() != 2*nCuts + 1)
+        throw std::runtime_error("Tree " + std::to_string(iTree) + " of the compact forest has " + std::to_string(boost_weights.size()) + " boost weights for " + std::to_string(nCuts) + " cuts");
+      forest.AddTree(Tree<T>(cuts, {}, {}, boost_weights));
+    }
+    return forest;
+  }
+
+  template<class T>
+  void writeBinary(BinaryWriter &writer, const FeatureBinning<T> &featureBinning) {
+    writer.Write(static_cast<uint64_t>(featureBinning.GetNLevels()));
+    writer.Write(featureBinning.GetBinning());
+  }
+
+  /**
+   * Reads a FeatureBinning, the stored boundaries are used as they are (see FeatureBinning::Restore)
+   */
+  template<class T>
+  FeatureBinning<T> readFeatureBinningFromBinary(BinaryReader &reader) {
+    const uint64_t nLevels = reader.Read<uint64_t>();
+    auto bins = reader.Read<std::vector<T>>();
+    return FeatureBinning<T>::Restore(nLevels, std::move(bins));
+  }
+
+  inline void writeBinary(BinaryWriter &writer, const PurityTransformation &purityTransformation) {
+    writer.Write(purityTransformation.GetMapping());
+  }
+
+  inline PurityTransformation readPurityTransformationFromBinary(BinaryReader &reader) {
+    PurityTransformation purityTransformation;
+    purityTransformation.SetMapping(reader.Read<std::vector<unsigned long>>());
+    return purityTransformation;
+  }
+
+}
@@ -5,6 +5,8 @@
 #include "FastBDT.h"
 #include "FastBDT_IO.h"
 #include "Classifier.h"
+#include "FastBDT_ModelHandle.h"
+#include "FastBDT_Mapped.h"
 
 extern "C" {
 
@@ -21,6 +23,11 @@ extern "C" {
     
     void SetNTrees(void *ptr, unsigned long nTrees);
     unsigned long GetNTrees(void *ptr);
+
+    /**
+     * Returns the number of trees used by the prediction (see Classifier::GetNLoadedTrees)
+     */
+    unsigned long GetNLoadedTrees(void *ptr);
     
     void SetDepth(void *ptr, unsigned long depth);
     unsigned long GetDepth(void *ptr);
@@ -43,25 +50,114 @@ extern "C" {
     void SetSPlot(void *ptr, bool sPlot);
     bool GetSPlot(void *ptr);
     
+    void SetNThreads(void *ptr, unsigned long nThreads);
+    unsigned long GetNThreads(void *ptr);
+    
     void Delete(void *ptr);
     
     void Fit(void *ptr, float *data_ptr, float *weight_ptr, bool *target_ptr, unsigned long nEvents, unsigned long nFeatures);
 
-    void Load(void* ptr, char *weightfile);
+    /**
+     * Same as Fit, but writes the text weightfile while the trees are built (see Classifier::fit)
+     * @return false if the weightfile could not be written, the classifier is not trained if it cannot be opened
+     */
+    bool FitStreaming(void *ptr, float *data_ptr, float *weight_ptr, bool *target_ptr, unsigned long nEvents, unsigned long nFeatures, char *weightfile);
+
+    /**
+     * Loads a text or binary weightfile
+     * @return false if the weightfile could not be read, the classifier is unchanged in this case
+     */
+    bool Load(void* ptr, char *weightfile);
+
+    /**
+     * Same as Load, but loads only the first maxTrees trees of the forest (see Classifier(std::istream&, unsigned long))
+     */
+    bool LoadPartial(void* ptr, char *weightfile, unsigned long maxTrees);
+
+    /**
+     * Loads the complete trees of a weightfile written by an interrupted FitStreaming (see Classifier::Recover)
+     * @return false if the weightfile could not be read, the classifier is unchanged in this case
+     */
+    bool Recover(void* ptr, char *weightfile);
 
     float Predict(void *ptr, float *array);
 
     void PredictArray(void *ptr, float *array, float *result, unsigned long nEvents);
 
-    void Save(void* ptr, char *weightfile);
+    void PredictArrayThreaded(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long nThreads);
+
+    void PredictArrayStrided(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long rowStride, unsigned long columnStride, unsigned long nThreads);
+
+    bool PredictAbove(void *ptr, float *array, float threshold);
+
+    void PredictArrayAbove(void *ptr, float *array, bool *result, unsigned long nEvents, float threshold);
+
+    /**
+     * Writes nCheckpoints predictions per event (see Classifier::predict_staged)
+     * @return false if the checkpoints are not increasing or larger than GetNLoadedTrees()
+     */
+    bool PredictArrayStaged(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long *checkpoints, unsigned long nCheckpoints);
+
+    /**
+     * Writes GetNLoadedTrees() node ids per event (see Classifier::GetLeafIndices)
+     * @return false if the node ids of the forest do not fit into 16 bits
+     */
+    bool GetLeafIndicesArray(void *ptr, float *array, uint16_t *result, unsigned long nEvents);
+
+    /**
+     * Same as GetLeafIndicesArray with 8bit node ids
+     * @return false if the node ids of the forest do not fit into 8 bits, i.e. the trees are deeper than 7
+     */
+    bool GetLeafIndicesArray8(void *ptr, float *array, uint8_t *result, unsigned long nEvents);
+
+    /**
+     * Writes the text weightfile
+     * @return false if the classifier is inference-only (see IsInferenceOnly) or the weightfile could not be written
+     */
+    bool Save(void* ptr, char *weightfile);
+
+    /**
+     * Writes the binary weightfile
+     * @return false if the classifier is inference-only (see IsInferenceOnly) or the weightfile could not be written
+     */
+    bool SaveBinary(void* ptr, char *weightfile);
+
+    /**
+     * Writes the memory-mappable weightfile (see LoadMapped)
+     * @return false if the classifier cannot be stored in the mapped format or the weightfile could not be written
+     */
+    bool SaveMapped(void* ptr, char *weightfile);
+
+    /**
+     * Writes the inference-only binary weightfile (see Classifier::SaveCompact)
+     * @return false if the weightfile could not be written
+     */
+    bool SaveCompact(void* ptr, char *weightfile);
+
+    /**
+     * True if the classifier was loaded from an inference-only weightfile, which cannot be saved with Save and SaveBinary
+     * and has no variable rankings (see Classifier::IsInferenceOnly)
+     */
+    bool IsInferenceOnly(void* ptr);
     
     struct VariableRanking {
         std::map<unsigned long, double> ranking;
     }; 
 
+    /**
+     * @return the ranking, which has to be deleted with DeleteVariableRanking, or nullptr if the classifier is inference-only
+     */
     void* GetVariableRanking(void* ptr);
     
+    /**
+     * @return the ranking, which has to be deleted with DeleteVariableRanking, or nullptr if the classifier is inference-only
+     */
     void* GetIndividualVariableRanking(void* ptr, float *array);
+
+    /**
+     * @return false if the classifier is inference-only
+     */
+    bool GetIndividualVariableRankingArray(void* ptr, float *array, double *ranking, unsigned long nEvents);
     
     unsigned long ExtractNumberOfVariablesFromVariableRanking(void* ptr);
     
@@ -69,4 +165,26 @@ extern "C" {
     
     void DeleteVariableRanking(void* ptr);
 
+    void* CreateModelHandle();
+
+    void DeleteModelHandle(void *handle);
+
+    unsigned long LoadModelHandle(void *handle, char *weightfile);
+
+    unsigned long GetModelHandleVersion(void *handle);
+
+    float PredictModelHandle(void *handle, float *array);
+
+    void PredictArrayModelHandle(void *handle, float *array, float *result, unsigned long nEvents);
+
+    void* LoadMapped(char *weightfile);
+
+    void DeleteMapped(void *mapped);
+
+    unsigned long GetMappedNFeatures(void *mapped);
+
+    float PredictMapped(void *mapped, float *array);
+
+    void PredictArrayMapped(void *mapped, float *array, float *result, unsigned long nEvents, unsigned long nThreads);
+
 }
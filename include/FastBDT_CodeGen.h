@@ -0,0 +1,42 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Ahead-of-time code generation of a trained forest to C++ source
+ */
+
+#pragma once
+
+#include "FastBDT.h"
+#include "Classifier.h"
+
+#include <iostream>
+#include <string>
+
+namespace FastBDT {
+
+  /**
+   * Writes a self-contained C++ header containing the given forest.
+   * Every tree is written as an inline function with nested if/else statements,
+   * the cut values and boost weights are written as literals with full float precision.
+   * The header defines (in the given namespace)
+   *   nTrees, nFeatures            number of trees and the number of features used by the forest
+   *   float tree_<i>(const float*) boost weight of the node the event ends up in
+   *   double GetF(const float*)    identical to Forest<float>::GetF
+   *   float predict(const float*)  identical to Classifier::predict
+   * The header depends only on <cmath> and <limits>, so it can be compiled into a binary without FastBDT.
+   * @param stream output stream for the header
+   * @param forest the forest which shall be written
+   * @param name_space namespace of the generated code
+   */
+  void writeForestToHeader(std::ostream &stream, const Forest<float> &forest, const std::string &name_space);
+
+  /**
+   * Writes the forest of the given classifier as self-contained C++ header (see writeForestToHeader).
+   * Throws a runtime_error if the classifier cannot be evaluated on the original feature values.
+   * @param stream output stream for the header
+   * @param classifier the trained classifier
+   * @param name_space namespace of the generated code
+   */
+  void writeClassifierToHeader(std::ostream &stream, const Classifier &classifier, const std::string &name_space);
+
+}
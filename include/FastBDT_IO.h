@@ -6,12 +6,13 @@
 #include "FastBDT.h"
 
 #include <iostream>
+#include <string>
 #include <vector>
 #include <stdexcept>
 #include <type_traits>
 
 namespace FastBDT {
-  
+
   /**
    * Converts from string to float safely
    * Should behave similar to boost::lexical_cast<float>
@@ -19,7 +20,15 @@ namespace FastBDT {
    * @param input string containing a float
    */
   float convert_to_float_safely(std::string &input);
-  
+
+  /**
+   * Same as convert_to_float_safely, but the usual decimal and scientific notations
+   * are parsed directly from the characters, without creating a string
+   * @param characters first character of the float, not null-terminated
+   * @param length number of characters
+   */
+  float convert_to_float_fast(const char *characters, unsigned int length);
+
   /**
    * Converts from string to double safely
    * Should behave similar to boost::lexical_cast<double>
@@ -28,6 +37,200 @@ namespace FastBDT {
    */
   double convert_to_double_safely(std::string &input);
 
+  /**
+   * Buffered writer for the text format, which writes the same characters as the corresponding std::ostream operators.
+   * The floating point format (scientific and precision) of the stream is tracked like the std::ostream does,
+   * and is applied to the stream again when the writer is flushed.
+   * Lines are not flushed individually like with std::endl, the buffer is written to the stream in large chunks.
+   */
+  class TextWriter {
+
+    public:
+      explicit TextWriter(std::ostream &stream);
+
+      /**
+       * Flushes the buffer
+       */
+      ~TextWriter();
+
+      TextWriter(const TextWriter&) = delete;
+      TextWriter& operator=(const TextWriter&) = delete;
+
+      void Write(char character) {
+        if(size == buffer.size())
+          DrainBuffer();
+        buffer[size++] = character;
+      }
+      void Write(bool value) { Write(value ? '1' : '0'); }
+      void Write(unsigned long value);
+      void Write(unsigned int value) { Write(static_cast<unsigned long>(value)); }
+
+      /**
+       * Writes the value in the current floating point format, like std::ostream::operator<<(double)
+       */
+      void Write(double value);
+      void Write(float value) { Write(static_cast<double>(value)); }
+
+      /**
+       * Writes the value with the given number of digits after the decimal point in scientific notation
+       */
+      void WriteScientific(double value, int precision);
+
+      /**
+       * Equivalent of std::endl, but without flushing the stream
+       */
+      void EndLine() { Write('\n'); }
+
+      /**
+       * Equivalent of std::scientific
+       */
+      void SetScientific() {
+        scientific = true;
+        otherFormat = false;
+      }
+
+      /**
+       * Equivalent of std::ostream::precision
+       */
+      void SetPrecision(long precision) { this->precision = precision; }
+
+      /**
+       * Writes the buffer and the floating point format to the stream and flushes the stream
+       */
+      void Flush();
+
+    private:
+      void Append(const char *characters, unsigned long length);
+      void DrainBuffer();
+
+    private:
+      std::ostream &stream;
+      std::vector<char> buffer;
+      unsigned long size = 0; /**< Number of used characters in the buffer */
+      bool scientific; /**< Floating point values are written in scientific notation, otherwise like %g */
+      bool otherFormat; /**< The stream uses std::fixed or std::hexfloat, which are written by printf */
+      long precision;
+
+  };
+
+  /**
+   * Reader for the text format, which reads the same values as the corresponding std::istream operators.
+   * The characters which are already buffered by the std::streambuf of the stream are parsed in chunks,
+   * the characters behind the last read token are put back when the reader is destroyed.
+   * If a token is missing the failbit of the stream is set and the value is zero.
+   */
+  class TextReader {
+
+    public:
+      explicit TextReader(std::istream &stream) : stream(stream) { }
+
+      /**
+       * Puts the unused characters back into the stream
+       */
+      ~TextReader();
+
+      TextReader(const TextReader&) = delete;
+      TextReader& operator=(const TextReader&) = delete;
+
+      void Read(bool &value);
+      void Read(unsigned long &value);
+      void Read(unsigned int &value) { unsigned long temp; Read(temp); value = static_cast<unsigned int>(temp); }
+
+      /**
+       * Reads a floating point value, NaN, infinity and denormalized values are handled like convert_to_float_safely
+       */
+      void Read(float &value);
+
+      /**
+       * Reads a floating point value, NaN, infinity and denormalized values are handled like convert_to_double_safely
+       */
+      void Read(double &value);
+
+      template<class T>
+      T Read() {
+        T value;
+        Read(value);
+        return value;
+      }
+
+      /**
+       * Skips the next whitespace separated tokens without converting them
+       * @param nTokens number of tokens
+       */
+      void Skip(unsigned long nTokens);
+
+      /**
+       * True if a token was missing, i.e. the failbit of the stream is set
+       */
+      bool Failed() const { return stream.fail(); }
+
+    private:
+      /**
+       * Copies the next characters of the stream into the chunk
+       * @return false if the stream has no more characters
+       */
+      bool Refill();
+
+      /**
+       * Reads the next whitespace separated token
+       * @param length the length of the token, zero if there is no token
+       * @return pointer to the first character of the token, which is not null-terminated
+       */
+      const char* ReadToken(unsigned int &length);
+
+    private:
+      std::istream &stream;
+      std::vector<char> chunk;
+      const char *position = nullptr; /**< Next unused character in the chunk */
+      const char *end = nullptr; /**< End of the chunk */
+      std::string token; /**< Tokens which continue in the next chunk are assembled here */
+
+  };
+
+  inline void writeText(TextWriter &writer, bool value) { writer.Write(value); }
+  inline void writeText(TextWriter &writer, unsigned long value) { writer.Write(value); }
+  inline void writeText(TextWriter &writer, unsigned int value) { writer.Write(value); }
+  inline void writeText(TextWriter &writer, double value) { writer.Write(value); }
+  inline void writeText(TextWriter &writer, float value) { writer.Write(value); }
+
+  inline void readText(TextReader &reader, bool &value) { reader.Read(value); }
+  inline void readText(TextReader &reader, unsigned long &value) { reader.Read(value); }
+  inline void readText(TextReader &reader, unsigned int &value) { reader.Read(value); }
+  inline void readText(TextReader &reader, double &value) { reader.Read(value); }
+  inline void readText(TextReader &reader, float &value) { reader.Read(value); }
+
+  /**
+   * Writes a vector in the same way as the operator<< below
+   */
+  template<class T>
+  void writeText(TextWriter &writer, const std::vector<T> &vector) {
+     writer.Write(static_cast<unsigned long>(vector.size()));
+     for(const auto &value : vector) {
+         writer.Write(' ');
+         writeText(writer, static_cast<const T&>(value));
+     }
+     writer.EndLine();
+  }
+
+  /**
+   * Floating point values in vectors are written in scientific notation with enough digits to restore them exactly
+   */
+  void writeText(TextWriter &writer, const std::vector<float> &vector);
+
+  void writeText(TextWriter &writer, const std::vector<double> &vector);
+
+  template<class T>
+  void readText(TextReader &reader, std::vector<T> &vector) {
+     unsigned long size;
+     reader.Read(size);
+     vector.resize(size);
+     for(unsigned long i = 0; i < size; ++i) {
+         T temp;
+         readText(reader, temp);
+         vector[i] = temp;
+     }
+  }
+
   /**
    * This template saves a vector to an std::ostream
    * @param stream an std::ostream reference
@@ -42,7 +245,7 @@ namespace FastBDT {
      stream << std::endl;
      return stream;
   }
-  
+
   /**
    * Specialize vector output operator, so it checks for nan and infinity in float/double types
    * Note: I know about http://www.gotw.ca/publications/mill17.htm, SFINAE, but nothing worked for me ...
@@ -50,10 +253,10 @@ namespace FastBDT {
    */
   template<>
   std::ostream& operator<<(std::ostream& stream, const std::vector<float> &vector);
-  
+
   template<>
   std::ostream& operator<<(std::ostream& stream, const std::vector<double> &vector);
-  
+
   /**
    * This template reads a vector from an std::istream
    * @param stream an std::istream reference
@@ -71,13 +274,39 @@ namespace FastBDT {
      }
      return stream;
   }
-  
+
   template<>
   std::istream& operator>>(std::istream& stream, std::vector<float> &vector);
-  
+
   template<>
   std::istream& operator>>(std::istream& stream, std::vector<double> &vector);
 
+  template<class T>
+  void writeText(TextWriter &writer, const Cut<T> &cut) {
+     writer.Write(static_cast<unsigned long>(cut.feature));
+     writer.EndLine();
+     writer.SetPrecision(std::numeric_limits<T>::max_digits10);
+     writer.SetScientific();
+     writeText(writer, cut.index);
+     writer.EndLine();
+     writer.SetPrecision(6);
+     writer.Write(cut.valid);
+     writer.EndLine();
+     writer.Write(cut.gain);
+     writer.EndLine();
+  }
+
+  /**
+   * Unlike the std::istream operators the reader parses NaN and Infinity for all floating point values
+   */
+  template<class T>
+  void readText(TextReader &reader, Cut<T> &cut) {
+     cut.feature = reader.Read<unsigned long>();
+     readText(reader, cut.index);
+     reader.Read(cut.valid);
+     reader.Read(cut.gain);
+  }
+
   /**
    * This function saves a Cut to an std::ostream
    * @param stream an std::ostream reference
@@ -85,17 +314,11 @@ namespace FastBDT {
    */
   template<class T>
   std::ostream& operator<<(std::ostream& stream, const Cut<T> &cut) {
-     stream << cut.feature << std::endl;
-     stream.precision(std::numeric_limits<T>::max_digits10);
-     stream << std::scientific;
-     stream << cut.index << std::endl;
-     stream.precision(6);
-     stream << cut.valid << std::endl;
-     stream << cut.gain;
-     stream << std::endl;
+     TextWriter writer(stream);
+     writeText(writer, cut);
      return stream;
   }
-  
+
   /**
    * This function reads a Cut from an std::istream
    * @param stream an std::istream reference
@@ -103,20 +326,49 @@ namespace FastBDT {
    */
   template<class T>
   std::istream& operator>>(std::istream& stream, Cut<T> &cut) {
-     stream >> cut.feature;
-     stream >> cut.index;
-     stream >> cut.valid;
-     stream >> cut.gain;
+     TextReader reader(stream);
+     readText(reader, cut);
      return stream;
   }
-  
-  template<>
-  std::istream& operator>>(std::istream& stream, Cut<float> &cut);
-  
-  template<>
-  std::istream& operator>>(std::istream& stream, Cut<double> &cut);
-  
-  
+
+  template<class T>
+  void writeText(TextWriter &writer, const Tree<T> &tree) {
+     const auto &cuts = tree.GetCuts();
+     writer.Write(static_cast<unsigned long>(cuts.size()));
+     writer.EndLine();
+     for( const auto& cut : cuts ) {
+        writeText(writer, cut);
+        writer.EndLine();
+     }
+     writeText(writer, tree.GetBoostWeights());
+     writer.EndLine();
+     writeText(writer, tree.GetPurities());
+     writer.EndLine();
+     writeText(writer, tree.GetNEntries());
+     writer.EndLine();
+  }
+
+  template<class T>
+  Tree<T> readTreeFromText(TextReader &reader) {
+      unsigned long size;
+      reader.Read(size);
+      std::vector<Cut<T>> cuts(size);
+      for(unsigned long i = 0; i < size; ++i) {
+        readText(reader, cuts[i]);
+      }
+
+      std::vector<Weight> boost_weights;
+      readText(reader, boost_weights);
+
+      std::vector<Weight> purities;
+      readText(reader, purities);
+
+      std::vector<Weight> nEntries;
+      readText(reader, nEntries);
+
+      return Tree<T>(cuts, nEntries, purities, boost_weights);
+  }
+
   /**
    * This function saves a Tree to an std::ostream
    * @param stream an std::ostream reference
@@ -124,18 +376,12 @@ namespace FastBDT {
    */
   template<class T>
   std::ostream& operator<<(std::ostream& stream, const Tree<T> &tree) {
-     const auto &cuts = tree.GetCuts();
-     stream << cuts.size() << std::endl;
-     for( const auto& cut : cuts ) {
-        stream << cut << std::endl;
-     }
-     stream << tree.GetBoostWeights() << std::endl;
-     stream << tree.GetPurities() << std::endl;
-     stream << tree.GetNEntries() << std::endl;
+     TextWriter writer(stream);
+     writeText(writer, tree);
      return stream;
   }
-  
-  
+
+
   /**
    * This function reads a Tree from an std::istream
    * @param stream an std::istream reference
@@ -143,26 +389,70 @@ namespace FastBDT {
    */
   template<class T>
   Tree<T> readTreeFromStream(std::istream& stream) {
-      unsigned long size;
-      stream >> size;
-      std::vector<Cut<T>> cuts(size);
-      for(unsigned long i = 0; i < size; ++i) {
-        stream >> cuts[i];
-      }
+      TextReader reader(stream);
+      return readTreeFromText<T>(reader);
+  }
 
-      std::vector<Weight> boost_weights;
-      stream >> boost_weights;
-      
-      std::vector<Weight> purities;
-      stream >> purities;
-      
-			std::vector<Weight> nEntries;
-      stream >> nEntries;
-      
-      return Tree<T>(cuts, nEntries, purities, boost_weights);
+  template<class T>
+  void writeText(TextWriter &writer, const Forest<T> &forest) {
+     writer.Write(forest.GetF0());
+     writer.EndLine();
+     writer.Write(forest.GetShrinkage());
+     writer.EndLine();
+     writer.Write(forest.GetTransform2Probability());
+     writer.EndLine();
+
+     const auto &trees = forest.GetForest();
+     writer.Write(static_cast<unsigned long>(trees.size()));
+     writer.EndLine();
+     for(const auto& tree : trees) {
+         writeText(writer, tree);
+         writer.EndLine();
+     }
+  }
+
+  /**
+   * Skips a Tree written by writeText, the cuts and weights are only counted and not converted
+   */
+  inline void skipTreeInText(TextReader &reader) {
+      // Four values per cut and three vectors with their sizes in front
+      reader.Skip(4 * reader.Read<unsigned long>());
+      for(unsigned int i = 0; i < 3; ++i)
+        reader.Skip(reader.Read<unsigned long>());
+  }
 
+  /**
+   * Reads a Forest
+   * @param reader text reader
+   * @param allowTruncated if true the forest may end before the number of trees in its header is reached
+   *                       (e.g. a weightfile of a training which was interrupted, see Classifier::fit),
+   *                       all complete trees are returned, the incomplete last tree is dropped
+   * @param maxTrees only the first maxTrees trees are read, the remaining trees are skipped
+   */
+  template<class T>
+  Forest<T> readForestFromText(TextReader &reader, bool allowTruncated = false, unsigned long maxTrees = allTrees) {
+      const double F0 = reader.Read<double>();
+      const double shrinkage = reader.Read<double>();
+      const bool transform2probability = reader.Read<bool>();
+
+      Forest<T> forest(shrinkage, F0, transform2probability);
+
+      const unsigned long size = reader.Read<unsigned long>();
+      if(allowTruncated and reader.Failed()) {
+        throw std::runtime_error("Weightfile ends before the header of the forest");
+      }
+      for(unsigned long i = 0; i < std::min(size, maxTrees); ++i) {
+        auto tree = readTreeFromText<T>(reader);
+        if(allowTruncated and reader.Failed())
+          break;
+        forest.AddTree(tree);
+      }
+      for(unsigned long i = maxTrees; i < size and not reader.Failed(); ++i)
+        skipTreeInText(reader);
+
+      return forest;
   }
-  
+
   /**
    * This function saves a Forest to an std::ostream
    * @param stream an std::ostream reference
@@ -170,62 +460,69 @@ namespace FastBDT {
    */
   template<class T>
   std::ostream& operator<<(std::ostream& stream, const Forest<T> &forest) {
-     stream << forest.GetF0() << std::endl;
-     stream << forest.GetShrinkage() << std::endl;
-     stream << forest.GetTransform2Probability() << std::endl;
-
-     const auto &trees = forest.GetForest();
-     stream << trees.size() << std::endl;
-     for(const auto& tree : trees) {
-         stream << tree << std::endl;
-     }
-
+     TextWriter writer(stream);
+     writeText(writer, forest);
      return stream;
   }
-  
+
   /**
    * This function reads a Forest from an std::istream
    * @param stream an std::istream reference
+   * @param maxTrees only the first maxTrees trees are read, the remaining trees are skipped
    * @preturn forest containing read data
    */
   template<class T>
-  Forest<T> readForestFromStream(std::istream& stream) {
-      double F0;
-      stream >> F0;
-
-      double shrinkage;
-      stream >> shrinkage;
-     
-      bool transform2probability;
-      stream >> transform2probability;
-
-      Forest<T> forest(shrinkage, F0, transform2probability);
+  Forest<T> readForestFromStream(std::istream& stream, unsigned long maxTrees = allTrees) {
+      TextReader reader(stream);
+      return readForestFromText<T>(reader, false, maxTrees);
+  }
 
-      unsigned long size;
-      stream >> size;
+  void writeText(TextWriter &writer, const PurityTransformation &purityTransformation);
 
-      for(unsigned long i = 0; i < size; ++i) {
-        forest.AddTree(readTreeFromStream<T>(stream));
-      }
+  void readText(TextReader &reader, PurityTransformation &purityTransformation);
 
-      return forest;
-  }
-  
   /**
    * This function saves a PurityTransformation to an std::ostream
    * @param stream an std::ostream reference
    * @param purityTransformation the purity transformation which shall be stored
    */
   std::ostream& operator<<(std::ostream& stream, const PurityTransformation &purityTransformation);
-  
+
   /**
    * This function reads a PurityTransformation from an std::istream
    * @param stream an std::istream reference
    * @param purityTransformation the purity transformation which shall be stored
    */
   std::istream& operator>>(std::istream& stream, PurityTransformation &purityTransformation);
-  
-  
+
+  template<class T>
+  void writeText(TextWriter &writer, const FeatureBinning<T> &featureBinning) {
+     writer.Write(static_cast<unsigned long>(featureBinning.GetNLevels()));
+     writer.EndLine();
+     writeText(writer, featureBinning.GetBinning());
+     writer.EndLine();
+  }
+
+  template<class T>
+  FeatureBinning<T> readFeatureBinningFromText(TextReader &reader) {
+      const unsigned long nLevels = reader.Read<unsigned long>();
+
+      std::vector<T> bins;
+      readText(reader, bins);
+
+      return FeatureBinning<T>::Restore(nLevels, std::move(bins));
+  }
+
+  /**
+   * Appends the read FeatureBinnings to the vector, like the operator>> below
+   */
+  template<class T>
+  void readText(TextReader &reader, std::vector<FeatureBinning<T>> &vector) {
+     const unsigned long size = reader.Read<unsigned long>();
+     for(unsigned long i = 0; i < size; ++i)
+         vector.push_back(readFeatureBinningFromText<T>(reader));
+  }
+
   /**
    * This function saves a FeatureBinning to an std::ostream
    * @param stream an std::ostream reference
@@ -233,13 +530,11 @@ namespace FastBDT {
    */
   template<class T>
   std::ostream& operator<<(std::ostream& stream, const FeatureBinning<T> &featureBinning) {
-     
-     stream << featureBinning.GetNLevels() << std::endl;
-     stream << featureBinning.GetBinning() << std::endl;
-
+     TextWriter writer(stream);
+     writeText(writer, featureBinning);
      return stream;
   }
-  
+
   /**
    * This function reads a FeatureBinning from an std::istream
    * @param stream an std::istream reference
@@ -247,28 +542,19 @@ namespace FastBDT {
    */
   template<class T>
   FeatureBinning<T> readFeatureBinningFromStream(std::istream& stream) {
-  
-      unsigned long nLevels;
-      stream >> nLevels; 
-
-      std::vector<T> bins;
-      stream >> bins;
-
-      return FeatureBinning<T>(nLevels, bins);
-
+      TextReader reader(stream);
+      return readFeatureBinningFromText<T>(reader);
   }
- 
+
   /**
    * Overload vector input operator, so it can read in FeatureBinnings
    */
   template<class T>
   std::istream& operator>>(std::istream& stream, std::vector<FeatureBinning<T>> &vector) {
-     unsigned long size;
-     stream >> size;
-     for(unsigned long i = 0; i < size; ++i)
-         vector.push_back(readFeatureBinningFromStream<T>(stream));
+     TextReader reader(stream);
+     readText(reader, vector);
      return stream;
   }
-  
-  
+
+
 }
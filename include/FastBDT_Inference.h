@@ -0,0 +1,518 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Inference-only representations of a trained forest
+ */
+
+#pragma once
+
+#include "FastBDT.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+namespace FastBDT {
+
+  /**
+   * Contiguous read-only array used by CompiledForest, which either owns its elements
+   * or refers to memory owned by someone else, e.g. a memory-mapped model file (see MappedClassifier).
+   * A copy of an owning array owns a copy of the elements, a copy of a view refers to the same memory.
+   */
+  template<class T>
+  class ForestArray {
+
+    public:
+      ForestArray() = default;
+      ForestArray(const ForestArray &other) { *this = other; }
+
+      ForestArray& operator=(const ForestArray &other) {
+        storage = other.storage;
+        view = other.view;
+        first = view ? other.first : storage.data();
+        length = other.length;
+        return *this;
+      }
+
+      /**
+       * Takes ownership of the given elements
+       */
+      ForestArray& operator=(std::vector<T> &&elements) {
+        storage = std::move(elements);
+        view = false;
+        first = storage.data();
+        length = storage.size();
+        return *this;
+      }
+
+      /**
+       * Refers to the given memory, which must outlive this array and all its copies
+       */
+      void SetView(const T *data, unsigned long size) {
+        storage = std::vector<T>();
+        view = true;
+        first = data;
+        length = size;
+      }
+
+      bool IsView() const { return view; }
+
+      const T& operator[](unsigned long i) const { return first[i]; }
+      const T* data() const { return first; }
+      const T* begin() const { return first; }
+      const T* end() const { return first + length; }
+      unsigned long size() const { return length; }
+      bool empty() const { return length == 0; }
+
+    private:
+      std::vector<T> storage;
+      bool view = false;
+      const T *first = nullptr;
+      unsigned long length = 0;
+
+  };
+
+  /**
+   * Flattened representation of a Forest<float>, which is used for the inference only.
+   *
+   * The Forest<float> stores a vector of trees, each tree stores a vector of Cut objects
+   * (containing the gain and the valid flag) and the nEntries, purities and boost weights of all nodes.
+   * During the inference only the feature, the cut value and the boost weights are needed.
+   * Therefore this class stores the cuts of all trees in contiguous arrays (structure of arrays):
+   *   features      the feature ids of all cuts as 16bit integers
+   *   cuts          the cut values of all cuts as floats
+   *   boostWeights  the boost weights of all nodes
+   * The trees are stored one after another, the offsets of each tree are stored separately.
+   * Purities and the number of entries are not stored, the gains are stored in a separate array,
+   * which is only used for the variable ranking, so they do not pollute the cache.
+   *
+   * If all trees are complete and have the same depth (up to maxUnrolledDepth), which is the case for all
+   * trees trained by the ForestBuilder, a second copy of the trees is stored, in which invalid cuts are replaced by sentinels.
+   * These trees are evaluated by kernels which are unrolled at compile time for each depth,
+   * so the traversal of a tree has a fixed number of steps without any branches or bounds checks.
+   */
+  class CompiledForest {
+
+    public:
+      /**
+       * Marks an invalid cut in the features array, the event stops in this node
+       */
+      static const uint16_t invalidFeature = 0xFFFF;
+
+      /**
+       * Number of events which are evaluated together by the batch methods
+       */
+      static const unsigned long blockSize = 64;
+
+      /**
+       * Maximum depth of the trees for which depth-specialised kernels exist
+       */
+      static const unsigned long maxUnrolledDepth = 10;
+
+      /**
+       * Maximum number of events per tile used by the batch methods
+       */
+      static const unsigned long maxEventsPerTile = 1024;
+
+      /*
+       * Explicitly activate default/copy constructor and assign operator.
+       */
+      CompiledForest() = default;
+      CompiledForest(const CompiledForest&) = default;
+      CompiledForest& operator=(const CompiledForest &) = default;
+
+      /**
+       * Flattens the given forest, this has to be done only once after the training or loading of the forest.
+       * @param forest the forest which shall be compiled
+       */
+      explicit CompiledForest(const Forest<float> &forest);
+
+      /**
+       * Returns the F value calculated from the compiled forest for a given event.
+       * The result is identical to Forest<float>::GetF
+       * @param values pointer to the feature values of the event
+       */
+      double GetF(const float *values) const {
+
+          if(depth != 0)
+            return GetFUnrolled(values);
+
+          double F = F0_div_shrink;
+          const unsigned long nTrees = GetNTrees();
+          for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+            F += boostWeights[nodeOffsets[iTree] + ValueToNode(iTree, values)];
+          }
+          return F*shrinkage;
+
+      }
+
+      /**
+       * Returns the signal probability (or the F value if transform2probability is false) of a given event
+       * @param values pointer to the feature values of the event
+       */
+      double Analyse(const float *values) const {
+
+          if(not transform2probability)
+              return GetF(values);
+          return 1.0/(1.0+std::exp(-2*GetF(values)));
+
+      }
+
+      /**
+       * Calculates the F values of many events at once.
+       * The trees and the events are split into tiles (see SetTileSizes). All trees of a tree tile are applied
+       * to all events of an event tile (in blocks of blockSize events) before moving on to the next tree tile.
+       * So the trees of a tile stay in the cache while they are applied to many events,
+       * even if the whole forest does not fit into the cache.
+       * No memory is allocated.
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param F pointer to the output array, containing at least nEvents entries
+       */
+      void GetF(const float *values, unsigned long nEvents, unsigned long stride, double *F) const;
+
+      /**
+       * Calculates the signal probability (or the F value if transform2probability is false) of many events at once
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param result pointer to the output array, containing at least nEvents entries
+       */
+      void Analyse(const float *values, unsigned long nEvents, unsigned long stride, float *result) const;
+
+      /**
+       * Calculates the F values after the first checkpoints[i] trees of many events in one pass over the forest,
+       * the result is identical to Forest<float>::GetStagedF. The events are processed in tiles like in GetF.
+       * No memory is allocated.
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param checkpoints numbers of trees in increasing order, each at most GetNTrees()
+       * @param F pointer to the output array (row-major), containing at least nEvents*checkpoints.size() entries
+       */
+      void GetStagedF(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &checkpoints, double *F) const;
+
+      /**
+       * Calculates the signal probabilities (or the F values if transform2probability is false) after the first checkpoints[i] trees
+       * of many events in one pass over the forest
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param checkpoints numbers of trees in increasing order, each at most GetNTrees()
+       * @param result pointer to the output array (row-major), containing at least nEvents*checkpoints.size() entries
+       */
+      void AnalyseStaged(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &checkpoints, float *result) const;
+
+      /**
+       * Calculates the node (see ValueToNode) each event ends up in for all trees, e.g. as input for a tree embedding.
+       * Row i of the output contains the nodes of event i in all trees. No memory is allocated.
+       * Throws if GetNNodeIds() does not fit into the output type.
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param nodes pointer to the output array (row-major), containing at least nEvents*GetNTrees() entries
+       */
+      void GetLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, uint16_t *nodes) const;
+
+      /**
+       * Same as GetLeafIndices above with 8bit node ids, sufficient for trees with a depth up to 7
+       */
+      void GetLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, uint8_t *nodes) const;
+
+      /**
+       * Returns the number of different node ids returned by ValueToNode, the largest node id plus one
+       */
+      unsigned long GetNNodeIds() const { return nNodeIds; }
+
+      /**
+       * Returns the node of a given event in the given tree, same semantic as Tree::ValueToNode
+       * @param iTree index of the tree
+       * @param values pointer to the feature values of the event
+       */
+      unsigned long ValueToNode(unsigned long iTree, const float *values) const {
+
+          const uint16_t *tree_features = &features[cutOffsets[iTree]];
+          const float *tree_cuts = &cuts[cutOffsets[iTree]];
+          const unsigned long nCuts = cutOffsets[iTree+1] - cutOffsets[iTree];
+
+          unsigned long node = 1;
+          while( node <= nCuts ) {
+            const uint16_t feature = tree_features[node-1];
+            if(feature == invalidFeature)
+              break;
+            const float value = values[feature];
+            if(std::isnan(value))
+              break;
+            node = (node << 1) + static_cast<unsigned long>(value >= tree_cuts[node-1]);
+          }
+          return node - 1;
+
+      }
+
+      unsigned long GetNTrees() const { return cutOffsets.empty() ? 0 : cutOffsets.size() - 1; }
+      double GetShrinkage() const { return shrinkage; }
+      double GetF0() const { return F0; }
+      bool GetTransform2Probability() const { return transform2probability; }
+
+      /**
+       * Returns static_cast<float>(Analyse(values)) > threshold, which is the same as Classifier::predict(values) > threshold.
+       * The trees are summed up in the order set by SetEarlyExitOrder. Before each tree the smallest and largest F value
+       * which can still be reached with the remaining trees are compared to the threshold,
+       * and the evaluation stops as soon as the result cannot change anymore.
+       * @param values pointer to the feature values of the event
+       * @param threshold decision threshold on the output of Analyse
+       */
+      bool PredictAbove(const float *values, float threshold) const;
+
+      /**
+       * Same as PredictAbove above for many events
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param threshold decision threshold on the output of Analyse
+       * @param result pointer to the output array, containing at least nEvents entries
+       */
+      void PredictAbove(const float *values, unsigned long nEvents, unsigned long stride, float threshold, bool *result) const;
+
+      /**
+       * Sets the order of the trees used by PredictAbove, by default the original order of the trees is used.
+       * Sorting the trees by decreasing weight range (difference between the largest and the smallest boost weight)
+       * settles the outcome after fewer trees, but the trees are no longer accessed in the order they are stored.
+       * The order does not change the result of PredictAbove.
+       * @param sortByWeightRange sort the trees by weight range, otherwise the original order of the trees is used
+       */
+      void SetEarlyExitOrder(bool sortByWeightRange);
+
+      /**
+       * Calculates the individual variable ranking (see Forest<float>::GetIndividualVariableRanking) of many events at once.
+       * The gains of all cuts on the path of an event are summed up in the column of the cut feature,
+       * afterwards each row is normalised to one. Columns of features which are not used by the event stay zero,
+       * as do all columns of events which do not pass any cut.
+       * No memory is allocated.
+       * @param values pointer to the feature values of the first event
+       * @param nEvents number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param columns output column of each feature, must contain at least GetNFeatures() entries
+       * @param nColumns number of columns of the output, all columns must be smaller than this number
+       * @param ranking pointer to the output array (row-major), containing at least nEvents*nColumns entries
+       */
+      void GetIndividualVariableRanking(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &columns, unsigned long nColumns, double *ranking) const;
+
+      /**
+       * Returns the number of features used by the cuts (the largest feature id plus one)
+       */
+      unsigned long GetNFeatures() const { return nFeatures; }
+
+      /**
+       * Sets the tile sizes used by the batch methods, by default they are chosen from the size of the L2 cache.
+       * @param treesPerTile number of trees per tile, 0 chooses the number such that a tile uses half of the L2 cache
+       * @param eventsPerTile number of events per tile (at most maxEventsPerTile), 0 chooses the number for each
+       *                      call such that the feature values of a tile use a quarter of the L2 cache
+       */
+      void SetTileSizes(unsigned long treesPerTile, unsigned long eventsPerTile);
+
+      unsigned long GetTreesPerTile() const { return treesPerTile; }
+
+      /**
+       * Returns the number of events per tile used for the given stride
+       * @param stride distance (in floats) between the first features of two consecutive events
+       */
+      unsigned long GetEventsPerTile(unsigned long stride) const;
+
+      /**
+       * Returns the depth of the trees if the depth-specialised kernels are used, 0 otherwise
+       */
+      unsigned long GetDepth() const { return depth; }
+
+    private:
+      /**
+       * Adds the boost weights of the given tree to the F values of a block of events.
+       * If the library is compiled with AVX2 (AVX-512) 8 (16) events are pushed through the tree together,
+       * using gathers for the feature values and cut values and masked updates of the node numbers.
+       * NaN values and invalid cuts stop the event in the current node like in ValueToNode.
+       * @param iTree index of the tree
+       * @param block pointer to the feature values of the first event in the block
+       * @param nBlock number of events in the block
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param F F values of the events in the block
+       */
+      void AddTreeToBlock(unsigned long iTree, const float *block, unsigned long nBlock, unsigned long stride, double *F) const;
+
+      /**
+       * Implementation of GetLeafIndices for the different node id types
+       */
+      template<typename NodeId>
+      void FillLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, NodeId *nodes) const;
+
+      /**
+       * Returns the F value of a given event using the depth-specialised kernel of this forest
+       */
+      double GetFUnrolled(const float *values) const;
+
+      /**
+       * Depth-specialised version of GetF, the traversal of each tree is unrolled to D levels
+       */
+      template<unsigned long D>
+      double GetFUnrolled(const float *values) const;
+
+      /**
+       * Returns the F values corresponding to the threshold of PredictAbove:
+       * all F values >= high are above the threshold, all F values <= low are not above the threshold
+       */
+      void GetThresholdBounds(float threshold, double &low, double &high) const;
+
+      /**
+       * Returns the first number of evaluated trees after which the outcome of PredictAbove can be settled,
+       * or nTrees+1 if the outcome is never settled before all trees are evaluated
+       */
+      unsigned long GetFirstPossibleExit(double low, double high) const;
+
+      /**
+       * PredictAbove with precomputed threshold bounds, dispatches to the depth-specialised version
+       */
+      bool PredictAbove(const float *values, float threshold, double low, double high) const;
+
+      /**
+       * PredictAbove with depth-specialised tree traversal, D = 0 uses the generic traversal
+       */
+      template<unsigned long D>
+      bool PredictAbove(const float *values, float threshold, double low, double high) const;
+
+      /**
+       * Boost weight of the node the event ends up in, D = 0 uses the generic traversal
+       */
+      template<unsigned long D>
+      Weight GetTreeWeight(unsigned long iTree, const float *values) const;
+
+      /**
+       * Depth-specialised version of the scalar loop in AddTreeToBlock
+       */
+      template<unsigned long D>
+      void AddTreeToBlockUnrolled(unsigned long iTree, const float *block, unsigned long nBlock, unsigned long stride, double *F) const;
+
+    private:
+      /**
+       * Points the arrays to a memory-mapped weightfile
+       */
+      friend class MappedClassifier;
+
+      ForestArray<uint16_t> features; /**< Feature ids of all cuts of all trees */
+      ForestArray<float> cuts; /**< Cut values of all cuts of all trees */
+      ForestArray<Weight> boostWeights; /**< Boost weights of all nodes of all trees */
+      ForestArray<uint32_t> cutOffsets; /**< Position of the first cut of each tree, contains nTrees+1 entries */
+      ForestArray<uint32_t> nodeOffsets; /**< Position of the first node of each tree, contains nTrees+1 entries */
+      ForestArray<double> gains; /**< Separation gains of all cuts (zero for invalid cuts), only used by GetIndividualVariableRanking */
+      unsigned long nFeatures = 0; /**< Number of features used by the cuts */
+      unsigned long nNodeIds = 0; /**< Largest node id returned by ValueToNode plus one */
+
+      unsigned long depth = 0; /**< Depth of all trees if the depth-specialised kernels are used, 0 otherwise */
+      ForestArray<uint16_t> unrolledFeatures; /**< Feature ids of all cuts, invalid cuts are replaced by feature 0, nCuts per tree */
+      ForestArray<float> unrolledCuts; /**< Cut values of all cuts, invalid cuts are replaced by NaN, nCuts per tree */
+      ForestArray<Weight> unrolledWeights; /**< Boost weights of all nodes, nodes below invalid cuts get the weight of the invalid cut */
+
+      bool sortedExitOrder = false; /**< True if exitOrder differs from the original order of the trees */
+      ForestArray<uint32_t> exitOrder; /**< Order of the trees used by PredictAbove */
+      ForestArray<double> remainingMin; /**< Sum of the smallest boost weights of the trees not yet evaluated by PredictAbove, nTrees+1 entries */
+      ForestArray<double> remainingMax; /**< Sum of the largest boost weights of the trees not yet evaluated by PredictAbove, nTrees+1 entries */
+      ForestArray<double> remainingAbs; /**< Sum of the largest absolute boost weights of the trees not yet evaluated by PredictAbove, nTrees+1 entries */
+      ForestArray<double> bestLowerBound; /**< Largest possible lower bound on the sum of the boost weights after k trees, nTrees+1 entries */
+      ForestArray<double> bestUpperBound; /**< Smallest possible upper bound on the sum of the boost weights after k trees, nTrees+1 entries */
+
+      unsigned long treesPerTile = 1; /**< Number of trees per tile used by the batch methods */
+      unsigned long eventsPerTile = 0; /**< Number of events per tile used by the batch methods, 0 means automatic */
+
+      double shrinkage = 0.0;
+      double F0 = 0.0;
+      double F0_div_shrink = 0.0;
+      bool transform2probability = false;
+
+  };
+
+  /**
+   * QuickScorer representation of a Forest<float> with shallow complete trees (depth <= 6).
+   * See Lucchese et al., QuickScorer: a Fast Algorithm to Rank Documents with Additive Ensembles of Regression Trees.
+   *
+   * Instead of traversing each tree, the cuts of all trees are sorted by feature and cut value.
+   * Every node of a tree corresponds to one bit in the bitvector of the tree, the bits are ordered in post-order
+   * (left subtree, right subtree, node itself).
+   * For each feature value, all cuts with a cut value lower or equal than the value are visited
+   * (the event goes to the right child in these nodes) and the bits of the left subtree are cleared.
+   * Afterwards the lowest bit which is still set is the node the event ends up in.
+   *
+   * NaN values are handled like in Tree::ValueToNode: the event stops in the node with the NaN value.
+   * Therefore the bits of both subtrees of all nodes which cut on a feature with a NaN value are cleared,
+   * this leaves the bit of the node itself as the lowest one (due to the post-order).
+   * Invalid cuts are treated like NaN values, their bitmasks are applied to the initial bitvectors.
+   */
+  class QuickScorerForest {
+
+    public:
+      /**
+       * Maximum number of nodes per tree, corresponds to a depth of 6
+       */
+      static const unsigned long maxNodes = 127;
+
+      QuickScorerForest() = default;
+      QuickScorerForest(const QuickScorerForest&) = default;
+      QuickScorerForest& operator=(const QuickScorerForest &) = default;
+
+      /**
+       * Builds the sorted cuts and bitmasks of the given forest, all trees must be complete binary trees
+       * with at most maxNodes nodes
+       * @param forest the forest which shall be compiled
+       */
+      explicit QuickScorerForest(const Forest<float> &forest);
+
+      /**
+       * Returns the F value for a given event, the result is identical to Forest<float>::GetF
+       * @param values pointer to the feature values of the event
+       */
+      double GetF(const float *values) const;
+
+      /**
+       * Returns the signal probability (or the F value if transform2probability is false) of a given event
+       * @param values pointer to the feature values of the event
+       */
+      double Analyse(const float *values) const {
+
+          if(not transform2probability)
+              return GetF(values);
+          return 1.0/(1.0+std::exp(-2*GetF(values)));
+
+      }
+
+      unsigned long GetNTrees() const { return nTrees; }
+
+    private:
+      /**
+       * Evaluates the forest with a fixed number of 64bit words per bitvector
+       */
+      template<unsigned long N>
+      double GetF(const float *values) const;
+
+    private:
+      unsigned long nTrees = 0;
+      unsigned long nWords = 1; /**< Number of 64bit words in each bitvector */
+      unsigned long nNodes = 1; /**< Number of exit nodes per tree (the size of the largest tree) */
+      unsigned long nFeatures = 0; /**< Number of features used by the cuts */
+
+      std::vector<float> thresholds; /**< Cut values sorted by feature and value */
+      std::vector<uint32_t> thresholdTrees; /**< Tree of each cut value */
+      std::vector<uint64_t> thresholdMasks; /**< Bitmask (clearing the left subtree) of each cut value, nWords per cut */
+      std::vector<uint32_t> thresholdOffsets; /**< Position of the first cut of each feature, nFeatures+1 entries */
+
+      std::vector<uint32_t> nanTrees; /**< Tree of each cut, sorted by feature, used for NaN values */
+      std::vector<uint64_t> nanMasks; /**< Bitmask (clearing both subtrees) of each cut, nWords per cut */
+      std::vector<uint32_t> nanOffsets; /**< Position of the first cut of each feature, nFeatures+1 entries */
+
+      std::vector<uint64_t> initialBitvectors; /**< Bitvectors of all trees before any cut is applied, nWords per tree */
+      std::vector<Weight> exitWeights; /**< Boost weights of all trees ordered by bit position, nNodes per tree */
+
+      double shrinkage = 0.0;
+      double F0_div_shrink = 0.0;
+      bool transform2probability = false;
+
+  };
+
+}
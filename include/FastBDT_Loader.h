@@ -0,0 +1,49 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Parallel loader for training data stored in whitespace or comma separated text files
+ */
+
+#pragma once
+
+#include "FastBDT.h"
+
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Column index which means that the column does not exist in the file
+   */
+  const long noColumn = std::numeric_limits<long>::min();
+
+  /**
+   * Reads training data from a text file with one event per line, the values are separated by whitespaces and/or commas.
+   * All columns except the label and weight column are features, in the order of the columns.
+   * The file is mapped into memory, split into chunks at line boundaries and the chunks are parsed in parallel.
+   * The values are parsed like convert_to_float_safely, so NaN and infinity are supported.
+   * Lines which contain only separators are skipped, empty fields of a CSV file are not supported.
+   * Throws if a line has a different number of columns than the first line.
+   * @param filename path to the text file
+   * @param X is filled with the features in the format of Classifier::fit, X[iFeature][iEvent]
+   * @param y is filled with true for signal events (label 1) and false for all other events
+   * @param w is filled with the weights, or with 1 if there is no weight column
+   * @param skipLines number of lines at the beginning of the file which are skipped, e.g. a header
+   * @param labelColumn column of the label, negative values count from the end of the line (-1 is the last column)
+   * @param weightColumn column of the weight, negative values count from the end of the line, noColumn if all weights are 1
+   * @param nThreads number of threads, 0 means one thread per hardware thread
+   */
+  void loadTextData(const std::string &filename, std::vector<std::vector<float>> &X, std::vector<bool> &y, std::vector<Weight> &w,
+                    unsigned long skipLines = 0, long labelColumn = -1, long weightColumn = noColumn, unsigned long nThreads = 0);
+
+  /**
+   * Same as loadTextData above, but reads the text from memory
+   * @param data pointer to the first character of the text, not null-terminated
+   * @param size number of characters
+   */
+  void loadTextData(const char *data, unsigned long size, std::vector<std::vector<float>> &X, std::vector<bool> &y, std::vector<Weight> &w,
+                    unsigned long skipLines = 0, long labelColumn = -1, long weightColumn = noColumn, unsigned long nThreads = 0);
+
+}
@@ -0,0 +1,168 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Memory-mappable model format and a classifier which predicts directly on the mapped memory
+ */
+
+#pragma once
+
+#include "Classifier.h"
+#include "FastBDT_Inference.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Layout of a mapped weightfile, which contains the arrays of a CompiledForest as they are used by the inference.
+   * The file starts with a Header, followed by the arrays listed in the header, each aligned to 64 bytes.
+   * All values are stored in the byte order of the machine which wrote the file, files with a different
+   * byte order are rejected. There is no checksum, otherwise every page of the file would be read on load.
+   */
+  namespace MappedFormat {
+
+    /**
+     * Differs from the magic of the binary format, so the two formats cannot be confused
+     */
+    const char magic[8] = {'\x89', 'F', 'B', 'D', 'T', 'M', 'A', 'P'};
+
+    const uint64_t version = 1;
+
+    /**
+     * Written in the byte order of the machine, used to detect files written on a machine with a different byte order
+     */
+    const uint64_t byteOrder = 0x0102030405060708ul;
+
+    const uint64_t alignment = 64;
+
+    enum Array : uint64_t {
+      // Arrays of the CompiledForest with the same element types
+      features, cuts, boostWeights, cutOffsets, nodeOffsets, gains,
+      unrolledFeatures, unrolledCuts, unrolledWeights,
+      exitOrder, remainingMin, remainingMax, remainingAbs, bestLowerBound, bestUpperBound,
+      purityColumns, /**< Original feature (uint32) of each purity transformed feature */
+      purityLevels, /**< Number of binning levels (uint32) of each purity transformed feature */
+      purityOffsets, /**< Position of the binning and mapping of each purity transformed feature (uint64), nPurityFeatures+1 entries */
+      purityBinnings, /**< Binning boundaries (float) of all purity transformed features, see FeatureBinning */
+      purityMappings, /**< Purity bin (uint32) of each bin of all purity transformed features, see PurityTransformation */
+      nArrays
+    };
+
+    struct ArrayEntry {
+      uint64_t offset; /**< Position of the first element in bytes from the start of the file */
+      uint64_t size; /**< Number of elements */
+    };
+
+    struct Header {
+      char magic[8];
+      uint64_t version;
+      uint64_t byteOrder;
+      uint64_t fileSize;
+      double shrinkage;
+      double F0;
+      uint64_t transform2probability;
+      uint64_t sortedExitOrder;
+      uint64_t nFeatures; /**< Number of features used by the cuts (CompiledForest::GetNFeatures) */
+      uint64_t nNodeIds;
+      uint64_t depth;
+      uint64_t numberOfFeatures; /**< Number of features of an event (Classifier::GetNFeatures) */
+      ArrayEntry arrays[nArrays];
+    };
+
+  }
+
+  /**
+   * Non-owning view of a classifier stored in the mapped format (see MappedFormat), for the inference only.
+   *
+   * The file is mapped read-only into memory and the CompiledForest refers directly to the mapped arrays,
+   * no tree is copied or rebuilt on load. Therefore loading takes the same time for all model sizes,
+   * the pages are read from disk when they are used for the first time, and all processes which map
+   * the same file share the same physical memory.
+   *
+   * Only the structure of the file is checked on load (sizes and offsets of the arrays, offsets and feature ids of the trees),
+   * the cut values themselves are used as they are. So only files written by Save should be mapped.
+   */
+  class MappedClassifier {
+
+    public:
+      /**
+       * Maps the given file
+       * @param weightfile path to a weightfile written by Save
+       */
+      explicit MappedClassifier(const std::string &weightfile);
+
+      /**
+       * Uses the given memory, which must contain a mapped weightfile and outlive this object
+       * @param data pointer to the first byte of the weightfile, aligned to at least 8 bytes
+       * @param size number of bytes
+       */
+      MappedClassifier(const char *data, unsigned long size);
+
+      ~MappedClassifier();
+
+      MappedClassifier(const MappedClassifier&) = delete;
+      MappedClassifier& operator=(const MappedClassifier&) = delete;
+
+      /**
+       * Writes the given classifier in the mapped format
+       * @param classifier trained classifier
+       * @param stream output stream, should be opened in binary mode
+       */
+      static void Save(const Classifier &classifier, std::ostream &stream);
+
+      /**
+       * Returns the number of features of an event
+       */
+      unsigned long GetNFeatures() const { return numberOfFeatures; }
+
+      const CompiledForest& GetCompiledForest() const { return forest; }
+
+      /**
+       * Same as Classifier::predict
+       */
+      float predict(const std::vector<float> &X) const;
+
+      /**
+       * Same as Classifier::predict_batch
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param out pointer to the output array, containing at least nRows entries
+       * @param nThreads number of threads, 0 means one thread per hardware thread
+       */
+      void predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out, unsigned long nThreads = 1) const;
+
+    private:
+      /**
+       * Checks the header and the arrays and points the CompiledForest to the arrays
+       */
+      void Map(const char *data, unsigned long size);
+
+      /**
+       * Same as Classifier::FillPurityRow
+       */
+      void FillPurityRow(const float *X, float *row) const;
+
+      /**
+       * Predicts the given events on the calling thread
+       */
+      void predict_batch_serial(const float *X, unsigned long nRows, unsigned long stride, float *out) const;
+
+    private:
+      void *mapping = nullptr; /**< Start of the memory mapped by this object, nullptr if the memory is not owned */
+      unsigned long mappingSize = 0;
+
+      CompiledForest forest;
+      unsigned long numberOfFeatures = 0;
+      ForestArray<uint32_t> purityColumns;
+      ForestArray<uint32_t> purityLevels;
+      ForestArray<uint64_t> purityOffsets;
+      ForestArray<float> purityBinnings;
+      ForestArray<uint32_t> purityMappings;
+
+  };
+
+}
@@ -0,0 +1,141 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Handle to a classifier which can be replaced while other threads are predicting
+ */
+
+#pragma once
+
+#include "Classifier.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Holds an immutable classifier, which can be replaced by a new one (e.g. a newly trained weightfile)
+   * without pausing the threads which are predicting with the current one.
+   *
+   * The classifier is protected by an epoch-based scheme (similar to read-copy-update):
+   * Each reader increments the reader counter of the current epoch and reads the current model,
+   * it decrements the counter again when it is done. Readers never take a lock.
+   * Publish replaces the current model atomically and afterwards advances the epoch twice,
+   * each time waiting until all readers of the previous epoch are done.
+   * Afterwards no reader can hold the old model anymore and it is deleted.
+   * Writers are serialised by a mutex, which is never touched by the readers.
+   *
+   * A thread must not publish a new model while it holds a Reader itself, this would wait forever.
+   */
+  class ModelHandle {
+
+    private:
+      struct Model {
+        std::unique_ptr<const Classifier> classifier;
+        unsigned long version;
+      };
+
+      /**
+       * Reader counter of one epoch, each counter has its own cache line
+       */
+      struct ReaderCounter {
+        std::atomic<unsigned long> count;
+        char padding[64 - sizeof(std::atomic<unsigned long>)];
+      };
+
+    public:
+      /**
+       * Gives access to the model which was current when the reader was created,
+       * the model stays alive at least until the reader is destroyed
+       */
+      class Reader {
+
+        public:
+          explicit Reader(const ModelHandle &handle);
+          ~Reader();
+
+          Reader(const Reader&) = delete;
+          Reader& operator=(const Reader&) = delete;
+
+          /**
+           * Returns the classifier, or nullptr if no model was published yet
+           */
+          const Classifier* get() const { return model ? model->classifier.get() : nullptr; }
+          const Classifier& operator*() const { return *get(); }
+          const Classifier* operator->() const { return get(); }
+
+          /**
+           * Returns the version of the model (1 for the first published model), or 0 if no model was published yet
+           */
+          unsigned long GetVersion() const { return model ? model->version : 0; }
+
+        private:
+          const ModelHandle &handle;
+          unsigned long epoch;
+          const Model *model;
+
+      };
+
+      ModelHandle();
+      ~ModelHandle();
+
+      ModelHandle(const ModelHandle&) = delete;
+      ModelHandle& operator=(const ModelHandle&) = delete;
+
+      /**
+       * Replaces the current model by the given classifier. Returns after all readers of the old model are done
+       * and the old model was deleted.
+       * @param classifier the new classifier, it must not be changed afterwards
+       * @return the version of the new model
+       */
+      unsigned long Publish(std::unique_ptr<const Classifier> classifier);
+
+      /**
+       * Loads the classifier from the given weightfile and publishes it.
+       * The number of threads of the current model is kept, like in the Load function of the C API.
+       * @param weightfile path to the weightfile
+       * @return the version of the new model
+       */
+      unsigned long Load(const std::string &weightfile);
+
+      /**
+       * Loads and publishes the given weightfile on a background thread
+       * @param weightfile path to the weightfile
+       * @return future with the version of the new model, errors are rethrown by get()
+       */
+      std::future<unsigned long> LoadInBackground(const std::string &weightfile);
+
+      /**
+       * Returns the version of the current model, or 0 if no model was published yet
+       */
+      unsigned long GetVersion() const;
+
+      /**
+       * Predicts an event with the current model, throws if no model was published yet
+       * @param X features of the event
+       */
+      float predict(const std::vector<float> &X) const;
+
+      /**
+       * Predicts many events with the current model (see Classifier::predict_batch), all events are predicted by the same model
+       * @param X pointer to the features of the first event
+       * @param nRows number of events
+       * @param stride distance (in floats) between the first features of two consecutive events
+       * @param out pointer to the output array, containing at least nRows entries
+       */
+      void predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out) const;
+
+    private:
+      std::atomic<const Model*> current; /**< Current model, nullptr if no model was published yet */
+      std::atomic<unsigned long> epoch; /**< Current epoch, only changed by Publish */
+      mutable ReaderCounter readers[2]; /**< Number of active readers of even and odd epochs */
+      std::mutex publishMutex; /**< Serialises Publish, never used by readers */
+      unsigned long lastVersion = 0; /**< Version of the last published model, protected by publishMutex */
+
+  };
+
+}
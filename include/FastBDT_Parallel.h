@@ -0,0 +1,82 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Helper to distribute independent work items on several threads
+ */
+
+#pragma once
+
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+namespace FastBDT {
+
+  /**
+   * Returns the number of threads which should be used for the given configuration
+   * @param nThreads requested number of threads, 0 means one thread per hardware thread
+   */
+  inline unsigned long GetNumberOfThreads(unsigned long nThreads) {
+    if(nThreads == 0) {
+      nThreads = std::thread::hardware_concurrency();
+    }
+    return std::max(nThreads, 1ul);
+  }
+
+  /**
+   * Splits the items [0, nItems) into contiguous chunks and calls function(first, last) for each chunk on its own thread.
+   * The calling thread processes the first chunk itself, so nThreads = 1 does not start any thread at all.
+   * Exceptions thrown by the function are rethrown in the calling thread after all threads finished.
+   * @param nItems number of items
+   * @param nThreads number of threads, 0 means one thread per hardware thread
+   * @param granularity minimum number of items per chunk, chunk boundaries are multiples of this number
+   * @param function callable with the signature void(unsigned long first, unsigned long last)
+   */
+  template<class Function>
+  void ParallelFor(unsigned long nItems, unsigned long nThreads, unsigned long granularity, const Function &function) {
+
+    granularity = std::max(granularity, 1ul);
+    const unsigned long nGranules = (nItems + granularity - 1) / granularity;
+    nThreads = std::min(GetNumberOfThreads(nThreads), std::max(nGranules, 1ul));
+
+    if(nThreads == 1) {
+      function(0ul, nItems);
+      return;
+    }
+
+    const unsigned long granulesPerThread = (nGranules + nThreads - 1) / nThreads;
+    const unsigned long chunkSize = granulesPerThread * granularity;
+
+    std::vector<std::exception_ptr> exceptions(nThreads);
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+    for(unsigned long iThread = 1; iThread < nThreads; ++iThread) {
+      const unsigned long first = std::min(iThread * chunkSize, nItems);
+      const unsigned long last = std::min(first + chunkSize, nItems);
+      threads.emplace_back([&function, &exceptions, iThread, first, last]() {
+        try {
+          function(first, last);
+        } catch(...) {
+          exceptions[iThread] = std::current_exception();
+        }
+      });
+    }
+
+    try {
+      function(0ul, std::min(chunkSize, nItems));
+    } catch(...) {
+      exceptions[0] = std::current_exception();
+    }
+
+    for(auto &thread : threads)
+      thread.join();
+
+    for(auto &exception : exceptions) {
+      if(exception)
+        std::rethrow_exception(exception);
+    }
+
+  }
+
+}
@@ -0,0 +1,151 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Memory-mappable cache of a binned EventSample, so the binning is done only once for many trainings
+ */
+
+#pragma once
+
+#include "FastBDT.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Layout of a sample cache, which contains the bins and weights of all events of an EventSample before the training.
+   * The file starts with a Header, followed by the arrays listed in the header, each aligned to 64 bytes.
+   * The bins are stored with the smallest width which holds the largest bin of all features (see Header::bytesPerBin),
+   * e.g. one byte per bin for the default binning with 8 levels instead of the 8 bytes used in memory.
+   * All values are stored in the byte order of the machine which wrote the file, files with a different
+   * byte order are rejected. There is no checksum, otherwise every page of the file would be read twice on load.
+   */
+  namespace SampleFormat {
+
+    /**
+     * Differs from the magics of the binary and the mapped format, so the formats cannot be confused
+     */
+    const char magic[8] = {'\x89', 'F', 'B', 'D', 'T', 'S', 'M', 'P'};
+
+    const uint64_t version = 1;
+
+    /**
+     * Written in the byte order of the machine, used to detect files written on a machine with a different byte order
+     */
+    const uint64_t byteOrder = 0x0102030405060708ul;
+
+    const uint64_t alignment = 64;
+
+    enum Array : uint64_t {
+      levels, /**< Number of binning levels (uint64) of each feature and spectator */
+      bins, /**< Bins (unsigned integers with bytesPerBin bytes) of all events, event by event in the order of the calls to EventSample::AddEvent */
+      weights, /**< Original weight (float) of each event, in the same order as the bins */
+      preprocessing, /**< Bytes stored along with the events, e.g. the feature binnings and purity transformations of a Classifier */
+      nArrays
+    };
+
+    struct ArrayEntry {
+      uint64_t offset; /**< Position of the first element in bytes from the start of the file */
+      uint64_t size; /**< Number of elements */
+    };
+
+    struct Header {
+      char magic[8];
+      uint64_t version;
+      uint64_t byteOrder;
+      uint64_t fileSize;
+      uint64_t nEvents;
+      uint64_t nSignals; /**< The first nSignals stored events are signal events, the others background events */
+      uint64_t nFeatures;
+      uint64_t nSpectators;
+      uint64_t bytesPerBin; /**< Width of a bin, 1, 2, 4 or 8 bytes */
+      ArrayEntry arrays[nArrays];
+    };
+
+    /**
+     * Returns the smallest width of a bin (in bytes) which holds all bins of the given binning levels
+     */
+    uint64_t GetBytesPerBin(const std::vector<unsigned long> &levels);
+
+  }
+
+  /**
+   * Writes the events of a completely filled EventSample in the sample cache format (see SampleFormat).
+   * The sample has to be written before the training, because the ForestBuilder changes the weights.
+   * @param stream output stream, should be opened in binary mode
+   * @param sample event sample
+   * @param levels binning levels of the features and spectators, which were used to create the sample
+   * @param preprocessing bytes which are stored along with the events
+   */
+  void writeSampleCache(std::ostream &stream, const EventSample &sample, const std::vector<unsigned long> &levels, const std::string &preprocessing = "");
+
+  /**
+   * Read-only view of a sample cache.
+   *
+   * The file is mapped read-only into memory, the structure of the file is checked on load,
+   * but the bins are read only when an EventSample is created. Each training needs its own EventSample,
+   * because the ForestBuilder changes the weights and flags of the events, so a cache can be used for any number of trainings.
+   */
+  class SampleCache {
+
+    public:
+      /**
+       * Maps the given file
+       * @param filename path to a file written by writeSampleCache
+       */
+      explicit SampleCache(const std::string &filename);
+
+      /**
+       * Uses the given memory, which must contain a sample cache and outlive this object
+       * @param data pointer to the first byte of the cache, aligned to at least 8 bytes
+       * @param size number of bytes
+       */
+      SampleCache(const char *data, unsigned long size);
+
+      ~SampleCache();
+
+      SampleCache(const SampleCache&) = delete;
+      SampleCache& operator=(const SampleCache&) = delete;
+
+      unsigned long GetNEvents() const { return header.nEvents; }
+      unsigned long GetNSignals() const { return header.nSignals; }
+      unsigned long GetNFeatures() const { return header.nFeatures; }
+      unsigned long GetNSpectators() const { return header.nSpectators; }
+      const std::vector<unsigned long>& GetLevels() const { return levels; }
+
+      /**
+       * Returns the bytes stored along with the events
+       */
+      std::string GetPreprocessing() const;
+
+      /**
+       * Creates a new EventSample with the events of the cache, in the same order as in the sample which was written
+       */
+      EventSample GetEventSample() const;
+
+    private:
+      /**
+       * Checks the header and the sizes of the arrays
+       */
+      void Map(const char *data, unsigned long size);
+
+      /**
+       * Fills the sample with the events of the cache, reading bins of the given type
+       */
+      template<class T>
+      void Fill(EventSample &sample) const;
+
+    private:
+      void *mapping = nullptr; /**< Start of the memory mapped by this object, nullptr if the memory is not owned */
+      unsigned long mappingSize = 0;
+
+      const char *data = nullptr;
+      SampleFormat::Header header;
+      std::vector<unsigned long> levels;
+
+  };
+
+}
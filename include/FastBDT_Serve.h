@@ -0,0 +1,206 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Local inference daemon which batches concurrent requests over a Unix domain socket
+ */
+
+#pragma once
+
+#include "FastBDT_ModelHandle.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FastBDT {
+
+  /**
+   * Binary framing used between PredictionClient and PredictionServer.
+   * All fields are in the byte order of the host, the socket is local anyway.
+   *
+   * Request:  RequestHeader followed by nEvents*nFeatures floats (row-major)
+   * Response: ResponseHeader followed by nEvents floats (only if status is ok)
+   *
+   * A connection can be used for any number of requests, each request is answered before the next one is read.
+   * The events of a request are only read if the header is valid (known model, matching nFeatures and at most
+   * maxRequestEvents events), otherwise the server answers with the status and closes the connection.
+   */
+  namespace ServeProtocol {
+
+    const uint32_t magic = 0x54444246; /**< "FBDT" */
+
+    enum Status : uint32_t {
+      ok = 0,
+      unknownModel = 1, /**< The model index is larger than the number of loaded models */
+      wrongNumberOfFeatures = 2, /**< nFeatures does not match the number of features of the model */
+      tooManyEvents = 3, /**< nEvents is larger than PredictionServerOptions::maxRequestEvents */
+      predictionFailed = 4, /**< The prediction of the batch failed on the server, e.g. it ran out of memory */
+    };
+
+    struct RequestHeader {
+      uint32_t magic;
+      uint32_t model; /**< Index of the model in the list of weightfiles given to the server */
+      uint32_t nEvents;
+      uint32_t nFeatures;
+    };
+
+    struct ResponseHeader {
+      uint32_t magic;
+      uint32_t status;
+      uint32_t nEvents;
+      uint32_t reserved;
+    };
+
+  }
+
+  struct PredictionServerOptions {
+    unsigned long maxBatchEvents = 4096; /**< A batch is predicted as soon as it contains this number of events */
+    unsigned long maxDelayMicroseconds = 200; /**< A batch is predicted at the latest this time after its first request arrived */
+    unsigned long nThreads = 1; /**< Number of threads used to predict a batch, 0 means one thread per hardware thread */
+    unsigned long maxRequestEvents = 1ul << 20; /**< Requests with more events are rejected */
+  };
+
+  /**
+   * Serves the predictions of one or more classifiers over a Unix domain socket.
+   *
+   * Every connection is handled by its own thread, which reads the requests and puts them into the queue of the requested model.
+   * The batching thread of each model waits until maxBatchEvents events are queued or maxDelayMicroseconds passed since
+   * the first queued request arrived, concatenates the events of all queued requests and predicts them with one call
+   * of Classifier::predict_batch. Afterwards the scores are handed back to the connection threads.
+   *
+   * The models are held by ModelHandles, so they can be reloaded while the server is running.
+   */
+  class PredictionServer {
+
+    public:
+      /**
+       * Loads the weightfiles and starts listening on the given socket, an existing file at this path is removed
+       * @param socketPath path of the Unix domain socket
+       * @param weightfiles weightfiles of the served models, the index in this list is the model index of the requests
+       * @param options batching options
+       */
+      PredictionServer(const std::string &socketPath, const std::vector<std::string> &weightfiles, const PredictionServerOptions &options = PredictionServerOptions());
+
+      /**
+       * Stops the server (see Stop)
+       */
+      ~PredictionServer();
+
+      PredictionServer(const PredictionServer&) = delete;
+      PredictionServer& operator=(const PredictionServer&) = delete;
+
+      /**
+       * Stops accepting connections, closes all connections and waits until all threads are finished.
+       * Requests which are already queued are still answered.
+       */
+      void Stop();
+
+      /**
+       * Replaces the given model by the classifier in the weightfile, requests which are in flight still use the old model
+       * @param iModel index of the model
+       * @param weightfile path to the new weightfile
+       */
+      void Reload(unsigned long iModel, const std::string &weightfile);
+
+      unsigned long GetNModels() const { return models.size(); }
+
+      /**
+       * Returns the number of batches predicted so far by all models
+       */
+      unsigned long GetNBatches() const { return nBatches; }
+
+    private:
+      /**
+       * Request of a connection thread, which waits until done is set
+       */
+      struct PendingRequest {
+        const float *X;
+        unsigned long nEvents;
+        unsigned long nFeatures;
+        float *out;
+        ServeProtocol::Status status = ServeProtocol::ok;
+        bool done = false;
+      };
+
+      /**
+       * A served model together with its request queue and batching thread
+       */
+      struct Model {
+        ModelHandle handle;
+        std::mutex mutex;
+        std::condition_variable queued; /**< Notified when a request is queued or the server stops */
+        std::condition_variable finished; /**< Notified when a batch is done */
+        std::deque<PendingRequest*> queue;
+        unsigned long nQueuedEvents = 0;
+        std::thread batcher;
+      };
+
+      struct Connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> finished;
+      };
+
+      void AcceptConnections();
+      void HandleConnection(Connection *connection);
+      void BatchRequests(Model *model);
+
+    private:
+      std::string socketPath;
+      PredictionServerOptions options;
+      std::vector<std::unique_ptr<Model>> models;
+
+      int listenFd = -1;
+      std::atomic<bool> stopping; /**< Stops accepting and reading requests */
+      std::atomic<bool> stoppingBatchers; /**< Stops the batching threads once their queues are empty */
+      std::atomic<unsigned long> nBatches;
+      std::thread acceptor;
+      std::mutex connectionsMutex; /**< Protects connections */
+      std::vector<std::unique_ptr<Connection>> connections;
+      bool stopped = false;
+
+  };
+
+  /**
+   * Client of a PredictionServer, a client holds one connection and must not be used by several threads at once
+   */
+  class PredictionClient {
+
+    public:
+      /**
+       * Connects to the server listening on the given socket
+       * @param socketPath path of the Unix domain socket
+       */
+      explicit PredictionClient(const std::string &socketPath);
+      ~PredictionClient();
+
+      PredictionClient(const PredictionClient&) = delete;
+      PredictionClient& operator=(const PredictionClient&) = delete;
+
+      /**
+       * Sends the events to the server and waits for the scores. Throws a runtime_error if the server rejects the request.
+       * @param model index of the model
+       * @param X pointer to the features of the first event (row-major, without padding)
+       * @param nEvents number of events
+       * @param nFeatures number of features per event
+       * @param out pointer to the output array, containing at least nEvents entries
+       */
+      void predict(unsigned long model, const float *X, unsigned long nEvents, unsigned long nFeatures, float *out);
+
+      /**
+       * Same as predict above for a single event
+       */
+      float predict(unsigned long model, const std::vector<float> &X);
+
+    private:
+      int fd = -1;
+
+  };
+
+}
@@ -6,11 +6,373 @@
 
 
 #include "Classifier.h"
+#include "FastBDT_Binary.h"
+#include "FastBDT_Mapped.h"
+#include "FastBDT_Sample.h"
 #include <iostream>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include <string>
 
 namespace FastBDT {
 
+  namespace {
+
+    /**
+     * Writes a forest tree by tree in the text format of writeText(TextWriter&, const Forest<T>&).
+     * The number of trees is not known before the boosting is finished, so it is written padded
+     * to the width of the largest unsigned long and corrected by Finish if the stream is seekable.
+     * Nothing is written if the stream is a nullptr.
+     */
+    class ForestStreamer {
+
+      public:
+        explicit ForestStreamer(std::ostream *stream) : stream(stream) { }
+
+        template<class T>
+        void Start(const Forest<T> &forest, unsigned long maxTrees) {
+          if(stream == nullptr)
+            return;
+          {
+            TextWriter writer(*stream);
+            writer.Write(forest.GetF0());
+            writer.EndLine();
+            writer.Write(forest.GetShrinkage());
+            writer.EndLine();
+            writer.Write(forest.GetTransform2Probability());
+            writer.EndLine();
+          }
+          sizePosition = stream->tellp();
+          writtenSize = maxTrees;
+          WriteSize(maxTrees);
+          stream->put('\n');
+          stream->flush();
+        }
+
+        /**
+         * The tree is formatted completely before it is written,
+         * so an interrupted training leaves only complete trees in the weightfile
+         */
+        template<class T>
+        void Append(const Tree<T> &tree) {
+          if(stream == nullptr)
+            return;
+          std::ostringstream buffer;
+          {
+            TextWriter writer(buffer);
+            writeText(writer, tree);
+            writer.EndLine();
+          }
+          const std::string text = buffer.str();
+          stream->write(text.data(), text.size());
+          stream->flush();
+          nTrees++;
+        }
+
+        void Finish() {
+          if(stream == nullptr)
+            return;
+          stream->put('\n');
+          if(nTrees != writtenSize and sizePosition != std::streampos(-1)) {
+            stream->seekp(sizePosition);
+            WriteSize(nTrees);
+            stream->seekp(0, std::ios_base::end);
+          }
+          stream->flush();
+        }
+
+      private:
+        void WriteSize(unsigned long size) {
+          std::string text = std::to_string(size);
+          text.resize(std::to_string(std::numeric_limits<unsigned long>::max()).size(), ' ');
+          stream->write(text.data(), text.size());
+        }
+
+      private:
+        std::ostream *stream;
+        std::streampos sizePosition = -1;
+        unsigned long writtenSize = 0;
+        unsigned long nTrees = 0;
+
+    };
+
+  }
+
+  Classifier::Classifier(std::istream& stream, unsigned long maxTrees) {
+
+    if(isBinaryWeightfile(stream))
+      ReadBinary(stream, maxTrees);
+    else
+      ReadText(stream, false, maxTrees);
+    CompileForest();
+
+  }
+
+  Classifier Classifier::Recover(std::istream& stream) {
+
+    Classifier classifier;
+    classifier.ReadText(stream, true);
+    classifier.CompileForest();
+    return classifier;
+
+  }
+
+  void Classifier::ReadText(std::istream& stream, bool allowTruncated, unsigned long maxTrees) {
+
+    TextReader reader(stream);
+    reader.Read(m_version);
+    reader.Read(m_nTrees);
+    reader.Read(m_depth);
+    readText(reader, m_binning);
+    reader.Read(m_shrinkage);
+    reader.Read(m_subsample);
+    reader.Read(m_sPlot);
+    reader.Read(m_flatnessLoss);
+    readText(reader, m_purityTransformation);
+    reader.Read(m_transform2probability);
+    readText(reader, m_featureBinning);
+    readText(reader, m_purityBinning);
+    reader.Read(m_numberOfFeatures);
+    reader.Read(m_numberOfFinalFeatures);
+    reader.Read(m_numberOfFlatnessFeatures);
+    reader.Read(m_can_use_fast_forest);
+    if(allowTruncated and reader.Failed())
+      throw std::runtime_error("Weightfile ends before the forest");
+    m_fast_forest = readForestFromText<float>(reader, allowTruncated, maxTrees);
+    // The binned forest is empty if the fast forest is used, an interrupted training did not write it yet
+    if(allowTruncated and m_can_use_fast_forest)
+      m_binned_forest = Forest<unsigned long>();
+    else
+      m_binned_forest = readForestFromText<unsigned long>(reader, allowTruncated, maxTrees);
+
+  }
+
+  void Classifier::ReadBinary(std::istream& stream, unsigned long maxTrees) {
+
+    const uint32_t nSections = readBinaryHeader(stream);
+    std::vector<bool> found(BinaryFormat::compactForest + 1, false);
+    std::string payload;
+    for(uint32_t iSection = 0; iSection < nSections; ++iSection) {
+      const uint32_t id = readBinarySection(stream, payload);
+      BinaryReader reader(payload.data(), payload.size());
+      // The trees behind maxTrees are left in the payload of a forest section
+      uint64_t nStoredTrees = 0;
+      switch(id) {
+        case BinaryFormat::parameters:
+          reader.Read(m_version);
+          reader.Read(m_nTrees);
+          reader.Read(m_depth);
+          reader.Read(m_binning);
+          reader.Read(m_shrinkage);
+          reader.Read(m_subsample);
+          reader.Read(m_sPlot);
+          reader.Read(m_flatnessLoss);
+          reader.Read(m_purityTransformation);
+          reader.Read(m_transform2probability);
+          reader.Read(m_numberOfFeatures);
+          reader.Read(m_numberOfFinalFeatures);
+          reader.Read(m_numberOfFlatnessFeatures);
+          reader.Read(m_can_use_fast_forest);
+          break;
+        case BinaryFormat::featureBinning:
+          m_featureBinning.clear();
+          for(uint64_t i = 0, n = reader.Read<uint64_t>(); i < n; ++i)
+            m_featureBinning.push_back(readFeatureBinningFromBinary<float>(reader));
+          break;
+        case BinaryFormat::purityBinning:
+          m_purityBinning.clear();
+          for(uint64_t i = 0, n = reader.Read<uint64_t>(); i < n; ++i)
+            m_purityBinning.push_back(readPurityTransformationFromBinary(reader));
+          break;
+        case BinaryFormat::fastForest:
+          m_fast_forest = readForestFromBinary<float>(reader, maxTrees, &nStoredTrees);
+          break;
+        case BinaryFormat::binnedForest:
+          m_binned_forest = readForestFromBinary<unsigned long>(reader, maxTrees, &nStoredTrees);
+          break;
+        case BinaryFormat::compactForest:
+          // The type of the used forest is stored in the parameters
+          if(not found[BinaryFormat::parameters])
+            throw std::runtime_error("Compact forest in front of the parameters of the binary weightfile");
+          if(m_can_use_fast_forest) {
+            m_fast_forest = readCompactForestFromBinary<float>(reader, maxTrees, &nStoredTrees);
+          } else {
+            m_binned_forest = readCompactForestFromBinary<unsigned long>(reader, maxTrees, &nStoredTrees);
+          }
+          break;
+        default:
+          // Sections added by later versions of the format are skipped
+          continue;
+      }
+      if(not reader.AtEnd() and nStoredTrees <= maxTrees)
+        throw std::runtime_error("Section " + std::to_string(id) + " of the binary weightfile has an unexpected size");
+      found[id] = true;
+    }
+
+    // Inference-only weightfiles contain the compact forest instead of both forests
+    m_inference_only = found[BinaryFormat::compactForest];
+    std::vector<uint32_t> required = {BinaryFormat::parameters, BinaryFormat::featureBinning, BinaryFormat::purityBinning};
+    if(m_inference_only)
+      required.push_back(BinaryFormat::compactForest);
+    else
+      required.insert(required.end(), {BinaryFormat::fastForest, BinaryFormat::binnedForest});
+    for(uint32_t id : required) {
+      if(not found[id])
+        throw std::runtime_error("Binary weightfile is missing section " + std::to_string(id));
+    }
+
+  }
+
+  void Classifier::WriteBinaryParameters(std::ostream& stream) const {
+
+    BinaryWriter parameters;
+    parameters.Write(m_version);
+    parameters.Write(m_nTrees);
+    parameters.Write(m_depth);
+    parameters.Write(m_binning);
+    parameters.Write(m_shrinkage);
+    parameters.Write(m_subsample);
+    parameters.Write(m_sPlot);
+    parameters.Write(m_flatnessLoss);
+    parameters.Write(m_purityTransformation);
+    parameters.Write(m_transform2probability);
+    parameters.Write(m_numberOfFeatures);
+    parameters.Write(m_numberOfFinalFeatures);
+    parameters.Write(m_numberOfFlatnessFeatures);
+    parameters.Write(m_can_use_fast_forest);
+    writeBinarySection(stream, BinaryFormat::parameters, parameters);
+
+    BinaryWriter featureBinning;
+    featureBinning.Write(static_cast<uint64_t>(m_featureBinning.size()));
+    for(const auto &binning : m_featureBinning)
+      writeBinary(featureBinning, binning);
+    writeBinarySection(stream, BinaryFormat::featureBinning, featureBinning);
+
+    BinaryWriter purityBinning;
+    purityBinning.Write(static_cast<uint64_t>(m_purityBinning.size()));
+    for(const auto &binning : m_purityBinning)
+      writeBinary(purityBinning, binning);
+    writeBinarySection(stream, BinaryFormat::purityBinning, purityBinning);
+
+  }
+
+  void Classifier::SaveBinary(std::ostream& stream) const {
+
+    RequireCompleteTrees("SaveBinary");
+    writeBinaryHeader(stream, 5);
+    WriteBinaryParameters(stream);
+
+    BinaryWriter fastForest;
+    writeBinary(fastForest, m_fast_forest);
+    writeBinarySection(stream, BinaryFormat::fastForest, fastForest);
+
+    BinaryWriter binnedForest;
+    writeBinary(binnedForest, m_binned_forest);
+    writeBinarySection(stream, BinaryFormat::binnedForest, binnedForest);
+
+  }
+
+  void Classifier::SaveCompact(std::ostream& stream) const {
+
+    writeBinaryHeader(stream, 4);
+    WriteBinaryParameters(stream);
+
+    BinaryWriter compactForest;
+    if(m_can_use_fast_forest)
+      writeCompactBinary(compactForest, m_fast_forest);
+    else
+      writeCompactBinary(compactForest, m_binned_forest);
+    writeBinarySection(stream, BinaryFormat::compactForest, compactForest);
+
+  }
+
+  void Classifier::RequireCompleteTrees(const std::string &operation) const {
+    if(m_inference_only)
+      throw std::runtime_error(operation + " needs the complete trees, but the classifier was loaded from an inference-only weightfile");
+  }
+
+  void Classifier::SaveMapped(std::ostream& stream) const {
+    MappedClassifier::Save(*this, stream);
+  }
+
   void Classifier::fit(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w) {
+    EventSample eventSample = BinEvents(X, y, w);
+    Train(eventSample, nullptr);
+  }
+
+  void Classifier::fit(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w, std::ostream &weightfile) {
+    EventSample eventSample = BinEvents(X, y, w);
+    Train(eventSample, &weightfile);
+  }
+
+  void Classifier::fit(const SampleCache &cache) {
+    ReadPreprocessing(cache);
+    EventSample eventSample = cache.GetEventSample();
+    Train(eventSample, nullptr);
+  }
+
+  void Classifier::fit(const SampleCache &cache, std::ostream &weightfile) {
+    ReadPreprocessing(cache);
+    EventSample eventSample = cache.GetEventSample();
+    Train(eventSample, &weightfile);
+  }
+
+  void Classifier::SaveSampleCache(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w, std::ostream &stream) const {
+    // BinEvents changes the members, which are written to the cache instead
+    Classifier classifier(*this);
+    EventSample eventSample = classifier.BinEvents(X, y, w);
+    writeSampleCache(stream, eventSample, classifier.m_binning, classifier.WritePreprocessing());
+  }
+
+  std::string Classifier::WritePreprocessing() const {
+
+    BinaryWriter writer;
+    writer.Write(m_binning);
+    writer.Write(m_purityTransformation);
+    writer.Write(m_numberOfFeatures);
+    writer.Write(m_numberOfFinalFeatures);
+    writer.Write(m_numberOfFlatnessFeatures);
+    writer.Write(m_can_use_fast_forest);
+    writer.Write(static_cast<uint64_t>(m_featureBinning.size()));
+    for(const auto &binning : m_featureBinning)
+      writeBinary(writer, binning);
+    writer.Write(static_cast<uint64_t>(m_purityBinning.size()));
+    for(const auto &binning : m_purityBinning)
+      writeBinary(writer, binning);
+    return writer.GetBuffer();
+
+  }
+
+  void Classifier::ReadPreprocessing(const SampleCache &cache) {
+
+    const std::string preprocessing = cache.GetPreprocessing();
+    BinaryReader reader(preprocessing.data(), preprocessing.size());
+    reader.Read(m_binning);
+    reader.Read(m_purityTransformation);
+    reader.Read(m_numberOfFeatures);
+    reader.Read(m_numberOfFinalFeatures);
+    reader.Read(m_numberOfFlatnessFeatures);
+    reader.Read(m_can_use_fast_forest);
+    m_featureBinning.clear();
+    for(uint64_t i = 0, n = reader.Read<uint64_t>(); i < n; ++i)
+      m_featureBinning.push_back(readFeatureBinningFromBinary<float>(reader));
+    m_purityBinning.clear();
+    for(uint64_t i = 0, n = reader.Read<uint64_t>(); i < n; ++i)
+      m_purityBinning.push_back(readPurityTransformationFromBinary(reader));
+    if(not reader.AtEnd())
+      throw std::runtime_error("Sample cache contains unexpected data after the feature binnings");
+
+    if(m_binning != cache.GetLevels() or m_numberOfFinalFeatures != cache.GetNFeatures() or m_numberOfFlatnessFeatures != cache.GetNSpectators())
+      throw std::runtime_error("Binning of the sample cache does not match its events");
+    const unsigned long nPurityFeatures = std::count(m_purityTransformation.begin(), m_purityTransformation.end(), true);
+    if(m_featureBinning.size() != m_numberOfFeatures or m_purityTransformation.size() != m_numberOfFeatures or
+       m_purityBinning.size() != nPurityFeatures or m_numberOfFinalFeatures != m_numberOfFeatures + nPurityFeatures)
+      throw std::runtime_error("Number of feature binnings of the sample cache does not match the number of features");
+
+  }
+
+  EventSample Classifier::BinEvents(const std::vector<std::vector<float>> &X, const std::vector<bool> &y, const std::vector<Weight> &w) {
 
     if(static_cast<long>(X.size()) - static_cast<long>(m_numberOfFlatnessFeatures) <= 0) {
       throw std::runtime_error("FastBDT requires at least one feature");
@@ -95,22 +457,65 @@ namespace FastBDT {
     }
    
     m_featureBinning.resize(m_numberOfFeatures);
+    return eventSample;
 
-    ForestBuilder df(eventSample, m_nTrees, m_shrinkage, m_subsample, m_depth, m_sPlot, m_flatnessLoss);
-    if(m_can_use_fast_forest) {
-        Forest<float> temp_forest( df.GetShrinkage(), df.GetF0(), m_transform2probability);
-        for( auto t : df.GetForest() ) {
-           temp_forest.AddTree(removeFeatureBinningTransformationFromTree(t, m_featureBinning));
-        }
-        m_fast_forest = temp_forest;
-    } else {
-        Forest<unsigned long> temp_forest(df.GetShrinkage(), df.GetF0(), m_transform2probability);
-        for( auto t : df.GetForest() ) {
-           temp_forest.AddTree(t);
-        }
-        m_binned_forest = temp_forest;
+  }
+
+  void Classifier::Train(EventSample &eventSample, std::ostream *weightfile) {
+
+    m_inference_only = false;
+
+    // Everything in front of the used forest is known before the first tree is built
+    if(weightfile != nullptr) {
+      TextWriter writer(*weightfile);
+      WriteTextParameters(writer);
+      if(not m_can_use_fast_forest) {
+        writeText(writer, m_fast_forest);
+        writer.EndLine();
+      }
     }
 
+    // The trees are added to the forest of the classifier (and written to the weightfile) while they are built,
+    // so the ForestBuilder does not keep a second copy of the forest
+    ForestStreamer streamer(weightfile);
+    bool started = false;
+    auto start = [&](const ForestBuilder &builder) {
+      if(m_can_use_fast_forest) {
+        m_fast_forest = Forest<float>(builder.GetShrinkage(), builder.GetF0(), m_transform2probability);
+        streamer.Start(m_fast_forest, m_nTrees);
+      } else {
+        m_binned_forest = Forest<unsigned long>(builder.GetShrinkage(), builder.GetF0(), m_transform2probability);
+        streamer.Start(m_binned_forest, m_nTrees);
+      }
+      started = true;
+    };
+    auto addTree = [&](const ForestBuilder &builder, const Tree<unsigned long> &tree) {
+      if(not started)
+        start(builder);
+      if(m_can_use_fast_forest) {
+        m_fast_forest.AddTree(removeFeatureBinningTransformationFromTree(tree, m_featureBinning));
+        streamer.Append(m_fast_forest.GetForest().back());
+      } else {
+        m_binned_forest.AddTree(tree);
+        streamer.Append(tree);
+      }
+    };
+
+    ForestBuilder df(eventSample, m_nTrees, m_shrinkage, m_subsample, m_depth, m_sPlot, m_flatnessLoss, addTree);
+    if(not started)
+      start(df);
+    streamer.Finish();
+
+    if(weightfile != nullptr and m_can_use_fast_forest) {
+      TextWriter writer(*weightfile);
+      writeText(writer, m_binned_forest);
+      writer.EndLine();
+    }
+    if(weightfile != nullptr)
+      weightfile->flush();
+
+    CompileForest();
+
   }
 
   void Classifier::Print() {
@@ -121,52 +526,252 @@ namespace FastBDT {
 
   }
       
-  float Classifier::predict(const std::vector<float> &X) const {
+  void Classifier::FillBins(const float *X, std::vector<unsigned long> &bins) const {
+
+      unsigned long bin = 0;
+      unsigned long pFeature = 0;
+      for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature) {
+        bins[bin] = m_featureBinning[iFeature].ValueToBin(X[iFeature]);
+        bin++;
+        if(m_purityTransformation[iFeature]) {
+            bins[bin] = m_purityBinning[pFeature].BinToPurityBin(bins[bin-1]);
+            pFeature++;
+            bin++;
+        }
+      }
+
+  }
+      
+  void Classifier::CompileForest() {
 
       if(m_can_use_fast_forest) {
-        return m_fast_forest.Analyse(X);
+        m_compiled_forest = CompiledForest(m_fast_forest);
       } else {
-        std::vector<unsigned long> bins(m_numberOfFinalFeatures);
-        unsigned long bin = 0;
-        unsigned long pFeature = 0;
+        m_compiled_forest = CompiledForest(removePurityTransformationFromForest(m_binned_forest, m_featureBinning, m_purityTransformation));
+      }
+
+      // The rows of m_compiled_forest contain the original features followed by the purity transformed features
+      m_rankingColumns.clear();
+      for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature)
+        m_rankingColumns.push_back(iFeature);
+      if(not m_can_use_fast_forest) {
         for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature) {
-          bins[bin] = m_featureBinning[iFeature].ValueToBin(X[iFeature]);
-          bin++;
-          if(m_purityTransformation[iFeature]) {
-              bins[bin] = m_purityBinning[pFeature].BinToPurityBin(bins[bin-1]);
-              pFeature++;
-              bin++;
+          if(m_purityTransformation[iFeature])
+            m_rankingColumns.push_back(iFeature);
+        }
+      }
+
+  }
+
+  void Classifier::FillPurityRow(const float *X, float *row) const {
+
+      unsigned long pFeature = 0;
+      for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature) {
+        row[iFeature] = X[iFeature];
+        if(m_purityTransformation[iFeature]) {
+          const unsigned long purityBin = m_purityBinning[pFeature].BinToPurityBin(m_featureBinning[iFeature].ValueToBin(X[iFeature]));
+          row[m_numberOfFeatures + pFeature] = (purityBin == 0) ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(purityBin);
+          pFeature++;
+        }
+      }
+
+  }
+
+  float Classifier::predict(const std::vector<float> &X) const {
+
+      if(m_can_use_fast_forest) {
+        return m_compiled_forest.Analyse(X.data());
+      } else {
+        // Reused by all calls on this thread, so no memory is allocated per event
+        thread_local std::vector<float> row;
+        row.resize(GetPurityRowSize());
+        FillPurityRow(X.data(), row.data());
+        return m_compiled_forest.Analyse(row.data());
+      }
+  }
+
+  void Classifier::predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out) const {
+      predict_batch(X, nRows, stride, out, m_nThreads);
+  }
+
+  void Classifier::predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out, unsigned long nThreads) const {
+
+      // Each thread gets at least a few blocks, otherwise the thread start-up dominates
+      ParallelFor(nRows, nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        predict_batch_serial(X + first*stride, last - first, stride, out + first);
+      });
+  }
+
+  void Classifier::predict_batch_serial(const float *X, unsigned long nRows, unsigned long stride, float *out) const {
+
+      if(m_can_use_fast_forest) {
+        m_compiled_forest.Analyse(X, nRows, stride, out);
+      } else {
+        // The rows of one block are filled into one buffer, which is used for all blocks
+        const unsigned long rowSize = GetPurityRowSize();
+        std::vector<float> rows(CompiledForest::blockSize * rowSize);
+        for(unsigned long iFirst = 0; iFirst < nRows; iFirst += CompiledForest::blockSize) {
+          const unsigned long nBlock = std::min(CompiledForest::blockSize, nRows - iFirst);
+          for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+            FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+          m_compiled_forest.Analyse(rows.data(), nBlock, rowSize, out + iFirst);
+        }
+      }
+  }
+  
+  void Classifier::predict_batch_strided(const float *X, unsigned long nRows, unsigned long rowStride, unsigned long columnStride, float *out) const {
+      predict_batch_strided(X, nRows, rowStride, columnStride, out, m_nThreads);
+  }
+
+  void Classifier::predict_batch_strided(const float *X, unsigned long nRows, unsigned long rowStride, unsigned long columnStride, float *out, unsigned long nThreads) const {
+
+      if(columnStride == 1) {
+        predict_batch(X, nRows, rowStride, out, nThreads);
+        return;
+      }
+
+      ParallelFor(nRows, nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        // The features of a block are gathered feature by feature, so a column-major matrix is read contiguously
+        const unsigned long rowSize = m_can_use_fast_forest ? m_numberOfFeatures : GetPurityRowSize();
+        std::vector<float> block(CompiledForest::blockSize * m_numberOfFeatures);
+        std::vector<float> rows(m_can_use_fast_forest ? 0 : CompiledForest::blockSize * rowSize);
+        for(unsigned long iFirst = first; iFirst < last; iFirst += CompiledForest::blockSize) {
+          const unsigned long nBlock = std::min(CompiledForest::blockSize, last - iFirst);
+          for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature) {
+            const float *column = X + iFeature*columnStride + iFirst*rowStride;
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              block[iRow*m_numberOfFeatures + iFeature] = column[iRow*rowStride];
+          }
+          if(m_can_use_fast_forest) {
+            m_compiled_forest.Analyse(block.data(), nBlock, m_numberOfFeatures, out + iFirst);
+          } else {
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              FillPurityRow(&block[iRow*m_numberOfFeatures], &rows[iRow*rowSize]);
+            m_compiled_forest.Analyse(rows.data(), nBlock, rowSize, out + iFirst);
           }
         }
-        return m_binned_forest.Analyse(bins);
+      });
+  }
+
+  bool Classifier::predict_above(const std::vector<float> &X, float threshold) const {
+
+      if(m_can_use_fast_forest) {
+        return m_compiled_forest.PredictAbove(X.data(), threshold);
+      } else {
+        thread_local std::vector<float> row;
+        row.resize(GetPurityRowSize());
+        FillPurityRow(X.data(), row.data());
+        return m_compiled_forest.PredictAbove(row.data(), threshold);
       }
   }
+
+  void Classifier::predict_above(const float *X, unsigned long nRows, unsigned long stride, float threshold, bool *out) const {
+
+      ParallelFor(nRows, m_nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        if(m_can_use_fast_forest) {
+          m_compiled_forest.PredictAbove(X + first*stride, last - first, stride, threshold, out + first);
+        } else {
+          const unsigned long rowSize = GetPurityRowSize();
+          std::vector<float> rows(CompiledForest::blockSize * rowSize);
+          for(unsigned long iFirst = first; iFirst < last; iFirst += CompiledForest::blockSize) {
+            const unsigned long nBlock = std::min(CompiledForest::blockSize, last - iFirst);
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+            m_compiled_forest.PredictAbove(rows.data(), nBlock, rowSize, threshold, out + iFirst);
+          }
+        }
+      });
+  }
   
+  std::vector<float> Classifier::predict_staged(const std::vector<float> &X, const std::vector<unsigned long> &checkpoints) const {
+
+      std::vector<float> out(checkpoints.size());
+      predict_staged(X.data(), 1, X.size(), checkpoints, out.data());
+      return out;
+  }
+
+  void Classifier::predict_staged(const float *X, unsigned long nRows, unsigned long stride, const std::vector<unsigned long> &checkpoints, float *out) const {
+
+      const unsigned long nStages = checkpoints.size();
+      ParallelFor(nRows, m_nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        if(m_can_use_fast_forest) {
+          m_compiled_forest.AnalyseStaged(X + first*stride, last - first, stride, checkpoints, out + first*nStages);
+        } else {
+          const unsigned long rowSize = GetPurityRowSize();
+          std::vector<float> rows(CompiledForest::blockSize * rowSize);
+          for(unsigned long iFirst = first; iFirst < last; iFirst += CompiledForest::blockSize) {
+            const unsigned long nBlock = std::min(CompiledForest::blockSize, last - iFirst);
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+            m_compiled_forest.AnalyseStaged(rows.data(), nBlock, rowSize, checkpoints, out + iFirst*nStages);
+          }
+        }
+      });
+  }
+
+  template<typename NodeId>
+  void Classifier::FillLeafIndices(const float *X, unsigned long nRows, unsigned long stride, NodeId *out) const {
+
+      const unsigned long nTrees = m_compiled_forest.GetNTrees();
+      ParallelFor(nRows, m_nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        if(m_can_use_fast_forest) {
+          m_compiled_forest.GetLeafIndices(X + first*stride, last - first, stride, out + first*nTrees);
+        } else {
+          const unsigned long rowSize = GetPurityRowSize();
+          std::vector<float> rows(CompiledForest::blockSize * rowSize);
+          for(unsigned long iFirst = first; iFirst < last; iFirst += CompiledForest::blockSize) {
+            const unsigned long nBlock = std::min(CompiledForest::blockSize, last - iFirst);
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+            m_compiled_forest.GetLeafIndices(rows.data(), nBlock, rowSize, out + iFirst*nTrees);
+          }
+        }
+      });
+  }
+
+  void Classifier::GetLeafIndices(const float *X, unsigned long nRows, unsigned long stride, uint16_t *out) const {
+      FillLeafIndices(X, nRows, stride, out);
+  }
+
+  void Classifier::GetLeafIndices(const float *X, unsigned long nRows, unsigned long stride, uint8_t *out) const {
+      FillLeafIndices(X, nRows, stride, out);
+  }
+
   std::map<unsigned long, double> Classifier::GetIndividualVariableRanking(const std::vector<float> &X) const {
     
+      RequireCompleteTrees("GetIndividualVariableRanking");
       std::map<unsigned long, double> ranking;
 
       if(m_can_use_fast_forest) {
         ranking = m_fast_forest.GetIndividualVariableRanking(X);
       } else {
         std::vector<unsigned long> bins(m_numberOfFinalFeatures);
-        unsigned long bin = 0;
-        unsigned long pFeature = 0;
-        for(unsigned long iFeature = 0; iFeature < m_numberOfFeatures; ++iFeature) {
-          bins[bin] = m_featureBinning[iFeature].ValueToBin(X[iFeature]);
-          bin++;
-          if(m_purityTransformation[iFeature]) {
-              bins[bin] = m_purityBinning[pFeature].BinToPurityBin(bins[bin-1]);
-              pFeature++;
-              bin++;
-          }
-        }
+        FillBins(X.data(), bins);
         ranking = m_binned_forest.GetIndividualVariableRanking(bins);
       }
 
       return MapRankingToOriginalFeatures(ranking);
   }
 
+  void Classifier::GetIndividualVariableRanking(const float *X, unsigned long nRows, unsigned long stride, double *out) const {
+
+      RequireCompleteTrees("GetIndividualVariableRanking");
+      ParallelFor(nRows, m_nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+        if(m_can_use_fast_forest) {
+          m_compiled_forest.GetIndividualVariableRanking(X + first*stride, last - first, stride, m_rankingColumns, m_numberOfFeatures, out + first*m_numberOfFeatures);
+        } else {
+          const unsigned long rowSize = GetPurityRowSize();
+          std::vector<float> rows(CompiledForest::blockSize * rowSize);
+          for(unsigned long iFirst = first; iFirst < last; iFirst += CompiledForest::blockSize) {
+            const unsigned long nBlock = std::min(CompiledForest::blockSize, last - iFirst);
+            for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+              FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+            m_compiled_forest.GetIndividualVariableRanking(rows.data(), nBlock, rowSize, m_rankingColumns, m_numberOfFeatures, out + iFirst*m_numberOfFeatures);
+          }
+        }
+      });
+  }
+
   std::map<unsigned long, unsigned long> Classifier::GetFeatureMapping() const {
     
     std::map<unsigned long, unsigned long> transformed2original;
@@ -197,6 +802,7 @@ namespace FastBDT {
 
 
   std::map<unsigned long, double> Classifier::GetVariableRanking() const {
+    RequireCompleteTrees("GetVariableRanking");
     std::map<unsigned long, double> ranking;
     if (m_can_use_fast_forest)
       ranking = m_fast_forest.GetVariableRanking();
@@ -208,26 +814,52 @@ namespace FastBDT {
 
 std::ostream& operator<<(std::ostream& stream, const Classifier& classifier) {
 
-    stream << classifier.m_version << std::endl;
-    stream << classifier.m_nTrees << std::endl;
-    stream << classifier.m_depth << std::endl;
-    stream << classifier.m_binning << std::endl;
-    stream << classifier.m_shrinkage << std::endl;
-    stream << classifier.m_subsample << std::endl;
-    stream << classifier.m_sPlot << std::endl;
-    stream << classifier.m_flatnessLoss << std::endl;
-    stream << classifier.m_purityTransformation << std::endl;
-    stream << classifier.m_transform2probability << std::endl;
-    stream << classifier.m_featureBinning << std::endl;
-    stream << classifier.m_purityBinning << std::endl;
-    stream << classifier.m_numberOfFeatures << std::endl;
-    stream << classifier.m_numberOfFinalFeatures << std::endl;
-    stream << classifier.m_numberOfFlatnessFeatures << std::endl;
-    stream << classifier.m_can_use_fast_forest << std::endl;
-    stream << classifier.m_fast_forest << std::endl;
-    stream << classifier.m_binned_forest << std::endl;
+    classifier.RequireCompleteTrees("The text weightfile");
+    TextWriter writer(stream);
+    classifier.WriteTextParameters(writer);
+    writeText(writer, classifier.m_fast_forest);
+    writer.EndLine();
+    writeText(writer, classifier.m_binned_forest);
+    writer.EndLine();
 
     return stream;
 }
 
+void Classifier::WriteTextParameters(TextWriter &writer) const {
+
+    writer.Write(m_version);
+    writer.EndLine();
+    writer.Write(m_nTrees);
+    writer.EndLine();
+    writer.Write(m_depth);
+    writer.EndLine();
+    writeText(writer, m_binning);
+    writer.EndLine();
+    writer.Write(m_shrinkage);
+    writer.EndLine();
+    writer.Write(m_subsample);
+    writer.EndLine();
+    writer.Write(m_sPlot);
+    writer.EndLine();
+    writer.Write(m_flatnessLoss);
+    writer.EndLine();
+    writeText(writer, m_purityTransformation);
+    writer.EndLine();
+    writer.Write(m_transform2probability);
+    writer.EndLine();
+    writeText(writer, m_featureBinning);
+    writer.EndLine();
+    writeText(writer, m_purityBinning);
+    writer.EndLine();
+    writer.Write(m_numberOfFeatures);
+    writer.EndLine();
+    writer.Write(m_numberOfFinalFeatures);
+    writer.EndLine();
+    writer.Write(m_numberOfFlatnessFeatures);
+    writer.EndLine();
+    writer.Write(m_can_use_fast_forest);
+    writer.EndLine();
+
+}
+
 }
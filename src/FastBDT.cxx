@@ -357,7 +357,7 @@ namespace FastBDT {
     std::cout << "Finished Printing Tree" << std::endl;
   }
 
-  ForestBuilder::ForestBuilder(EventSample &sample, unsigned long nTrees, double shrinkage, double randRatio, unsigned long nLayersPerTree, bool sPlot, double flatnessLoss) : shrinkage(shrinkage), flatnessLoss(flatnessLoss) {
+  ForestBuilder::ForestBuilder(EventSample &sample, unsigned long nTrees, double shrinkage, double randRatio, unsigned long nLayersPerTree, bool sPlot, double flatnessLoss, const TreeCallback &treeCallback) : shrinkage(shrinkage), flatnessLoss(flatnessLoss) {
 
     auto &weights = sample.GetWeights();
     sums = weights.GetSums(sample.GetNSignals()); 
@@ -381,7 +381,8 @@ namespace FastBDT {
     FCache.resize(sample.GetNEvents(), 0.0);
      
     // Reserve enough space for the boost_weights and trees, to avoid reallocations
-    forest.reserve(nTrees);
+    if(not treeCallback)
+      forest.reserve(nTrees);
      
     // Reserve enough space for binned uniform spectators
     if(flatnessLoss > 0) {
@@ -439,7 +440,12 @@ namespace FastBDT {
       // Create and train a new train on the sample
       TreeBuilder builder(nLayersPerTree, sample);
       if(builder.IsValid()) {
+        // The trees are owned by the callback, only the last one is needed to update the event weights
+        if(treeCallback)
+          forest.clear();
         forest.push_back( Tree<unsigned long>( builder.GetCuts(), builder.GetNEntries(), builder.GetPurities(), builder.GetBoostWeights() ) );
+        if(treeCallback)
+          treeCallback(*this, forest.back());
       } else {
         std::cerr << "Terminated boosting at tree " << iTree << " out of " << nTrees << std::endl;
         std::cerr << "Because the last tree was not valid, meaning it couldn't find an optimal cut." << std::endl;
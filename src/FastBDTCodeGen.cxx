@@ -0,0 +1,42 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Command line tool which converts a weightfile to a self-contained C++ header
+ */
+
+#include "Classifier.h"
+#include "FastBDT_CodeGen.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+
+int main(int argc, char *argv[]) {
+
+  if(argc < 3 or argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " weightfile header [namespace]" << std::endl;
+    return 1;
+  }
+
+  const std::string name_space = (argc == 4) ? argv[3] : "fastbdt_model";
+
+  try {
+    std::fstream file_in(argv[1], std::ios_base::in);
+    if(not file_in) {
+      throw std::runtime_error(std::string("Could not open weightfile ") + argv[1]);
+    }
+    FastBDT::Classifier classifier(file_in);
+
+    std::fstream file_out(argv[2], std::ios_base::out | std::ios_base::trunc);
+    if(not file_out) {
+      throw std::runtime_error(std::string("Could not open output file ") + argv[2]);
+    }
+    FastBDT::writeClassifierToHeader(file_out, classifier, name_space);
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
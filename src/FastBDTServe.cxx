@@ -0,0 +1,76 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Command line tool which serves the predictions of one or more weightfiles over a Unix domain socket
+ */
+
+#include "FastBDT_Serve.h"
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+#include <signal.h>
+
+int main(int argc, char *argv[]) {
+
+  FastBDT::PredictionServerOptions options;
+  std::vector<std::string> arguments;
+  try {
+    for(int i = 1; i < argc; ++i) {
+      const std::string argument = argv[i];
+      if(argument == "--max-batch" and i + 1 < argc)
+        options.maxBatchEvents = std::stoul(argv[++i]);
+      else if(argument == "--max-delay-us" and i + 1 < argc)
+        options.maxDelayMicroseconds = std::stoul(argv[++i]);
+      else if(argument == "--threads" and i + 1 < argc)
+        options.nThreads = std::stoul(argv[++i]);
+      else
+        arguments.push_back(argument);
+    }
+  } catch(const std::exception &e) {
+    arguments.clear();
+  }
+
+  if(arguments.size() < 2) {
+    std::cerr << "Usage: " << argv[0] << " socket weightfile [weightfile ...] [--max-batch N] [--max-delay-us N] [--threads N]" << std::endl;
+    std::cerr << "The index of a weightfile in the list is the model index of the requests." << std::endl;
+    std::cerr << "SIGHUP reloads all weightfiles, SIGINT and SIGTERM stop the server." << std::endl;
+    return 1;
+  }
+
+  const std::string socketPath = arguments[0];
+  const std::vector<std::string> weightfiles(arguments.begin() + 1, arguments.end());
+
+  // The signals are blocked in all threads and received synchronously by the main thread
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  try {
+    FastBDT::PredictionServer server(socketPath, weightfiles, options);
+    std::cerr << "Serving " << weightfiles.size() << " model(s) on " << socketPath << std::endl;
+
+    int signal = 0;
+    while(sigwait(&signals, &signal) == 0 and signal == SIGHUP) {
+      for(unsigned long iModel = 0; iModel < weightfiles.size(); ++iModel) {
+        try {
+          server.Reload(iModel, weightfiles[iModel]);
+        } catch(const std::exception &e) {
+          std::cerr << e.what() << std::endl;
+        }
+      }
+      std::cerr << "Reloaded " << weightfiles.size() << " model(s)" << std::endl;
+    }
+    server.Stop();
+  } catch(const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
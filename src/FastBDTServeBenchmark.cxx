@@ -0,0 +1,103 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Load generator for fastbdt-serve, measures the throughput and the latency of concurrent clients
+ */
+
+#include "FastBDT_Serve.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+
+  unsigned long nClients = 8;
+  unsigned long nRequests = 1000;
+  unsigned long nEvents = 1;
+  unsigned long model = 0;
+  std::vector<std::string> arguments;
+  try {
+    for(int i = 1; i < argc; ++i) {
+      const std::string argument = argv[i];
+      if(argument == "--clients" and i + 1 < argc)
+        nClients = std::stoul(argv[++i]);
+      else if(argument == "--requests" and i + 1 < argc)
+        nRequests = std::stoul(argv[++i]);
+      else if(argument == "--events" and i + 1 < argc)
+        nEvents = std::stoul(argv[++i]);
+      else if(argument == "--model" and i + 1 < argc)
+        model = std::stoul(argv[++i]);
+      else
+        arguments.push_back(argument);
+    }
+  } catch(const std::exception &e) {
+    arguments.clear();
+  }
+
+  if(arguments.size() != 2) {
+    std::cerr << "Usage: " << argv[0] << " socket nFeatures [--clients N] [--requests N per client] [--events N per request] [--model N]" << std::endl;
+    return 1;
+  }
+
+  const std::string socketPath = arguments[0];
+  const unsigned long nFeatures = std::stoul(arguments[1]);
+
+  // Each client sends its requests one after another, the latency of every request is recorded
+  std::vector<std::vector<double>> latencies(nClients);
+  std::vector<std::string> errors(nClients);
+  std::vector<std::thread> clients;
+  const auto start = std::chrono::steady_clock::now();
+  for(unsigned long iClient = 0; iClient < nClients; ++iClient) {
+    clients.emplace_back([&, iClient]() {
+      try {
+        std::default_random_engine generator(iClient);
+        std::normal_distribution<float> normal(0.0, 1.0);
+        std::vector<float> X(nEvents * nFeatures);
+        std::vector<float> out(nEvents);
+        FastBDT::PredictionClient client(socketPath);
+        latencies[iClient].reserve(nRequests);
+        for(unsigned long iRequest = 0; iRequest < nRequests; ++iRequest) {
+          for(auto &value : X)
+            value = normal(generator);
+          const auto request_start = std::chrono::steady_clock::now();
+          client.predict(model, X.data(), nEvents, nFeatures, out.data());
+          latencies[iClient].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - request_start).count());
+        }
+      } catch(const std::exception &e) {
+        errors[iClient] = e.what();
+      }
+    });
+  }
+  for(auto &client : clients)
+    client.join();
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for(auto &error : errors) {
+    if(not error.empty()) {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+  }
+
+  std::vector<double> all;
+  for(auto &client_latencies : latencies)
+    all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+  std::sort(all.begin(), all.end());
+  if(all.empty()) {
+    std::cerr << "No requests were sent" << std::endl;
+    return 1;
+  }
+
+  auto percentile = [&all](double p) { return all[std::min(static_cast<unsigned long>(p * all.size()), all.size() - 1)]; };
+  std::cout << "Requests:   " << all.size() << " (" << nClients << " clients, " << nEvents << " events per request)" << std::endl;
+  std::cout << "Throughput: " << all.size() / seconds << " requests/s, " << all.size() * nEvents / seconds << " events/s" << std::endl;
+  std::cout << "Latency:    p50 " << percentile(0.50) << " us, p99 " << percentile(0.99) << " us, max " << all.back() << " us" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Versioned binary weightfile format
+ */
+
+#include "FastBDT_Binary.h"
+
+#include <algorithm>
+
+namespace FastBDT {
+
+  namespace {
+
+    struct CRC32Table {
+      CRC32Table() {
+        for(uint32_t i = 0; i < 256; ++i) {
+          uint32_t value = i;
+          for(unsigned int bit = 0; bit < 8; ++bit)
+            value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+          entries[i] = value;
+        }
+      }
+      uint32_t entries[256];
+    };
+
+    /**
+     * Reads exactly size bytes, throws a runtime_error if the stream ends before
+     */
+    void readExactly(std::istream &stream, char *data, unsigned long size) {
+      if(not stream.read(data, size))
+        throw std::runtime_error("Binary weightfile is truncated");
+    }
+
+  }
+
+  uint32_t crc32(const char *data, unsigned long size) {
+    static const CRC32Table table;
+    uint32_t crc = 0xFFFFFFFFu;
+    for(unsigned long i = 0; i < size; ++i)
+      crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+  }
+
+  bool isBinaryWeightfile(std::istream &stream) {
+    return stream.peek() == static_cast<unsigned char>(BinaryFormat::magic[0]);
+  }
+
+  void writeBinaryHeader(std::ostream &stream, uint32_t nSections) {
+    BinaryWriter header;
+    for(auto byte : BinaryFormat::magic)
+      header.Write(static_cast<uint8_t>(byte));
+    header.Write(BinaryFormat::version);
+    header.Write(nSections);
+    stream.write(header.GetBuffer().data(), header.GetBuffer().size());
+  }
+
+  void writeBinarySection(std::ostream &stream, BinaryFormat::Section id, const BinaryWriter &payload) {
+    const std::string &buffer = payload.GetBuffer();
+    BinaryWriter header;
+    header.Write(static_cast<uint32_t>(id));
+    header.Write(static_cast<uint64_t>(buffer.size()));
+    BinaryWriter checksum;
+    checksum.Write(crc32(buffer.data(), buffer.size()));
+    stream.write(header.GetBuffer().data(), header.GetBuffer().size());
+    stream.write(buffer.data(), buffer.size());
+    stream.write(checksum.GetBuffer().data(), checksum.GetBuffer().size());
+  }
+
+  uint32_t readBinaryHeader(std::istream &stream) {
+    char buffer[16];
+    readExactly(stream, buffer, sizeof(buffer));
+    if(std::memcmp(buffer, BinaryFormat::magic, sizeof(BinaryFormat::magic)) != 0)
+      throw std::runtime_error("Not a binary weightfile");
+
+    BinaryReader reader(buffer + sizeof(BinaryFormat::magic), sizeof(buffer) - sizeof(BinaryFormat::magic));
+    const uint32_t version = reader.Read<uint32_t>();
+    if(version == 0 or version > BinaryFormat::version)
+      throw std::runtime_error("Binary weightfile has version " + std::to_string(version) + ", but this version of FastBDT supports only versions up to " + std::to_string(BinaryFormat::version));
+    return reader.Read<uint32_t>();
+  }
+
+  uint32_t readBinarySection(std::istream &stream, std::string &payload) {
+    char buffer[12];
+    readExactly(stream, buffer, sizeof(buffer));
+    BinaryReader reader(buffer, sizeof(buffer));
+    const uint32_t id = reader.Read<uint32_t>();
+    const uint64_t size = reader.Read<uint64_t>();
+
+    // The payload is read in chunks, so a corrupt size cannot trigger a huge allocation
+    payload.clear();
+    const uint64_t chunkSize = 1ul << 20;
+    for(uint64_t position = 0; position < size; position += chunkSize) {
+      const uint64_t n = std::min(chunkSize, size - position);
+      payload.resize(position + n);
+      readExactly(stream, &payload[position], n);
+    }
+
+    char checksum[4];
+    readExactly(stream, checksum, sizeof(checksum));
+    if(BinaryReader(checksum, sizeof(checksum)).Read<uint32_t>() != crc32(payload.data(), payload.size()))
+      throw std::runtime_error("Checksum of section " + std::to_string(id) + " of the binary weightfile is wrong");
+    return id;
+  }
+
+}
@@ -7,9 +7,43 @@
 #include <fstream>
 #include <new>
 #include <iostream>
+#include <limits>
+#include <algorithm>
 
 using namespace FastBDT;
 
+namespace {
+
+  /**
+   * Fits the classifier of the expertise on a row-major feature matrix, see Classifier::fit
+   */
+  void FitExpertise(Expertise *expertise, float *data_ptr, float *weight_ptr, bool *target_ptr, unsigned long nEvents, unsigned long nFeatures, std::ostream *weightfile) {
+
+    std::vector<float> w;
+    if(weight_ptr != nullptr)
+      w = std::vector<float>(weight_ptr, weight_ptr + nEvents);
+    else
+      w = std::vector<float>(nEvents, 1.0);
+
+    std::vector<bool> y(target_ptr, target_ptr + nEvents);
+    std::vector<std::vector<float>> X(nFeatures);
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+      std::vector<float> temp(nEvents);
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+        temp[iEvent] = data_ptr[iEvent*nFeatures + iFeature];
+      }
+      X[iFeature] = temp;
+    }
+
+    if(weightfile != nullptr)
+      expertise->classifier.fit(X, y, w, *weightfile);
+    else
+      expertise->classifier.fit(X, y, w);
+
+  }
+
+}
+
 extern "C" {
 
     void PrintVersion() {
@@ -36,6 +70,10 @@ extern "C" {
     unsigned long GetNTrees(void *ptr) {
       return reinterpret_cast<Expertise*>(ptr)->classifier.GetNTrees();
     }
+
+    unsigned long GetNLoadedTrees(void *ptr) {
+      return reinterpret_cast<Expertise*>(ptr)->classifier.GetNLoadedTrees();
+    }
     
     void SetDepth(void *ptr, unsigned long depth) {
       reinterpret_cast<Expertise*>(ptr)->classifier.SetDepth(depth);
@@ -92,42 +130,72 @@ extern "C" {
     bool GetSPlot(void *ptr) {
       return reinterpret_cast<Expertise*>(ptr)->classifier.GetSPlot();
     }
+    
+    void SetNThreads(void *ptr, unsigned long nThreads) {
+      reinterpret_cast<Expertise*>(ptr)->classifier.SetNThreads(nThreads);
+    }
+
+    unsigned long GetNThreads(void *ptr) {
+      return reinterpret_cast<Expertise*>(ptr)->classifier.GetNThreads();
+    }
 
     void Delete(void *ptr) {
       delete reinterpret_cast<Expertise*>(ptr);
     }
     
     void Fit(void *ptr, float *data_ptr, float *weight_ptr, bool *target_ptr, unsigned long nEvents, unsigned long nFeatures) {
-      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      FitExpertise(reinterpret_cast<Expertise*>(ptr), data_ptr, weight_ptr, target_ptr, nEvents, nFeatures, nullptr);
+    }
 
-      std::vector<float> w;
-      if(weight_ptr != nullptr)
-        w = std::vector<float>(weight_ptr, weight_ptr + nEvents);
-      else
-        w = std::vector<float>(nEvents, 1.0);
+    bool FitStreaming(void *ptr, float *data_ptr, float *weight_ptr, bool *target_ptr, unsigned long nEvents, unsigned long nFeatures, char *weightfile) {
+      // The weightfile is checked before the training, so no trees are built which cannot be saved
+      std::fstream file(weightfile, std::ios_base::out | std::ios_base::trunc);
+      if(not file)
+        return false;
+      FitExpertise(reinterpret_cast<Expertise*>(ptr), data_ptr, weight_ptr, target_ptr, nEvents, nFeatures, &file);
+      return static_cast<bool>(file);
+    }
 
-      std::vector<bool> y(target_ptr, target_ptr + nEvents);
-      std::vector<std::vector<float>> X(nFeatures);
-      for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
-        std::vector<float> temp(nEvents);
-        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
-          temp[iEvent] = data_ptr[iEvent*nFeatures + iFeature];
-        }
-        X[iFeature] = temp;
-      }
+    bool Load(void* ptr, char *weightfile) {
+      return LoadPartial(ptr, weightfile, FastBDT::allTrees);
+    }
 
-      expertise->classifier.fit(X, y, w);
+    bool LoadPartial(void* ptr, char *weightfile, unsigned long maxTrees) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      
+      // Text and binary weightfiles are detected automatically
+      std::fstream file(weightfile, std::ios_base::in | std::ios_base::binary);
+      if(not file)
+    	  return false;
 
+      // Errors cannot be passed through the C interface, in this case false is returned
+      try {
+        // The number of threads is a runtime setting of the expertise and not part of the weightfile
+        unsigned long nThreads = expertise->classifier.GetNThreads();
+        expertise->classifier = FastBDT::Classifier(file, maxTrees);
+        expertise->classifier.SetNThreads(nThreads);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return true;
     }
 
-    void Load(void* ptr, char *weightfile) {
+    bool Recover(void* ptr, char *weightfile) {
       Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
-      
+
       std::fstream file(weightfile, std::ios_base::in);
       if(not file)
-    	  return;
+        return false;
 
-      expertise->classifier = FastBDT::Classifier(file);
+      // Errors cannot be passed through the C interface, in this case false is returned
+      try {
+        unsigned long nThreads = expertise->classifier.GetNThreads();
+        expertise->classifier = FastBDT::Classifier::Recover(file);
+        expertise->classifier.SetNThreads(nThreads);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return true;
     }
 
     float Predict(void *ptr, float *array) {
@@ -138,31 +206,157 @@ extern "C" {
     void PredictArray(void *ptr, float *array, float *result, unsigned long nEvents) {
       Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
       unsigned long nFeatures = expertise->classifier.GetNFeatures();
-      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
-        result[iEvent] = expertise->classifier.predict(std::vector<float>(array + iEvent*nFeatures, array + (iEvent+1)*nFeatures));
+      expertise->classifier.predict_batch(array, nEvents, nFeatures, result);
+    }
+    
+    void PredictArrayThreaded(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long nThreads) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      expertise->classifier.predict_batch(array, nEvents, nFeatures, result, nThreads);
+    }
+
+    void PredictArrayStrided(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long rowStride, unsigned long columnStride, unsigned long nThreads) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      expertise->classifier.predict_batch_strided(array, nEvents, rowStride, columnStride, result, nThreads);
+    }
+
+    bool PredictAbove(void *ptr, float *array, float threshold) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      return expertise->classifier.predict_above(std::vector<float>(array, array + expertise->classifier.GetNFeatures()), threshold);
+    }
+
+    void PredictArrayAbove(void *ptr, float *array, bool *result, unsigned long nEvents, float threshold) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      expertise->classifier.predict_above(array, nEvents, nFeatures, threshold, result);
+    }
+
+    bool PredictArrayStaged(void *ptr, float *array, float *result, unsigned long nEvents, unsigned long *checkpoints, unsigned long nCheckpoints) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      // Errors cannot be passed through the C interface, in this case false is returned
+      try {
+        expertise->classifier.predict_staged(array, nEvents, nFeatures, std::vector<unsigned long>(checkpoints, checkpoints + nCheckpoints), result);
+      } catch(const std::exception &) {
+        return false;
       }
+      return true;
     }
 
-    void Save(void* ptr, char *weightfile) {
+    bool GetLeafIndicesArray(void *ptr, float *array, uint16_t *result, unsigned long nEvents) {
       Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      // Errors cannot be passed through the C interface, in this case false is returned
+      try {
+        expertise->classifier.GetLeafIndices(array, nEvents, nFeatures, result);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return true;
+    }
 
+    bool GetLeafIndicesArray8(void *ptr, float *array, uint8_t *result, unsigned long nEvents) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      try {
+        expertise->classifier.GetLeafIndices(array, nEvents, nFeatures, result);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return true;
+    }
+
+    bool Save(void* ptr, char *weightfile) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+
+      // Errors cannot be passed through the C interface, in this case false is returned
       std::fstream file(weightfile, std::ios_base::out | std::ios_base::trunc);
-      file << expertise->classifier << std::endl;
+      try {
+        file << expertise->classifier << std::endl;
+      } catch(const std::exception &) {
+        return false;
+      }
+      return static_cast<bool>(file);
+    }
+
+    bool SaveBinary(void* ptr, char *weightfile) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+
+      std::fstream file(weightfile, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      try {
+        expertise->classifier.SaveBinary(file);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return static_cast<bool>(file);
+    }
+
+    bool SaveMapped(void* ptr, char *weightfile) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+
+      std::fstream file(weightfile, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      try {
+        expertise->classifier.SaveMapped(file);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return static_cast<bool>(file);
+    }
+
+    bool SaveCompact(void* ptr, char *weightfile) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+
+      std::fstream file(weightfile, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      try {
+        expertise->classifier.SaveCompact(file);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return static_cast<bool>(file);
+    }
+
+    bool IsInferenceOnly(void* ptr) {
+      return reinterpret_cast<Expertise*>(ptr)->classifier.IsInferenceOnly();
     }
   
     void* GetVariableRanking(void* ptr) {
       Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
       VariableRanking *ranking = new(std::nothrow) VariableRanking;
-      ranking->ranking = expertise->classifier.GetVariableRanking();
+      if(ranking == nullptr)
+        return nullptr;
+      try {
+        ranking->ranking = expertise->classifier.GetVariableRanking();
+      } catch(const std::exception &) {
+        delete ranking;
+        return nullptr;
+      }
       return ranking;
     }
     
     void* GetIndividualVariableRanking(void* ptr, float *array) {
       Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
       VariableRanking *ranking = new(std::nothrow) VariableRanking;
-      ranking->ranking = expertise->classifier.GetIndividualVariableRanking(std::vector<float>(array, array + expertise->classifier.GetNFeatures()));
+      if(ranking == nullptr)
+        return nullptr;
+      try {
+        ranking->ranking = expertise->classifier.GetIndividualVariableRanking(std::vector<float>(array, array + expertise->classifier.GetNFeatures()));
+      } catch(const std::exception &) {
+        delete ranking;
+        return nullptr;
+      }
       return ranking;
     }
+
+    bool GetIndividualVariableRankingArray(void* ptr, float *array, double *ranking, unsigned long nEvents) {
+      Expertise *expertise = reinterpret_cast<Expertise*>(ptr);
+      unsigned long nFeatures = expertise->classifier.GetNFeatures();
+      try {
+        expertise->classifier.GetIndividualVariableRanking(array, nEvents, nFeatures, ranking);
+      } catch(const std::exception &) {
+        return false;
+      }
+      return true;
+    }
     
     unsigned long ExtractNumberOfVariablesFromVariableRanking(void* ptr) {
       VariableRanking *ranking = reinterpret_cast<VariableRanking*>(ptr);
@@ -186,4 +380,68 @@ extern "C" {
       delete reinterpret_cast<VariableRanking*>(ptr);
     }
 
+    void* CreateModelHandle() {
+      return new(std::nothrow) FastBDT::ModelHandle;
+    }
+
+    void DeleteModelHandle(void *handle) {
+      delete reinterpret_cast<FastBDT::ModelHandle*>(handle);
+    }
+
+    unsigned long LoadModelHandle(void *handle, char *weightfile) {
+      // Errors cannot be passed through the C interface, in this case the current model is kept and 0 is returned
+      try {
+        return reinterpret_cast<FastBDT::ModelHandle*>(handle)->Load(weightfile);
+      } catch(const std::exception &) {
+        return 0;
+      }
+    }
+
+    unsigned long GetModelHandleVersion(void *handle) {
+      return reinterpret_cast<FastBDT::ModelHandle*>(handle)->GetVersion();
+    }
+
+    float PredictModelHandle(void *handle, float *array) {
+      FastBDT::ModelHandle::Reader reader(*reinterpret_cast<FastBDT::ModelHandle*>(handle));
+      if(reader.get() == nullptr)
+        return std::numeric_limits<float>::quiet_NaN();
+      return reader->predict(std::vector<float>(array, array + reader->GetNFeatures()));
+    }
+
+    void PredictArrayModelHandle(void *handle, float *array, float *result, unsigned long nEvents) {
+      FastBDT::ModelHandle::Reader reader(*reinterpret_cast<FastBDT::ModelHandle*>(handle));
+      if(reader.get() == nullptr) {
+        std::fill(result, result + nEvents, std::numeric_limits<float>::quiet_NaN());
+        return;
+      }
+      reader->predict_batch(array, nEvents, reader->GetNFeatures(), result);
+    }
+
+    void* LoadMapped(char *weightfile) {
+      // Errors cannot be passed through the C interface, in this case nullptr is returned
+      try {
+        return new FastBDT::MappedClassifier(weightfile);
+      } catch(const std::exception &) {
+        return nullptr;
+      }
+    }
+
+    void DeleteMapped(void *mapped) {
+      delete reinterpret_cast<FastBDT::MappedClassifier*>(mapped);
+    }
+
+    unsigned long GetMappedNFeatures(void *mapped) {
+      return reinterpret_cast<FastBDT::MappedClassifier*>(mapped)->GetNFeatures();
+    }
+
+    float PredictMapped(void *mapped, float *array) {
+      FastBDT::MappedClassifier *classifier = reinterpret_cast<FastBDT::MappedClassifier*>(mapped);
+      return classifier->predict(std::vector<float>(array, array + classifier->GetNFeatures()));
+    }
+
+    void PredictArrayMapped(void *mapped, float *array, float *result, unsigned long nEvents, unsigned long nThreads) {
+      FastBDT::MappedClassifier *classifier = reinterpret_cast<FastBDT::MappedClassifier*>(mapped);
+      classifier->predict_batch(array, nEvents, classifier->GetNFeatures(), result, nThreads);
+    }
+
 }
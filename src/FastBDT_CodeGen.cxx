@@ -0,0 +1,136 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Ahead-of-time code generation of a trained forest to C++ source
+ */
+
+#include "FastBDT_CodeGen.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+
+namespace FastBDT {
+
+  namespace {
+
+    /**
+     * Returns a float literal which is parsed to exactly the given value
+     */
+    std::string FloatLiteral(float value) {
+      if(std::isinf(value))
+        return value > 0 ? "std::numeric_limits<float>::infinity()" : "-std::numeric_limits<float>::infinity()";
+      if(std::isnan(value))
+        return "std::numeric_limits<float>::quiet_NaN()";
+      char buffer[32];
+      std::snprintf(buffer, sizeof(buffer), "%.9ef", value);
+      return buffer;
+    }
+
+    /**
+     * Returns a double literal which is parsed to exactly the given value
+     */
+    std::string DoubleLiteral(double value) {
+      if(std::isinf(value))
+        return value > 0 ? "std::numeric_limits<double>::infinity()" : "-std::numeric_limits<double>::infinity()";
+      if(std::isnan(value))
+        return "std::numeric_limits<double>::quiet_NaN()";
+      char buffer[40];
+      std::snprintf(buffer, sizeof(buffer), "%.17e", value);
+      return buffer;
+    }
+
+    /**
+     * Writes the subtree below the given node with the same semantic as Tree::ValueToNode
+     * @param node current node (1-based like in Tree::ValueToNode)
+     */
+    void WriteNode(std::ostream &stream, const Tree<float> &tree, unsigned long node, const std::string &indent) {
+
+      const auto &cuts = tree.GetCuts();
+      const auto &boostWeights = tree.GetBoostWeights();
+      const std::string weight = FloatLiteral(boostWeights[node-1]);
+
+      if(node > cuts.size() or not cuts[node-1].valid) {
+        stream << indent << "return " << weight << ";" << std::endl;
+        return;
+      }
+
+      const auto &cut = cuts[node-1];
+      const std::string value = "values[" + std::to_string(cut.feature) + "]";
+      stream << indent << "if(std::isnan(" << value << "))" << std::endl;
+      stream << indent << "  return " << weight << ";" << std::endl;
+      // A comparison with a NaN cut value is always false, so the event always goes to the left
+      if(not std::isnan(cut.index)) {
+        stream << indent << "if(" << value << " >= " << FloatLiteral(cut.index) << ") {" << std::endl;
+        WriteNode(stream, tree, 2*node + 1, indent + "  ");
+        stream << indent << "}" << std::endl;
+      }
+      WriteNode(stream, tree, 2*node, indent);
+
+    }
+
+  }
+
+  void writeForestToHeader(std::ostream &stream, const Forest<float> &forest, const std::string &name_space) {
+
+    const auto &trees = forest.GetForest();
+    unsigned long nFeatures = 0;
+    for(const auto &tree : trees) {
+      const auto &cuts = tree.GetCuts();
+      if(tree.GetBoostWeights().size() < 2*cuts.size() + 1) {
+        throw std::runtime_error("Code generation requires complete trees, but a tree with " + std::to_string(cuts.size()) + " cuts and " + std::to_string(tree.GetBoostWeights().size()) + " nodes was found");
+      }
+      for(const auto &cut : cuts) {
+        if(cut.valid and cut.feature + 1 > nFeatures)
+          nFeatures = cut.feature + 1;
+      }
+    }
+
+    stream << "/**" << std::endl;
+    stream << " * Generated by FastBDT, do not edit." << std::endl;
+    stream << " * Forest with " << trees.size() << " trees on " << nFeatures << " features." << std::endl;
+    stream << " */" << std::endl << std::endl;
+    stream << "#pragma once" << std::endl << std::endl;
+    stream << "#include <cmath>" << std::endl;
+    stream << "#include <limits>" << std::endl << std::endl;
+    stream << "namespace " << name_space << " {" << std::endl << std::endl;
+    stream << "  constexpr unsigned long nTrees = " << trees.size() << ";" << std::endl;
+    stream << "  constexpr unsigned long nFeatures = " << nFeatures << ";" << std::endl << std::endl;
+
+    for(unsigned long iTree = 0; iTree < trees.size(); ++iTree) {
+      stream << "  inline float tree_" << iTree << "(const float *values) {" << std::endl;
+      WriteNode(stream, trees[iTree], 1, "    ");
+      stream << "  }" << std::endl << std::endl;
+    }
+
+    // Same order of operations as in Forest::GetF, so the result is identical
+    stream << "  inline double GetF(const float *values) {" << std::endl;
+    stream << "    double F = " << DoubleLiteral(forest.GetF0() / forest.GetShrinkage()) << ";" << std::endl;
+    for(unsigned long iTree = 0; iTree < trees.size(); ++iTree) {
+      stream << "    F += tree_" << iTree << "(values);" << std::endl;
+    }
+    stream << "    return F * " << DoubleLiteral(forest.GetShrinkage()) << ";" << std::endl;
+    stream << "  }" << std::endl << std::endl;
+
+    stream << "  inline float predict(const float *values) {" << std::endl;
+    if(forest.GetTransform2Probability())
+      stream << "    return 1.0/(1.0+std::exp(-2*GetF(values)));" << std::endl;
+    else
+      stream << "    return GetF(values);" << std::endl;
+    stream << "  }" << std::endl << std::endl;
+
+    stream << "}" << std::endl;
+
+  }
+
+  void writeClassifierToHeader(std::ostream &stream, const Classifier &classifier, const std::string &name_space) {
+
+    if(not classifier.GetCanUseFastForest()) {
+      throw std::runtime_error("Code generation is only supported for classifiers which can be evaluated on the original feature values");
+    }
+    writeForestToHeader(stream, classifier.GetFastForest(), name_space);
+
+  }
+
+}
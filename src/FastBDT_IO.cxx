@@ -4,9 +4,18 @@
 
 #include "FastBDT_IO.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <sstream>
 
+#include <locale.h>
+
 namespace FastBDT {
 
   float convert_to_float_safely(std::string &input) {
@@ -41,106 +50,629 @@ namespace FastBDT {
      return result;
   }
   
-  template<>
-  std::ostream& operator<<(std::ostream& stream, const std::vector<float> &vector) {
-     stream << vector.size();
-     stream.precision(std::numeric_limits<float>::max_digits10);
-     stream << std::scientific;
+  namespace {
+
+    const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    /**
+     * The printf of the rare values which are not handled by the fast path must not depend on the global locale
+     * of the program, like the std::ostream operators
+     */
+    locale_t GetCLocale() {
+      static const locale_t cLocale = newlocale(LC_ALL_MASK, "C", static_cast<locale_t>(0));
+      return cLocale;
+    }
+
+    /**
+     * Multiplies the value with 10^exponent in at most three roundings for |exponent| <= 66
+     */
+    double Scale(double value, int exponent) {
+      while(exponent > 22) {
+        value *= 1e22;
+        exponent -= 22;
+      }
+      while(exponent < -22) {
+        value /= 1e22;
+        exponent += 22;
+      }
+      return (exponent >= 0) ? value * powersOf10[exponent] : value / powersOf10[-exponent];
+    }
+
+    /**
+     * Rounds a finite positive value to nDigits significant decimal digits, like printf with round-half-even
+     * on the exact binary value. The calculation is done in double precision, which is exact enough unless
+     * the value is close to the middle between two decimals, in this case false is returned.
+     * @param value positive finite value
+     * @param nDigits number of significant digits, at most 10
+     * @param digits the nDigits significant digits as an integer
+     * @param exponent decimal exponent of the first digit
+     */
+    bool RoundToDecimal(double value, int nDigits, uint64_t &digits, int &exponent) {
+
+      if(nDigits > 10 or value < 1e-55 or value > 1e55)
+        return false;
+
+      // value is in [2^(binaryExponent-1), 2^binaryExponent), so the decimal exponent is the estimate or one more
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      const int binaryExponent = static_cast<int>((bits >> 52) & 0x7FF) - 1022;
+      exponent = ((binaryExponent - 1) * 78913) >> 18;
+
+      double scaled = Scale(value, nDigits - 1 - exponent);
+      if(scaled >= powersOf10[nDigits]) {
+        exponent++;
+        scaled = Scale(value, nDigits - 1 - exponent);
+      } else if(scaled < powersOf10[nDigits - 1]) {
+        exponent--;
+        scaled = Scale(value, nDigits - 1 - exponent);
+      }
+
+      // The relative error of scaled is below 1e-15, so the absolute error below 1e-5
+      const uint64_t integer = static_cast<uint64_t>(scaled);
+      const double fraction = scaled - static_cast<double>(integer);
+      if(std::fabs(fraction - 0.5) < 1e-4)
+        return false;
+
+      digits = integer + ((fraction > 0.5) ? 1 : 0);
+      if(digits >= static_cast<uint64_t>(powersOf10[nDigits])) {
+        digits /= 10;
+        exponent++;
+      }
+      return true;
+    }
+
+    /**
+     * Writes the decimal exponent like printf
+     * @return the number of written characters
+     */
+    unsigned int FormatExponent(char *characters, int exponent) {
+      unsigned int length = 0;
+      characters[length++] = 'e';
+      characters[length++] = (exponent < 0) ? '-' : '+';
+      const unsigned int absolute = std::abs(exponent);
+      if(absolute >= 100)
+        characters[length++] = static_cast<char>('0' + absolute / 100);
+      characters[length++] = static_cast<char>('0' + (absolute / 10) % 10);
+      characters[length++] = static_cast<char>('0' + absolute % 10);
+      return length;
+    }
+
+    const char digitPairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+
+    /**
+     * Writes the digits of the integer into the characters, most significant digit first
+     */
+    void FormatDigits(uint64_t digits, char *characters, int nDigits) {
+      int i = nDigits;
+      while(i >= 2) {
+        const unsigned int pair = static_cast<unsigned int>(digits % 100);
+        digits /= 100;
+        i -= 2;
+        characters[i] = digitPairs[2 * pair];
+        characters[i + 1] = digitPairs[2 * pair + 1];
+      }
+      if(i == 1)
+        characters[0] = static_cast<char>('0' + digits % 10);
+    }
+
+    /**
+     * Formats the value with printf, using the C locale
+     */
+    std::string FormatPrintf(const char *format, int precision, double value) {
+      const locale_t previous = uselocale(GetCLocale());
+      std::string result(32, '\0');
+      int length = std::snprintf(&result[0], result.size(), format, precision, value);
+      if(length >= static_cast<int>(result.size())) {
+        result.resize(length + 1);
+        length = std::snprintf(&result[0], result.size(), format, precision, value);
+      }
+      uselocale(previous);
+      result.resize(length);
+      return result;
+    }
+
+    /**
+     * Formats the value like printf("%.*e", precision, value), if the fast path can be used
+     * @return the number of written characters, zero if printf must be used
+     */
+    unsigned int FormatScientific(char *characters, double value, int precision) {
+
+      uint64_t digits = 0;
+      int exponent = 0;
+      if(not std::isfinite(value) or precision < 0 or precision > 9 or (value != 0 and not RoundToDecimal(std::fabs(value), precision + 1, digits, exponent)))
+        return 0;
+
+      unsigned int length = 0;
+      if(std::signbit(value))
+        characters[length++] = '-';
+      FormatDigits(digits, characters + length + 1, precision + 1);
+      // The first digit is moved in front of the decimal point
+      characters[length] = characters[length + 1];
+      length++;
+      if(precision > 0) {
+        characters[length] = '.';
+        length += precision + 1;
+      }
+      return length + FormatExponent(characters + length, exponent);
+    }
+
+    /**
+     * Formats the value like printf("%.*g", precision, value), if the fast path can be used
+     * @return the number of written characters, zero if printf must be used
+     */
+    unsigned int FormatGeneral(char *characters, double value, int precision) {
+
+      const int nDigits = (precision == 0) ? 1 : precision;
+      uint64_t digits = 0;
+      int exponent = 0;
+      if(not std::isfinite(value) or precision < 0 or precision > 10 or (value != 0 and not RoundToDecimal(std::fabs(value), nDigits, digits, exponent)))
+        return 0;
+
+      unsigned int length = 0;
+      if(std::signbit(value))
+        characters[length++] = '-';
+      if(value == 0) {
+        characters[length++] = '0';
+        return length;
+      }
+
+      char significant[16];
+      FormatDigits(digits, significant, nDigits);
+      // Trailing zeros are removed
+      int nSignificant = nDigits;
+      while(nSignificant > 1 and significant[nSignificant - 1] == '0')
+        nSignificant--;
+
+      if(exponent < -4 or exponent >= nDigits) {
+        characters[length++] = significant[0];
+        if(nSignificant > 1) {
+          characters[length++] = '.';
+          std::memcpy(characters + length, significant + 1, nSignificant - 1);
+          length += nSignificant - 1;
+        }
+        length += FormatExponent(characters + length, exponent);
+      } else if(exponent < 0) {
+        characters[length++] = '0';
+        characters[length++] = '.';
+        for(int i = 0; i < -exponent - 1; ++i)
+          characters[length++] = '0';
+        std::memcpy(characters + length, significant, nSignificant);
+        length += nSignificant;
+      } else {
+        std::memcpy(characters + length, significant, exponent + 1);
+        length += exponent + 1;
+        if(nSignificant > exponent + 1) {
+          characters[length++] = '.';
+          std::memcpy(characters + length, significant + exponent + 1, nSignificant - exponent - 1);
+          length += nSignificant - exponent - 1;
+        }
+      }
+      return length;
+    }
+
+    bool IsSpace(char character) {
+      return character == ' ' or (character >= '\t' and character <= '\r');
+    }
+
+    bool IsDigit(char character) {
+      return character >= '0' and character <= '9';
+    }
+
+    /**
+     * Parses a number in the format of the floats in vectors, d.ddddddddde[-+]dd (see printf("%.9e")),
+     * which are most of the values of a weightfile
+     * @return false if the token does not have exactly this format
+     */
+    bool ParseScientific9(const char *token, unsigned int length, bool &negative, uint64_t &mantissa, int &exponent) {
+
+      negative = length == 16 and token[0] == '-';
+      if(negative) {
+        token++;
+        length--;
+      }
+      if(length != 15 or token[1] != '.' or token[11] != 'e' or (token[12] != '-' and token[12] != '+'))
+        return false;
+
+      mantissa = 0;
+      for(unsigned int i = 0; i < 11; ++i) {
+        if(i == 1)
+          continue;
+        if(not IsDigit(token[i]))
+          return false;
+        mantissa = 10 * mantissa + (token[i] - '0');
+      }
+      if(not IsDigit(token[13]) or not IsDigit(token[14]))
+        return false;
+      const int value = 10 * (token[13] - '0') + (token[14] - '0');
+      exponent = ((token[12] == '-') ? -value : value) - 9;
+      return true;
+    }
+
+    /**
+     * Parses a decimal number of the form [-+]digits[.digits][e[-+]digits] with at most 19 significant digits
+     * @param token the characters of the number
+     * @param length number of characters
+     * @param negative true if the number has a minus sign
+     * @param mantissa the significant digits as an integer
+     * @param exponent the value of the number is mantissa * 10^exponent
+     * @return false if the token is not a number of this form
+     */
+    bool ParseDecimal(const char *token, unsigned int length, bool &negative, uint64_t &mantissa, int &exponent) {
+
+      const char *position = token;
+      const char *end = token + length;
+      negative = false;
+      if(position != end and (*position == '-' or *position == '+')) {
+        negative = *position == '-';
+        position++;
+      }
+
+      mantissa = 0;
+      exponent = 0;
+      unsigned int nDigits = 0;
+      unsigned int nSignificant = 0;
+      bool point = false;
+      for(; position != end; ++position) {
+        const char character = *position;
+        if(character >= '0' and character <= '9') {
+          nDigits++;
+          // Leading zeros are not significant
+          if(mantissa != 0 or character != '0') {
+            if(++nSignificant > 19)
+              return false;
+            mantissa = 10 * mantissa + (character - '0');
+          }
+          if(point)
+            exponent--;
+        } else if(character == '.' and not point) {
+          point = true;
+        } else {
+          break;
+        }
+      }
+      if(nDigits == 0)
+        return false;
+
+      if(position != end) {
+        if(*position != 'e' and *position != 'E')
+          return false;
+        position++;
+        bool negativeExponent = false;
+        if(position != end and (*position == '-' or *position == '+')) {
+          negativeExponent = *position == '-';
+          position++;
+        }
+        if(position == end)
+          return false;
+        int value = 0;
+        for(; position != end; ++position) {
+          if(*position < '0' or *position > '9' or value > 10000)
+            return false;
+          value = 10 * value + (*position - '0');
+        }
+        exponent += negativeExponent ? -value : value;
+      }
+      return true;
+    }
+
+  }
+
+  TextWriter::TextWriter(std::ostream &stream) : stream(stream), buffer(1 << 16) {
+    const auto floatfield = stream.flags() & std::ios_base::floatfield;
+    scientific = floatfield == std::ios_base::scientific;
+    otherFormat = floatfield != std::ios_base::scientific and floatfield != std::ios_base::fmtflags(0);
+    precision = stream.precision();
+  }
+
+  TextWriter::~TextWriter() {
+    Flush();
+  }
+
+  void TextWriter::Write(unsigned long value) {
+    char characters[24];
+    int position = sizeof(characters);
+    do {
+      characters[--position] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while(value > 0);
+    Append(characters + position, sizeof(characters) - position);
+  }
+
+  void TextWriter::Write(double value) {
+    char characters[64];
+    unsigned int length = 0;
+    if(otherFormat) {
+      // std::fixed and std::hexfloat are not used by the text format
+      const auto floatfield = stream.flags() & std::ios_base::floatfield;
+      const std::string formatted = FormatPrintf((floatfield == std::ios_base::fixed) ? "%.*f" : "%.*a", static_cast<int>(precision), value);
+      Append(formatted.data(), formatted.size());
+      return;
+    } else if(scientific) {
+      length = FormatScientific(characters, value, static_cast<int>(precision));
+    } else {
+      length = FormatGeneral(characters, value, static_cast<int>(precision));
+    }
+    if(length > 0) {
+      Append(characters, length);
+    } else {
+      const std::string formatted = FormatPrintf(scientific ? "%.*e" : "%.*g", static_cast<int>(precision), value);
+      Append(formatted.data(), formatted.size());
+    }
+  }
+
+  void TextWriter::WriteScientific(double value, int precision) {
+    char characters[64];
+    const unsigned int length = FormatScientific(characters, value, precision);
+    if(length > 0) {
+      Append(characters, length);
+    } else {
+      const std::string formatted = FormatPrintf("%.*e", precision, value);
+      Append(formatted.data(), formatted.size());
+    }
+  }
+
+  void TextWriter::Append(const char *characters, unsigned long length) {
+    if(size + length > buffer.size()) {
+      DrainBuffer();
+      if(length > buffer.size())
+        buffer.resize(length);
+    }
+    std::memcpy(buffer.data() + size, characters, length);
+    size += length;
+  }
+
+  void TextWriter::DrainBuffer() {
+    stream.write(buffer.data(), size);
+    size = 0;
+  }
+
+  void TextWriter::Flush() {
+    DrainBuffer();
+    if(scientific)
+      stream << std::scientific;
+    stream.precision(precision);
+    stream.flush();
+  }
+
+  TextReader::~TextReader() {
+    // The characters behind the last token were copied from the get area of the streambuf, they are put back
+    std::streambuf *buffer = stream.rdbuf();
+    const long remaining = end - position;
+    for(long i = remaining - 1; i >= 0; --i) {
+      if(buffer->sputbackc(position[i]) == std::char_traits<char>::eof()) {
+        buffer->pubseekoff(-(i + 1), std::ios_base::cur, std::ios_base::in);
+        break;
+      }
+    }
+  }
+
+  bool TextReader::Refill() {
+    // Only the characters which are already in the get area are copied, so they can be put back later
+    std::streambuf *buffer = stream.rdbuf();
+    if(buffer->sgetc() == std::char_traits<char>::eof())
+      return false;
+    const std::streamsize available = std::max<std::streamsize>(buffer->in_avail(), 1);
+    if(static_cast<std::streamsize>(chunk.size()) < available)
+      chunk.resize(available);
+    const std::streamsize n = buffer->sgetn(chunk.data(), available);
+    position = chunk.data();
+    end = position + n;
+    return n > 0;
+  }
+
+  const char* TextReader::ReadToken(unsigned int &length) {
+
+    length = 0;
+    // Same as the sentry of the std::istream operators
+    if(not stream.good()) {
+      stream.setstate(std::ios_base::failbit);
+      return nullptr;
+    }
+
+    while(true) {
+      while(position != end and IsSpace(*position))
+        ++position;
+      if(position != end)
+        break;
+      if(not Refill()) {
+        stream.setstate(std::ios_base::eofbit | std::ios_base::failbit);
+        return nullptr;
+      }
+    }
+
+    const char *start = position;
+    while(position != end and not IsSpace(*position))
+      ++position;
+    if(position != end) {
+      length = position - start;
+      return start;
+    }
+
+    // The token continues in the next chunk
+    token.assign(start, position);
+    while(position == end and Refill()) {
+      start = position;
+      while(position != end and not IsSpace(*position))
+        ++position;
+      token.append(start, position);
+    }
+    if(position == end)
+      stream.setstate(std::ios_base::eofbit);
+    length = token.size();
+    return token.data();
+  }
+
+  void TextReader::Skip(unsigned long nTokens) {
+    unsigned int length;
+    for(unsigned long i = 0; i < nTokens; ++i) {
+      ReadToken(length);
+      if(length == 0)
+        return;
+    }
+  }
+
+  void TextReader::Read(bool &value) {
+    unsigned int length;
+    const char *characters = ReadToken(length);
+    value = false;
+    if(length == 1 and (characters[0] == '0' or characters[0] == '1')) {
+      value = characters[0] == '1';
+    } else if(length > 0) {
+      std::istringstream fallback(std::string(characters, length));
+      fallback >> value;
+      if(fallback.fail())
+        stream.setstate(std::ios_base::failbit);
+    }
+  }
+
+  void TextReader::Read(unsigned long &value) {
+    unsigned int length;
+    const char *characters = ReadToken(length);
+    value = 0;
+    if(length == 0)
+      return;
+    if(length < 20 and std::all_of(characters, characters + length, [](char c) { return c >= '0' and c <= '9'; })) {
+      for(unsigned int i = 0; i < length; ++i)
+        value = 10 * value + (characters[i] - '0');
+    } else {
+      std::istringstream fallback(std::string(characters, length));
+      fallback >> value;
+      if(fallback.fail())
+        stream.setstate(std::ios_base::failbit);
+    }
+  }
+
+  void TextReader::Read(float &value) {
+
+    unsigned int length;
+    const char *characters = ReadToken(length);
+    value = 0;
+    if(length == 0)
+      return;
+    value = convert_to_float_fast(characters, length);
+
+  }
+
+  float convert_to_float_fast(const char *characters, unsigned int length) {
+
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    if((ParseScientific9(characters, length, negative, mantissa, exponent) or ParseDecimal(characters, length, negative, mantissa, exponent)) and std::abs(exponent) <= 66) {
+      if(mantissa == 0)
+        return negative ? -0.0f : 0.0f;
+      // The result in double precision is rounded at most four times (relative error below 4 ulp),
+      // so rounding it to float gives the correctly rounded float, unless it is close to the middle between two floats.
+      // Denormalized and too large floats are left to convert_to_float_safely.
+      const double result = Scale(static_cast<double>(mantissa), exponent);
+      if(result >= std::numeric_limits<float>::min() and result <= std::numeric_limits<float>::max()) {
+        uint64_t bits;
+        std::memcpy(&bits, &result, sizeof(bits));
+        const int64_t remainder = static_cast<int64_t>(bits & ((1ul << 29) - 1));
+        if(std::abs(remainder - (1l << 28)) > 16)
+          return static_cast<float>(negative ? -result : result);
+      }
+    }
+    std::string fallback(characters, length);
+    return convert_to_float_safely(fallback);
+
+  }
+
+  void TextReader::Read(double &value) {
+
+    unsigned int length;
+    const char *characters = ReadToken(length);
+    value = 0;
+    if(length == 0)
+      return;
+
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    // Both the mantissa and the power of ten are exact, so the result is correctly rounded
+    if(ParseDecimal(characters, length, negative, mantissa, exponent) and mantissa <= (1ul << 53) and std::abs(exponent) <= 22) {
+      const double result = (exponent >= 0) ? mantissa * powersOf10[exponent] : mantissa / powersOf10[-exponent];
+      value = negative ? -result : result;
+      return;
+    }
+    std::string fallback(characters, length);
+    value = convert_to_double_safely(fallback);
+  }
+
+  void writeText(TextWriter &writer, const std::vector<float> &vector) {
+     writer.Write(static_cast<unsigned long>(vector.size()));
      for(const auto &value : vector) {
-         stream << " " << value;
+         writer.Write(' ');
+         writer.WriteScientific(value, std::numeric_limits<float>::max_digits10);
      }
-     stream.precision(6);
-     stream << std::endl;
-     return stream;
+     writer.SetScientific();
+     writer.SetPrecision(6);
+     writer.EndLine();
   }
-  
-  template<>
-  std::ostream& operator<<(std::ostream& stream, const std::vector<double> &vector) {
-     stream << vector.size();
-     stream.precision(std::numeric_limits<double>::max_digits10);
-     stream << std::scientific;
+
+  void writeText(TextWriter &writer, const std::vector<double> &vector) {
+     writer.Write(static_cast<unsigned long>(vector.size()));
      for(const auto &value : vector) {
-         stream << " " << value;
+         writer.Write(' ');
+         writer.WriteScientific(value, std::numeric_limits<double>::max_digits10);
      }
-     stream.precision(6);
-     stream << std::endl;
-     return stream;
+     writer.SetScientific();
+     writer.SetPrecision(6);
+     writer.EndLine();
   }
-  
+
   template<>
-  std::istream& operator>>(std::istream& stream, std::vector<float> &vector) {
-     unsigned long size;
-     stream >> size;
-     vector.resize(size);
-     for(unsigned long i = 0; i < size; ++i) {
-         std::string temp;
-         stream >> temp;
-         vector[i] = convert_to_float_safely(temp);
-     }
+  std::ostream& operator<<(std::ostream& stream, const std::vector<float> &vector) {
+     TextWriter writer(stream);
+     writeText(writer, vector);
      return stream;
   }
-  
+
   template<>
-  std::istream& operator>>(std::istream& stream, std::vector<double> &vector) {
-     unsigned long size;
-     stream >> size;
-     vector.resize(size);
-     for(unsigned long i = 0; i < size; ++i) {
-         std::string temp;
-         stream >> temp;
-         vector[i] = convert_to_double_safely(temp);
-     }
+  std::ostream& operator<<(std::ostream& stream, const std::vector<double> &vector) {
+     TextWriter writer(stream);
+     writeText(writer, vector);
      return stream;
   }
-  
-  /**
-   * This function reads a Cut from an std::istream
-   * @param stream an std::istream reference
-   * @param cut containing read data
-   */
+
   template<>
-  std::istream& operator>>(std::istream& stream, Cut<float> &cut) {
-     stream >> cut.feature;
-
-     // Unfortunately we have to use our own conversion here to correctly parse NaN and Infinity
-     // because usualy istream::operator>> doesn't do this!
-     std::string index_string;
-     stream >> index_string;
-     cut.index = convert_to_float_safely(index_string);
-     stream >> cut.valid;
-     stream >> cut.gain;
+  std::istream& operator>>(std::istream& stream, std::vector<float> &vector) {
+     TextReader reader(stream);
+     readText(reader, vector);
      return stream;
   }
-  
-  /**
-   * This function reads a Cut from an std::istream
-   * @param stream an std::istream reference
-   * @param cut containing read data
-   */
+
   template<>
-  std::istream& operator>>(std::istream& stream, Cut<double> &cut) {
-     stream >> cut.feature;
-
-     // Unfortunately we have to use our own conversion here to correctly parse NaN and Infinity
-     // because usualy istream::operator>> doesn't do this!
-     std::string index_string;
-     stream >> index_string;
-     cut.index = convert_to_double_safely(index_string);
-     stream >> cut.valid;
-     stream >> cut.gain;
+  std::istream& operator>>(std::istream& stream, std::vector<double> &vector) {
+     TextReader reader(stream);
+     readText(reader, vector);
      return stream;
   }
-  
-  std::ostream& operator<<(std::ostream& stream, const PurityTransformation &purityTransformation) {
-      stream << purityTransformation.GetMapping() << std::endl;
-      return stream;
+
+  void writeText(TextWriter &writer, const PurityTransformation &purityTransformation) {
+      writeText(writer, purityTransformation.GetMapping());
+      writer.EndLine();
   }
-  
-  std::istream& operator>>(std::istream& stream, PurityTransformation &purityTransformation) {
 
+  void readText(TextReader &reader, PurityTransformation &purityTransformation) {
       std::vector<unsigned long> mapping;
-      stream >> mapping;
+      readText(reader, mapping);
       purityTransformation.SetMapping(mapping);
+  }
+
+  std::ostream& operator<<(std::ostream& stream, const PurityTransformation &purityTransformation) {
+      TextWriter writer(stream);
+      writeText(writer, purityTransformation);
+      return stream;
+  }
+
+  std::istream& operator>>(std::istream& stream, PurityTransformation &purityTransformation) {
+      TextReader reader(stream);
+      readText(reader, purityTransformation);
       return stream;
   }
 
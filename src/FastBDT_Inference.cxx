@@ -0,0 +1,969 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Inference-only representations of a trained forest
+ */
+
+#include "FastBDT_Inference.h"
+
+#include <string>
+#include <algorithm>
+#include <limits>
+
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace FastBDT {
+
+  namespace {
+
+    /**
+     * Assigns the post-order bit positions to the nodes of a tree with nCuts inner nodes.
+     * @param node current node (0-based)
+     * @param nCuts number of inner nodes, all other nodes are leaves
+     * @param counter next free position
+     * @param first position of the first node in the subtree of each node
+     * @param position position of each node
+     */
+    void AssignPostOrderPositions(unsigned long node, unsigned long nCuts, unsigned long &counter, std::vector<unsigned long> &first, std::vector<unsigned long> &position) {
+      first[node] = counter;
+      if(node < nCuts) {
+        AssignPostOrderPositions(2*node + 1, nCuts, counter, first, position);
+        AssignPostOrderPositions(2*node + 2, nCuts, counter, first, position);
+      }
+      position[node] = counter++;
+    }
+
+    /**
+     * Clears the bits [first, last) in the given bitmask
+     */
+    void ClearBits(uint64_t *mask, unsigned long first, unsigned long last) {
+      for(unsigned long bit = first; bit < last; ++bit)
+        mask[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+    }
+
+    /**
+     * Traverses the remaining D levels of a complete tree without any branches or bounds checks.
+     * NaN values keep the event in its current node, so it stays there for all remaining levels.
+     * Invalid cuts must be replaced by sentinels beforehand (see CompiledForest).
+     */
+    template<unsigned long D>
+    struct UnrolledTraversal {
+      static unsigned long Node(const uint16_t *features, const float *cuts, const float *values, unsigned long node) {
+        const float value = values[features[node-1]];
+        const unsigned long child = (node << 1) + static_cast<unsigned long>(value >= cuts[node-1]);
+        return UnrolledTraversal<D-1>::Node(features, cuts, values, std::isnan(value) ? node : child);
+      }
+    };
+
+    template<>
+    struct UnrolledTraversal<0> {
+      static unsigned long Node(const uint16_t *, const float *, const float *, unsigned long node) {
+        return node;
+      }
+    };
+
+    /**
+     * Returns the size of the L2 cache in bytes, or 256kB if it cannot be determined
+     */
+    unsigned long GetL2CacheSize() {
+      long size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+      size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+      return (size > 0) ? static_cast<unsigned long>(size) : 256*1024ul;
+    }
+
+    struct QuickScorerCondition {
+      float threshold;
+      uint32_t tree;
+      std::vector<uint64_t> mask;
+    };
+
+  }
+
+  const uint16_t CompiledForest::invalidFeature;
+  const unsigned long CompiledForest::blockSize;
+  const unsigned long CompiledForest::maxUnrolledDepth;
+  const unsigned long CompiledForest::maxEventsPerTile;
+
+  CompiledForest::CompiledForest(const Forest<float> &forest) : shrinkage(forest.GetShrinkage()), F0(forest.GetF0()), transform2probability(forest.GetTransform2Probability()) {
+
+    F0_div_shrink = F0 / shrinkage;
+
+    const auto &trees = forest.GetForest();
+
+    // The arrays are filled here and handed over to the members at the end
+    std::vector<uint16_t> flat_features;
+    std::vector<float> flat_cuts;
+    std::vector<double> flat_gains;
+    std::vector<Weight> flat_boostWeights;
+    std::vector<uint32_t> flat_cutOffsets;
+    std::vector<uint32_t> flat_nodeOffsets;
+    std::vector<uint16_t> flat_unrolledFeatures;
+    std::vector<float> flat_unrolledCuts;
+    std::vector<Weight> flat_unrolledWeights;
+
+    unsigned long nCuts = 0;
+    unsigned long nNodes = 0;
+    for(const auto &tree : trees) {
+      nCuts += tree.GetCuts().size();
+      nNodes += tree.GetBoostWeights().size();
+    }
+
+    flat_features.reserve(nCuts);
+    flat_cuts.reserve(nCuts);
+    flat_gains.reserve(nCuts);
+    flat_boostWeights.reserve(nNodes);
+    flat_cutOffsets.reserve(trees.size() + 1);
+    flat_nodeOffsets.reserve(trees.size() + 1);
+
+    for(const auto &tree : trees) {
+      flat_cutOffsets.push_back(flat_features.size());
+      flat_nodeOffsets.push_back(flat_boostWeights.size());
+
+      for(const auto &cut : tree.GetCuts()) {
+        if(cut.valid and cut.feature >= invalidFeature) {
+          throw std::runtime_error("CompiledForest supports at most " + std::to_string(invalidFeature) + " features, but a cut on feature " + std::to_string(cut.feature) + " was found");
+        }
+        flat_features.push_back(cut.valid ? static_cast<uint16_t>(cut.feature) : invalidFeature);
+        flat_cuts.push_back(cut.index);
+        flat_gains.push_back(cut.valid ? cut.gain : 0.0);
+        if(cut.valid)
+          nFeatures = std::max(nFeatures, cut.feature + 1);
+      }
+
+      nNodeIds = std::max(nNodeIds, 2*tree.GetCuts().size() + 1);
+
+      for(const auto &boostWeight : tree.GetBoostWeights()) {
+        flat_boostWeights.push_back(boostWeight);
+      }
+    }
+    flat_cutOffsets.push_back(flat_features.size());
+    flat_nodeOffsets.push_back(flat_boostWeights.size());
+
+    // The vectorised traversal gathers the 16bit feature ids with 32bit loads,
+    // which read one feature id past the last cut
+    flat_features.push_back(invalidFeature);
+
+
+    // Trees trained by the ForestBuilder are complete and have all the same depth,
+    // in this case the depth-specialised kernels are used
+    unsigned long treeDepth = 0;
+    if(not trees.empty()) {
+      const unsigned long nTreeCuts = trees[0].GetCuts().size();
+      while(treeDepth <= maxUnrolledDepth and (1ul << treeDepth) - 1 < nTreeCuts)
+        ++treeDepth;
+      bool uniform = treeDepth >= 1 and treeDepth <= maxUnrolledDepth and nTreeCuts == (1ul << treeDepth) - 1;
+      for(const auto &tree : trees) {
+        if(tree.GetCuts().size() != nTreeCuts or tree.GetBoostWeights().size() < 2*nTreeCuts + 1)
+          uniform = false;
+      }
+      if(not uniform)
+        treeDepth = 0;
+    }
+
+    if(treeDepth > 0) {
+      depth = treeDepth;
+      const unsigned long nTreeCuts = (1ul << depth) - 1;
+      const unsigned long nTreeNodes = 2*nTreeCuts + 1;
+      flat_unrolledFeatures.reserve(trees.size() * nTreeCuts);
+      flat_unrolledCuts.reserve(trees.size() * nTreeCuts);
+      flat_unrolledWeights.reserve(trees.size() * nTreeNodes);
+
+      for(const auto &tree : trees) {
+        const auto &tree_cuts = tree.GetCuts();
+        const auto &tree_boostWeights = tree.GetBoostWeights();
+
+        // An event which reaches an invalid cut stops there, so all nodes below an invalid cut
+        // get the boost weight of the invalid cut. The invalid cut itself is replaced by a cut on feature 0
+        // with a NaN cut value, which sends every event to the left (or keeps it in the node for a NaN value).
+        std::vector<bool> stopped(nTreeNodes, false);
+        for(unsigned long iNode = 0; iNode < nTreeNodes; ++iNode) {
+          const unsigned long parent = (iNode - 1) / 2;
+          const bool below_stop = iNode > 0 and stopped[parent];
+          flat_unrolledWeights.push_back(below_stop ? flat_unrolledWeights[flat_unrolledWeights.size() - iNode + parent] : tree_boostWeights[iNode]);
+          if(iNode < nTreeCuts) {
+            stopped[iNode] = below_stop or not tree_cuts[iNode].valid;
+            flat_unrolledFeatures.push_back(stopped[iNode] ? 0 : static_cast<uint16_t>(tree_cuts[iNode].feature));
+            flat_unrolledCuts.push_back(stopped[iNode] ? std::numeric_limits<float>::quiet_NaN() : tree_cuts[iNode].index);
+          }
+        }
+      }
+    }
+
+    features = std::move(flat_features);
+    cuts = std::move(flat_cuts);
+    gains = std::move(flat_gains);
+    boostWeights = std::move(flat_boostWeights);
+    cutOffsets = std::move(flat_cutOffsets);
+    nodeOffsets = std::move(flat_nodeOffsets);
+    unrolledFeatures = std::move(flat_unrolledFeatures);
+    unrolledCuts = std::move(flat_unrolledCuts);
+    unrolledWeights = std::move(flat_unrolledWeights);
+
+    SetTileSizes(0, 0);
+    SetEarlyExitOrder(false);
+
+  }
+
+  template<unsigned long D>
+  double CompiledForest::GetFUnrolled(const float *values) const {
+
+    const unsigned long nTreeCuts = (1ul << D) - 1;
+    const unsigned long nTreeNodes = 2*nTreeCuts + 1;
+    const unsigned long nTrees = GetNTrees();
+    const uint16_t *tree_features = unrolledFeatures.data();
+    const float *tree_cuts = unrolledCuts.data();
+    const Weight *tree_boostWeights = unrolledWeights.data();
+
+    double F = F0_div_shrink;
+    for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+      F += tree_boostWeights[UnrolledTraversal<D>::Node(tree_features, tree_cuts, values, 1) - 1];
+      tree_features += nTreeCuts;
+      tree_cuts += nTreeCuts;
+      tree_boostWeights += nTreeNodes;
+    }
+    return F*shrinkage;
+
+  }
+
+  double CompiledForest::GetFUnrolled(const float *values) const {
+
+    switch(depth) {
+      case 1: return GetFUnrolled<1>(values);
+      case 2: return GetFUnrolled<2>(values);
+      case 3: return GetFUnrolled<3>(values);
+      case 4: return GetFUnrolled<4>(values);
+      case 5: return GetFUnrolled<5>(values);
+      case 6: return GetFUnrolled<6>(values);
+      case 7: return GetFUnrolled<7>(values);
+      case 8: return GetFUnrolled<8>(values);
+      case 9: return GetFUnrolled<9>(values);
+      case 10: return GetFUnrolled<10>(values);
+    }
+    throw std::runtime_error("No depth-specialised kernel for depth " + std::to_string(depth));
+
+  }
+
+  template<unsigned long D>
+  void CompiledForest::AddTreeToBlockUnrolled(unsigned long iTree, const float *block, unsigned long nBlock, unsigned long stride, double *F) const {
+
+    const unsigned long nTreeCuts = (1ul << D) - 1;
+    const unsigned long nTreeNodes = 2*nTreeCuts + 1;
+    const uint16_t *tree_features = &unrolledFeatures[iTree*nTreeCuts];
+    const float *tree_cuts = &unrolledCuts[iTree*nTreeCuts];
+    const Weight *tree_boostWeights = &unrolledWeights[iTree*nTreeNodes];
+
+    for(unsigned long iEvent = 0; iEvent < nBlock; ++iEvent) {
+      F[iEvent] += tree_boostWeights[UnrolledTraversal<D>::Node(tree_features, tree_cuts, block + iEvent*stride, 1) - 1];
+    }
+
+  }
+
+  void CompiledForest::SetEarlyExitOrder(bool sortByWeightRange) {
+
+    const unsigned long nTrees = GetNTrees();
+    std::vector<Weight> minWeights(nTrees), maxWeights(nTrees);
+    for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+      // Every node can be the final node of an event, due to NaN values and invalid cuts
+      const auto first = boostWeights.begin() + nodeOffsets[iTree];
+      const auto last = boostWeights.begin() + nodeOffsets[iTree+1];
+      minWeights[iTree] = (first == last) ? 0 : *std::min_element(first, last);
+      maxWeights[iTree] = (first == last) ? 0 : *std::max_element(first, last);
+    }
+
+    sortedExitOrder = sortByWeightRange;
+    std::vector<uint32_t> order(nTrees);
+    for(unsigned long iTree = 0; iTree < nTrees; ++iTree)
+      order[iTree] = iTree;
+    if(sortByWeightRange) {
+      std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return maxWeights[a] - minWeights[a] > maxWeights[b] - minWeights[b];
+      });
+    }
+
+    std::vector<double> minimum(nTrees + 1, 0.0);
+    std::vector<double> maximum(nTrees + 1, 0.0);
+    std::vector<double> absolute(nTrees + 1, 0.0);
+    for(unsigned long k = nTrees; k > 0; --k) {
+      const uint32_t iTree = order[k-1];
+      minimum[k-1] = minimum[k] + minWeights[iTree];
+      maximum[k-1] = maximum[k] + maxWeights[iTree];
+      absolute[k-1] = absolute[k] + std::max(std::fabs(minWeights[iTree]), std::fabs(maxWeights[iTree]));
+    }
+
+    std::vector<double> lowerBound(nTrees + 1, 0.0);
+    std::vector<double> upperBound(nTrees + 1, 0.0);
+    double evaluatedMin = 0.0;
+    double evaluatedMax = 0.0;
+    for(unsigned long k = 0; k <= nTrees; ++k) {
+      lowerBound[k] = evaluatedMax + minimum[k];
+      upperBound[k] = evaluatedMin + maximum[k];
+      if(k < nTrees) {
+        evaluatedMin += minWeights[order[k]];
+        evaluatedMax += maxWeights[order[k]];
+      }
+    }
+
+    exitOrder = std::move(order);
+    remainingMin = std::move(minimum);
+    remainingMax = std::move(maximum);
+    remainingAbs = std::move(absolute);
+    bestLowerBound = std::move(lowerBound);
+    bestUpperBound = std::move(upperBound);
+
+  }
+
+  void CompiledForest::GetThresholdBounds(float threshold, double &low, double &high) const {
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    // Same calculation as in Analyse, including the conversion to float done by Classifier::predict
+    auto output = [&](double F) -> float {
+      if(transform2probability)
+        return 1.0/(1.0+std::exp(-2*F));
+      return F;
+    };
+
+    double center = 0.0;
+    if(std::isnan(threshold)) {
+      low = high = infinity;
+      return;
+    }
+    if(transform2probability) {
+      if(threshold >= 1.0) {
+        low = high = infinity;
+        return;
+      }
+      if(threshold < 0.0) {
+        low = high = -infinity;
+        return;
+      }
+      center = (threshold > 0.0) ? 0.5*std::log(threshold / (1.0 - threshold)) : -400.0;
+    } else {
+      if(std::isinf(threshold)) {
+        low = high = threshold;
+        return;
+      }
+      center = threshold;
+    }
+
+    // Move away from the center until the output (which is monotonic in F) is on the correct side of the threshold,
+    // this takes care of all rounding effects in the transformation
+    double step = 1e-12 * (1.0 + std::fabs(center));
+    high = center;
+    while(not (output(high) > threshold)) {
+      high += step;
+      step *= 2;
+    }
+    step = 1e-12 * (1.0 + std::fabs(center));
+    low = center;
+    while(output(low) > threshold) {
+      low -= step;
+      step *= 2;
+    }
+
+  }
+
+  unsigned long CompiledForest::GetFirstPossibleExit(double low, double high) const {
+
+    const unsigned long nTrees = GetNTrees();
+    if(shrinkage <= 0.0)
+      return 0;
+
+    // The best bounds are monotonic in the number of evaluated trees, so a binary search finds the first one
+    // which can settle the outcome. Rounding errors only lead to later checks, never to wrong results.
+    auto possible = [&](unsigned long k) {
+      return (F0_div_shrink + bestLowerBound[k]) * shrinkage >= high or (F0_div_shrink + bestUpperBound[k]) * shrinkage <= low;
+    };
+    unsigned long first = 0;
+    unsigned long last = nTrees + 1;
+    while(first < last) {
+      const unsigned long middle = first + (last - first) / 2;
+      if(possible(middle))
+        last = middle;
+      else
+        first = middle + 1;
+    }
+    return first;
+
+  }
+
+  template<>
+  Weight CompiledForest::GetTreeWeight<0>(unsigned long iTree, const float *values) const {
+    return boostWeights[nodeOffsets[iTree] + ValueToNode(iTree, values)];
+  }
+
+  template<unsigned long D>
+  Weight CompiledForest::GetTreeWeight(unsigned long iTree, const float *values) const {
+    const unsigned long nTreeCuts = (1ul << D) - 1;
+    const unsigned long nTreeNodes = 2*nTreeCuts + 1;
+    return unrolledWeights[iTree*nTreeNodes + UnrolledTraversal<D>::Node(&unrolledFeatures[iTree*nTreeCuts], &unrolledCuts[iTree*nTreeCuts], values, 1) - 1];
+  }
+
+  template<unsigned long D>
+  bool CompiledForest::PredictAbove(const float *values, float threshold, double low, double high) const {
+
+    const unsigned long nTrees = GetNTrees();
+    // Upper limit of the relative rounding error of the sum, which depends on the order of the trees
+    const double relativeError = (nTrees + 2) * std::numeric_limits<double>::epsilon();
+
+    // The bounds are only checked every few trees, so the evaluation of the trees in between is not
+    // serialized by the branches depending on the sum
+    const unsigned long checkInterval = 8;
+
+    const unsigned long first = GetFirstPossibleExit(low, high);
+    if(first > nTrees)
+      return static_cast<float>(Analyse(values)) > threshold;
+
+    double F = F0_div_shrink;
+    unsigned long k = 0;
+    for(; k < first; ++k)
+      F += GetTreeWeight<D>(exitOrder[k], values);
+
+    while(true) {
+      const double tolerance = relativeError * (std::fabs(F) + remainingAbs[k]) * std::fabs(shrinkage);
+      const double a = (F + remainingMin[k]) * shrinkage;
+      const double b = (F + remainingMax[k]) * shrinkage;
+      if(std::min(a, b) - tolerance >= high)
+        return true;
+      if(std::max(a, b) + tolerance <= low)
+        return false;
+      if(k == nTrees)
+        break;
+      const unsigned long last = std::min(k + checkInterval, nTrees);
+      for(; k < last; ++k)
+        F += GetTreeWeight<D>(exitOrder[k], values);
+    }
+
+    // The F value is too close to the threshold, the exact calculation decides.
+    // In the original order the sum is exactly the same as in GetF.
+    if(not sortedExitOrder)
+      F *= shrinkage;
+    else
+      F = GetF(values);
+    if(transform2probability)
+      return static_cast<float>(1.0/(1.0+std::exp(-2*F))) > threshold;
+    return static_cast<float>(F) > threshold;
+
+  }
+
+  bool CompiledForest::PredictAbove(const float *values, float threshold, double low, double high) const {
+
+    switch(depth) {
+      case 1: return PredictAbove<1>(values, threshold, low, high);
+      case 2: return PredictAbove<2>(values, threshold, low, high);
+      case 3: return PredictAbove<3>(values, threshold, low, high);
+      case 4: return PredictAbove<4>(values, threshold, low, high);
+      case 5: return PredictAbove<5>(values, threshold, low, high);
+      case 6: return PredictAbove<6>(values, threshold, low, high);
+      case 7: return PredictAbove<7>(values, threshold, low, high);
+      case 8: return PredictAbove<8>(values, threshold, low, high);
+      case 9: return PredictAbove<9>(values, threshold, low, high);
+      case 10: return PredictAbove<10>(values, threshold, low, high);
+    }
+    return PredictAbove<0>(values, threshold, low, high);
+
+  }
+
+  bool CompiledForest::PredictAbove(const float *values, float threshold) const {
+
+    // The bounds depend only on the threshold and the transformation, and are usually the same for many calls
+    thread_local float cachedThreshold = std::numeric_limits<float>::quiet_NaN();
+    thread_local bool cachedTransform2probability = false;
+    thread_local double cachedLow = 0.0;
+    thread_local double cachedHigh = 0.0;
+    if(not (threshold == cachedThreshold and transform2probability == cachedTransform2probability)) {
+      GetThresholdBounds(threshold, cachedLow, cachedHigh);
+      cachedThreshold = threshold;
+      cachedTransform2probability = transform2probability;
+    }
+    return PredictAbove(values, threshold, cachedLow, cachedHigh);
+
+  }
+
+  void CompiledForest::PredictAbove(const float *values, unsigned long nEvents, unsigned long stride, float threshold, bool *result) const {
+
+    double low, high;
+    GetThresholdBounds(threshold, low, high);
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+      result[iEvent] = PredictAbove(values + iEvent*stride, threshold, low, high);
+
+  }
+
+  void CompiledForest::SetTileSizes(unsigned long _treesPerTile, unsigned long _eventsPerTile) {
+
+    if(_eventsPerTile > maxEventsPerTile) {
+      throw std::runtime_error("CompiledForest supports at most " + std::to_string(maxEventsPerTile) + " events per tile, but " + std::to_string(_eventsPerTile) + " were requested");
+    }
+
+    // The default number of trees per tile uses half of the L2 cache for the trees, the rest is left for the events
+    if(_treesPerTile == 0) {
+      const unsigned long nTrees = std::max(GetNTrees(), 1ul);
+      const unsigned long modelSize = features.size()*sizeof(uint16_t) + cuts.size()*sizeof(float) + boostWeights.size()*sizeof(Weight)
+                                    + unrolledFeatures.size()*sizeof(uint16_t) + unrolledCuts.size()*sizeof(float) + unrolledWeights.size()*sizeof(Weight);
+      const unsigned long treeSize = std::max(modelSize / nTrees, 1ul);
+      _treesPerTile = std::max(GetL2CacheSize() / 2 / treeSize, 1ul);
+    }
+    treesPerTile = _treesPerTile;
+    eventsPerTile = _eventsPerTile;
+
+  }
+
+  unsigned long CompiledForest::GetEventsPerTile(unsigned long stride) const {
+
+    if(eventsPerTile != 0)
+      return eventsPerTile;
+
+    // The events of one tile (and their F values) use a quarter of the L2 cache
+    const unsigned long eventSize = stride*sizeof(float) + sizeof(double);
+    const unsigned long nEvents = GetL2CacheSize() / 4 / eventSize;
+    return std::max(std::min(nEvents, maxEventsPerTile) / blockSize, 1ul) * blockSize;
+
+  }
+
+  void CompiledForest::GetF(const float *values, unsigned long nEvents, unsigned long stride, double *F) const {
+
+    const unsigned long nTrees = GetNTrees();
+    const unsigned long tileEvents = GetEventsPerTile(stride);
+
+    // All trees of a tree tile are applied to all events of an event tile, before the next tree tile is loaded.
+    // Each event still sums up the trees in their original order, so the result does not depend on the tile sizes.
+    for(unsigned long iFirstEvent = 0; iFirstEvent < nEvents; iFirstEvent += tileEvents) {
+      const unsigned long nTileEvents = std::min(tileEvents, nEvents - iFirstEvent);
+      const float *tile = values + iFirstEvent*stride;
+      double *tile_F = F + iFirstEvent;
+
+      for(unsigned long iEvent = 0; iEvent < nTileEvents; ++iEvent)
+        tile_F[iEvent] = F0_div_shrink;
+
+      for(unsigned long iFirstTree = 0; iFirstTree < nTrees; iFirstTree += treesPerTile) {
+        const unsigned long iLastTree = std::min(iFirstTree + treesPerTile, nTrees);
+        for(unsigned long iFirst = 0; iFirst < nTileEvents; iFirst += blockSize) {
+          const unsigned long nBlock = std::min(blockSize, nTileEvents - iFirst);
+          for(unsigned long iTree = iFirstTree; iTree < iLastTree; ++iTree) {
+            AddTreeToBlock(iTree, tile + iFirst*stride, nBlock, stride, tile_F + iFirst);
+          }
+        }
+      }
+
+      for(unsigned long iEvent = 0; iEvent < nTileEvents; ++iEvent)
+        tile_F[iEvent] *= shrinkage;
+    }
+
+  }
+
+  void CompiledForest::GetStagedF(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &checkpoints, double *F) const {
+
+    const unsigned long nTrees = GetNTrees();
+    const unsigned long nStages = checkpoints.size();
+    checkStagedCheckpoints(checkpoints, nTrees);
+
+    const unsigned long tileEvents = GetEventsPerTile(stride);
+    double tile_F[maxEventsPerTile];
+
+    // Same loops as in GetF, the running F values of a block are written out whenever a checkpoint is reached
+    for(unsigned long iFirstEvent = 0; iFirstEvent < nEvents; iFirstEvent += tileEvents) {
+      const unsigned long nTileEvents = std::min(tileEvents, nEvents - iFirstEvent);
+      const float *tile = values + iFirstEvent*stride;
+      double *tile_out = F + iFirstEvent*nStages;
+
+      for(unsigned long iEvent = 0; iEvent < nTileEvents; ++iEvent)
+        tile_F[iEvent] = F0_div_shrink;
+
+      unsigned long iFirstStage = 0;
+      for(; iFirstStage < nStages and checkpoints[iFirstStage] == 0; ++iFirstStage) {
+        for(unsigned long iEvent = 0; iEvent < nTileEvents; ++iEvent)
+          tile_out[iEvent*nStages + iFirstStage] = F0_div_shrink*shrinkage;
+      }
+
+      for(unsigned long iFirstTree = 0; iFirstTree < nTrees and iFirstStage < nStages; iFirstTree += treesPerTile) {
+        const unsigned long iLastTree = std::min(iFirstTree + treesPerTile, nTrees);
+        unsigned long iStage = iFirstStage;
+        for(unsigned long iFirst = 0; iFirst < nTileEvents; iFirst += blockSize) {
+          const unsigned long nBlock = std::min(blockSize, nTileEvents - iFirst);
+          iStage = iFirstStage;
+          for(unsigned long iTree = iFirstTree; iTree < iLastTree and iStage < nStages; ++iTree) {
+            AddTreeToBlock(iTree, tile + iFirst*stride, nBlock, stride, tile_F + iFirst);
+            for(; iStage < nStages and checkpoints[iStage] == iTree + 1; ++iStage) {
+              for(unsigned long iEvent = iFirst; iEvent < iFirst + nBlock; ++iEvent)
+                tile_out[iEvent*nStages + iStage] = tile_F[iEvent]*shrinkage;
+            }
+          }
+        }
+        iFirstStage = iStage;
+      }
+    }
+
+  }
+
+  void CompiledForest::AnalyseStaged(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &checkpoints, float *result) const {
+
+    const unsigned long nStages = checkpoints.size();
+    if(nStages == 0)
+      return;
+
+    // The F values are calculated for a few events at a time, the buffer is allocated once per call
+    const unsigned long chunkEvents = std::max(maxEventsPerTile / nStages, 1ul);
+    std::vector<double> F(chunkEvents*nStages);
+    for(unsigned long iFirst = 0; iFirst < nEvents; iFirst += chunkEvents) {
+      const unsigned long nChunk = std::min(chunkEvents, nEvents - iFirst);
+      GetStagedF(values + iFirst*stride, nChunk, stride, checkpoints, F.data());
+      for(unsigned long i = 0; i < nChunk*nStages; ++i) {
+        if(transform2probability)
+          result[iFirst*nStages + i] = 1.0/(1.0+std::exp(-2*F[i]));
+        else
+          result[iFirst*nStages + i] = F[i];
+      }
+    }
+
+  }
+
+  template<typename NodeId>
+  void CompiledForest::FillLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, NodeId *nodes) const {
+
+    if(nNodeIds > std::numeric_limits<NodeId>::max() + 1ul) {
+      throw std::runtime_error("The node ids of the forest go up to " + std::to_string(nNodeIds - 1) + " and do not fit into " + std::to_string(8*sizeof(NodeId)) + " bits");
+    }
+
+    // A tree is applied to a whole block of events, so it stays in the cache
+    const unsigned long nTrees = GetNTrees();
+    for(unsigned long iFirst = 0; iFirst < nEvents; iFirst += blockSize) {
+      const unsigned long nBlock = std::min(blockSize, nEvents - iFirst);
+      const float *block = values + iFirst*stride;
+      NodeId *block_nodes = nodes + iFirst*nTrees;
+      for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+        for(unsigned long iEvent = 0; iEvent < nBlock; ++iEvent)
+          block_nodes[iEvent*nTrees + iTree] = static_cast<NodeId>(ValueToNode(iTree, block + iEvent*stride));
+      }
+    }
+
+  }
+
+  void CompiledForest::GetLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, uint16_t *nodes) const {
+    FillLeafIndices(values, nEvents, stride, nodes);
+  }
+
+  void CompiledForest::GetLeafIndices(const float *values, unsigned long nEvents, unsigned long stride, uint8_t *nodes) const {
+    FillLeafIndices(values, nEvents, stride, nodes);
+  }
+
+  void CompiledForest::AddTreeToBlock(unsigned long iTree, const float *block, unsigned long nBlock, unsigned long stride, double *F) const {
+
+    const Weight *tree_boostWeights = &boostWeights[nodeOffsets[iTree]];
+    unsigned long iEvent = 0;
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    // The events of one group are addressed with 32bit offsets relative to the first event of the group
+    if(stride <= (1ul << 26)) {
+      const unsigned long nCuts = cutOffsets[iTree+1] - cutOffsets[iTree];
+      // Each level at least doubles the node number, so after this many levels all events left the inner nodes
+      const unsigned long nLevels = (nCuts == 0) ? 0 : 64 - __builtin_clzl(nCuts);
+      const uint16_t *tree_features = &features[cutOffsets[iTree]];
+      const float *tree_cuts = &cuts[cutOffsets[iTree]];
+#if defined(__AVX512F__)
+      // 16 events per group, the lanes which left the tree (NaN value, invalid cut or leaf node) are masked out
+      const __m512i one = _mm512_set1_epi32(1);
+      const __m512i limit = _mm512_set1_epi32(nCuts + 1);
+      const __m512i featureMask = _mm512_set1_epi32(0xFFFF);
+      const __m512i invalid = _mm512_set1_epi32(invalidFeature);
+      const __m512i rowOffsets = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(stride));
+      for(; iEvent + 16 <= nBlock; iEvent += 16) {
+        const float *events = block + iEvent*stride;
+        __m512i node = one;
+        for(unsigned long iLevel = 0; iLevel < nLevels; ++iLevel) {
+          __mmask16 active = _mm512_cmplt_epi32_mask(node, limit);
+          if(active == 0)
+            break;
+          const __m512i index = _mm512_sub_epi32(node, one);
+          __m512i feature = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, index, tree_features, 2);
+          feature = _mm512_and_si512(feature, featureMask);
+          active = _mm512_mask_cmpneq_epi32_mask(active, feature, invalid);
+          const __m512 value = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, _mm512_add_epi32(rowOffsets, feature), events, 4);
+          const __m512 cut = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), active, index, tree_cuts, 4);
+          active = _mm512_mask_cmp_ps_mask(active, value, value, _CMP_ORD_Q);
+          const __mmask16 right = _mm512_mask_cmp_ps_mask(active, value, cut, _CMP_GE_OQ);
+          node = _mm512_mask_add_epi32(node, active, node, node);
+          node = _mm512_mask_add_epi32(node, right, node, one);
+        }
+        const __m512 weight = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, _mm512_sub_epi32(node, one), tree_boostWeights, 4);
+        // The zero-masked forms avoid the undefined pass-through operand of the unmasked intrinsics (-Wmaybe-uninitialized)
+        const __m256 weight_low = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(weight), 0));
+        const __m256 weight_high = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(weight), 1));
+        _mm512_storeu_pd(F + iEvent, _mm512_add_pd(_mm512_loadu_pd(F + iEvent), _mm512_maskz_cvtps_pd(0xFF, weight_low)));
+        _mm512_storeu_pd(F + iEvent + 8, _mm512_add_pd(_mm512_loadu_pd(F + iEvent + 8), _mm512_maskz_cvtps_pd(0xFF, weight_high)));
+      }
+#else
+      // 8 events per group, the lanes which left the tree (NaN value, invalid cut or leaf node) are masked out
+      const __m256i one = _mm256_set1_epi32(1);
+      const __m256i limit = _mm256_set1_epi32(nCuts + 1);
+      const __m256i featureMask = _mm256_set1_epi32(0xFFFF);
+      const __m256i invalid = _mm256_set1_epi32(invalidFeature);
+      const __m256i rowOffsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+      const int *tree_features_int = reinterpret_cast<const int*>(tree_features);
+      for(; iEvent + 8 <= nBlock; iEvent += 8) {
+        const float *events = block + iEvent*stride;
+        __m256i node = one;
+        for(unsigned long iLevel = 0; iLevel < nLevels; ++iLevel) {
+          __m256i active = _mm256_cmpgt_epi32(limit, node);
+          if(_mm256_testz_si256(active, active))
+            break;
+          const __m256i index = _mm256_sub_epi32(node, one);
+          __m256i feature = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), tree_features_int, index, active, 2);
+          feature = _mm256_and_si256(feature, featureMask);
+          active = _mm256_andnot_si256(_mm256_cmpeq_epi32(feature, invalid), active);
+          const __m256 value = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), events, _mm256_add_epi32(rowOffsets, feature), _mm256_castsi256_ps(active), 4);
+          const __m256 cut = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), tree_cuts, index, _mm256_castsi256_ps(active), 4);
+          active = _mm256_and_si256(active, _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_ORD_Q)));
+          const __m256i right = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cmp_ps(value, cut, _CMP_GE_OQ)), 31);
+          const __m256i child = _mm256_add_epi32(_mm256_add_epi32(node, node), right);
+          node = _mm256_blendv_epi8(node, child, active);
+        }
+        const __m256 weight = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), tree_boostWeights, _mm256_sub_epi32(node, one), _mm256_castsi256_ps(_mm256_set1_epi32(-1)), 4);
+        _mm256_storeu_pd(F + iEvent, _mm256_add_pd(_mm256_loadu_pd(F + iEvent), _mm256_cvtps_pd(_mm256_castps256_ps128(weight))));
+        _mm256_storeu_pd(F + iEvent + 4, _mm256_add_pd(_mm256_loadu_pd(F + iEvent + 4), _mm256_cvtps_pd(_mm256_extractf128_ps(weight, 1))));
+      }
+#endif
+    }
+#endif
+
+    // Remaining events (or all events if no vector instructions are available)
+    block += iEvent*stride;
+    nBlock -= iEvent;
+    F += iEvent;
+    switch(depth) {
+      case 1: return AddTreeToBlockUnrolled<1>(iTree, block, nBlock, stride, F);
+      case 2: return AddTreeToBlockUnrolled<2>(iTree, block, nBlock, stride, F);
+      case 3: return AddTreeToBlockUnrolled<3>(iTree, block, nBlock, stride, F);
+      case 4: return AddTreeToBlockUnrolled<4>(iTree, block, nBlock, stride, F);
+      case 5: return AddTreeToBlockUnrolled<5>(iTree, block, nBlock, stride, F);
+      case 6: return AddTreeToBlockUnrolled<6>(iTree, block, nBlock, stride, F);
+      case 7: return AddTreeToBlockUnrolled<7>(iTree, block, nBlock, stride, F);
+      case 8: return AddTreeToBlockUnrolled<8>(iTree, block, nBlock, stride, F);
+      case 9: return AddTreeToBlockUnrolled<9>(iTree, block, nBlock, stride, F);
+      case 10: return AddTreeToBlockUnrolled<10>(iTree, block, nBlock, stride, F);
+    }
+    for(iEvent = 0; iEvent < nBlock; ++iEvent) {
+      F[iEvent] += tree_boostWeights[ValueToNode(iTree, block + iEvent*stride)];
+    }
+
+  }
+
+  void CompiledForest::Analyse(const float *values, unsigned long nEvents, unsigned long stride, float *result) const {
+
+    double F[maxEventsPerTile];
+    const unsigned long tileEvents = GetEventsPerTile(stride);
+    for(unsigned long iFirst = 0; iFirst < nEvents; iFirst += tileEvents) {
+      const unsigned long nBlock = std::min(tileEvents, nEvents - iFirst);
+      GetF(values + iFirst*stride, nBlock, stride, F);
+      for(unsigned long iEvent = 0; iEvent < nBlock; ++iEvent) {
+        if(transform2probability)
+          result[iFirst + iEvent] = 1.0/(1.0+std::exp(-2*F[iEvent]));
+        else
+          result[iFirst + iEvent] = F[iEvent];
+      }
+    }
+
+  }
+
+  void CompiledForest::GetIndividualVariableRanking(const float *values, unsigned long nEvents, unsigned long stride, const std::vector<unsigned long> &columns, unsigned long nColumns, double *ranking) const {
+
+    if(columns.size() < nFeatures) {
+      throw std::runtime_error("The forest uses " + std::to_string(nFeatures) + " features, but only " + std::to_string(columns.size()) + " columns were given");
+    }
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+      if(columns[iFeature] >= nColumns)
+        throw std::runtime_error("Column " + std::to_string(columns[iFeature]) + " of feature " + std::to_string(iFeature) + " is out of range");
+    }
+
+    const unsigned long nTrees = GetNTrees();
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+      const float *event = values + iEvent*stride;
+      double *row = ranking + iEvent*nColumns;
+      std::fill(row, row + nColumns, 0.0);
+
+      // Same traversal as ValueToNode, the gain of every passed cut is added on the way down
+      for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+        const uint16_t *tree_features = &features[cutOffsets[iTree]];
+        const float *tree_cuts = &cuts[cutOffsets[iTree]];
+        const double *tree_gains = &gains[cutOffsets[iTree]];
+        const unsigned long nCuts = cutOffsets[iTree+1] - cutOffsets[iTree];
+
+        unsigned long node = 1;
+        while( node <= nCuts ) {
+          const uint16_t feature = tree_features[node-1];
+          if(feature == invalidFeature)
+            break;
+          const float value = event[feature];
+          if(std::isnan(value))
+            break;
+          row[columns[feature]] += tree_gains[node-1];
+          node = (node << 1) + static_cast<unsigned long>(value >= tree_cuts[node-1]);
+        }
+      }
+
+      double norm = 0;
+      for(unsigned long iColumn = 0; iColumn < nColumns; ++iColumn)
+        norm += row[iColumn];
+      if(norm != 0) {
+        for(unsigned long iColumn = 0; iColumn < nColumns; ++iColumn)
+          row[iColumn] /= norm;
+      }
+    }
+
+  }
+
+  const unsigned long QuickScorerForest::maxNodes;
+
+  QuickScorerForest::QuickScorerForest(const Forest<float> &forest) : shrinkage(forest.GetShrinkage()), transform2probability(forest.GetTransform2Probability()) {
+
+    F0_div_shrink = forest.GetF0() / shrinkage;
+
+    const auto &trees = forest.GetForest();
+    nTrees = trees.size();
+
+    for(const auto &tree : trees) {
+      const auto &cuts = tree.GetCuts();
+      const unsigned long nTreeNodes = 2*cuts.size() + 1;
+      if(tree.GetBoostWeights().size() < nTreeNodes) {
+        throw std::runtime_error("QuickScorerForest requires complete trees, but a tree with " + std::to_string(cuts.size()) + " cuts and " + std::to_string(tree.GetBoostWeights().size()) + " nodes was found");
+      }
+      if(nTreeNodes > maxNodes) {
+        throw std::runtime_error("QuickScorerForest supports trees with at most " + std::to_string(maxNodes) + " nodes, but a tree with " + std::to_string(nTreeNodes) + " nodes was found");
+      }
+      nNodes = std::max(nNodes, nTreeNodes);
+      for(const auto &cut : cuts) {
+        if(cut.valid)
+          nFeatures = std::max(nFeatures, cut.feature + 1);
+      }
+    }
+    nWords = (nNodes + 63) / 64;
+
+    std::vector<std::vector<QuickScorerCondition>> conditions(nFeatures);
+    std::vector<std::vector<QuickScorerCondition>> nanConditions(nFeatures);
+    initialBitvectors.resize(nTrees*nWords, 0);
+    exitWeights.resize(nTrees*nNodes, 0);
+
+    for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+      const auto &cuts = trees[iTree].GetCuts();
+      const auto &boostWeights = trees[iTree].GetBoostWeights();
+      const unsigned long nCuts = cuts.size();
+      const unsigned long nTreeNodes = 2*nCuts + 1;
+
+      std::vector<unsigned long> first(nTreeNodes);
+      std::vector<unsigned long> position(nTreeNodes);
+      unsigned long counter = 0;
+      AssignPostOrderPositions(0, nCuts, counter, first, position);
+
+      uint64_t *bitvector = &initialBitvectors[iTree*nWords];
+      for(unsigned long iNode = 0; iNode < nTreeNodes; ++iNode) {
+        exitWeights[iTree*nNodes + position[iNode]] = boostWeights[iNode];
+        bitvector[position[iNode] / 64] |= uint64_t(1) << (position[iNode] % 64);
+      }
+
+      // Nodes below an invalid cut are never reached, so their cuts can be skipped
+      std::vector<bool> reachable(nTreeNodes, true);
+      for(unsigned long iNode = 0; iNode < nCuts; ++iNode) {
+        const auto &cut = cuts[iNode];
+        if(not reachable[iNode] or not cut.valid) {
+          reachable[2*iNode + 1] = false;
+          reachable[2*iNode + 2] = false;
+        }
+        if(not reachable[iNode])
+          continue;
+
+        const unsigned long right = 2*iNode + 2;
+        if(not cut.valid) {
+          // The event always stops in this node
+          ClearBits(bitvector, first[iNode], position[iNode]);
+          continue;
+        }
+
+        QuickScorerCondition nanCondition{cut.index, static_cast<uint32_t>(iTree), std::vector<uint64_t>(nWords, ~uint64_t(0))};
+        ClearBits(nanCondition.mask.data(), first[iNode], position[iNode]);
+        nanConditions[cut.feature].push_back(nanCondition);
+
+        // value >= NaN is never true, so the event always goes to the left child
+        if(std::isnan(cut.index))
+          continue;
+
+        QuickScorerCondition condition{cut.index, static_cast<uint32_t>(iTree), std::vector<uint64_t>(nWords, ~uint64_t(0))};
+        ClearBits(condition.mask.data(), first[iNode], first[right]);
+        conditions[cut.feature].push_back(condition);
+      }
+    }
+
+    thresholdOffsets.push_back(0);
+    nanOffsets.push_back(0);
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+      auto &feature_conditions = conditions[iFeature];
+      std::stable_sort(feature_conditions.begin(), feature_conditions.end(), [](const QuickScorerCondition &a, const QuickScorerCondition &b) { return a.threshold < b.threshold; });
+      for(const auto &condition : feature_conditions) {
+        thresholds.push_back(condition.threshold);
+        thresholdTrees.push_back(condition.tree);
+        thresholdMasks.insert(thresholdMasks.end(), condition.mask.begin(), condition.mask.end());
+      }
+      thresholdOffsets.push_back(thresholds.size());
+
+      for(const auto &condition : nanConditions[iFeature]) {
+        nanTrees.push_back(condition.tree);
+        nanMasks.insert(nanMasks.end(), condition.mask.begin(), condition.mask.end());
+      }
+      nanOffsets.push_back(nanTrees.size());
+    }
+
+  }
+
+  double QuickScorerForest::GetF(const float *values) const {
+
+    if(nWords == 1)
+      return GetF<1>(values);
+    return GetF<2>(values);
+
+  }
+
+  template<unsigned long N>
+  double QuickScorerForest::GetF(const float *values) const {
+
+    // The bitvectors are reused by all calls of the same thread
+    thread_local std::vector<uint64_t> bitvectors;
+    bitvectors.assign(initialBitvectors.begin(), initialBitvectors.end());
+    uint64_t *bitvector_data = bitvectors.data();
+
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+      const float value = values[iFeature];
+      if(std::isnan(value)) {
+        for(unsigned long iCondition = nanOffsets[iFeature]; iCondition < nanOffsets[iFeature+1]; ++iCondition) {
+          uint64_t *bitvector = bitvector_data + nanTrees[iCondition]*N;
+          for(unsigned long iWord = 0; iWord < N; ++iWord)
+            bitvector[iWord] &= nanMasks[iCondition*N + iWord];
+        }
+      } else {
+        // The cut values are sorted, so we can stop at the first cut value which is larger than the value
+        const unsigned long last = thresholdOffsets[iFeature+1];
+        for(unsigned long iCondition = thresholdOffsets[iFeature]; iCondition < last and thresholds[iCondition] <= value; ++iCondition) {
+          uint64_t *bitvector = bitvector_data + thresholdTrees[iCondition]*N;
+          for(unsigned long iWord = 0; iWord < N; ++iWord)
+            bitvector[iWord] &= thresholdMasks[iCondition*N + iWord];
+        }
+      }
+    }
+
+    double F = F0_div_shrink;
+    for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+      // The bit of the root node is never cleared, so there is always a bit set
+      const uint64_t *bitvector = bitvector_data + iTree*N;
+      unsigned long iWord = 0;
+      while(bitvector[iWord] == 0)
+        ++iWord;
+      const unsigned long exit = iWord*64 + __builtin_ctzll(bitvector[iWord]);
+      F += exitWeights[iTree*nNodes + exit];
+    }
+    return F*shrinkage;
+
+  }
+
+}
@@ -0,0 +1,220 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Parallel loader for training data stored in whitespace or comma separated text files
+ */
+
+#include "FastBDT_Loader.h"
+#include "FastBDT_IO.h"
+#include "FastBDT_Parallel.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FastBDT {
+
+  namespace {
+
+    inline bool IsSeparator(char c) {
+      return c == ' ' or c == ',' or c == '\t' or c == '\r' or c == '\v' or c == '\f';
+    }
+
+    /**
+     * Returns the position of the newline which ends the line starting at the given position, or end
+     */
+    inline const char* FindLineEnd(const char *position, const char *end) {
+      const void *newline = std::memchr(position, '\n', end - position);
+      return (newline == nullptr) ? end : static_cast<const char*>(newline);
+    }
+
+    /**
+     * Returns the start of the next line, or end
+     */
+    inline const char* NextLine(const char *position, const char *end) {
+      const char *lineEnd = FindLineEnd(position, end);
+      return (lineEnd == end) ? end : lineEnd + 1;
+    }
+
+    inline const char* SkipSeparators(const char *position, const char *lineEnd) {
+      while(position != lineEnd and IsSeparator(*position))
+        ++position;
+      return position;
+    }
+
+    /**
+     * Calls function(line, lineEnd) for each line in [begin, end) which contains at least one value
+     */
+    template<class Function>
+    void ForEachEvent(const char *begin, const char *end, const Function &function) {
+      for(const char *line = begin; line != end; line = NextLine(line, end)) {
+        const char *lineEnd = FindLineEnd(line, end);
+        if(SkipSeparators(line, lineEnd) != lineEnd)
+          function(line, lineEnd);
+      }
+    }
+
+    unsigned long CountColumns(const char *line, const char *lineEnd) {
+      unsigned long nColumns = 0;
+      for(const char *position = SkipSeparators(line, lineEnd); position != lineEnd; position = SkipSeparators(position, lineEnd)) {
+        while(position != lineEnd and not IsSeparator(*position))
+          ++position;
+        ++nColumns;
+      }
+      return nColumns;
+    }
+
+    /**
+     * Converts a column index which may count from the end of the line into a column index counting from the start
+     */
+    unsigned long ResolveColumn(long column, unsigned long nColumns, const std::string &name) {
+      const long resolved = (column < 0) ? static_cast<long>(nColumns) + column : column;
+      if(resolved < 0 or resolved >= static_cast<long>(nColumns))
+        throw std::runtime_error("The " + name + " column " + std::to_string(column) + " does not exist, the data has " + std::to_string(nColumns) + " columns");
+      return resolved;
+    }
+
+  }
+
+  void loadTextData(const std::string &filename, std::vector<std::vector<float>> &X, std::vector<bool> &y, std::vector<Weight> &w,
+                    unsigned long skipLines, long labelColumn, long weightColumn, unsigned long nThreads) {
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+      throw std::runtime_error("Could not open data file " + filename + ": " + std::strerror(errno));
+
+    struct stat status;
+    if(fstat(fd, &status) != 0) {
+      close(fd);
+      throw std::runtime_error("Could not map data file " + filename);
+    }
+    const unsigned long size = status.st_size;
+    if(size == 0) {
+      close(fd);
+      loadTextData("", 0, X, y, w, skipLines, labelColumn, weightColumn, nThreads);
+      return;
+    }
+
+    // The mapping stays valid after the file descriptor is closed
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+      throw std::runtime_error("Could not map data file " + filename + ": " + std::strerror(errno));
+
+    // The file is read twice (counting and parsing), so the pages must not be dropped after the first read like with MADV_SEQUENTIAL
+    madvise(mapping, size, MADV_WILLNEED);
+
+    try {
+      loadTextData(static_cast<const char*>(mapping), size, X, y, w, skipLines, labelColumn, weightColumn, nThreads);
+    } catch(...) {
+      munmap(mapping, size);
+      throw;
+    }
+    munmap(mapping, size);
+
+  }
+
+  void loadTextData(const char *data, unsigned long size, std::vector<std::vector<float>> &X, std::vector<bool> &y, std::vector<Weight> &w,
+                    unsigned long skipLines, long labelColumn, long weightColumn, unsigned long nThreads) {
+
+    const char *end = data + size;
+    const char *begin = data;
+    for(unsigned long iLine = 0; iLine < skipLines; ++iLine)
+      begin = NextLine(begin, end);
+
+    // The number of columns is taken from the first event
+    unsigned long nColumns = 0;
+    for(const char *line = begin; line != end and nColumns == 0; line = NextLine(line, end))
+      nColumns = CountColumns(line, FindLineEnd(line, end));
+    if(nColumns == 0)
+      throw std::runtime_error("The data contains no events");
+
+    // Each column is either a feature, the label or the weight
+    const unsigned long labelTarget = nColumns;
+    const unsigned long weightTarget = nColumns + 1;
+    std::vector<unsigned long> targets(nColumns, 0);
+    targets[ResolveColumn(labelColumn, nColumns, "label")] = labelTarget;
+    if(weightColumn != noColumn) {
+      const unsigned long iWeightColumn = ResolveColumn(weightColumn, nColumns, "weight");
+      if(targets[iWeightColumn] == labelTarget)
+        throw std::runtime_error("The label and the weight column must be different");
+      targets[iWeightColumn] = weightTarget;
+    }
+    unsigned long nFeatures = 0;
+    for(auto &target : targets) {
+      if(target == 0)
+        target = nFeatures++;
+    }
+    if(nFeatures == 0)
+      throw std::runtime_error("The data contains no features");
+
+    // The text is split at line boundaries into one chunk per thread, small texts are not split
+    nThreads = GetNumberOfThreads(nThreads);
+    const unsigned long minChunkSize = 1ul << 20;
+    const unsigned long nChunks = std::max(1ul, std::min(nThreads, static_cast<unsigned long>(end - begin) / minChunkSize));
+    std::vector<const char*> boundaries(nChunks + 1, end);
+    boundaries[0] = begin;
+    for(unsigned long iChunk = 1; iChunk < nChunks; ++iChunk)
+      boundaries[iChunk] = NextLine(std::max(begin + (end - begin) / nChunks * iChunk, boundaries[iChunk - 1]), end);
+
+    // The events of each chunk are counted first, so the chunks can be parsed directly into the final columns
+    std::vector<unsigned long> offsets(nChunks + 1, 0);
+    ParallelFor(nChunks, nThreads, 1, [&](unsigned long first, unsigned long last) {
+      for(unsigned long iChunk = first; iChunk < last; ++iChunk) {
+        unsigned long nEvents = 0;
+        ForEachEvent(boundaries[iChunk], boundaries[iChunk + 1], [&](const char*, const char*) { ++nEvents; });
+        offsets[iChunk + 1] = nEvents;
+      }
+    });
+    for(unsigned long iChunk = 0; iChunk < nChunks; ++iChunk)
+      offsets[iChunk + 1] += offsets[iChunk];
+    const unsigned long nEvents = offsets[nChunks];
+
+    X.assign(nFeatures, std::vector<float>(nEvents));
+    w.assign(nEvents, 1.0);
+    // std::vector<bool> cannot be written by several threads
+    std::vector<char> labels(nEvents);
+
+    std::vector<float*> columns(nFeatures);
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature)
+      columns[iFeature] = X[iFeature].data();
+
+    ParallelFor(nChunks, nThreads, 1, [&](unsigned long first, unsigned long last) {
+      for(unsigned long iChunk = first; iChunk < last; ++iChunk) {
+        unsigned long iEvent = offsets[iChunk];
+        ForEachEvent(boundaries[iChunk], boundaries[iChunk + 1], [&](const char *line, const char *lineEnd) {
+          unsigned long iColumn = 0;
+          for(const char *position = SkipSeparators(line, lineEnd); position != lineEnd; position = SkipSeparators(position, lineEnd)) {
+            const char *token = position;
+            while(position != lineEnd and not IsSeparator(*position))
+              ++position;
+            if(iColumn < nColumns) {
+              const float value = convert_to_float_fast(token, position - token);
+              const unsigned long target = targets[iColumn];
+              if(target < nFeatures)
+                columns[target][iEvent] = value;
+              else if(target == labelTarget)
+                labels[iEvent] = value == 1;
+              else
+                w[iEvent] = value;
+            }
+            ++iColumn;
+          }
+          if(iColumn != nColumns)
+            throw std::runtime_error("Event " + std::to_string(iEvent) + " has " + std::to_string(iColumn) + " columns, but the first event has " + std::to_string(nColumns));
+          ++iEvent;
+        });
+      }
+    });
+
+    y.assign(labels.begin(), labels.end());
+
+  }
+
+}
@@ -0,0 +1,336 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Memory-mappable model format and a classifier which predicts directly on the mapped memory
+ */
+
+#include "FastBDT_Mapped.h"
+#include "FastBDT_Parallel.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FastBDT {
+
+  namespace {
+
+    /**
+     * Contiguous elements which are written as one array of a mapped weightfile
+     */
+    struct Block {
+      const void *data;
+      uint64_t size;
+      uint64_t elementSize;
+    };
+
+    template<class T>
+    Block MakeBlock(const ForestArray<T> &array) {
+      return {array.data(), array.size(), sizeof(T)};
+    }
+
+    template<class T>
+    Block MakeBlock(const std::vector<T> &array) {
+      return {array.data(), array.size(), sizeof(T)};
+    }
+
+    uint64_t Align(uint64_t position) {
+      return (position + MappedFormat::alignment - 1) / MappedFormat::alignment * MappedFormat::alignment;
+    }
+
+    /**
+     * Points the array to the array with the given id in the file, throws if it does not fit into the file
+     */
+    template<class T>
+    void View(const char *data, const MappedFormat::Header &header, MappedFormat::Array id, ForestArray<T> &array) {
+      const auto &entry = header.arrays[id];
+      if(entry.offset % sizeof(T) != 0 or entry.offset > header.fileSize or entry.size > (header.fileSize - entry.offset) / sizeof(T))
+        throw std::runtime_error("Array " + std::to_string(id) + " of the mapped weightfile is out of bounds");
+      array.SetView(reinterpret_cast<const T*>(data + entry.offset), entry.size);
+    }
+
+    void Check(bool condition, const std::string &message) {
+      if(not condition)
+        throw std::runtime_error("Mapped weightfile is corrupt: " + message);
+    }
+
+  }
+
+  MappedClassifier::MappedClassifier(const std::string &weightfile) {
+
+    const int fd = open(weightfile.c_str(), O_RDONLY);
+    if(fd < 0)
+      throw std::runtime_error("Could not open weightfile " + weightfile + ": " + std::strerror(errno));
+
+    struct stat status;
+    if(fstat(fd, &status) != 0 or status.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("Could not map weightfile " + weightfile);
+    }
+    mappingSize = status.st_size;
+
+    // The mapping stays valid after the file descriptor is closed
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+      mapping = nullptr;
+      throw std::runtime_error("Could not map weightfile " + weightfile + ": " + std::strerror(errno));
+    }
+
+    try {
+      Map(static_cast<const char*>(mapping), mappingSize);
+    } catch(...) {
+      munmap(mapping, mappingSize);
+      throw;
+    }
+
+  }
+
+  MappedClassifier::MappedClassifier(const char *data, unsigned long size) {
+    Map(data, size);
+  }
+
+  MappedClassifier::~MappedClassifier() {
+    if(mapping != nullptr)
+      munmap(mapping, mappingSize);
+  }
+
+  void MappedClassifier::Save(const Classifier &classifier, std::ostream &stream) {
+
+    const CompiledForest &forest = classifier.m_compiled_forest;
+
+    // The feature binnings and purity transformations are flattened in the same way as the forest
+    std::vector<uint32_t> columns;
+    std::vector<uint32_t> levels;
+    std::vector<uint64_t> offsets = {0};
+    std::vector<float> binnings;
+    std::vector<uint32_t> mappings;
+    if(not classifier.m_can_use_fast_forest) {
+      unsigned long pFeature = 0;
+      for(unsigned long iFeature = 0; iFeature < classifier.m_numberOfFeatures; ++iFeature) {
+        if(not classifier.m_purityTransformation[iFeature])
+          continue;
+        const auto &featureBinning = classifier.m_featureBinning[iFeature];
+        const auto binning = featureBinning.GetBinning();
+        const auto mapping = classifier.m_purityBinning[pFeature].GetMapping();
+        if(binning.size() != featureBinning.GetNBins() or mapping.size() != binning.size())
+          throw std::runtime_error("The purity transformation of feature " + std::to_string(iFeature) + " does not match its binning");
+        columns.push_back(iFeature);
+        levels.push_back(featureBinning.GetNLevels());
+        binnings.insert(binnings.end(), binning.begin(), binning.end());
+        mappings.insert(mappings.end(), mapping.begin(), mapping.end());
+        offsets.push_back(binnings.size());
+        pFeature++;
+      }
+    }
+
+    const Block blocks[MappedFormat::nArrays] = {
+      MakeBlock(forest.features), MakeBlock(forest.cuts), MakeBlock(forest.boostWeights),
+      MakeBlock(forest.cutOffsets), MakeBlock(forest.nodeOffsets), MakeBlock(forest.gains),
+      MakeBlock(forest.unrolledFeatures), MakeBlock(forest.unrolledCuts), MakeBlock(forest.unrolledWeights),
+      MakeBlock(forest.exitOrder), MakeBlock(forest.remainingMin), MakeBlock(forest.remainingMax), MakeBlock(forest.remainingAbs),
+      MakeBlock(forest.bestLowerBound), MakeBlock(forest.bestUpperBound),
+      MakeBlock(columns), MakeBlock(levels), MakeBlock(offsets), MakeBlock(binnings), MakeBlock(mappings)
+    };
+
+    MappedFormat::Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MappedFormat::magic, sizeof(header.magic));
+    header.version = MappedFormat::version;
+    header.byteOrder = MappedFormat::byteOrder;
+    header.shrinkage = forest.shrinkage;
+    header.F0 = forest.F0;
+    header.transform2probability = forest.transform2probability;
+    header.sortedExitOrder = forest.sortedExitOrder;
+    header.nFeatures = forest.nFeatures;
+    header.nNodeIds = forest.nNodeIds;
+    header.depth = forest.depth;
+    header.numberOfFeatures = classifier.m_numberOfFeatures;
+
+    uint64_t position = Align(sizeof(header));
+    for(unsigned long iArray = 0; iArray < MappedFormat::nArrays; ++iArray) {
+      header.arrays[iArray].offset = position;
+      header.arrays[iArray].size = blocks[iArray].size;
+      position = Align(position + blocks[iArray].size * blocks[iArray].elementSize);
+    }
+    header.fileSize = position;
+
+    const char padding[MappedFormat::alignment] = {};
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    position = sizeof(header);
+    for(unsigned long iArray = 0; iArray < MappedFormat::nArrays; ++iArray) {
+      stream.write(padding, header.arrays[iArray].offset - position);
+      const uint64_t nBytes = blocks[iArray].size * blocks[iArray].elementSize;
+      stream.write(static_cast<const char*>(blocks[iArray].data), nBytes);
+      position = header.arrays[iArray].offset + nBytes;
+    }
+    stream.write(padding, header.fileSize - position);
+
+  }
+
+  void MappedClassifier::Map(const char *data, unsigned long size) {
+
+    if(reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t) != 0)
+      throw std::runtime_error("A mapped weightfile must be aligned to at least 8 bytes");
+    if(size < sizeof(MappedFormat::Header) or std::memcmp(data, MappedFormat::magic, sizeof(MappedFormat::magic)) != 0)
+      throw std::runtime_error("Not a mapped weightfile");
+
+    MappedFormat::Header header;
+    std::memcpy(&header, data, sizeof(header));
+    if(header.byteOrder != MappedFormat::byteOrder)
+      throw std::runtime_error("Mapped weightfile was written on a machine with a different byte order");
+    if(header.version == 0 or header.version > MappedFormat::version)
+      throw std::runtime_error("Mapped weightfile has version " + std::to_string(header.version) + ", but this version of FastBDT supports only versions up to " + std::to_string(MappedFormat::version));
+    if(header.fileSize > size)
+      throw std::runtime_error("Mapped weightfile is truncated");
+
+    View(data, header, MappedFormat::features, forest.features);
+    View(data, header, MappedFormat::cuts, forest.cuts);
+    View(data, header, MappedFormat::boostWeights, forest.boostWeights);
+    View(data, header, MappedFormat::cutOffsets, forest.cutOffsets);
+    View(data, header, MappedFormat::nodeOffsets, forest.nodeOffsets);
+    View(data, header, MappedFormat::gains, forest.gains);
+    View(data, header, MappedFormat::unrolledFeatures, forest.unrolledFeatures);
+    View(data, header, MappedFormat::unrolledCuts, forest.unrolledCuts);
+    View(data, header, MappedFormat::unrolledWeights, forest.unrolledWeights);
+    View(data, header, MappedFormat::exitOrder, forest.exitOrder);
+    View(data, header, MappedFormat::remainingMin, forest.remainingMin);
+    View(data, header, MappedFormat::remainingMax, forest.remainingMax);
+    View(data, header, MappedFormat::remainingAbs, forest.remainingAbs);
+    View(data, header, MappedFormat::bestLowerBound, forest.bestLowerBound);
+    View(data, header, MappedFormat::bestUpperBound, forest.bestUpperBound);
+    View(data, header, MappedFormat::purityColumns, purityColumns);
+    View(data, header, MappedFormat::purityLevels, purityLevels);
+    View(data, header, MappedFormat::purityOffsets, purityOffsets);
+    View(data, header, MappedFormat::purityBinnings, purityBinnings);
+    View(data, header, MappedFormat::purityMappings, purityMappings);
+
+    forest.shrinkage = header.shrinkage;
+    forest.F0 = header.F0;
+    forest.F0_div_shrink = header.F0 / header.shrinkage;
+    forest.transform2probability = header.transform2probability != 0;
+    forest.sortedExitOrder = header.sortedExitOrder != 0;
+    forest.nFeatures = header.nFeatures;
+    forest.nNodeIds = header.nNodeIds;
+    forest.depth = header.depth;
+    numberOfFeatures = header.numberOfFeatures;
+
+    // The offsets and the feature ids of the trees are checked, so no tree reads outside of the arrays or the rows
+    const unsigned long nTrees = forest.GetNTrees();
+    const unsigned long rowSize = numberOfFeatures + purityColumns.size();
+    Check(forest.depth <= CompiledForest::maxUnrolledDepth, "depth");
+    const unsigned long nTreeCuts = (1ul << forest.depth) - 1;
+    if(forest.depth > 0) {
+      Check(forest.unrolledFeatures.size() == nTrees*nTreeCuts and forest.unrolledCuts.size() == nTrees*nTreeCuts, "number of unrolled cuts");
+      Check(forest.unrolledWeights.size() == nTrees*(2*nTreeCuts + 1), "number of unrolled boost weights");
+    }
+    Check(forest.nodeOffsets.size() == forest.cutOffsets.size(), "number of tree offsets");
+    if(not forest.cutOffsets.empty()) {
+      Check(forest.cutOffsets[0] == 0 and forest.nodeOffsets[0] == 0, "offset of the first tree");
+      // The features contain one padding entry for the vectorised traversal
+      Check(forest.cutOffsets[nTrees] < forest.features.size(), "number of features");
+      Check(forest.cutOffsets[nTrees] <= forest.cuts.size() and forest.cutOffsets[nTrees] <= forest.gains.size(), "number of cuts");
+      Check(forest.nodeOffsets[nTrees] <= forest.boostWeights.size(), "number of boost weights");
+      for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+        Check(forest.cutOffsets[iTree] <= forest.cutOffsets[iTree+1] and forest.cutOffsets[iTree+1] <= forest.cutOffsets[nTrees] and
+              forest.nodeOffsets[iTree] <= forest.nodeOffsets[iTree+1], "tree offsets");
+        const unsigned long nCuts = forest.cutOffsets[iTree+1] - forest.cutOffsets[iTree];
+        Check(forest.nodeOffsets[iTree+1] - forest.nodeOffsets[iTree] >= 2*nCuts + 1, "number of nodes of tree " + std::to_string(iTree));
+        for(unsigned long iCut = forest.cutOffsets[iTree]; iCut < forest.cutOffsets[iTree+1]; ++iCut)
+          Check(forest.features[iCut] < rowSize or forest.features[iCut] == CompiledForest::invalidFeature, "feature of tree " + std::to_string(iTree));
+        // Invalid cuts of the unrolled trees use feature 0 instead of the sentinel
+        if(forest.depth > 0) {
+          for(unsigned long iCut = iTree*nTreeCuts; iCut < (iTree+1)*nTreeCuts; ++iCut)
+            Check(forest.unrolledFeatures[iCut] < rowSize, "unrolled feature of tree " + std::to_string(iTree));
+        }
+      }
+    }
+
+    Check(forest.exitOrder.size() == nTrees, "exit order");
+    for(unsigned long k = 0; k < nTrees; ++k)
+      Check(forest.exitOrder[k] < nTrees, "exit order");
+    for(const auto *bounds : {&forest.remainingMin, &forest.remainingMax, &forest.remainingAbs, &forest.bestLowerBound, &forest.bestUpperBound})
+      Check(bounds->size() == nTrees + 1, "early exit bounds");
+
+    const unsigned long nPurityFeatures = purityColumns.size();
+    Check(purityLevels.size() == nPurityFeatures and purityOffsets.size() == nPurityFeatures + 1 and purityOffsets[0] == 0, "number of purity transformations");
+    for(unsigned long pFeature = 0; pFeature < nPurityFeatures; ++pFeature) {
+      Check(purityColumns[pFeature] < numberOfFeatures, "feature of purity transformation " + std::to_string(pFeature));
+      Check(purityLevels[pFeature] < 8*sizeof(unsigned long) - 1 and purityOffsets[pFeature] <= purityOffsets[pFeature+1] and
+            purityOffsets[pFeature+1] - purityOffsets[pFeature] == (1ul << purityLevels[pFeature]) + 1, "binning of purity transformation " + std::to_string(pFeature));
+    }
+    Check(purityOffsets[nPurityFeatures] <= purityBinnings.size() and purityOffsets[nPurityFeatures] <= purityMappings.size(), "size of the purity transformations");
+    Check(forest.nFeatures <= numberOfFeatures + nPurityFeatures, "number of features used by the cuts");
+
+    forest.SetTileSizes(0, 0);
+
+  }
+
+  void MappedClassifier::FillPurityRow(const float *X, float *row) const {
+
+    std::copy(X, X + numberOfFeatures, row);
+    const unsigned long nPurityFeatures = purityColumns.size();
+    for(unsigned long pFeature = 0; pFeature < nPurityFeatures; ++pFeature) {
+      // Same as PurityTransformation::BinToPurityBin(FeatureBinning::ValueToBin(value))
+      const float value = X[purityColumns[pFeature]];
+      unsigned long purityBin = 0;
+      if(not std::isnan(value)) {
+        const float *binning = &purityBinnings[purityOffsets[pFeature]];
+        const unsigned long nLevels = purityLevels[pFeature];
+        unsigned long index = 1;
+        for(unsigned long iLevel = 0; iLevel < nLevels; ++iLevel)
+          index = 2*index + static_cast<unsigned long>(value >= binning[index]);
+        purityBin = purityMappings[purityOffsets[pFeature] + index - (1ul << nLevels) + 1];
+      }
+      row[numberOfFeatures + pFeature] = (purityBin == 0) ? std::numeric_limits<float>::quiet_NaN() : static_cast<float>(purityBin);
+    }
+
+  }
+
+  float MappedClassifier::predict(const std::vector<float> &X) const {
+
+    if(purityColumns.empty())
+      return forest.Analyse(X.data());
+
+    // Reused by all calls on this thread, so no memory is allocated per event
+    thread_local std::vector<float> row;
+    row.resize(numberOfFeatures + purityColumns.size());
+    FillPurityRow(X.data(), row.data());
+    return forest.Analyse(row.data());
+
+  }
+
+  void MappedClassifier::predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out, unsigned long nThreads) const {
+
+    ParallelFor(nRows, nThreads, 4*CompiledForest::blockSize, [&](unsigned long first, unsigned long last) {
+      predict_batch_serial(X + first*stride, last - first, stride, out + first);
+    });
+
+  }
+
+  void MappedClassifier::predict_batch_serial(const float *X, unsigned long nRows, unsigned long stride, float *out) const {
+
+    if(purityColumns.empty()) {
+      forest.Analyse(X, nRows, stride, out);
+      return;
+    }
+
+    const unsigned long rowSize = numberOfFeatures + purityColumns.size();
+    std::vector<float> rows(CompiledForest::blockSize * rowSize);
+    for(unsigned long iFirst = 0; iFirst < nRows; iFirst += CompiledForest::blockSize) {
+      const unsigned long nBlock = std::min(CompiledForest::blockSize, nRows - iFirst);
+      for(unsigned long iRow = 0; iRow < nBlock; ++iRow)
+        FillPurityRow(X + (iFirst + iRow)*stride, &rows[iRow*rowSize]);
+      forest.Analyse(rows.data(), nBlock, rowSize, out + iFirst);
+    }
+
+  }
+
+}
@@ -0,0 +1,103 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Handle to a classifier which can be replaced while other threads are predicting
+ */
+
+#include "FastBDT_ModelHandle.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace FastBDT {
+
+  ModelHandle::Reader::Reader(const ModelHandle &handle) : handle(handle) {
+
+    // The counter is incremented before the model is read, so Publish either sees this reader
+    // or this reader sees the model published by Publish (all operations are sequentially consistent)
+    epoch = handle.epoch.load();
+    handle.readers[epoch % 2].count.fetch_add(1);
+    model = handle.current.load();
+
+  }
+
+  ModelHandle::Reader::~Reader() {
+    handle.readers[epoch % 2].count.fetch_sub(1);
+  }
+
+  ModelHandle::ModelHandle() : current(nullptr), epoch(0) {
+    readers[0].count = 0;
+    readers[1].count = 0;
+  }
+
+  ModelHandle::~ModelHandle() {
+    delete current.load();
+  }
+
+  unsigned long ModelHandle::Publish(std::unique_ptr<const Classifier> classifier) {
+
+    std::lock_guard<std::mutex> lock(publishMutex);
+
+    Model *model = new Model;
+    model->classifier = std::move(classifier);
+    model->version = ++lastVersion;
+    const Model *old = current.exchange(model);
+
+    // Readers which started before the exchange are counted in the current or the previous epoch.
+    // New readers use the new epoch, so the counter of the previous epoch drops to zero eventually.
+    for(unsigned int iGracePeriod = 0; iGracePeriod < 2; ++iGracePeriod) {
+      const unsigned long previous = epoch.fetch_add(1);
+      while(readers[previous % 2].count.load() != 0)
+        std::this_thread::yield();
+    }
+
+    delete old;
+    return model->version;
+
+  }
+
+  unsigned long ModelHandle::Load(const std::string &weightfile) {
+
+    std::fstream file(weightfile, std::ios_base::in | std::ios_base::binary);
+    if(not file)
+      throw std::runtime_error("Could not open weightfile " + weightfile);
+
+    std::unique_ptr<Classifier> classifier(new Classifier(file));
+    {
+      Reader reader(*this);
+      if(reader.get() != nullptr)
+        classifier->SetNThreads(reader->GetNThreads());
+    }
+    return Publish(std::move(classifier));
+
+  }
+
+  std::future<unsigned long> ModelHandle::LoadInBackground(const std::string &weightfile) {
+    return std::async(std::launch::async, [this, weightfile]() { return Load(weightfile); });
+  }
+
+  unsigned long ModelHandle::GetVersion() const {
+    Reader reader(*this);
+    return reader.GetVersion();
+  }
+
+  float ModelHandle::predict(const std::vector<float> &X) const {
+
+    Reader reader(*this);
+    if(reader.get() == nullptr)
+      throw std::runtime_error("No model was published to the model handle");
+    return reader->predict(X);
+
+  }
+
+  void ModelHandle::predict_batch(const float *X, unsigned long nRows, unsigned long stride, float *out) const {
+
+    Reader reader(*this);
+    if(reader.get() == nullptr)
+      throw std::runtime_error("No model was published to the model handle");
+    reader->predict_batch(X, nRows, stride, out);
+
+  }
+
+}
@@ -0,0 +1,262 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Memory-mappable cache of a binned EventSample, so the binning is done only once for many trainings
+ */
+
+#include "FastBDT_Sample.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace FastBDT {
+
+  namespace {
+
+    uint64_t Align(uint64_t position) {
+      return (position + SampleFormat::alignment - 1) / SampleFormat::alignment * SampleFormat::alignment;
+    }
+
+    void Check(bool condition, const std::string &message) {
+      if(not condition)
+        throw std::runtime_error("Sample cache is corrupt: " + message);
+    }
+
+    /**
+     * Checks that the array with the given id and element size fits into the file
+     */
+    void CheckArray(const SampleFormat::Header &header, SampleFormat::Array id, uint64_t elementSize) {
+      const auto &entry = header.arrays[id];
+      if(entry.offset % elementSize != 0 or entry.offset > header.fileSize or entry.size > (header.fileSize - entry.offset) / elementSize)
+        throw std::runtime_error("Array " + std::to_string(id) + " of the sample cache is out of bounds");
+    }
+
+    /**
+     * Returns the position in the EventSample of the event at the given position in the cache.
+     * The events are stored in the order in which AddEvent has to be called to reproduce the sample:
+     * AddEvent stores the background events from the end of the sample to the front,
+     * so they are stored in reversed order after the signal events.
+     */
+    unsigned long SampleIndex(const EventSample &sample, unsigned long iStored) {
+      return (iStored < sample.GetNSignals()) ? iStored : sample.GetNEvents() - 1 - (iStored - sample.GetNSignals());
+    }
+
+    /**
+     * Writes the bins of all events with the given width, a block of events at a time
+     */
+    template<class T>
+    void WriteBins(std::ostream &stream, const EventSample &sample, unsigned long nColumns) {
+      const unsigned long nEvents = sample.GetNEvents();
+      const unsigned long blockSize = 4096;
+      std::vector<T> block;
+      block.reserve(blockSize * nColumns);
+      for(unsigned long iFirst = 0; iFirst < nEvents; iFirst += blockSize) {
+        block.clear();
+        const unsigned long iLast = std::min(iFirst + blockSize, nEvents);
+        for(unsigned long iStored = iFirst; iStored < iLast; ++iStored) {
+          const unsigned long *row = &sample.GetValues().Get(SampleIndex(sample, iStored));
+          for(unsigned long iColumn = 0; iColumn < nColumns; ++iColumn)
+            block.push_back(static_cast<T>(row[iColumn]));
+        }
+        stream.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(T));
+      }
+    }
+
+  }
+
+  uint64_t SampleFormat::GetBytesPerBin(const std::vector<unsigned long> &levels) {
+    // The largest bin of a feature with n levels is 2^n, bin 0 is reserved for NaN values
+    uint64_t bytesPerBin = 1;
+    for(auto &level : levels) {
+      while(bytesPerBin < sizeof(uint64_t) and level >= 8*bytesPerBin)
+        bytesPerBin *= 2;
+    }
+    return bytesPerBin;
+  }
+
+  void writeSampleCache(std::ostream &stream, const EventSample &sample, const std::vector<unsigned long> &levels, const std::string &preprocessing) {
+
+    const EventValues &values = sample.GetValues();
+    const unsigned long nEvents = sample.GetNEvents();
+    const unsigned long nColumns = values.GetNFeatures() + values.GetNSpectators();
+    if(sample.GetNSignals() + sample.GetNBckgrds() != nEvents)
+      throw std::runtime_error("Only a completely filled event sample can be written to a sample cache");
+    if(levels.size() != nColumns)
+      throw std::runtime_error("Number of binning levels does not match the number of features and spectators of the event sample");
+
+    SampleFormat::Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SampleFormat::magic, sizeof(header.magic));
+    header.version = SampleFormat::version;
+    header.byteOrder = SampleFormat::byteOrder;
+    header.nEvents = nEvents;
+    header.nSignals = sample.GetNSignals();
+    header.nFeatures = values.GetNFeatures();
+    header.nSpectators = values.GetNSpectators();
+    header.bytesPerBin = SampleFormat::GetBytesPerBin(levels);
+
+    const uint64_t sizes[SampleFormat::nArrays] = {nColumns, nEvents * nColumns, nEvents, preprocessing.size()};
+    const uint64_t elementSizes[SampleFormat::nArrays] = {sizeof(uint64_t), header.bytesPerBin, sizeof(float), 1};
+    uint64_t position = Align(sizeof(header));
+    for(unsigned long iArray = 0; iArray < SampleFormat::nArrays; ++iArray) {
+      header.arrays[iArray].offset = position;
+      header.arrays[iArray].size = sizes[iArray];
+      position = Align(position + sizes[iArray] * elementSizes[iArray]);
+    }
+    header.fileSize = position;
+
+    const char padding[SampleFormat::alignment] = {};
+    auto pad = [&](uint64_t from, uint64_t to) { stream.write(padding, to - from); };
+
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    pad(sizeof(header), header.arrays[SampleFormat::levels].offset);
+
+    const std::vector<uint64_t> levels64(levels.begin(), levels.end());
+    stream.write(reinterpret_cast<const char*>(levels64.data()), levels64.size() * sizeof(uint64_t));
+    pad(header.arrays[SampleFormat::levels].offset + levels64.size() * sizeof(uint64_t), header.arrays[SampleFormat::bins].offset);
+
+    switch(header.bytesPerBin) {
+      case 1: WriteBins<uint8_t>(stream, sample, nColumns); break;
+      case 2: WriteBins<uint16_t>(stream, sample, nColumns); break;
+      case 4: WriteBins<uint32_t>(stream, sample, nColumns); break;
+      default: WriteBins<uint64_t>(stream, sample, nColumns); break;
+    }
+    pad(header.arrays[SampleFormat::bins].offset + nEvents * nColumns * header.bytesPerBin, header.arrays[SampleFormat::weights].offset);
+
+    std::vector<float> weights(nEvents);
+    for(unsigned long iStored = 0; iStored < nEvents; ++iStored)
+      weights[iStored] = sample.GetWeights().GetOriginalWeight(SampleIndex(sample, iStored));
+    stream.write(reinterpret_cast<const char*>(weights.data()), nEvents * sizeof(float));
+    pad(header.arrays[SampleFormat::weights].offset + nEvents * sizeof(float), header.arrays[SampleFormat::preprocessing].offset);
+
+    stream.write(preprocessing.data(), preprocessing.size());
+    pad(header.arrays[SampleFormat::preprocessing].offset + preprocessing.size(), header.fileSize);
+
+  }
+
+  SampleCache::SampleCache(const std::string &filename) {
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+      throw std::runtime_error("Could not open sample cache " + filename + ": " + std::strerror(errno));
+
+    struct stat status;
+    if(fstat(fd, &status) != 0 or status.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("Could not map sample cache " + filename);
+    }
+    mappingSize = status.st_size;
+
+    // The mapping stays valid after the file descriptor is closed
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+      mapping = nullptr;
+      throw std::runtime_error("Could not map sample cache " + filename + ": " + std::strerror(errno));
+    }
+
+    try {
+      Map(static_cast<const char*>(mapping), mappingSize);
+    } catch(...) {
+      munmap(mapping, mappingSize);
+      throw;
+    }
+
+    // The bins and weights are read once from the front to the end by GetEventSample
+    madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+  }
+
+  SampleCache::SampleCache(const char *data, unsigned long size) {
+    Map(data, size);
+  }
+
+  SampleCache::~SampleCache() {
+    if(mapping != nullptr)
+      munmap(mapping, mappingSize);
+  }
+
+  void SampleCache::Map(const char *data, unsigned long size) {
+
+    if(reinterpret_cast<uintptr_t>(data) % sizeof(uint64_t) != 0)
+      throw std::runtime_error("A sample cache must be aligned to at least 8 bytes");
+    if(size < sizeof(SampleFormat::Header) or std::memcmp(data, SampleFormat::magic, sizeof(SampleFormat::magic)) != 0)
+      throw std::runtime_error("Not a sample cache");
+
+    std::memcpy(&header, data, sizeof(header));
+    if(header.byteOrder != SampleFormat::byteOrder)
+      throw std::runtime_error("Sample cache was written on a machine with a different byte order");
+    if(header.version == 0 or header.version > SampleFormat::version)
+      throw std::runtime_error("Sample cache has version " + std::to_string(header.version) + ", but this version of FastBDT supports only versions up to " + std::to_string(SampleFormat::version));
+    if(header.fileSize > size)
+      throw std::runtime_error("Sample cache is truncated");
+
+    Check(header.bytesPerBin == 1 or header.bytesPerBin == 2 or header.bytesPerBin == 4 or header.bytesPerBin == 8, "width of the bins");
+    CheckArray(header, SampleFormat::levels, sizeof(uint64_t));
+    CheckArray(header, SampleFormat::bins, header.bytesPerBin);
+    CheckArray(header, SampleFormat::weights, sizeof(float));
+    CheckArray(header, SampleFormat::preprocessing, 1);
+
+    const unsigned long nColumns = header.nFeatures + header.nSpectators;
+    Check(header.nFeatures <= header.fileSize and header.nSpectators <= header.fileSize, "number of features");
+    Check(header.nSignals <= header.nEvents, "number of signal events");
+    Check(header.arrays[SampleFormat::levels].size == nColumns, "number of binning levels");
+    Check(header.arrays[SampleFormat::weights].size == header.nEvents, "number of weights");
+    Check(nColumns == 0 or header.arrays[SampleFormat::bins].size / nColumns == header.nEvents, "number of bins");
+    Check(header.arrays[SampleFormat::bins].size == header.nEvents * nColumns, "number of bins");
+
+    const uint64_t *storedLevels = reinterpret_cast<const uint64_t*>(data + header.arrays[SampleFormat::levels].offset);
+    levels.assign(storedLevels, storedLevels + nColumns);
+    // The EventValues calculate the number of bins as an int
+    for(auto &level : levels)
+      Check(level < 31, "binning levels");
+    Check(SampleFormat::GetBytesPerBin(levels) <= header.bytesPerBin, "width of the bins");
+
+    this->data = data;
+
+  }
+
+  std::string SampleCache::GetPreprocessing() const {
+    const auto &entry = header.arrays[SampleFormat::preprocessing];
+    return std::string(data + entry.offset, entry.size);
+  }
+
+  template<class T>
+  void SampleCache::Fill(EventSample &sample) const {
+
+    const unsigned long nColumns = levels.size();
+    const T *bins = reinterpret_cast<const T*>(data + header.arrays[SampleFormat::bins].offset);
+    const float *weights = reinterpret_cast<const float*>(data + header.arrays[SampleFormat::weights].offset);
+    std::vector<unsigned long> row(nColumns);
+
+    // The events are stored in the order of the calls to AddEvent, which reproduces the order of the written sample
+    for(unsigned long iEvent = 0; iEvent < header.nEvents; ++iEvent) {
+      const T *event = bins + iEvent*nColumns;
+      for(unsigned long iColumn = 0; iColumn < nColumns; ++iColumn)
+        row[iColumn] = event[iColumn];
+      sample.AddEvent(row, weights[iEvent], iEvent < header.nSignals);
+    }
+
+  }
+
+  EventSample SampleCache::GetEventSample() const {
+
+    EventSample sample(header.nEvents, header.nFeatures, header.nSpectators, levels);
+    switch(header.bytesPerBin) {
+      case 1: Fill<uint8_t>(sample); break;
+      case 2: Fill<uint16_t>(sample); break;
+      case 4: Fill<uint32_t>(sample); break;
+      default: Fill<uint64_t>(sample); break;
+    }
+    return sample;
+
+  }
+
+}
@@ -0,0 +1,362 @@
+/**
+ * Thomas Keck 2017
+ *
+ * Local inference daemon which batches concurrent requests over a Unix domain socket
+ */
+
+#include "FastBDT_Serve.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace FastBDT {
+
+  namespace {
+
+    /**
+     * Reads exactly size bytes, returns false if the connection was closed or an error occurred
+     */
+    bool ReadAll(int fd, void *data, unsigned long size) {
+      char *buffer = static_cast<char*>(data);
+      while(size > 0) {
+        const ssize_t n = recv(fd, buffer, size, 0);
+        if(n < 0 and errno == EINTR)
+          continue;
+        if(n <= 0)
+          return false;
+        buffer += n;
+        size -= n;
+      }
+      return true;
+    }
+
+    /**
+     * Writes exactly size bytes, returns false if the connection was closed or an error occurred
+     */
+    bool WriteAll(int fd, const void *data, unsigned long size) {
+      const char *buffer = static_cast<const char*>(data);
+      while(size > 0) {
+        const ssize_t n = send(fd, buffer, size, MSG_NOSIGNAL);
+        if(n < 0 and errno == EINTR)
+          continue;
+        if(n <= 0)
+          return false;
+        buffer += n;
+        size -= n;
+      }
+      return true;
+    }
+
+    /**
+     * Waits until the predicate is true. The untimed condition_variable::wait is a new symbol in the libstdc++ of GCC 12
+     * (GLIBCXX_3.4.30), the timed wait is inlined, so the library still runs against the libstdc++ of older compilers.
+     */
+    template<class Predicate>
+    void WaitUntil(std::condition_variable &condition, std::unique_lock<std::mutex> &lock, Predicate predicate) {
+      while(not predicate())
+        condition.wait_for(lock, std::chrono::seconds(1));
+    }
+
+    sockaddr_un GetSocketAddress(const std::string &socketPath) {
+      sockaddr_un address;
+      std::memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      if(socketPath.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Socket path " + socketPath + " is too long");
+      std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+      return address;
+    }
+
+  }
+
+  PredictionServer::PredictionServer(const std::string &socketPath, const std::vector<std::string> &weightfiles, const PredictionServerOptions &options) :
+    socketPath(socketPath), options(options), stopping(false), stoppingBatchers(false), nBatches(0) {
+
+    for(auto &weightfile : weightfiles) {
+      std::unique_ptr<Model> model(new Model);
+      model->handle.Load(weightfile);
+      models.push_back(std::move(model));
+    }
+
+    const sockaddr_un address = GetSocketAddress(socketPath);
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenFd < 0)
+      throw std::runtime_error("Could not create socket: " + std::string(std::strerror(errno)));
+    unlink(socketPath.c_str());
+    if(bind(listenFd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 or listen(listenFd, 128) != 0) {
+      const std::string error = std::strerror(errno);
+      close(listenFd);
+      throw std::runtime_error("Could not listen on " + socketPath + ": " + error);
+    }
+
+    for(auto &model : models) {
+      Model *m = model.get();
+      m->batcher = std::thread([this, m]() { BatchRequests(m); });
+    }
+    acceptor = std::thread([this]() { AcceptConnections(); });
+
+  }
+
+  PredictionServer::~PredictionServer() {
+    Stop();
+  }
+
+  void PredictionServer::Stop() {
+
+    if(stopped)
+      return;
+    stopped = true;
+
+    // The connections are closed first, their queued requests are still answered by the batching threads
+    stopping = true;
+    acceptor.join();
+    close(listenFd);
+    unlink(socketPath.c_str());
+
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      for(auto &connection : connections)
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+    for(auto &connection : connections) {
+      connection->thread.join();
+      close(connection->fd);
+    }
+    connections.clear();
+
+    // No request can be queued anymore
+    stoppingBatchers = true;
+    for(auto &model : models) {
+      {
+        std::lock_guard<std::mutex> lock(model->mutex);
+        model->queued.notify_all();
+      }
+      model->batcher.join();
+    }
+
+  }
+
+  void PredictionServer::Reload(unsigned long iModel, const std::string &weightfile) {
+    if(iModel >= models.size())
+      throw std::runtime_error("There is no model with index " + std::to_string(iModel));
+    models[iModel]->handle.Load(weightfile);
+  }
+
+  void PredictionServer::AcceptConnections() {
+
+    while(not stopping) {
+      pollfd listen_poll = {listenFd, POLLIN, 0};
+      if(poll(&listen_poll, 1, 100) <= 0)
+        continue;
+
+      const int fd = accept(listenFd, nullptr, nullptr);
+      if(fd < 0)
+        continue;
+
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+
+      // Threads of closed connections are joined here, so they do not pile up
+      for(auto it = connections.begin(); it != connections.end();) {
+        if((*it)->finished) {
+          (*it)->thread.join();
+          close((*it)->fd);
+          it = connections.erase(it);
+        } else {
+          ++it;
+        }
+      }
+
+      std::unique_ptr<Connection> connection(new Connection);
+      connection->fd = fd;
+      connection->finished = false;
+      Connection *c = connection.get();
+      connection->thread = std::thread([this, c]() { HandleConnection(c); });
+      connections.push_back(std::move(connection));
+    }
+
+  }
+
+  void PredictionServer::HandleConnection(Connection *connection) {
+
+    // The buffers are reused by all requests of the connection
+    std::vector<float> X;
+    std::vector<float> out;
+    ServeProtocol::RequestHeader request;
+
+    // A failed request closes its connection, but must not terminate the server
+    try {
+      while(ReadAll(connection->fd, &request, sizeof(request))) {
+        if(request.magic != ServeProtocol::magic)
+          break;
+
+        // The size of the events is checked before the buffer is resized, so a client cannot request huge allocations.
+        // The events of a rejected request cannot be skipped without reading them, so the connection is closed after the response.
+        ServeProtocol::ResponseHeader response = {ServeProtocol::magic, ServeProtocol::ok, 0, 0};
+        if(request.nEvents > options.maxRequestEvents)
+          response.status = ServeProtocol::tooManyEvents;
+        else if(request.model >= models.size())
+          response.status = ServeProtocol::unknownModel;
+        else if(request.nFeatures != ModelHandle::Reader(models[request.model]->handle)->GetNFeatures())
+          response.status = ServeProtocol::wrongNumberOfFeatures;
+        if(response.status != ServeProtocol::ok) {
+          WriteAll(connection->fd, &response, sizeof(response));
+          break;
+        }
+
+        const unsigned long nValues = static_cast<unsigned long>(request.nEvents) * request.nFeatures;
+        X.resize(nValues);
+        if(not ReadAll(connection->fd, X.data(), nValues*sizeof(float)))
+          break;
+
+        Model *model = models[request.model].get();
+        out.resize(request.nEvents);
+        PendingRequest pending;
+        pending.X = X.data();
+        pending.nEvents = request.nEvents;
+        pending.nFeatures = request.nFeatures;
+        pending.out = out.data();
+
+        {
+          std::unique_lock<std::mutex> lock(model->mutex);
+          model->queue.push_back(&pending);
+          model->nQueuedEvents += pending.nEvents;
+          model->queued.notify_one();
+          WaitUntil(model->finished, lock, [&pending]() { return pending.done; });
+        }
+
+        // The number of features is checked again by the batching thread, because the model may have been reloaded
+        response.status = pending.status;
+        if(pending.status == ServeProtocol::ok)
+          response.nEvents = request.nEvents;
+
+        if(not WriteAll(connection->fd, &response, sizeof(response)))
+          break;
+        if(response.nEvents > 0 and not WriteAll(connection->fd, out.data(), response.nEvents*sizeof(float)))
+          break;
+      }
+    } catch(...) {
+    }
+
+    // The client notices the closed connection immediately, the descriptor itself is closed by the accepting thread
+    shutdown(connection->fd, SHUT_RDWR);
+    connection->finished = true;
+
+  }
+
+  void PredictionServer::BatchRequests(Model *model) {
+
+    std::vector<PendingRequest*> batch;
+    std::vector<float> X;
+    std::vector<float> out;
+
+    std::unique_lock<std::mutex> lock(model->mutex);
+    while(true) {
+      WaitUntil(model->queued, lock, [&]() { return stoppingBatchers or not model->queue.empty(); });
+      if(model->queue.empty())
+        return;
+
+      // Wait for more requests until the batch is full or the deadline of the first request passed
+      const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(options.maxDelayMicroseconds);
+      while(model->nQueuedEvents < options.maxBatchEvents and not stoppingBatchers) {
+        if(model->queued.wait_until(lock, deadline) == std::cv_status::timeout)
+          break;
+      }
+
+      // A request is never split, but a single request can exceed maxBatchEvents
+      batch.clear();
+      unsigned long nEvents = 0;
+      while(not model->queue.empty() and (batch.empty() or nEvents + model->queue.front()->nEvents <= options.maxBatchEvents)) {
+        batch.push_back(model->queue.front());
+        nEvents += model->queue.front()->nEvents;
+        model->nQueuedEvents -= model->queue.front()->nEvents;
+        model->queue.pop_front();
+      }
+      lock.unlock();
+
+      // The requests of a failed batch are answered with an error, the server keeps running
+      try {
+        ModelHandle::Reader reader(model->handle);
+        const unsigned long nFeatures = reader->GetNFeatures();
+        X.clear();
+        for(auto *pending : batch) {
+          if(pending->nFeatures != nFeatures)
+            pending->status = ServeProtocol::wrongNumberOfFeatures;
+          else
+            X.insert(X.end(), pending->X, pending->X + pending->nEvents*nFeatures);
+        }
+        const unsigned long nValid = (nFeatures > 0) ? X.size() / nFeatures : 0;
+        out.resize(nValid);
+        reader->predict_batch(X.data(), nValid, nFeatures, out.data(), options.nThreads);
+
+        unsigned long iEvent = 0;
+        for(auto *pending : batch) {
+          if(pending->status != ServeProtocol::ok)
+            continue;
+          std::copy(out.begin() + iEvent, out.begin() + iEvent + pending->nEvents, pending->out);
+          iEvent += pending->nEvents;
+        }
+      } catch(...) {
+        for(auto *pending : batch) {
+          if(pending->status == ServeProtocol::ok)
+            pending->status = ServeProtocol::predictionFailed;
+        }
+      }
+      nBatches++;
+
+      lock.lock();
+      for(auto *pending : batch)
+        pending->done = true;
+      model->finished.notify_all();
+    }
+
+  }
+
+  PredictionClient::PredictionClient(const std::string &socketPath) {
+
+    const sockaddr_un address = GetSocketAddress(socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+      throw std::runtime_error("Could not create socket: " + std::string(std::strerror(errno)));
+    if(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+      const std::string error = std::strerror(errno);
+      close(fd);
+      throw std::runtime_error("Could not connect to " + socketPath + ": " + error);
+    }
+
+  }
+
+  PredictionClient::~PredictionClient() {
+    close(fd);
+  }
+
+  void PredictionClient::predict(unsigned long model, const float *X, unsigned long nEvents, unsigned long nFeatures, float *out) {
+
+    const ServeProtocol::RequestHeader request = {ServeProtocol::magic, static_cast<uint32_t>(model), static_cast<uint32_t>(nEvents), static_cast<uint32_t>(nFeatures)};
+    if(not WriteAll(fd, &request, sizeof(request)) or not WriteAll(fd, X, nEvents*nFeatures*sizeof(float)))
+      throw std::runtime_error("Could not send the request to the server");
+
+    ServeProtocol::ResponseHeader response;
+    if(not ReadAll(fd, &response, sizeof(response)) or response.magic != ServeProtocol::magic)
+      throw std::runtime_error("Could not read the response of the server");
+    if(response.status != ServeProtocol::ok)
+      throw std::runtime_error("The server rejected the request with status " + std::to_string(response.status));
+    if(response.nEvents != nEvents or not ReadAll(fd, out, nEvents*sizeof(float)))
+      throw std::runtime_error("Could not read the scores from the server");
+
+  }
+
+  float PredictionClient::predict(unsigned long model, const std::vector<float> &X) {
+    float out = 0;
+    predict(model, X.data(), 1, X.size(), &out);
+    return out;
+  }
+
+}
@@ -13,6 +13,7 @@
 
 #include <algorithm>
 #include <random>
+#include <memory>
 
 using namespace FastBDT;
 
@@ -189,3 +190,367 @@ TEST_F(ClassifierTest, LoadAndSaveWorks) {
     EXPECT_FLOAT_EQ(score1, score2);
 }
 
+TEST_F(ClassifierTest, LoadAndSaveWithPurityTransformationWorks) {
+
+    // The iris features contain many repeated values, so the binning boundaries are repeated as well
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, -1.0, {true, false, true, false});
+    classifier.fit(X, y, w);
+
+    std::stringstream text;
+    text << classifier << std::endl;
+    FastBDT::Classifier textClassifier(text);
+
+    std::stringstream binary;
+    classifier.SaveBinary(binary);
+    FastBDT::Classifier binaryClassifier(binary);
+
+    for(unsigned long iEvent = 0; iEvent < y.size(); ++iEvent) {
+      // Shifted events probe the bin boundaries between the training values
+      for(float shift : {0.0f, 0.05f, -0.05f}) {
+        std::vector<float> event = {X[0][iEvent] + shift, X[1][iEvent] + shift, X[2][iEvent] + shift, X[3][iEvent] + shift};
+        const float p = classifier.predict(event);
+        // The text format stores F0 and the shrinkage with 6 digits, only the binary format restores them exactly
+        EXPECT_FLOAT_EQ(textClassifier.predict(event), p);
+        EXPECT_EQ(binaryClassifier.predict(event), p);
+      }
+    }
+
+    // Saving the loaded classifier again gives the same weightfile
+    std::stringstream text2;
+    text2 << textClassifier << std::endl;
+    EXPECT_EQ(text2.str(), text.str());
+
+}
+
+
+TEST_F(ClassifierTest, StreamedFitIsSameAsFit) {
+
+    for(bool purity : {false, true}) {
+      FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, -1.0, {purity, false, false, false});
+      classifier.fit(X, y, w);
+
+      FastBDT::Classifier streamed(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, -1.0, {purity, false, false, false});
+      std::stringstream weightfile;
+      streamed.fit(X, y, w, weightfile);
+
+      FastBDT::Classifier loaded(weightfile);
+      for(unsigned long iEvent = 0; iEvent < y.size(); ++iEvent) {
+        std::vector<float> event = {X[0][iEvent], X[1][iEvent], X[2][iEvent], X[3][iEvent]};
+        EXPECT_EQ(streamed.predict(event), classifier.predict(event));
+        // The text format stores F0 and the shrinkage with 6 digits
+        EXPECT_FLOAT_EQ(loaded.predict(event), classifier.predict(event));
+      }
+
+      // Only the padding of the number of trees differs from the weightfile written after the training
+      std::stringstream expected, actual;
+      expected << classifier;
+      actual << loaded;
+      EXPECT_EQ(actual.str(), expected.str());
+    }
+
+}
+
+TEST_F(ClassifierTest, RecoverLoadsAllCompleteTrees) {
+
+    for(bool purity : {false, true}) {
+      FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, -1.0, {purity, false, false, false});
+      std::stringstream stream;
+      classifier.fit(X, y, w, stream);
+      const std::string weightfile = stream.str();
+
+      // Weightfiles of trainings which were interrupted at different times, the forest is in the second half
+      unsigned long nTrees = 0;
+      for(unsigned long length = weightfile.size() / 2; length <= weightfile.size(); length += weightfile.size() / 50) {
+        std::stringstream truncated(weightfile.substr(0, length));
+        FastBDT::Classifier recovered;
+        try {
+          recovered = FastBDT::Classifier::Recover(truncated);
+        } catch(const std::runtime_error &) {
+          // The weightfile ends before the first tree
+          EXPECT_EQ(nTrees, 0u);
+          continue;
+        }
+        const unsigned long nRecoveredTrees = purity ? recovered.GetBinnedForest().GetForest().size() : recovered.GetFastForest().GetForest().size();
+        EXPECT_GE(nRecoveredTrees, nTrees);
+        nTrees = nRecoveredTrees;
+        for(unsigned long iEvent = 0; iEvent < y.size(); ++iEvent) {
+          std::vector<float> event = {X[0][iEvent], X[1][iEvent], X[2][iEvent], X[3][iEvent]};
+          EXPECT_FLOAT_EQ(recovered.predict(event), classifier.predict_staged(event, {nTrees})[0]);
+        }
+      }
+      EXPECT_EQ(nTrees, 10u);
+
+      std::stringstream parameters(weightfile.substr(0, 100));
+      EXPECT_THROW(FastBDT::Classifier::Recover(parameters), std::runtime_error);
+    }
+
+}
+
+TEST_F(ClassifierTest, PartialLoadIsSameAsStagedPrediction) {
+
+    for(bool purity : {false, true}) {
+      FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, -1.0, {purity, false, false, false});
+      classifier.fit(X, y, w);
+
+      std::stringstream text, binary, compact;
+      text << classifier;
+      classifier.SaveBinary(binary);
+      classifier.SaveCompact(compact);
+      for(const auto &weightfile : {text.str(), binary.str(), compact.str()}) {
+        for(unsigned long maxTrees : {0ul, 3ul, 10ul, 20ul}) {
+          // The skipped trees are consumed, so the stream ends up behind the weightfile
+          std::stringstream stream(weightfile + "end");
+          FastBDT::Classifier loaded(stream, maxTrees);
+          std::string end;
+          stream >> end;
+          EXPECT_EQ(end, "end");
+
+          const unsigned long nTrees = std::min(maxTrees, 10ul);
+          EXPECT_EQ(loaded.GetNTrees(), 10u);
+          EXPECT_EQ(purity ? loaded.GetBinnedForest().GetForest().size() : loaded.GetFastForest().GetForest().size(), nTrees);
+          for(unsigned long iEvent = 0; iEvent < y.size(); ++iEvent) {
+            std::vector<float> event = {X[0][iEvent], X[1][iEvent], X[2][iEvent], X[3][iEvent]};
+            EXPECT_FLOAT_EQ(loaded.predict(event), classifier.predict_staged(event, {nTrees})[0]);
+          }
+        }
+      }
+    }
+
+}
+
+TEST_F(ClassifierTest, PredictBatchIsSameAsPredict) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+    
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    std::vector<float> matrix;
+    for(unsigned long i = 0; i < y.size(); ++i) {
+      matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+    }
+
+    std::vector<float> result(y.size());
+    std::vector<float> purity_result(y.size());
+    classifier.predict_batch(matrix.data(), y.size(), 4, result.data());
+    purity_classifier.predict_batch(matrix.data(), y.size(), 4, purity_result.data());
+
+    for(unsigned long i = 0; i < y.size(); ++i) {
+      EXPECT_EQ(result[i], classifier.predict({X[0][i], X[1][i], X[2][i], X[3][i]}));
+      EXPECT_EQ(purity_result[i], purity_classifier.predict({X[0][i], X[1][i], X[2][i], X[3][i]}));
+    }
+
+}
+
+TEST_F(ClassifierTest, PredictBatchStridedIsSameAsPredict) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    const unsigned long nRows = y.size();
+
+    // Column-major matrix, the columns of X are stored one after another
+    std::vector<float> columns;
+    for(auto &feature : X)
+      columns.insert(columns.end(), feature.begin(), feature.end());
+
+    // Row-major matrix with two unused floats after each event, read with swapped strides
+    std::vector<float> padded;
+    for(unsigned long i = 0; i < nRows; ++i)
+      padded.insert(padded.end(), {X[0][i], X[1][i], X[2][i], X[3][i], -1.0, -1.0});
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      for(unsigned long nThreads : {1ul, 3ul}) {
+        std::vector<float> column_result(nRows);
+        std::vector<float> padded_result(nRows);
+        c->predict_batch_strided(columns.data(), nRows, 1, nRows, column_result.data(), nThreads);
+        c->predict_batch_strided(padded.data(), nRows, 6, 1, padded_result.data(), nThreads);
+        for(unsigned long i = 0; i < nRows; ++i) {
+          float expected = c->predict({X[0][i], X[1][i], X[2][i], X[3][i]});
+          EXPECT_EQ(column_result[i], expected);
+          EXPECT_EQ(padded_result[i], expected);
+        }
+      }
+    }
+
+}
+
+TEST_F(ClassifierTest, PredictAboveIsSameAsPredict) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    std::vector<float> matrix;
+    for(unsigned long i = 0; i < y.size(); ++i) {
+      matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+    }
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      for(float threshold : {0.1f, 0.5f, 0.9f, c->predict({X[0][0], X[1][0], X[2][0], X[3][0]})}) {
+        std::unique_ptr<bool[]> result(new bool[y.size()]);
+        c->predict_above(matrix.data(), y.size(), 4, threshold, result.get());
+        for(unsigned long i = 0; i < y.size(); ++i) {
+          bool expected = c->predict({X[0][i], X[1][i], X[2][i], X[3][i]}) > threshold;
+          EXPECT_EQ(c->predict_above({X[0][i], X[1][i], X[2][i], X[3][i]}, threshold), expected);
+          EXPECT_EQ(result[i], expected);
+        }
+      }
+    }
+
+}
+
+TEST_F(ClassifierTest, PredictStagedIsSameAsSmallerForests) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    std::vector<float> matrix;
+    for(unsigned long i = 0; i < y.size(); ++i) {
+      matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+    }
+
+    std::vector<unsigned long> checkpoints = {0, 1, 5, 10};
+    for(auto *c : {&classifier, &purity_classifier}) {
+      std::vector<float> staged(y.size() * checkpoints.size());
+      c->predict_staged(matrix.data(), y.size(), 4, checkpoints, staged.data());
+      for(unsigned long i = 0; i < y.size(); ++i) {
+        std::vector<float> event = {X[0][i], X[1][i], X[2][i], X[3][i]};
+        auto single = c->predict_staged(event, checkpoints);
+        for(unsigned long iStage = 0; iStage < checkpoints.size(); ++iStage)
+          EXPECT_EQ(staged[i*checkpoints.size() + iStage], single[iStage]);
+        EXPECT_EQ(single.back(), c->predict(event));
+      }
+      EXPECT_THROW(c->predict_staged(std::vector<float>(matrix.begin(), matrix.begin() + 4), {11}), std::runtime_error);
+    }
+
+    // The staged predictions must not depend on the trees after the checkpoint
+    FastBDT::Classifier small_classifier(5, 3, {4, 4, 4, 4}, 1.0);
+    small_classifier.fit(X, y, w);
+    FastBDT::Classifier large_classifier(10, 3, {4, 4, 4, 4}, 1.0);
+    large_classifier.fit(X, y, w);
+    for(unsigned long i = 0; i < y.size(); ++i) {
+      std::vector<float> event = {X[0][i], X[1][i], X[2][i], X[3][i]};
+      EXPECT_FLOAT_EQ(large_classifier.predict_staged(event, {5})[0], small_classifier.predict(event));
+    }
+
+}
+
+TEST_F(ClassifierTest, LeafIndicesDetermineThePrediction) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    std::vector<float> matrix;
+    for(unsigned long iRepeat = 0; iRepeat < 5; ++iRepeat) {
+      for(unsigned long i = 0; i < y.size(); ++i) {
+        matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+      }
+    }
+    const unsigned long nRows = matrix.size() / 4;
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      c->SetNThreads(3);
+      std::vector<uint16_t> nodes(nRows * 10);
+      std::vector<uint8_t> nodes8(nRows * 10);
+      c->GetLeafIndices(matrix.data(), nRows, 4, nodes.data());
+      c->GetLeafIndices(matrix.data(), nRows, 4, nodes8.data());
+      for(unsigned long i = 0; i < nRows * 10; ++i) {
+        EXPECT_LT(nodes[i], 15u);
+        EXPECT_EQ(nodes8[i], nodes[i]);
+      }
+      // Events with the same nodes in all trees get the same prediction
+      for(unsigned long iRow = 1; iRow < nRows; ++iRow) {
+        if(std::equal(&nodes[iRow*10], &nodes[iRow*10] + 10, &nodes[(iRow-1)*10])) {
+          EXPECT_EQ(c->predict(std::vector<float>(&matrix[iRow*4], &matrix[iRow*4] + 4)), c->predict(std::vector<float>(&matrix[(iRow-1)*4], &matrix[(iRow-1)*4] + 4)));
+        }
+      }
+      for(unsigned long iRow = 0; iRow < y.size(); ++iRow)
+        EXPECT_TRUE(std::equal(&nodes[iRow*10], &nodes[iRow*10] + 10, &nodes[(iRow + y.size())*10]));
+    }
+
+}
+
+TEST_F(ClassifierTest, BatchIndividualVariableRankingIsSameAsMap) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    FastBDT::Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    // Repeat the iris data, so that there are enough events for several threads
+    std::vector<float> matrix;
+    for(unsigned long iRepeat = 0; iRepeat < 5; ++iRepeat) {
+      for(unsigned long i = 0; i < y.size(); ++i) {
+        matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+      }
+    }
+    const unsigned long nRows = matrix.size() / 4;
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      for(unsigned long nThreads : {1ul, 3ul}) {
+        c->SetNThreads(nThreads);
+        std::vector<double> ranking(nRows * 4, -1.0);
+        c->GetIndividualVariableRanking(matrix.data(), nRows, 4, ranking.data());
+        for(unsigned long iRow = 0; iRow < nRows; ++iRow) {
+          auto expected = c->GetIndividualVariableRanking(std::vector<float>(&matrix[iRow*4], &matrix[iRow*4] + 4));
+          for(unsigned long iFeature = 0; iFeature < 4; ++iFeature) {
+            if(expected.find(iFeature) == expected.end())
+              EXPECT_EQ(ranking[iRow*4 + iFeature], 0.0);
+            else
+              EXPECT_NEAR(ranking[iRow*4 + iFeature], expected[iFeature], 1e-12);
+          }
+        }
+      }
+    }
+
+}
+
+TEST_F(ClassifierTest, ThreadedPredictBatchIsSameAsPredict) {
+
+    FastBDT::Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+    EXPECT_EQ(classifier.GetNThreads(), 1u);
+
+    // Repeat the iris data, so that there are enough events for several threads
+    std::vector<float> matrix;
+    std::vector<float> expected;
+    for(unsigned long iRepeat = 0; iRepeat < 20; ++iRepeat) {
+      for(unsigned long i = 0; i < y.size(); ++i) {
+        matrix.insert(matrix.end(), {X[0][i], X[1][i], X[2][i], X[3][i]});
+        expected.push_back(classifier.predict({X[0][i], X[1][i], X[2][i], X[3][i]}));
+      }
+    }
+    const unsigned long nRows = expected.size();
+
+    for(unsigned long nThreads : {1ul, 2ul, 3ul, 0ul}) {
+      std::vector<float> result(nRows);
+      classifier.predict_batch(matrix.data(), nRows, 4, result.data(), nThreads);
+      EXPECT_EQ(result, expected);
+
+      classifier.SetNThreads(nThreads);
+      std::vector<float> result2(nRows);
+      classifier.predict_batch(matrix.data(), nRows, 4, result2.data());
+      EXPECT_EQ(result2, expected);
+    }
+
+}
@@ -265,7 +265,51 @@ TEST_F(FeatureBinningTest, LowStatisticIsHandledCorrectly) {
     EXPECT_EQ( featureBinning2.ValueToBin(10.0f), 5u);
     EXPECT_EQ( featureBinning2.ValueToBin(11.0f), 6u);
     EXPECT_EQ( featureBinning2.ValueToBin(12.0f), 16u);
-    
+
+}
+
+TEST_F(FeatureBinningTest, RestoreKeepsTheStoredBinning) {
+
+    // Few distinct values with many repetitions, binning the stored boundaries again would give a different binning
+    std::vector<float> data = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 2.0f, 3.0f };
+    FeatureBinning<float> trained(2, data);
+    std::vector<float> binning = { 0.0f, 0.0f, 0.0f, 0.0f, 3.0f };
+    EXPECT_EQ( trained.GetBinning(), binning);
+
+    std::vector<float> values = binning;
+    FeatureBinning<float> rebinned(2, values);
+    EXPECT_NE( rebinned.GetBinning(), binning);
+
+    auto featureBinning = FeatureBinning<float>::Restore(2, binning);
+    EXPECT_EQ( featureBinning.GetNLevels(), 2u);
+    EXPECT_EQ( featureBinning.GetBinning(), binning);
+    for(float value : {-1.0f, 0.0f, 1.0f, 2.0f, 3.0f, 4.0f}) {
+      EXPECT_EQ( featureBinning.ValueToBin(value), trained.ValueToBin(value));
+    }
+
+    auto restoredBinning = FeatureBinning<float>::Restore(2, predefinedBinning->GetBinning());
+    EXPECT_EQ( restoredBinning.GetBinning(), predefinedBinning->GetBinning());
+
+    // Binning of a feature without finite values
+    std::vector<float> zeros(9, 0.0f);
+    EXPECT_EQ( FeatureBinning<float>::Restore(3, zeros).GetBinning(), zeros);
+
+}
+
+TEST_F(FeatureBinningTest, RestoreRejectsInvalidBinning) {
+
+    EXPECT_THROW( FeatureBinning<float>::Restore(1, {1.0f, 2.0f, 3.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(31, {1.0f, 2.0f, 3.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {1.0f, 7.0f, 4.0f, 10.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {1.0f, 7.0f, 4.0f, 10.0f, 12.0f, 13.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {1.0f, 7.0f, NAN, 10.0f, 12.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {NAN, 7.0f, 4.0f, 10.0f, 12.0f}), std::runtime_error);
+    // Layer by layer instead of the binary tree
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {1.0f, 4.0f, 7.0f, 10.0f, 12.0f}), std::runtime_error);
+    // Boundaries outside of minimum and maximum
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {5.0f, 7.0f, 4.0f, 10.0f, 12.0f}), std::runtime_error);
+    EXPECT_THROW( FeatureBinning<float>::Restore(2, {1.0f, 7.0f, 4.0f, 10.0f, 9.0f}), std::runtime_error);
+
 }
 
 class WeightedFeatureBinningTest : public ::testing::Test {
@@ -1798,3 +1842,37 @@ TEST_F(RewriteTest, CheckSameResultForOriginalAndRewrittenFloatForest) {
     }
 
 }
+
+TEST_F(RewriteTest, CheckSameResultForOriginalAndRewrittenPurityForest) {
+
+    // Binned feature 0 is the original feature, binned feature 1 its purity transformed copy
+    std::vector<unsigned long> binned_data = {0, 1, 1, 2, 2, 2, 3, 4, 4};
+    std::vector<Weight> weights(binned_data.size(), 1.0);
+    std::vector<bool> isSignal = {true, false, false, true, true, false, true, true, false};
+    PurityTransformation purityTransformation(2, binned_data, weights, isSignal);
+
+    Cut<unsigned long> cut1, cut2, cut3;
+    cut1.feature = 1;
+    cut1.index = 3;
+    cut1.valid = true;
+    cut2.feature = 0;
+    cut2.index = 2;
+    cut2.valid = true;
+    cut3.feature = 1;
+    cut3.index = 4;
+    cut3.valid = true;
+    Forest<unsigned long> purity_forest(1.0, 0.0, true);
+    purity_forest.AddTree(Tree<unsigned long>({cut1, cut2, cut3}, {}, {}, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0}));
+    cut1.valid = false;
+    purity_forest.AddTree(Tree<unsigned long>({cut1, cut2, cut3}, {}, {}, {10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0}));
+
+    auto rewritten_forest = removePurityTransformationFromForest<float>(purity_forest, {*featureBinning}, {true});
+    std::vector<float> values = {-1.0f, -0.5f, 0.0f, 0.1f, 0.25f, 0.3f, 0.5f, 0.6f, 0.75f, 0.9f, 1.0f, 1.2f, std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), NAN, std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()};
+    for(auto &x : values) {
+      unsigned long bin = featureBinning->ValueToBin(x);
+      unsigned long purityBin = purityTransformation.BinToPurityBin(bin);
+      float purityValue = (purityBin == 0) ? NAN : static_cast<float>(purityBin);
+      EXPECT_FLOAT_EQ(purity_forest.GetF(std::vector<unsigned long>({bin, purityBin})), rewritten_forest.GetF(std::vector<float>({x, purityValue})));
+    }
+
+}
@@ -0,0 +1,303 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT.h"
+#include "FastBDT_Binary.h"
+#include "Classifier.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <limits>
+#include <cstring>
+
+using namespace FastBDT;
+
+class BinaryTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+          std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+          ASSERT_TRUE(weightfile.good());
+          classifier = Classifier(weightfile);
+
+          std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+          ASSERT_TRUE(data.good());
+          std::string header;
+          std::getline(data, header);
+          float a, b, c, d;
+          int label;
+          while(data >> a >> b >> c >> d >> label)
+            events.push_back({a, b, c, d});
+
+          std::stringstream stream;
+          classifier.SaveBinary(stream);
+          binary = stream.str();
+        }
+
+        Classifier classifier;
+        std::vector<std::vector<float>> events;
+        std::string binary;
+
+};
+
+TEST_F(BinaryTest, CRC32) {
+
+    const char data[] = "123456789";
+    EXPECT_EQ(crc32(data, 9), 0xCBF43926u);
+    EXPECT_EQ(crc32(data, 0), 0u);
+
+}
+
+TEST_F(BinaryTest, IOForestUsingSpecialValues) {
+
+    std::vector<float> indices = {std::numeric_limits<float>::denorm_min(),
+                                  std::numeric_limits<float>::infinity(),
+                                  -std::numeric_limits<float>::infinity(),
+                                  std::numeric_limits<float>::quiet_NaN(),
+                                  std::numeric_limits<float>::lowest(),
+                                  -0.0f, 1.5f};
+
+    Forest<float> before(0.1, -0.3, false);
+    for(unsigned long i = 0; i < indices.size(); ++i) {
+      Cut<float> cut;
+      cut.feature = i;
+      cut.index = indices[i];
+      cut.valid = i % 2 == 0;
+      cut.gain = 1.0 / (i + 1);
+      before.AddTree(Tree<float>({cut}, {1.0, 2.0, 3.0}, {0.1, 0.2, 0.3}, {-1.0, 0.5, std::numeric_limits<float>::infinity()}));
+    }
+
+    BinaryWriter writer;
+    writeBinary(writer, before);
+    BinaryReader reader(writer.GetBuffer().data(), writer.GetBuffer().size());
+    auto after = readForestFromBinary<float>(reader);
+    EXPECT_TRUE(reader.AtEnd());
+
+    EXPECT_EQ(before.GetF0(), after.GetF0());
+    EXPECT_EQ(before.GetShrinkage(), after.GetShrinkage());
+    EXPECT_EQ(before.GetTransform2Probability(), after.GetTransform2Probability());
+    ASSERT_EQ(before.GetForest().size(), after.GetForest().size());
+    for(unsigned long i = 0; i < indices.size(); ++i) {
+      const auto &before_tree = before.GetForest()[i];
+      const auto &after_tree = after.GetForest()[i];
+      ASSERT_EQ(after_tree.GetCuts().size(), 1u);
+      const auto &before_cut = before_tree.GetCuts()[0];
+      const auto &after_cut = after_tree.GetCuts()[0];
+      EXPECT_EQ(before_cut.feature, after_cut.feature);
+      EXPECT_EQ(before_cut.valid, after_cut.valid);
+      EXPECT_EQ(before_cut.gain, after_cut.gain);
+      // The values are stored bit by bit
+      EXPECT_EQ(std::memcmp(&before_cut.index, &after_cut.index, sizeof(float)), 0);
+      EXPECT_EQ(before_tree.GetBoostWeights(), after_tree.GetBoostWeights());
+      EXPECT_EQ(before_tree.GetPurities(), after_tree.GetPurities());
+      EXPECT_EQ(before_tree.GetNEntries(), after_tree.GetNEntries());
+    }
+
+    // Each tree needs one boost weight, purity and number of entries per node
+    for(unsigned long corrupt_array = 0; corrupt_array < 3; ++corrupt_array) {
+      std::vector<std::vector<Weight>> arrays(3, {1.0, 2.0, 3.0});
+      arrays[corrupt_array].pop_back();
+      BinaryWriter corrupt;
+      corrupt.Write(0.0);
+      corrupt.Write(1.0);
+      corrupt.Write(true);
+      corrupt.Write(static_cast<uint64_t>(1));
+      corrupt.Write(static_cast<uint64_t>(1));
+      writeBinary(corrupt, Cut<float>());
+      for(const auto &array : arrays)
+        corrupt.Write(array);
+      BinaryReader corrupt_reader(corrupt.GetBuffer().data(), corrupt.GetBuffer().size());
+      EXPECT_THROW(readForestFromBinary<float>(corrupt_reader), std::runtime_error);
+    }
+
+}
+
+TEST_F(BinaryTest, BinaryClassifierIsSameAsText) {
+
+    EXPECT_EQ(binary.compare(0, sizeof(BinaryFormat::magic), BinaryFormat::magic, sizeof(BinaryFormat::magic)), 0);
+
+    std::stringstream stream(binary);
+    EXPECT_TRUE(isBinaryWeightfile(stream));
+    Classifier after(stream);
+
+    EXPECT_EQ(after.GetNTrees(), classifier.GetNTrees());
+    EXPECT_EQ(after.GetDepth(), classifier.GetDepth());
+    EXPECT_EQ(after.GetBinning(), classifier.GetBinning());
+    EXPECT_EQ(after.GetShrinkage(), classifier.GetShrinkage());
+    EXPECT_EQ(after.GetNFeatures(), classifier.GetNFeatures());
+    EXPECT_EQ(after.GetCanUseFastForest(), classifier.GetCanUseFastForest());
+    for(auto &event : events)
+      EXPECT_EQ(after.predict(event), classifier.predict(event));
+
+    // The text format is still detected
+    std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+    EXPECT_FALSE(isBinaryWeightfile(weightfile));
+
+}
+
+TEST_F(BinaryTest, CorruptBinaryWeightfilesAreRejected) {
+
+    // Flipped bit in the payload of the last section
+    std::string corrupt = binary;
+    corrupt[corrupt.size() - 10] ^= 0x01;
+    std::stringstream corrupt_stream(corrupt);
+    EXPECT_THROW(Classifier{corrupt_stream}, std::runtime_error);
+
+    std::stringstream truncated_stream(binary.substr(0, binary.size() - 1));
+    EXPECT_THROW(Classifier{truncated_stream}, std::runtime_error);
+
+    // Newer version of the format
+    std::string newer = binary;
+    newer[sizeof(BinaryFormat::magic)] = static_cast<char>(BinaryFormat::version + 1);
+    std::stringstream newer_stream(newer);
+    EXPECT_THROW(Classifier{newer_stream}, std::runtime_error);
+
+}
+
+TEST_F(BinaryTest, TrailingBytesInForestSectionsAreRejected) {
+
+    // Same weightfile with trailing bytes behind the trees of the fast forest
+    std::stringstream input(binary);
+    const uint32_t nSections = readBinaryHeader(input);
+    std::stringstream output;
+    writeBinaryHeader(output, nSections);
+    std::string payload;
+    for(uint32_t iSection = 0; iSection < nSections; ++iSection) {
+      const uint32_t id = readBinarySection(input, payload);
+      if(id == BinaryFormat::fastForest)
+        payload += std::string(4, '\0');
+      BinaryWriter writer;
+      for(char byte : payload)
+        writer.Write(static_cast<uint8_t>(byte));
+      writeBinarySection(output, static_cast<BinaryFormat::Section>(id), writer);
+    }
+    const std::string trailing = output.str();
+
+    // Only skipped trees may be left in the section
+    const unsigned long nTrees = classifier.GetFastForest().GetForest().size();
+    for(unsigned long maxTrees : {allTrees, nTrees}) {
+      std::stringstream stream(trailing);
+      EXPECT_THROW(Classifier(stream, maxTrees), std::runtime_error);
+    }
+    std::stringstream stream(trailing);
+    Classifier partial(stream, nTrees - 1);
+    EXPECT_EQ(partial.GetFastForest().GetForest().size(), nTrees - 1);
+
+}
+
+TEST_F(BinaryTest, UnknownSectionsAreSkipped) {
+
+    // Same weightfile with an additional section of a later version of the format
+    std::stringstream stream;
+    writeBinaryHeader(stream, 6);
+    BinaryWriter extra;
+    extra.Write(std::vector<float>{1.0, 2.0, 3.0});
+    writeBinarySection(stream, static_cast<BinaryFormat::Section>(99), extra);
+    stream << binary.substr(16);
+
+    Classifier after(stream);
+    for(auto &event : events)
+      EXPECT_EQ(after.predict(event), classifier.predict(event));
+
+}
+
+TEST_F(BinaryTest, IOCompactForest) {
+
+    Forest<unsigned long> before(0.1, -0.3, true);
+    for(unsigned long i = 0; i < 3; ++i) {
+      Cut<unsigned long> cut;
+      cut.feature = i;
+      cut.index = 1000 * i + 1;
+      cut.valid = i != 1;
+      cut.gain = 2.5;
+      before.AddTree(Tree<unsigned long>({cut}, {1.0, 2.0, 3.0}, {0.1, 0.2, 0.3}, {-1.0, 0.5, 1.5f * i}));
+    }
+
+    BinaryWriter writer;
+    writeCompactBinary(writer, before);
+    BinaryReader reader(writer.GetBuffer().data(), writer.GetBuffer().size());
+    auto after = readCompactForestFromBinary<unsigned long>(reader);
+    EXPECT_TRUE(reader.AtEnd());
+
+    EXPECT_EQ(before.GetF0(), after.GetF0());
+    EXPECT_EQ(before.GetShrinkage(), after.GetShrinkage());
+    EXPECT_EQ(before.GetTransform2Probability(), after.GetTransform2Probability());
+    ASSERT_EQ(after.GetForest().size(), 3u);
+    for(unsigned long i = 0; i < 3; ++i) {
+      const auto &before_tree = before.GetForest()[i];
+      const auto &after_tree = after.GetForest()[i];
+      ASSERT_EQ(after_tree.GetCuts().size(), 1u);
+      EXPECT_EQ(after_tree.GetCuts()[0].feature, before_tree.GetCuts()[0].feature);
+      EXPECT_EQ(after_tree.GetCuts()[0].index, before_tree.GetCuts()[0].index);
+      EXPECT_EQ(after_tree.GetCuts()[0].valid, before_tree.GetCuts()[0].valid);
+      EXPECT_EQ(after_tree.GetCuts()[0].gain, 0.0);
+      EXPECT_EQ(after_tree.GetBoostWeights(), before_tree.GetBoostWeights());
+      EXPECT_TRUE(after_tree.GetPurities().empty());
+      EXPECT_TRUE(after_tree.GetNEntries().empty());
+    }
+
+    // Each tree needs one boost weight per node
+    BinaryWriter corrupt;
+    corrupt.Write(0.0);
+    corrupt.Write(1.0);
+    corrupt.Write(true);
+    corrupt.Write(static_cast<uint64_t>(1));
+    corrupt.Write(static_cast<uint64_t>(1));
+    corrupt.Write(static_cast<uint32_t>(0));
+    corrupt.Write(true);
+    corrupt.Write(1.0f);
+    corrupt.Write(std::vector<float>{1.0, 2.0});
+    BinaryReader corrupt_reader(corrupt.GetBuffer().data(), corrupt.GetBuffer().size());
+    EXPECT_THROW(readCompactForestFromBinary<float>(corrupt_reader), std::runtime_error);
+
+}
+
+TEST_F(BinaryTest, CompactClassifierIsSameAsClassifier) {
+
+    std::vector<std::vector<float>> X(4);
+    std::vector<bool> y;
+    for(auto &event : events) {
+      for(unsigned long iFeature = 0; iFeature < 4; ++iFeature)
+        X[iFeature].push_back(event[iFeature]);
+      y.push_back(y.size() % 3 == 1);
+    }
+    std::vector<float> w(y.size(), 1.0);
+    Classifier purity_classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0);
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      std::stringstream full;
+      c->SaveBinary(full);
+      std::stringstream compact_stream;
+      c->SaveCompact(compact_stream);
+      const std::string compact = compact_stream.str();
+      EXPECT_LT(compact.size(), full.str().size() / 2);
+
+      std::stringstream stream(compact);
+      EXPECT_TRUE(isBinaryWeightfile(stream));
+      Classifier after(stream);
+      EXPECT_TRUE(after.IsInferenceOnly());
+      EXPECT_FALSE(c->IsInferenceOnly());
+      EXPECT_EQ(after.GetNFeatures(), c->GetNFeatures());
+      EXPECT_EQ(after.GetCanUseFastForest(), c->GetCanUseFastForest());
+      for(auto &event : events)
+        EXPECT_EQ(after.predict(event), c->predict(event));
+
+      // Only the compact and mapped formats can be written without the complete trees
+      std::stringstream again;
+      after.SaveCompact(again);
+      EXPECT_EQ(again.str(), compact);
+      std::stringstream mapped;
+      EXPECT_NO_THROW(after.SaveMapped(mapped));
+      std::stringstream text, binary_stream;
+      EXPECT_THROW(text << after, std::runtime_error);
+      EXPECT_THROW(after.SaveBinary(binary_stream), std::runtime_error);
+      EXPECT_THROW(after.GetVariableRanking(), std::runtime_error);
+      EXPECT_THROW(after.GetIndividualVariableRanking(events[0]), std::runtime_error);
+    }
+
+}
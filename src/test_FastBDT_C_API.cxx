@@ -6,6 +6,14 @@
 
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
+
 class CInterfaceTest : public ::testing::Test {
     protected:
         virtual void SetUp() {
@@ -187,3 +195,328 @@ TEST_F(CInterfaceTest, TrainAndAnalyseForestWorksWithWeights ) {
     Fit(expertise, data_ptr, weight_ptr3, target_ptr, 7, 2);
     EXPECT_LE(Predict(expertise, test_ptr), 0.03);
 }
+
+TEST_F(CInterfaceTest, PredictArrayThreadedIsSameAsPredict ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 1u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetTransform2Probability(expertise, true);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    SetNThreads(expertise, 2u);
+    EXPECT_EQ(GetNThreads(expertise), 2u);
+
+    float result[7];
+    float threaded_result[7];
+    PredictArray(expertise, data_ptr, result, 7);
+    PredictArrayThreaded(expertise, data_ptr, threaded_result, 7, 3);
+    for(unsigned long i = 0; i < 7; ++i) {
+      EXPECT_EQ(result[i], Predict(expertise, data_ptr + 2*i));
+      EXPECT_EQ(threaded_result[i], result[i]);
+    }
+}
+
+TEST_F(CInterfaceTest, PredictAboveIsSameAsPredict ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 1u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetTransform2Probability(expertise, true);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    bool result[7];
+    PredictArrayAbove(expertise, data_ptr, result, 7, 0.5);
+    for(unsigned long i = 0; i < 7; ++i) {
+      EXPECT_EQ(result[i], Predict(expertise, data_ptr + 2*i) > 0.5);
+      EXPECT_EQ(PredictAbove(expertise, data_ptr + 2*i, 0.5), result[i]);
+    }
+}
+
+TEST_F(CInterfaceTest, IndividualVariableRankingArrayIsSameAsSingleRanking ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 2u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    double ranking[14];
+    GetIndividualVariableRankingArray(expertise, data_ptr, ranking, 7);
+    for(unsigned long i = 0; i < 7; ++i) {
+      void *single = GetIndividualVariableRanking(expertise, data_ptr + 2*i);
+      for(unsigned int iFeature = 0; iFeature < 2; ++iFeature) {
+        EXPECT_NEAR(ranking[2*i + iFeature], ExtractImportanceOfVariableFromVariableRanking(single, iFeature), 1e-12);
+      }
+      DeleteVariableRanking(single);
+    }
+}
+
+TEST_F(CInterfaceTest, PredictArrayStagedIsSameAsPredict ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 1u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    unsigned long checkpoints[] = {1, 10};
+    float result[14];
+    EXPECT_TRUE(PredictArrayStaged(expertise, data_ptr, result, 7, checkpoints, 2));
+    for(unsigned long i = 0; i < 7; ++i) {
+      EXPECT_EQ(result[2*i + 1], Predict(expertise, data_ptr + 2*i));
+    }
+
+    // Invalid checkpoints are reported instead of throwing through the C interface
+    unsigned long too_large[] = {1, 11};
+    EXPECT_FALSE(PredictArrayStaged(expertise, data_ptr, result, 7, too_large, 2));
+    unsigned long decreasing[] = {10, 1};
+    EXPECT_FALSE(PredictArrayStaged(expertise, data_ptr, result, 7, decreasing, 2));
+}
+
+TEST_F(CInterfaceTest, LeafIndicesArrayWorks ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 1u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    uint16_t nodes[70];
+    uint8_t nodes8[70];
+    EXPECT_EQ(GetNLoadedTrees(expertise), 10u);
+    EXPECT_TRUE(GetLeafIndicesArray(expertise, data_ptr, nodes, 7));
+    EXPECT_TRUE(GetLeafIndicesArray8(expertise, data_ptr, nodes8, 7));
+    for(unsigned long i = 0; i < 70; ++i) {
+      EXPECT_LT(nodes[i], 3u);
+      EXPECT_EQ(nodes8[i], nodes[i]);
+    }
+
+    // The node ids of trees with depth 8 do not fit into 8 bits
+    Expertise *deep = static_cast<Expertise*>(Create());
+    SetNTrees(deep, 2u);
+    SetDepth(deep, 8u);
+    SetSubsample(deep, 1.0);
+    unsigned long deep_binning[] = {4u, 4u};
+    SetBinning(deep, deep_binning, 2);
+    float deep_data[2000];
+    bool deep_target[1000];
+    for(unsigned long i = 0; i < 1000; ++i) {
+      deep_data[2*i] = (i * 37) % 101;
+      deep_data[2*i + 1] = (i * 53) % 97;
+      deep_target[i] = (i * 7) % 3 == 0;
+    }
+    Fit(deep, deep_data, nullptr, deep_target, 1000, 2);
+    uint8_t deep_nodes8[2000];
+    uint16_t deep_nodes[2000];
+    EXPECT_FALSE(GetLeafIndicesArray8(deep, deep_data, deep_nodes8, 1000));
+    EXPECT_TRUE(GetLeafIndicesArray(deep, deep_data, deep_nodes, 1000));
+    Delete(deep);
+}
+
+TEST_F(CInterfaceTest, ModelHandleWorks ) {
+
+    void *handle = CreateModelHandle();
+    float data_ptr[] = {5.1, 3.5, 1.4, 0.1, 6.3, 3.3, 6.0, 2.5};
+    EXPECT_TRUE(std::isnan(PredictModelHandle(handle, data_ptr)));
+    EXPECT_EQ(LoadModelHandle(handle, const_cast<char*>("/this/weightfile/does/not/exist")), 0u);
+    EXPECT_EQ(GetModelHandleVersion(handle), 0u);
+
+    EXPECT_EQ(LoadModelHandle(handle, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile")), 1u);
+    Load(expertise, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"));
+    float result[2];
+    PredictArrayModelHandle(handle, data_ptr, result, 2);
+    for(unsigned long i = 0; i < 2; ++i) {
+      EXPECT_EQ(result[i], Predict(expertise, data_ptr + 4*i));
+      EXPECT_EQ(PredictModelHandle(handle, data_ptr + 4*i), result[i]);
+    }
+    EXPECT_EQ(LoadModelHandle(handle, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile")), 2u);
+    EXPECT_EQ(GetModelHandleVersion(handle), 2u);
+    DeleteModelHandle(handle);
+}
+
+TEST_F(CInterfaceTest, PredictArrayStridedIsSameAsPredict ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 2u);
+    SetSubsample(expertise, 1.0);
+    SetShrinkage(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    Fit(expertise, data_ptr, nullptr, target_ptr, 7, 2);
+
+    float column_major[14];
+    for(unsigned long i = 0; i < 7; ++i) {
+      column_major[i] = data_ptr[2*i];
+      column_major[7 + i] = data_ptr[2*i + 1];
+    }
+    float result[7];
+    PredictArrayStrided(expertise, column_major, result, 7, 1, 7, 2);
+    for(unsigned long i = 0; i < 7; ++i) {
+      EXPECT_EQ(result[i], Predict(expertise, data_ptr + 2*i));
+    }
+}
+
+TEST_F(CInterfaceTest, SaveBinaryAndLoadWorks ) {
+
+    float data_ptr[] = {5.1, 3.5, 1.4, 0.2,
+                        6.3, 2.9, 5.6, 1.8};
+    Load(expertise, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"));
+
+    const std::string weightfile = "/tmp/fastbdt_binary_" + std::to_string(getpid()) + ".weightfile";
+    EXPECT_TRUE(SaveBinary(expertise, const_cast<char*>(weightfile.c_str())));
+
+    Expertise *binary = static_cast<Expertise*>(Create());
+    EXPECT_TRUE(Load(binary, const_cast<char*>(weightfile.c_str())));
+    for(unsigned long i = 0; i < 2; ++i)
+      EXPECT_EQ(Predict(binary, data_ptr + 4*i), Predict(expertise, data_ptr + 4*i));
+
+    // A truncated weightfile is reported instead of throwing through the C interface, the classifier is unchanged
+    std::ifstream input(weightfile, std::ios_base::binary);
+    const std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    std::ofstream(weightfile, std::ios_base::binary | std::ios_base::trunc) << content.substr(0, 16);
+    EXPECT_FALSE(Load(binary, const_cast<char*>(weightfile.c_str())));
+    EXPECT_FALSE(LoadPartial(binary, const_cast<char*>(weightfile.c_str()), 5));
+    std::remove(weightfile.c_str());
+    EXPECT_FALSE(Load(binary, const_cast<char*>(weightfile.c_str())));
+    for(unsigned long i = 0; i < 2; ++i)
+      EXPECT_EQ(Predict(binary, data_ptr + 4*i), Predict(expertise, data_ptr + 4*i));
+    Delete(binary);
+}
+
+TEST_F(CInterfaceTest, LoadPartialWorks ) {
+
+    float data_ptr[] = {5.1, 3.5, 1.4, 0.2,
+                        6.3, 2.9, 5.6, 1.8};
+    Load(expertise, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"));
+
+    Expertise *partial = static_cast<Expertise*>(Create());
+    EXPECT_TRUE(LoadPartial(partial, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"), 5));
+    EXPECT_EQ(partial->classifier.GetFastForest().GetForest().size(), 5u);
+    EXPECT_EQ(GetNLoadedTrees(partial), 5u);
+    EXPECT_EQ(GetNTrees(partial), GetNTrees(expertise));
+    for(unsigned long i = 0; i < 2; ++i)
+      EXPECT_FLOAT_EQ(Predict(partial, data_ptr + 4*i), expertise->classifier.predict_staged({data_ptr + 4*i, data_ptr + 4*i + 4}, {5})[0]);
+    Delete(partial);
+}
+
+TEST_F(CInterfaceTest, SaveCompactAndLoadWorks ) {
+
+    float data_ptr[] = {5.1, 3.5, 1.4, 0.2,
+                        6.3, 2.9, 5.6, 1.8};
+    Load(expertise, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"));
+
+    const std::string weightfile = "/tmp/fastbdt_compact_" + std::to_string(getpid()) + ".weightfile";
+    EXPECT_FALSE(SaveCompact(expertise, const_cast<char*>("/this/directory/does/not/exist/compact.weightfile")));
+    EXPECT_TRUE(SaveCompact(expertise, const_cast<char*>(weightfile.c_str())));
+
+    Expertise *compact = static_cast<Expertise*>(Create());
+    Load(compact, const_cast<char*>(weightfile.c_str()));
+    std::remove(weightfile.c_str());
+    EXPECT_TRUE(IsInferenceOnly(compact));
+    EXPECT_FALSE(IsInferenceOnly(expertise));
+    for(unsigned long i = 0; i < 2; ++i)
+      EXPECT_EQ(Predict(compact, data_ptr + 4*i), Predict(expertise, data_ptr + 4*i));
+
+    // The operations which need the complete trees report an error instead of throwing through the C interface
+    EXPECT_FALSE(Save(compact, const_cast<char*>(weightfile.c_str())));
+    EXPECT_FALSE(SaveBinary(compact, const_cast<char*>(weightfile.c_str())));
+    std::remove(weightfile.c_str());
+    EXPECT_EQ(GetVariableRanking(compact), nullptr);
+    EXPECT_EQ(GetIndividualVariableRanking(compact, data_ptr), nullptr);
+    double ranking[8];
+    EXPECT_FALSE(GetIndividualVariableRankingArray(compact, data_ptr, ranking, 2));
+    EXPECT_TRUE(GetIndividualVariableRankingArray(expertise, data_ptr, ranking, 2));
+    Delete(compact);
+}
+
+TEST_F(CInterfaceTest, SaveMappedAndLoadMappedWorks ) {
+
+    float data_ptr[] = {5.1, 3.5, 1.4, 0.2,
+                        6.3, 2.9, 5.6, 1.8};
+    Load(expertise, const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile"));
+    EXPECT_EQ(LoadMapped(const_cast<char*>("/this/weightfile/does/not/exist")), nullptr);
+    EXPECT_EQ(LoadMapped(const_cast<char*>(FastBDT_FILES_DIR "/iris.weightfile")), nullptr);
+
+    const std::string weightfile = "/tmp/fastbdt_mapped_" + std::to_string(getpid()) + ".weightfile";
+    EXPECT_FALSE(SaveMapped(expertise, const_cast<char*>("/this/directory/does/not/exist/mapped.weightfile")));
+    EXPECT_TRUE(SaveMapped(expertise, const_cast<char*>(weightfile.c_str())));
+
+    void *mapped = LoadMapped(const_cast<char*>(weightfile.c_str()));
+    std::remove(weightfile.c_str());
+    ASSERT_NE(mapped, nullptr);
+    EXPECT_EQ(GetMappedNFeatures(mapped), 4u);
+    float result[2];
+    PredictArrayMapped(mapped, data_ptr, result, 2, 2);
+    for(unsigned long i = 0; i < 2; ++i) {
+      EXPECT_EQ(result[i], Predict(expertise, data_ptr + 4*i));
+      EXPECT_EQ(PredictMapped(mapped, data_ptr + 4*i), result[i]);
+    }
+    DeleteMapped(mapped);
+}
+
+TEST_F(CInterfaceTest, FitStreamingAndRecoverWorks ) {
+
+    SetNTrees(expertise, 10u);
+    SetDepth(expertise, 2u);
+    SetSubsample(expertise, 1.0);
+    unsigned long binning[] = {2u, 2u};
+    SetBinning(expertise, binning, 2);
+    SetNumberOfFlatnessFeatures(expertise, 0);
+
+    float data_ptr[] = {1.0, 2.6, 1.6, 2.5, 1.1, 2.0, 1.9, 2.1, 1.6, 2.9, 1.9, 2.9, 1.5, 2.0};
+    bool target_ptr[] = {0, 1, 0, 1, 1, 1, 0};
+    const std::string weightfile = "/tmp/fastbdt_streaming_" + std::to_string(getpid()) + ".weightfile";
+    EXPECT_FALSE(FitStreaming(expertise, data_ptr, nullptr, target_ptr, 7, 2, const_cast<char*>("/this/directory/does/not/exist/streaming.weightfile")));
+    EXPECT_TRUE(FitStreaming(expertise, data_ptr, nullptr, target_ptr, 7, 2, const_cast<char*>(weightfile.c_str())));
+
+    Expertise *loaded = static_cast<Expertise*>(Create());
+    EXPECT_TRUE(Load(loaded, const_cast<char*>(weightfile.c_str())));
+    Expertise *recovered = static_cast<Expertise*>(Create());
+    EXPECT_TRUE(Recover(recovered, const_cast<char*>(weightfile.c_str())));
+    std::remove(weightfile.c_str());
+    EXPECT_FALSE(Recover(recovered, const_cast<char*>(weightfile.c_str())));
+
+    for(unsigned long i = 0; i < 7; ++i) {
+      EXPECT_FLOAT_EQ(Predict(loaded, data_ptr + 2*i), Predict(expertise, data_ptr + 2*i));
+      EXPECT_FLOAT_EQ(Predict(recovered, data_ptr + 2*i), Predict(expertise, data_ptr + 2*i));
+    }
+    Delete(loaded);
+    Delete(recovered);
+}
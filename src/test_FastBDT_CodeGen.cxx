@@ -0,0 +1,76 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT.h"
+#include "FastBDT_CodeGen.h"
+#include "Classifier.h"
+
+// Generated at build time by fastbdt-codegen from files/iris.weightfile
+#include "iris_forest.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <limits>
+
+using namespace FastBDT;
+
+TEST(CodeGenTest, GeneratedIrisForestIsSameAsClassifier) {
+
+    std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+    ASSERT_TRUE(weightfile.good());
+    Classifier classifier(weightfile);
+    EXPECT_EQ(iris_forest::nTrees, classifier.GetFastForest().GetForest().size());
+
+    std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+    ASSERT_TRUE(data.good());
+    std::string header;
+    std::getline(data, header);
+
+    unsigned long nEvents = 0;
+    std::vector<float> event(4);
+    int label = 0;
+    while(data >> event[0] >> event[1] >> event[2] >> event[3] >> label) {
+      EXPECT_EQ(iris_forest::predict(event.data()), classifier.predict(event));
+      ++nEvents;
+    }
+    EXPECT_EQ(nEvents, 150u);
+
+    // Missing values stop the event in the corresponding node
+    std::vector<float> missing = {5.0, std::numeric_limits<float>::quiet_NaN(), 4.0, std::numeric_limits<float>::quiet_NaN()};
+    EXPECT_EQ(iris_forest::predict(missing.data()), classifier.predict(missing));
+
+}
+
+TEST(CodeGenTest, WriteForestToHeader) {
+
+    Cut<float> cut1, cut2, cut3;
+    cut1.feature = 0;
+    cut1.index = 0.5;
+    cut1.valid = true;
+    cut2.feature = 3;
+    cut2.index = -std::numeric_limits<float>::infinity();
+    cut2.valid = true;
+    cut3.valid = false;
+    Forest<float> forest(0.1, 1.0, false);
+    forest.AddTree(Tree<float>({cut1, cut2, cut3}, {}, {}, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0}));
+
+    std::stringstream stream;
+    writeForestToHeader(stream, forest, "my_model");
+    const std::string code = stream.str();
+    EXPECT_NE(code.find("namespace my_model {"), std::string::npos);
+    EXPECT_NE(code.find("constexpr unsigned long nTrees = 1;"), std::string::npos);
+    EXPECT_NE(code.find("constexpr unsigned long nFeatures = 4;"), std::string::npos);
+    EXPECT_NE(code.find("inline float tree_0(const float *values) {"), std::string::npos);
+    EXPECT_NE(code.find("values[3] >= -std::numeric_limits<float>::infinity()"), std::string::npos);
+    EXPECT_NE(code.find("return GetF(values);"), std::string::npos);
+
+    // Incomplete trees cannot be written
+    Forest<float> incomplete(0.1, 1.0, false);
+    incomplete.AddTree(Tree<float>({cut1}, {}, {}, {1.0}));
+    EXPECT_THROW(writeForestToHeader(stream, incomplete, "my_model"), std::runtime_error);
+
+}
@@ -7,9 +7,15 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
 #include <sstream>
 #include <limits>
 
+#include <unistd.h>
+
 using namespace FastBDT;
 
 
@@ -360,3 +366,153 @@ TEST_F(IOTest, IOForest) {
             EXPECT_FLOAT_EQ(before_nEntries[i], after_nEntries[i]);
     }
 }
+
+namespace {
+
+  std::string printf_format(const char *format, int precision, double value) {
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), format, precision, value);
+    return buffer;
+  }
+
+  /**
+   * Random floats with random bit patterns, so all exponents including denormalized values are covered
+   */
+  std::vector<float> random_floats(unsigned long n) {
+    std::mt19937 generator(42);
+    std::vector<float> values;
+    while(values.size() < n) {
+      const uint32_t bits = generator();
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      if(std::isfinite(value))
+        values.push_back(value);
+    }
+    // Values which are exactly in the middle between two decimals
+    values.insert(values.end(), {0.5f, 2.5f, 1.953125f, 0.001953125f, 1.0f, 1e10f, 9.9999999e9f, -0.0f});
+    return values;
+  }
+
+}
+
+TEST_F(IOTest, TextWriterIsSameAsPrintf) {
+
+    const auto floats = random_floats(100000);
+    std::stringstream stream;
+    stream << floats;
+
+    std::string expected = std::to_string(floats.size());
+    for(auto &value : floats)
+      expected += " " + printf_format("%.*e", 9, value);
+    expected += "\n";
+    EXPECT_EQ(stream.str(), expected);
+
+    // Scalars are written in the current format of the stream, like %g before and like %e after the first vector
+    std::stringstream general;
+    std::string expected_general;
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> exponent(-50, 50);
+    for(unsigned int i = 0; i < 10000; ++i) {
+      const double value = ((i % 2 == 0) ? 1 : -1) * std::pow(10.0, exponent(generator));
+      {
+        TextWriter writer(general);
+        writer.Write(value);
+        writer.Write(' ');
+        writer.Write(static_cast<double>(floats[i]));
+        writer.EndLine();
+      }
+      expected_general += printf_format("%.*g", 6, value) + " " + printf_format("%.*g", 6, floats[i]) + "\n";
+    }
+    for(double value : {0.0, -0.0, 0.1, 0.5, -1.0, 1e6, 123456.5, 0.0001, 0.00001, 2.5e-5, 1234567.0}) {
+      TextWriter writer(general);
+      writer.Write(value);
+      writer.EndLine();
+      expected_general += printf_format("%.*g", 6, value) + "\n";
+    }
+    EXPECT_EQ(general.str(), expected_general);
+
+    // The writer leaves the stream in the same state as the std::ostream operators did
+    std::stringstream state;
+    Cut<float> cut;
+    state << cut;
+    EXPECT_TRUE(state.flags() & std::ios_base::scientific);
+    EXPECT_EQ(state.precision(), 6);
+    state.str("");
+    state << 0.25;
+    EXPECT_EQ(state.str(), "2.500000e-01");
+
+}
+
+TEST_F(IOTest, TextReaderIsSameAsConvertSafely) {
+
+    auto floats = random_floats(100000);
+    for(auto value : {std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+                      -std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::denorm_min(), std::numeric_limits<float>::max()})
+      floats.push_back(value);
+
+    // Tokens with fewer digits, in the %g format and with redundant zeros use the general parser
+    std::vector<std::string> tokens;
+    for(auto &value : floats) {
+      tokens.push_back(printf_format("%.*e", 9, value));
+      tokens.push_back(printf_format("%.*g", 6, value));
+      tokens.push_back(printf_format("%.*e", 3, value));
+    }
+    tokens.insert(tokens.end(), {"0", "-0", "007", "1.", ".5", "+1.5", "1E3", "3.4028236e38", "1e-46", "1.00000000000000000001", "0.000000000000000000000001234"});
+
+    std::string text = std::to_string(tokens.size());
+    for(auto &token : tokens)
+      text += " " + token;
+    text += "\n";
+
+    std::stringstream float_stream(text);
+    std::vector<float> float_values;
+    float_stream >> float_values;
+    std::stringstream double_stream(text);
+    std::vector<double> double_values;
+    double_stream >> double_values;
+
+    ASSERT_EQ(float_values.size(), tokens.size());
+    ASSERT_EQ(double_values.size(), tokens.size());
+    for(unsigned long i = 0; i < tokens.size(); ++i) {
+      const float expected_float = convert_to_float_safely(tokens[i]);
+      const double expected_double = convert_to_double_safely(tokens[i]);
+      EXPECT_EQ(std::memcmp(&float_values[i], &expected_float, sizeof(float)), 0) << tokens[i];
+      EXPECT_EQ(std::memcmp(&double_values[i], &expected_double, sizeof(double)), 0) << tokens[i];
+    }
+
+}
+
+TEST_F(IOTest, TextReaderLeavesStreamAfterLastToken) {
+
+    const auto floats = random_floats(1000);
+    const std::string filename = "/tmp/fastbdt_io_" + std::to_string(getpid()) + ".txt";
+    {
+      std::fstream file(filename, std::ios_base::out | std::ios_base::trunc);
+      file << floats << "next 42" << std::endl;
+    }
+
+    // A tiny buffer splits many tokens between two chunks
+    char buffer[7];
+    std::fstream file;
+    file.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+    file.open(filename, std::ios_base::in);
+    std::vector<float> after;
+    file >> after;
+    std::string word;
+    unsigned long number = 0;
+    file >> word >> number;
+    std::remove(filename.c_str());
+
+    EXPECT_EQ(after, floats);
+    EXPECT_EQ(word, "next");
+    EXPECT_EQ(number, 42u);
+
+    // Missing values set the failbit
+    std::stringstream truncated("3 1.0 2.0");
+    std::vector<float> values;
+    truncated >> values;
+    EXPECT_TRUE(truncated.fail());
+    EXPECT_EQ(values[2], 0.0f);
+
+}
+
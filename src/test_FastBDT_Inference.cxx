@@ -0,0 +1,507 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT.h"
+#include "FastBDT_Inference.h"
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <random>
+#include <memory>
+
+using namespace FastBDT;
+
+class CompiledForestTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+            Cut<float> cut1, cut2, cut3;
+            cut1.feature = 0;
+            cut1.index = 0.5;
+            cut1.valid = true;
+            cut1.gain = 2.0;
+            cut2.feature = 1;
+            cut2.index = 0.9;
+            cut2.valid = true;
+            cut2.gain = 1.0;
+            cut3.valid = false;
+
+            std::vector<Cut<float>> cuts = {cut1, cut2, cut3};
+            std::vector<Weight> nEntries = { 10.0, 11.0, 12.0, 13.0, 14.0, 15.0, 16.0 };
+            std::vector<Weight> purities = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7 };
+            std::vector<Weight> boostWeights = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0};
+            tree = Tree<float>(cuts, nEntries, purities, boostWeights);
+
+            forest = Forest<float>(0.1, 1.0, true);
+            forest.AddTree(tree);
+
+            // A deeper forest with random cuts to compare against Forest::GetF
+            std::default_random_engine generator;
+            std::uniform_real_distribution<float> uniform(0.0, 1.0);
+            std::uniform_int_distribution<unsigned long> feature(0, nFeatures - 1);
+            random_forest = Forest<float>(0.2, -0.3, false);
+            for(unsigned long iTree = 0; iTree < 20; ++iTree) {
+              std::vector<Cut<float>> random_cuts(15);
+              for(auto &cut : random_cuts) {
+                cut.feature = feature(generator);
+                cut.index = uniform(generator);
+                cut.valid = uniform(generator) > 0.1;
+              }
+              std::vector<Weight> random_weights(31);
+              for(auto &weight : random_weights)
+                weight = uniform(generator) - 0.5;
+              random_forest.AddTree(Tree<float>(random_cuts, random_weights, random_weights, random_weights));
+            }
+
+            random_events.resize(1000, std::vector<float>(nFeatures));
+            for(auto &event : random_events) {
+              for(auto &value : event) {
+                value = uniform(generator);
+                if(value < 0.05)
+                  value = std::numeric_limits<float>::quiet_NaN();
+              }
+            }
+        }
+
+        const unsigned long nFeatures = 5;
+        Tree<float> tree;
+        Forest<float> forest;
+        Forest<float> random_forest;
+        std::vector<std::vector<float>> random_events;
+
+};
+
+TEST_F(CompiledForestTest, ValueToNodeIsSameAsTree) {
+
+    CompiledForest compiled(forest);
+    std::vector<std::vector<float>> events = {{0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0},
+                                              {NAN, 1.0}, {0.0, NAN}, {1.0, NAN}};
+    for(auto &event : events) {
+      EXPECT_EQ(compiled.ValueToNode(0, event.data()), tree.ValueToNode(event));
+    }
+
+}
+
+TEST_F(CompiledForestTest, MetaDataIsCopied) {
+
+    CompiledForest compiled(forest);
+    EXPECT_EQ(compiled.GetNTrees(), 1u);
+    EXPECT_DOUBLE_EQ(compiled.GetShrinkage(), 0.1);
+    EXPECT_DOUBLE_EQ(compiled.GetF0(), 1.0);
+    EXPECT_TRUE(compiled.GetTransform2Probability());
+
+}
+
+TEST_F(CompiledForestTest, AnalyseIsSameAsForest) {
+
+    CompiledForest compiled(random_forest);
+    EXPECT_EQ(compiled.GetNTrees(), 20u);
+    for(auto &event : random_events) {
+      EXPECT_EQ(compiled.GetF(event.data()), random_forest.GetF(event));
+      EXPECT_EQ(compiled.Analyse(event.data()), random_forest.Analyse(event));
+    }
+
+}
+
+TEST_F(CompiledForestTest, EmptyForestReturnsF0) {
+
+    Forest<float> empty(0.1, 1.0, false);
+    CompiledForest compiled(empty);
+    std::vector<float> event = {0.0, 0.0};
+    EXPECT_EQ(compiled.GetNTrees(), 0u);
+    EXPECT_DOUBLE_EQ(compiled.GetF(event.data()), empty.GetF(event));
+
+}
+
+TEST_F(CompiledForestTest, TooManyFeaturesThrow) {
+
+    Cut<float> cut;
+    cut.feature = 70000;
+    cut.valid = true;
+    Forest<float> large(0.1, 1.0, false);
+    large.AddTree(Tree<float>({cut}, {1.0, 1.0, 1.0}, {1.0, 1.0, 1.0}, {1.0, 1.0, 1.0}));
+    EXPECT_THROW(CompiledForest compiled(large), std::runtime_error);
+
+}
+
+TEST_F(CompiledForestTest, UnrolledKernelsAreSameAsForest) {
+
+    // The random forest is complete with depth 4, the small forest with depth 2
+    EXPECT_EQ(CompiledForest(random_forest).GetDepth(), 4u);
+    EXPECT_EQ(CompiledForest(forest).GetDepth(), 2u);
+
+    std::default_random_engine generator(23);
+    std::uniform_real_distribution<float> uniform(0.0, 1.0);
+    std::uniform_int_distribution<unsigned long> feature(0, nFeatures - 1);
+    for(unsigned long depth = 1; depth <= CompiledForest::maxUnrolledDepth + 1; ++depth) {
+      Forest<float> depth_forest(0.1, 0.5, true);
+      for(unsigned long iTree = 0; iTree < 5; ++iTree) {
+        std::vector<Cut<float>> cuts((1ul << depth) - 1);
+        for(auto &cut : cuts) {
+          cut.feature = feature(generator);
+          cut.index = uniform(generator);
+          cut.valid = uniform(generator) > 0.1;
+        }
+        std::vector<Weight> weights(2*cuts.size() + 1);
+        for(auto &weight : weights)
+          weight = uniform(generator) - 0.5;
+        depth_forest.AddTree(Tree<float>(cuts, weights, weights, weights));
+      }
+
+      CompiledForest compiled(depth_forest);
+      EXPECT_EQ(compiled.GetDepth(), depth <= CompiledForest::maxUnrolledDepth ? depth : 0u);
+      std::vector<double> F(random_events.size());
+      std::vector<float> matrix;
+      for(auto &event : random_events)
+        matrix.insert(matrix.end(), event.begin(), event.end());
+      compiled.GetF(matrix.data(), random_events.size(), nFeatures, F.data());
+      for(unsigned long iEvent = 0; iEvent < random_events.size(); ++iEvent) {
+        EXPECT_EQ(compiled.GetF(random_events[iEvent].data()), depth_forest.GetF(random_events[iEvent]));
+        EXPECT_EQ(F[iEvent], depth_forest.GetF(random_events[iEvent]));
+      }
+    }
+
+    // Trees with different depths use the generic traversal
+    Forest<float> mixed(random_forest);
+    mixed.AddTree(tree);
+    CompiledForest compiled(mixed);
+    EXPECT_EQ(compiled.GetDepth(), 0u);
+    for(auto &event : random_events) {
+      EXPECT_EQ(compiled.GetF(event.data()), mixed.GetF(event));
+    }
+
+}
+
+TEST_F(CompiledForestTest, BatchIsSameAsSingleEvents) {
+
+    CompiledForest compiled(random_forest);
+
+    // Use a stride larger than the number of features and a number of events which is not a multiple of the block size
+    const unsigned long stride = nFeatures + 3;
+    const unsigned long nEvents = random_events.size() - 7;
+    std::vector<float> matrix(nEvents * stride, 42.0);
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+      std::copy(random_events[iEvent].begin(), random_events[iEvent].end(), matrix.begin() + iEvent*stride);
+
+    std::vector<double> F(nEvents);
+    compiled.GetF(matrix.data(), nEvents, stride, F.data());
+    std::vector<float> result(nEvents);
+    compiled.Analyse(matrix.data(), nEvents, stride, result.data());
+
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+      EXPECT_EQ(F[iEvent], compiled.GetF(random_events[iEvent].data()));
+      EXPECT_EQ(result[iEvent], static_cast<float>(compiled.Analyse(random_events[iEvent].data())));
+    }
+
+}
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+TEST_F(CompiledForestTest, VectorisedKernelIsSameAsScalarPath) {
+
+    // The batch inference processes full groups of 8 (AVX2) or 16 (AVX-512) events with the vector instructions,
+    // the single event inference always uses the scalar traversal
+    std::default_random_engine generator(42);
+    std::uniform_real_distribution<float> uniform(0.0, 1.0);
+    std::uniform_int_distribution<unsigned long> feature(0, nFeatures - 1);
+    const unsigned long nEvents = 16 * (random_events.size() / 16);
+    for(unsigned long depth = 1; depth <= CompiledForest::maxUnrolledDepth + 1; ++depth) {
+      Forest<float> depth_forest(0.1, 0.5, true);
+      for(unsigned long iTree = 0; iTree < 5; ++iTree) {
+        std::vector<Cut<float>> cuts((1ul << depth) - 1);
+        for(auto &cut : cuts) {
+          cut.feature = feature(generator);
+          cut.index = uniform(generator);
+          cut.valid = uniform(generator) > 0.2;
+        }
+        std::vector<Weight> weights(2*cuts.size() + 1);
+        for(auto &weight : weights)
+          weight = uniform(generator) - 0.5;
+        depth_forest.AddTree(Tree<float>(cuts, weights, weights, weights));
+      }
+      CompiledForest compiled(depth_forest);
+
+      for(unsigned long stride : {nFeatures, nFeatures + 3}) {
+        std::vector<float> matrix(nEvents * stride, 42.0);
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+          std::copy(random_events[iEvent].begin(), random_events[iEvent].end(), matrix.begin() + iEvent*stride);
+
+        std::vector<double> F(nEvents);
+        compiled.GetF(matrix.data(), nEvents, stride, F.data());
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+          EXPECT_EQ(F[iEvent], compiled.GetF(random_events[iEvent].data()));
+        }
+      }
+    }
+
+}
+#endif
+
+TEST_F(CompiledForestTest, TileSizesDoNotChangeResult) {
+
+    CompiledForest compiled(random_forest);
+    EXPECT_GE(compiled.GetTreesPerTile(), 1u);
+    EXPECT_EQ(compiled.GetEventsPerTile(nFeatures) % CompiledForest::blockSize, 0u);
+    EXPECT_LE(compiled.GetEventsPerTile(nFeatures), CompiledForest::maxEventsPerTile);
+
+    std::vector<float> matrix;
+    for(auto &event : random_events)
+      matrix.insert(matrix.end(), event.begin(), event.end());
+    const unsigned long nEvents = random_events.size();
+
+    std::vector<std::pair<unsigned long, unsigned long>> tileSizes = {{1, 1}, {3, 7}, {20, 64}, {7, 100}, {100, CompiledForest::maxEventsPerTile}};
+    for(auto &tileSize : tileSizes) {
+      compiled.SetTileSizes(tileSize.first, tileSize.second);
+      EXPECT_EQ(compiled.GetTreesPerTile(), tileSize.first);
+      EXPECT_EQ(compiled.GetEventsPerTile(nFeatures), tileSize.second);
+      std::vector<double> F(nEvents);
+      compiled.GetF(matrix.data(), nEvents, nFeatures, F.data());
+      std::vector<float> result(nEvents);
+      compiled.Analyse(matrix.data(), nEvents, nFeatures, result.data());
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+        EXPECT_EQ(F[iEvent], random_forest.GetF(random_events[iEvent]));
+        EXPECT_EQ(result[iEvent], static_cast<float>(random_forest.Analyse(random_events[iEvent])));
+      }
+    }
+
+    EXPECT_THROW(compiled.SetTileSizes(1, CompiledForest::maxEventsPerTile + 1), std::runtime_error);
+
+}
+
+TEST_F(CompiledForestTest, PredictAboveIsSameAsAnalyse) {
+
+    Forest<float> probability_forest(random_forest.GetShrinkage(), random_forest.GetF0(), true);
+    for(auto &tree : random_forest.GetForest())
+      probability_forest.AddTree(tree);
+
+    for(auto *forest : {&random_forest, &probability_forest}) {
+      CompiledForest compiled(*forest);
+      std::vector<float> outputs;
+      for(auto &event : random_events)
+        outputs.push_back(static_cast<float>(compiled.Analyse(event.data())));
+
+      // The outputs themselves are the most difficult thresholds
+      std::vector<float> thresholds = {outputs[0], outputs[1], outputs[2], std::nextafter(outputs[0], -1.0f), -1.0, 0.0, 0.5, 1.0, 2.0, 
+                                       std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), NAN};
+      for(bool sortByWeightRange : {true, false}) {
+        compiled.SetEarlyExitOrder(sortByWeightRange);
+        for(auto threshold : thresholds) {
+          std::unique_ptr<bool[]> result(new bool[random_events.size()]);
+          std::vector<float> matrix;
+          for(auto &event : random_events)
+            matrix.insert(matrix.end(), event.begin(), event.end());
+          compiled.PredictAbove(matrix.data(), random_events.size(), nFeatures, threshold, result.get());
+          for(unsigned long iEvent = 0; iEvent < random_events.size(); ++iEvent) {
+            EXPECT_EQ(compiled.PredictAbove(random_events[iEvent].data(), threshold), outputs[iEvent] > threshold);
+            EXPECT_EQ(result[iEvent], outputs[iEvent] > threshold);
+          }
+        }
+      }
+    }
+
+}
+
+TEST_F(CompiledForestTest, StagedFIsSameAsForest) {
+
+    CompiledForest compiled(random_forest);
+    std::vector<float> matrix;
+    for(auto &event : random_events)
+      matrix.insert(matrix.end(), event.begin(), event.end());
+    const unsigned long nEvents = random_events.size();
+
+    std::vector<unsigned long> checkpoints = {0, 1, 5, 5, 13, 20};
+    for(unsigned long treesPerTile : {0ul, 1ul, 3ul}) {
+      compiled.SetTileSizes(treesPerTile, 0);
+      std::vector<double> staged_F(nEvents * checkpoints.size());
+      compiled.GetStagedF(matrix.data(), nEvents, nFeatures, checkpoints, staged_F.data());
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+        auto expected = random_forest.GetStagedF(random_events[iEvent], checkpoints);
+        for(unsigned long iStage = 0; iStage < checkpoints.size(); ++iStage)
+          EXPECT_EQ(staged_F[iEvent*checkpoints.size() + iStage], expected[iStage]);
+        EXPECT_EQ(staged_F[iEvent*checkpoints.size() + checkpoints.size() - 1], random_forest.GetF(random_events[iEvent]));
+      }
+    }
+
+    std::vector<float> staged_result(nEvents * 2);
+    compiled.AnalyseStaged(matrix.data(), nEvents, nFeatures, {10, 20}, staged_result.data());
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+      auto expected = random_forest.AnalyseStaged(random_events[iEvent], {10, 20});
+      EXPECT_EQ(staged_result[2*iEvent], static_cast<float>(expected[0]));
+      EXPECT_EQ(staged_result[2*iEvent + 1], static_cast<float>(random_forest.Analyse(random_events[iEvent])));
+    }
+
+    double F[2];
+    EXPECT_THROW(compiled.GetStagedF(matrix.data(), 1, nFeatures, {21}, F), std::runtime_error);
+    EXPECT_THROW(compiled.GetStagedF(matrix.data(), 1, nFeatures, {5, 4}, F), std::runtime_error);
+    EXPECT_THROW(random_forest.GetStagedF(random_events[0], {21}), std::runtime_error);
+
+}
+
+TEST_F(CompiledForestTest, LeafIndicesAreSameAsTree) {
+
+    CompiledForest compiled(random_forest);
+    EXPECT_EQ(compiled.GetNNodeIds(), 31u);
+    std::vector<float> matrix;
+    for(auto &event : random_events)
+      matrix.insert(matrix.end(), event.begin(), event.end());
+    const unsigned long nEvents = random_events.size();
+    const unsigned long nTrees = compiled.GetNTrees();
+
+    std::vector<uint16_t> nodes(nEvents * nTrees);
+    std::vector<uint8_t> nodes8(nEvents * nTrees);
+    compiled.GetLeafIndices(matrix.data(), nEvents, nFeatures, nodes.data());
+    compiled.GetLeafIndices(matrix.data(), nEvents, nFeatures, nodes8.data());
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent) {
+      for(unsigned long iTree = 0; iTree < nTrees; ++iTree) {
+        const unsigned long expected = random_forest.GetForest()[iTree].ValueToNode(random_events[iEvent]);
+        EXPECT_EQ(nodes[iEvent*nTrees + iTree], expected);
+        EXPECT_EQ(nodes8[iEvent*nTrees + iTree], expected);
+      }
+    }
+
+    // A tree with depth 8 has node ids up to 510, which do not fit into 8 bits
+    Forest<float> deep_forest(0.1, 0.0, false);
+    deep_forest.AddTree(Tree<float>(std::vector<Cut<float>>(255), std::vector<Weight>(511), std::vector<Weight>(511), std::vector<Weight>(511)));
+    CompiledForest deep_compiled(deep_forest);
+    EXPECT_THROW(deep_compiled.GetLeafIndices(matrix.data(), 1, nFeatures, nodes8.data()), std::runtime_error);
+    EXPECT_NO_THROW(deep_compiled.GetLeafIndices(matrix.data(), 1, nFeatures, nodes.data()));
+    EXPECT_EQ(nodes[0], 0u);
+
+}
+
+TEST_F(CompiledForestTest, IndividualVariableRankingIsSameAsForest) {
+
+    // The random forest has no gains, so a copy with random gains is used
+    std::default_random_engine generator;
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    Forest<float> gain_forest(random_forest.GetShrinkage(), random_forest.GetF0(), random_forest.GetTransform2Probability());
+    for(auto &random_tree : random_forest.GetForest()) {
+      auto gain_cuts = random_tree.GetCuts();
+      for(auto &cut : gain_cuts)
+        cut.gain = uniform(generator);
+      gain_forest.AddTree(Tree<float>(gain_cuts, random_tree.GetNEntries(), random_tree.GetPurities(), random_tree.GetBoostWeights()));
+    }
+
+    CompiledForest compiled(gain_forest);
+    EXPECT_EQ(compiled.GetNFeatures(), nFeatures);
+
+    std::vector<float> matrix;
+    for(auto &event : random_events)
+      matrix.insert(matrix.end(), event.begin(), event.end());
+
+    // Identity mapping
+    std::vector<unsigned long> columns = {0, 1, 2, 3, 4};
+    std::vector<double> ranking(random_events.size() * nFeatures, -1.0);
+    compiled.GetIndividualVariableRanking(matrix.data(), random_events.size(), nFeatures, columns, nFeatures, ranking.data());
+    for(unsigned long iEvent = 0; iEvent < random_events.size(); ++iEvent) {
+      auto expected = gain_forest.GetIndividualVariableRanking(random_events[iEvent]);
+      for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+        const double value = ranking[iEvent*nFeatures + iFeature];
+        if(expected.find(iFeature) == expected.end())
+          EXPECT_EQ(value, 0.0);
+        else
+          EXPECT_DOUBLE_EQ(value, expected[iFeature]);
+      }
+    }
+
+    // Features 1 and 3 are merged into column 0, the other features are put into column 1
+    std::vector<double> merged(random_events.size() * 2);
+    compiled.GetIndividualVariableRanking(matrix.data(), random_events.size(), nFeatures, {1, 0, 1, 0, 1}, 2, merged.data());
+    for(unsigned long iEvent = 0; iEvent < random_events.size(); ++iEvent) {
+      const double *row = &ranking[iEvent*nFeatures];
+      EXPECT_NEAR(merged[iEvent*2], row[1] + row[3], 1e-12);
+      EXPECT_NEAR(merged[iEvent*2 + 1], row[0] + row[2] + row[4], 1e-12);
+    }
+
+    EXPECT_THROW(compiled.GetIndividualVariableRanking(matrix.data(), 1, nFeatures, {0, 1, 2, 3}, nFeatures, ranking.data()), std::runtime_error);
+    EXPECT_THROW(compiled.GetIndividualVariableRanking(matrix.data(), 1, nFeatures, {0, 1, 2, 3, 5}, nFeatures, ranking.data()), std::runtime_error);
+
+}
+
+TEST_F(CompiledForestTest, QuickScorerIsSameAsForest) {
+
+    QuickScorerForest quickscorer(random_forest);
+    EXPECT_EQ(quickscorer.GetNTrees(), 20u);
+    for(auto &event : random_events) {
+      EXPECT_EQ(quickscorer.GetF(event.data()), random_forest.GetF(event));
+      EXPECT_EQ(quickscorer.Analyse(event.data()), random_forest.Analyse(event));
+    }
+
+    QuickScorerForest small_quickscorer(forest);
+    std::vector<std::vector<float>> events = {{0.0, 0.0}, {0.0, 1.0}, {1.0, 0.0}, {1.0, 1.0},
+                                              {NAN, 1.0}, {0.0, NAN}, {1.0, NAN}};
+    for(auto &event : events) {
+      EXPECT_EQ(small_quickscorer.Analyse(event.data()), forest.Analyse(event));
+    }
+
+}
+
+TEST_F(CompiledForestTest, QuickScorerHandlesSpecialCutValues) {
+
+    // NaN cut values send every event to the left, -inf cut values every (non-NaN) event to the right
+    Cut<float> cut1, cut2, cut3;
+    cut1.feature = 0;
+    cut1.index = NAN;
+    cut1.valid = true;
+    cut2.feature = 1;
+    cut2.index = -std::numeric_limits<float>::infinity();
+    cut2.valid = true;
+    cut3.feature = 1;
+    cut3.index = std::numeric_limits<float>::infinity();
+    cut3.valid = true;
+    Forest<float> special(1.0, 0.0, false);
+    special.AddTree(Tree<float>({cut1, cut2, cut3}, {}, {}, {1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0}));
+    special.AddTree(Tree<float>({cut3, cut1, cut2}, {}, {}, {10.0, 20.0, 30.0, 40.0, 50.0, 60.0, 70.0}));
+
+    QuickScorerForest quickscorer(special);
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<std::vector<float>> events = {{0.0, 0.0}, {-inf, -inf}, {inf, inf}, {NAN, inf}, {inf, NAN}, {NAN, NAN}};
+    for(auto &event : events) {
+      EXPECT_EQ(quickscorer.GetF(event.data()), special.GetF(event));
+    }
+
+}
+
+TEST_F(CompiledForestTest, QuickScorerRejectsDeepOrIncompleteTrees) {
+
+    Forest<float> deep(0.1, 1.0, false);
+    deep.AddTree(Tree<float>(std::vector<Cut<float>>(127), {}, {}, std::vector<Weight>(255)));
+    EXPECT_THROW(QuickScorerForest quickscorer(deep), std::runtime_error);
+
+    Forest<float> incomplete(0.1, 1.0, false);
+    incomplete.AddTree(Tree<float>(std::vector<Cut<float>>(3), {}, {}, std::vector<Weight>(3)));
+    EXPECT_THROW(QuickScorerForest quickscorer(incomplete), std::runtime_error);
+
+    Forest<float> depth6(0.1, 1.0, false);
+    depth6.AddTree(Tree<float>(std::vector<Cut<float>>(63), {}, {}, std::vector<Weight>(127)));
+    EXPECT_NO_THROW(QuickScorerForest quickscorer(depth6));
+
+}
+
+TEST_F(CompiledForestTest, QuickScorerWorksWithDepthSix) {
+
+    // Trees with 127 nodes need two 64bit words per bitvector
+    std::default_random_engine generator(42);
+    std::uniform_real_distribution<float> uniform(0.0, 1.0);
+    std::uniform_int_distribution<unsigned long> feature(0, nFeatures - 1);
+    Forest<float> deep_forest(0.1, 0.5, true);
+    for(unsigned long iTree = 0; iTree < 10; ++iTree) {
+      std::vector<Cut<float>> cuts(63);
+      for(auto &cut : cuts) {
+        cut.feature = feature(generator);
+        cut.index = uniform(generator);
+        cut.valid = uniform(generator) > 0.05;
+      }
+      std::vector<Weight> weights(127);
+      for(auto &weight : weights)
+        weight = uniform(generator) - 0.5;
+      deep_forest.AddTree(Tree<float>(cuts, weights, weights, weights));
+    }
+
+    QuickScorerForest quickscorer(deep_forest);
+    for(auto &event : random_events) {
+      EXPECT_EQ(quickscorer.Analyse(event.data()), deep_forest.Analyse(event));
+    }
+
+}
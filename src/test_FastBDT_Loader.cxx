@@ -0,0 +1,129 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_Loader.h"
+#include "FastBDT_IO.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+using namespace FastBDT;
+
+class LoaderTest : public ::testing::Test {
+    protected:
+        void Load(const std::string &text, unsigned long skipLines = 0, long labelColumn = -1, long weightColumn = noColumn, unsigned long nThreads = 1) {
+          loadTextData(text.data(), text.size(), X, y, w, skipLines, labelColumn, weightColumn, nThreads);
+        }
+
+        std::vector<std::vector<float>> X;
+        std::vector<bool> y;
+        std::vector<float> w;
+};
+
+TEST_F(LoaderTest, WhitespaceSeparatedDataIsLoaded) {
+
+    Load("a b label\n1.5 -2 1\n\n  3e2\t4.25   0  \n");
+    ASSERT_EQ(X.size(), 2u);
+    EXPECT_EQ(X[0].size(), 3u);
+    // Without skipping the header, the names are converted to zero
+    EXPECT_EQ(X[0], std::vector<float>({0.0f, 1.5f, 300.0f}));
+
+    Load("a b label\n1.5 -2 1\n\n  3e2\t4.25   0  \n", 1);
+    EXPECT_EQ(X[0], std::vector<float>({1.5f, 300.0f}));
+    EXPECT_EQ(X[1], std::vector<float>({-2.0f, 4.25f}));
+    EXPECT_EQ(y, std::vector<bool>({true, false}));
+    EXPECT_EQ(w, std::vector<float>({1.0f, 1.0f}));
+
+}
+
+TEST_F(LoaderTest, CSVDataIsLoaded) {
+
+    // Windows line endings and a missing newline at the end of the file
+    Load("label,weight,x\r\n2,0.5,nan\r\n1,2.5,-inf\r\n0,1,1e-40", 1, 0, 1);
+    ASSERT_EQ(X.size(), 1u);
+    ASSERT_EQ(X[0].size(), 3u);
+    EXPECT_TRUE(std::isnan(X[0][0]));
+    EXPECT_EQ(X[0][1], -std::numeric_limits<float>::infinity());
+    std::string denormalized = "1e-40";
+    EXPECT_EQ(X[0][2], convert_to_float_safely(denormalized));
+    EXPECT_EQ(y, std::vector<bool>({false, true, false}));
+    EXPECT_EQ(w, std::vector<float>({0.5f, 2.5f, 1.0f}));
+
+    // Negative columns count from the end
+    Load("1,2,3,4\n5,6,7,8\n", 0, -2, -4);
+    EXPECT_EQ(X[0], std::vector<float>({2.0f, 6.0f}));
+    EXPECT_EQ(X[1], std::vector<float>({4.0f, 8.0f}));
+    EXPECT_EQ(w, std::vector<float>({1.0f, 5.0f}));
+
+}
+
+TEST_F(LoaderTest, ParallelLoadingIsSameAsSerialLoading) {
+
+    // Large enough to be split into several chunks
+    std::ostringstream text;
+    for(unsigned long iEvent = 0; iEvent < 200000; ++iEvent)
+      text << iEvent << " " << (iEvent * 0.37f) << " " << -1.0 / (iEvent + 1) << " " << (iEvent % 2) << "\n";
+    ASSERT_GT(text.str().size(), 4ul << 20);
+
+    Load(text.str());
+    const auto serialX = X;
+    const auto serialY = y;
+    ASSERT_EQ(serialX.size(), 3u);
+    ASSERT_EQ(serialX[0].size(), 200000u);
+    for(unsigned long iEvent = 0; iEvent < 200000; ++iEvent) {
+      EXPECT_EQ(serialX[0][iEvent], static_cast<float>(iEvent));
+      EXPECT_EQ(serialY[iEvent], iEvent % 2 == 1);
+    }
+
+    for(unsigned long nThreads : {2ul, 3ul, 4ul, 0ul}) {
+      Load(text.str(), 0, -1, noColumn, nThreads);
+      EXPECT_EQ(X, serialX);
+      EXPECT_EQ(y, serialY);
+    }
+
+}
+
+TEST_F(LoaderTest, FileIsLoadedLikeIostreams) {
+
+    loadTextData(FastBDT_FILES_DIR "/iris.txt", X, y, w, 1);
+
+    std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+    std::string header;
+    std::getline(data, header);
+    float a, b, c, d;
+    int label;
+    unsigned long iEvent = 0;
+    ASSERT_EQ(X.size(), 4u);
+    while(data >> a >> b >> c >> d >> label) {
+      ASSERT_LT(iEvent, y.size());
+      EXPECT_EQ(X[0][iEvent], a);
+      EXPECT_EQ(X[1][iEvent], b);
+      EXPECT_EQ(X[2][iEvent], c);
+      EXPECT_EQ(X[3][iEvent], d);
+      EXPECT_EQ(y[iEvent], label == 1);
+      iEvent++;
+    }
+    EXPECT_EQ(iEvent, y.size());
+
+    EXPECT_THROW(loadTextData("/tmp/this/data/file/does/not/exist", X, y, w), std::runtime_error);
+
+}
+
+TEST_F(LoaderTest, InvalidDataIsRejected) {
+
+    EXPECT_THROW(Load(""), std::runtime_error);
+    EXPECT_THROW(Load("header\n \n", 1), std::runtime_error);
+    EXPECT_THROW(Load("1 2 3\n4 5\n"), std::runtime_error);
+    EXPECT_THROW(Load("1 2 3\n4 5 6 7\n"), std::runtime_error);
+    EXPECT_THROW(Load("1\n"), std::runtime_error);
+    EXPECT_THROW(Load("1 2 3\n", 0, 3), std::runtime_error);
+    EXPECT_THROW(Load("1 2 3\n", 0, -4), std::runtime_error);
+    EXPECT_THROW(Load("1 2 3\n", 0, -1, 2), std::runtime_error);
+
+}
@@ -0,0 +1,178 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_Mapped.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+using namespace FastBDT;
+
+class MappedClassifierTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+          std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+          ASSERT_TRUE(data.good());
+          std::string header;
+          std::getline(data, header);
+          X.resize(4);
+          float a, b, c, d;
+          int label;
+          while(data >> a >> b >> c >> d >> label) {
+            X[0].push_back(a);
+            X[1].push_back(b);
+            X[2].push_back(c);
+            X[3].push_back(d);
+            y.push_back(label == 1);
+            matrix.insert(matrix.end(), {a, b, c, d});
+          }
+          w.assign(y.size(), 1.0);
+        }
+
+        /**
+         * Returns the mapped weightfile of the classifier in a buffer aligned to 8 bytes
+         */
+        std::vector<uint64_t> SaveMapped(const Classifier &classifier, unsigned long &size) {
+          std::stringstream stream;
+          classifier.SaveMapped(stream);
+          const std::string bytes = stream.str();
+          size = bytes.size();
+          std::vector<uint64_t> buffer((size + 7) / 8);
+          std::memcpy(buffer.data(), bytes.data(), size);
+          return buffer;
+        }
+
+        std::vector<std::vector<float>> X;
+        std::vector<bool> y;
+        std::vector<float> w;
+        std::vector<float> matrix;
+
+};
+
+TEST_F(MappedClassifierTest, MappedClassifierIsSameAsClassifier) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+
+    Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    purity_classifier.fit(X, y, w);
+
+    for(auto *c : {&classifier, &purity_classifier}) {
+      unsigned long size = 0;
+      auto buffer = SaveMapped(*c, size);
+      EXPECT_EQ(size % MappedFormat::alignment, 0u);
+      MappedClassifier mapped(reinterpret_cast<const char*>(buffer.data()), size);
+      EXPECT_EQ(mapped.GetNFeatures(), 4u);
+      EXPECT_EQ(mapped.GetCompiledForest().GetNTrees(), 10u);
+      EXPECT_EQ(mapped.GetCompiledForest().GetDepth(), 3u);
+
+      const unsigned long nRows = y.size();
+      std::vector<float> expected(nRows);
+      c->predict_batch(matrix.data(), nRows, 4, expected.data());
+      for(unsigned long nThreads : {1ul, 3ul}) {
+        std::vector<float> result(nRows);
+        mapped.predict_batch(matrix.data(), nRows, 4, result.data(), nThreads);
+        EXPECT_EQ(result, expected);
+      }
+      for(unsigned long iRow = 0; iRow < nRows; ++iRow) {
+        const std::vector<float> event(&matrix[iRow*4], &matrix[iRow*4] + 4);
+        EXPECT_EQ(mapped.predict(event), expected[iRow]);
+      }
+    }
+
+}
+
+TEST_F(MappedClassifierTest, MappedFileWorks) {
+
+    std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+    Classifier classifier(weightfile);
+
+    const std::string filename = "/tmp/fastbdt_mapped_classifier_" + std::to_string(getpid()) + ".weightfile";
+    {
+      std::fstream file(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      classifier.SaveMapped(file);
+    }
+
+    {
+      MappedClassifier mapped(filename);
+      std::remove(filename.c_str());
+      const unsigned long nRows = y.size();
+      std::vector<float> expected(nRows), result(nRows);
+      classifier.predict_batch(matrix.data(), nRows, 4, expected.data());
+      mapped.predict_batch(matrix.data(), nRows, 4, result.data());
+      EXPECT_EQ(result, expected);
+
+      // The early exit of PredictAbove uses the mapped bounds
+      for(unsigned long iRow = 0; iRow < nRows; ++iRow)
+        EXPECT_EQ(mapped.GetCompiledForest().PredictAbove(&matrix[iRow*4], 0.5), expected[iRow] > 0.5);
+    }
+
+    EXPECT_THROW(MappedClassifier("/tmp/this/weightfile/does/not/exist"), std::runtime_error);
+
+}
+
+TEST_F(MappedClassifierTest, CorruptMappedWeightfilesAreRejected) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    classifier.fit(X, y, w);
+    unsigned long size = 0;
+    const auto buffer = SaveMapped(classifier, size);
+    const char *data = reinterpret_cast<const char*>(buffer.data());
+
+    // Misaligned and truncated memory
+    std::vector<uint64_t> shifted(buffer.size() + 1);
+    std::memcpy(reinterpret_cast<char*>(shifted.data()) + 1, data, size);
+    EXPECT_THROW(MappedClassifier(reinterpret_cast<const char*>(shifted.data()) + 1, size), std::runtime_error);
+    EXPECT_THROW(MappedClassifier(data, sizeof(MappedFormat::Header) - 1), std::runtime_error);
+    EXPECT_THROW(MappedClassifier(data, size - 1), std::runtime_error);
+
+    // Text and binary weightfiles are not mapped weightfiles
+    std::stringstream binary;
+    classifier.SaveBinary(binary);
+    std::vector<uint64_t> binary_buffer(binary.str().size() / 8 + 1);
+    std::memcpy(binary_buffer.data(), binary.str().data(), binary.str().size());
+    EXPECT_THROW(MappedClassifier(reinterpret_cast<const char*>(binary_buffer.data()), binary.str().size()), std::runtime_error);
+
+    auto modify = [&](std::function<void(MappedFormat::Header&)> change) {
+      std::vector<uint64_t> copy = buffer;
+      MappedFormat::Header header;
+      std::memcpy(&header, copy.data(), sizeof(header));
+      change(header);
+      std::memcpy(copy.data(), &header, sizeof(header));
+      MappedClassifier mapped(reinterpret_cast<const char*>(copy.data()), size);
+    };
+    EXPECT_NO_THROW(modify([](MappedFormat::Header &) { }));
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.version++; }), std::runtime_error);
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.byteOrder = 0x0807060504030201ul; }), std::runtime_error);
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.arrays[MappedFormat::cuts].size += 1000; }), std::runtime_error);
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.arrays[MappedFormat::boostWeights].size -= 1; }), std::runtime_error);
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.arrays[MappedFormat::exitOrder].size -= 1; }), std::runtime_error);
+    EXPECT_THROW(modify([](MappedFormat::Header &header) { header.depth = 4; }), std::runtime_error);
+
+    // Feature ids outside of the row of an event, only the cuts of the generic traversal may use the sentinel of an invalid cut
+    auto modifyFeature = [&](MappedFormat::Array array, uint16_t feature) {
+      std::vector<uint64_t> copy = buffer;
+      MappedFormat::Header header;
+      std::memcpy(&header, copy.data(), sizeof(header));
+      std::memcpy(reinterpret_cast<char*>(copy.data()) + header.arrays[array].offset, &feature, sizeof(feature));
+      MappedClassifier mapped(reinterpret_cast<const char*>(copy.data()), size);
+    };
+    EXPECT_NO_THROW(modifyFeature(MappedFormat::features, 3));
+    EXPECT_NO_THROW(modifyFeature(MappedFormat::features, CompiledForest::invalidFeature));
+    EXPECT_THROW(modifyFeature(MappedFormat::features, 4), std::runtime_error);
+    EXPECT_NO_THROW(modifyFeature(MappedFormat::unrolledFeatures, 3));
+    EXPECT_THROW(modifyFeature(MappedFormat::unrolledFeatures, 4), std::runtime_error);
+    EXPECT_THROW(modifyFeature(MappedFormat::unrolledFeatures, CompiledForest::invalidFeature), std::runtime_error);
+
+}
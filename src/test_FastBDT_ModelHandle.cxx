@@ -0,0 +1,150 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_ModelHandle.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using namespace FastBDT;
+
+class ModelHandleTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+          std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+          ASSERT_TRUE(data.good());
+          std::string header;
+          std::getline(data, header);
+
+          std::vector<std::vector<float>> X(4);
+          std::vector<bool> y;
+          float a, b, c, d;
+          int label;
+          while(data >> a >> b >> c >> d >> label) {
+            X[0].push_back(a);
+            X[1].push_back(b);
+            X[2].push_back(c);
+            X[3].push_back(d);
+            y.push_back(label == 2);
+            matrix.insert(matrix.end(), {a, b, c, d});
+          }
+
+          // The weightfile was trained with 100 trees, the second model is a much smaller one
+          small_classifier = Classifier(5, 2, {4, 4, 4, 4});
+          small_classifier.fit(X, y, std::vector<float>(y.size(), 1.0));
+
+          std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+          ASSERT_TRUE(weightfile.good());
+          iris_classifier = Classifier(weightfile);
+
+          nEvents = y.size();
+          for(unsigned long i = 0; i < nEvents; ++i) {
+            std::vector<float> event(&matrix[4*i], &matrix[4*i] + 4);
+            small_predictions.push_back(small_classifier.predict(event));
+            iris_predictions.push_back(iris_classifier.predict(event));
+          }
+        }
+
+        std::vector<float> matrix;
+        unsigned long nEvents = 0;
+        Classifier small_classifier;
+        Classifier iris_classifier;
+        std::vector<float> small_predictions;
+        std::vector<float> iris_predictions;
+
+};
+
+TEST_F(ModelHandleTest, EmptyHandleThrows) {
+
+    ModelHandle handle;
+    EXPECT_EQ(handle.GetVersion(), 0u);
+    EXPECT_THROW(handle.predict({1.0, 2.0, 3.0, 4.0}), std::runtime_error);
+    ModelHandle::Reader reader(handle);
+    EXPECT_EQ(reader.get(), nullptr);
+    EXPECT_THROW(handle.Load("/this/weightfile/does/not/exist"), std::runtime_error);
+
+}
+
+TEST_F(ModelHandleTest, PublishReplacesModel) {
+
+    ModelHandle handle;
+    EXPECT_EQ(handle.Publish(std::unique_ptr<const Classifier>(new Classifier(small_classifier))), 1u);
+    EXPECT_EQ(handle.predict({matrix.begin(), matrix.begin() + 4}), small_predictions[0]);
+
+    EXPECT_EQ(handle.Load(FastBDT_FILES_DIR "/iris.weightfile"), 2u);
+    EXPECT_EQ(handle.GetVersion(), 2u);
+    std::vector<float> out(nEvents);
+    handle.predict_batch(matrix.data(), nEvents, 4, out.data());
+    EXPECT_EQ(out, iris_predictions);
+
+}
+
+TEST_F(ModelHandleTest, ReaderKeepsModelAlive) {
+
+    ModelHandle handle;
+    handle.Publish(std::unique_ptr<const Classifier>(new Classifier(small_classifier)));
+
+    auto reader = std::unique_ptr<ModelHandle::Reader>(new ModelHandle::Reader(handle));
+    auto loaded = handle.LoadInBackground(FastBDT_FILES_DIR "/iris.weightfile");
+
+    // The new model is visible to new readers as soon as it is published,
+    // but the publish cannot finish while the old model is still read
+    while(handle.GetVersion() != 2)
+      std::this_thread::yield();
+    EXPECT_EQ(handle.predict({matrix.begin(), matrix.begin() + 4}), iris_predictions[0]);
+    EXPECT_EQ(loaded.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    EXPECT_EQ(reader->GetVersion(), 1u);
+    EXPECT_EQ((*reader)->predict({matrix.begin(), matrix.begin() + 4}), small_predictions[0]);
+
+    reader.reset();
+    EXPECT_EQ(loaded.get(), 2u);
+
+}
+
+TEST_F(ModelHandleTest, ConcurrentReadersSeeConsistentModels) {
+
+    ModelHandle handle;
+    handle.Publish(std::unique_ptr<const Classifier>(new Classifier(small_classifier)));
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long> nWrong(0);
+    std::atomic<unsigned long> nBatches(0);
+    std::vector<std::thread> readers;
+    for(unsigned int iThread = 0; iThread < 3; ++iThread) {
+      readers.emplace_back([&]() {
+        std::vector<float> out(nEvents);
+        while(not stop) {
+          // All events of a batch are predicted by the same model
+          handle.predict_batch(matrix.data(), nEvents, 4, out.data());
+          if(out != small_predictions and out != iris_predictions)
+            nWrong++;
+          nBatches++;
+        }
+      });
+    }
+
+    for(unsigned int iPublish = 0; iPublish < 20; ++iPublish) {
+      if(iPublish % 2 == 0)
+        handle.Publish(std::unique_ptr<const Classifier>(new Classifier(iris_classifier)));
+      else
+        handle.Publish(std::unique_ptr<const Classifier>(new Classifier(small_classifier)));
+    }
+    // Let the readers run at least once with the final model
+    const unsigned long nBatchesAfterPublish = nBatches;
+    while(nBatches < nBatchesAfterPublish + 3)
+      std::this_thread::yield();
+    stop = true;
+    for(auto &thread : readers)
+      thread.join();
+
+    EXPECT_EQ(nWrong, 0u);
+    EXPECT_EQ(handle.GetVersion(), 21u);
+
+}
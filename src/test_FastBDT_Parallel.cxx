@@ -0,0 +1,56 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_Parallel.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace FastBDT;
+
+TEST(ParallelForTest, EveryItemIsProcessedExactlyOnce) {
+
+    for(unsigned long nThreads : {1ul, 2ul, 3ul, 7ul, 0ul}) {
+      for(unsigned long nItems : {0ul, 1ul, 5ul, 64ul, 1000ul}) {
+        std::vector<std::atomic<unsigned long>> counts(nItems);
+        for(auto &count : counts)
+          count = 0;
+        ParallelFor(nItems, nThreads, 4, [&](unsigned long first, unsigned long last) {
+          EXPECT_LE(first, last);
+          EXPECT_LE(last, nItems);
+          for(unsigned long i = first; i < last; ++i)
+            counts[i]++;
+        });
+        for(auto &count : counts)
+          EXPECT_EQ(count, 1u);
+      }
+    }
+
+}
+
+TEST(ParallelForTest, ChunksAreMultiplesOfGranularity) {
+
+    ParallelFor(1000, 3, 64, [&](unsigned long first, unsigned long) {
+      EXPECT_EQ(first % 64, 0u);
+    });
+
+}
+
+TEST(ParallelForTest, ExceptionsArePropagated) {
+
+    EXPECT_THROW(ParallelFor(1000, 4, 1, [&](unsigned long first, unsigned long) {
+      if(first > 0)
+        throw std::runtime_error("Failure in worker thread");
+    }), std::runtime_error);
+
+}
+
+TEST(ParallelForTest, ZeroThreadsUsesHardwareConcurrency) {
+
+    EXPECT_GE(GetNumberOfThreads(0), 1u);
+    EXPECT_EQ(GetNumberOfThreads(3), 3u);
+
+}
@@ -0,0 +1,243 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_Sample.h"
+#include "Classifier.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+using namespace FastBDT;
+
+class SampleCacheTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+          std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+          ASSERT_TRUE(data.good());
+          std::string header;
+          std::getline(data, header);
+          X.resize(4);
+          float a, b, c, d;
+          int label;
+          while(data >> a >> b >> c >> d >> label) {
+            X[0].push_back(a);
+            X[1].push_back(b);
+            X[2].push_back(c);
+            X[3].push_back(d);
+            y.push_back(label == 1);
+            matrix.insert(matrix.end(), {a, b, c, d});
+          }
+          for(unsigned long iEvent = 0; iEvent < y.size(); ++iEvent)
+            w.push_back(1.0 + (iEvent % 3));
+        }
+
+        /**
+         * Returns the sample cache of the classifier in a buffer aligned to 8 bytes
+         */
+        std::vector<uint64_t> SaveSampleCache(const Classifier &classifier, unsigned long &size) {
+          std::stringstream stream;
+          classifier.SaveSampleCache(X, y, w, stream);
+          const std::string bytes = stream.str();
+          size = bytes.size();
+          std::vector<uint64_t> buffer((size + 7) / 8);
+          std::memcpy(buffer.data(), bytes.data(), size);
+          return buffer;
+        }
+
+        std::vector<float> Predict(const Classifier &classifier) {
+          std::vector<float> result(y.size());
+          classifier.predict_batch(matrix.data(), y.size(), 4, result.data());
+          return result;
+        }
+
+        std::vector<std::vector<float>> X;
+        std::vector<bool> y;
+        std::vector<float> w;
+        std::vector<float> matrix;
+
+};
+
+TEST_F(SampleCacheTest, EventSampleIsRestored) {
+
+    EventSample sample(5, 2, 1, {2, 9, 3});
+    sample.AddEvent({1, 300, 2}, 1.0, true);
+    sample.AddEvent({2, 0, 3}, 2.0, false);
+    sample.AddEvent({3, 512, 8}, 3.0, true);
+    sample.AddEvent({4, 1, 1}, 4.0, false);
+    sample.AddEvent({0, 7, 0}, 5.0, false);
+
+    std::stringstream stream;
+    writeSampleCache(stream, sample, {2, 9, 3}, "preprocessing");
+    const std::string bytes = stream.str();
+    std::vector<uint64_t> buffer((bytes.size() + 7) / 8);
+    std::memcpy(buffer.data(), bytes.data(), bytes.size());
+
+    SampleCache cache(reinterpret_cast<const char*>(buffer.data()), bytes.size());
+    EXPECT_EQ(cache.GetNEvents(), 5u);
+    EXPECT_EQ(cache.GetNSignals(), 2u);
+    EXPECT_EQ(cache.GetNFeatures(), 2u);
+    EXPECT_EQ(cache.GetNSpectators(), 1u);
+    EXPECT_EQ(cache.GetLevels(), std::vector<unsigned long>({2, 9, 3}));
+    EXPECT_EQ(cache.GetPreprocessing(), "preprocessing");
+
+    // A bin of 512 needs two bytes
+    SampleFormat::Header header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    EXPECT_EQ(header.bytesPerBin, 2u);
+    EXPECT_EQ(header.fileSize % SampleFormat::alignment, 0u);
+
+    const EventSample restored = cache.GetEventSample();
+    EXPECT_EQ(restored.GetNEvents(), sample.GetNEvents());
+    EXPECT_EQ(restored.GetNSignals(), sample.GetNSignals());
+    EXPECT_EQ(restored.GetNBckgrds(), sample.GetNBckgrds());
+    for(unsigned long iEvent = 0; iEvent < sample.GetNEvents(); ++iEvent) {
+      EXPECT_EQ(restored.GetWeights().GetOriginalWeight(iEvent), sample.GetWeights().GetOriginalWeight(iEvent));
+      for(unsigned long iColumn = 0; iColumn < 3; ++iColumn)
+        EXPECT_EQ(restored.GetValues().Get(iEvent, iColumn), sample.GetValues().Get(iEvent, iColumn));
+    }
+
+}
+
+TEST_F(SampleCacheTest, BytesPerBinFitTheLargestBin) {
+
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({}), 1u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({1, 7}), 1u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({8}), 2u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({15, 3}), 2u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({16}), 4u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({31}), 4u);
+    EXPECT_EQ(SampleFormat::GetBytesPerBin({32}), 8u);
+
+}
+
+TEST_F(SampleCacheTest, FitWithSampleCacheIsSameAsFit) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    Classifier purity_classifier(10, 3, {4, 4, 4, 4});
+    purity_classifier.SetPurityTransformation({true, false, true, false});
+    Classifier flatness_classifier(10, 3, {4, 4, 4, 4}, 0.1, 1.0, false, 0.5, {false, false, false}, 1);
+
+    for(auto *c : {&classifier, &purity_classifier, &flatness_classifier}) {
+      unsigned long size = 0;
+      const auto buffer = SaveSampleCache(*c, size);
+      SampleCache cache(reinterpret_cast<const char*>(buffer.data()), size);
+
+      // The classifier which wrote the cache is not trained
+      EXPECT_EQ(c->GetNFeatures(), 0u);
+
+      Classifier cached(*c);
+      cached.fit(cache);
+      c->fit(X, y, w);
+      EXPECT_EQ(cached.GetNFeatures(), c->GetNFeatures());
+      EXPECT_EQ(cached.GetBinning(), c->GetBinning());
+      EXPECT_EQ(cached.GetCanUseFastForest(), c->GetCanUseFastForest());
+      EXPECT_EQ(Predict(cached), Predict(*c));
+
+      // The cache is used again with other hyperparameters
+      Classifier deeper(*c);
+      deeper.SetDepth(2);
+      deeper.SetNTrees(5);
+      deeper.fit(cache);
+      EXPECT_EQ(deeper.GetCanUseFastForest() ? deeper.GetFastForest().GetForest().size() : deeper.GetBinnedForest().GetForest().size(), 5u);
+      EXPECT_NE(Predict(deeper), Predict(*c));
+    }
+
+}
+
+TEST_F(SampleCacheTest, StreamedFitWithSampleCacheIsSameAsFit) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    unsigned long size = 0;
+    const auto buffer = SaveSampleCache(classifier, size);
+    SampleCache cache(reinterpret_cast<const char*>(buffer.data()), size);
+
+    std::stringstream weightfile;
+    Classifier cached(classifier);
+    cached.fit(cache, weightfile);
+    classifier.fit(X, y, w);
+
+    // Only the padding of the number of trees differs from the weightfile written after the training
+    Classifier loaded(weightfile);
+    std::stringstream expected, actual;
+    expected << classifier;
+    actual << loaded;
+    EXPECT_EQ(actual.str(), expected.str());
+
+}
+
+TEST_F(SampleCacheTest, SampleCacheFileWorks) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    const std::string filename = "/tmp/fastbdt_sample_cache_" + std::to_string(getpid()) + ".cache";
+    {
+      std::fstream file(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+      classifier.SaveSampleCache(X, y, w, file);
+    }
+
+    {
+      SampleCache cache(filename);
+      std::remove(filename.c_str());
+      EXPECT_EQ(cache.GetNEvents(), y.size());
+      Classifier cached(classifier);
+      cached.fit(cache);
+      classifier.fit(X, y, w);
+      EXPECT_EQ(Predict(cached), Predict(classifier));
+    }
+
+    EXPECT_THROW(SampleCache("/tmp/this/sample/cache/does/not/exist"), std::runtime_error);
+
+}
+
+TEST_F(SampleCacheTest, CorruptSampleCachesAreRejected) {
+
+    Classifier classifier(10, 3, {4, 4, 4, 4});
+    unsigned long size = 0;
+    const auto buffer = SaveSampleCache(classifier, size);
+    const char *data = reinterpret_cast<const char*>(buffer.data());
+
+    // Misaligned and truncated memory
+    std::vector<uint64_t> shifted(buffer.size() + 1);
+    std::memcpy(reinterpret_cast<char*>(shifted.data()) + 1, data, size);
+    EXPECT_THROW(SampleCache(reinterpret_cast<const char*>(shifted.data()) + 1, size), std::runtime_error);
+    EXPECT_THROW(SampleCache(data, sizeof(SampleFormat::Header) - 1), std::runtime_error);
+    EXPECT_THROW(SampleCache(data, size - 1), std::runtime_error);
+
+    // A mapped weightfile is not a sample cache
+    classifier.fit(X, y, w);
+    std::stringstream mapped;
+    classifier.SaveMapped(mapped);
+    std::vector<uint64_t> mapped_buffer(mapped.str().size() / 8 + 1);
+    std::memcpy(mapped_buffer.data(), mapped.str().data(), mapped.str().size());
+    EXPECT_THROW(SampleCache(reinterpret_cast<const char*>(mapped_buffer.data()), mapped.str().size()), std::runtime_error);
+
+    auto modify = [&](std::function<void(SampleFormat::Header&)> change) {
+      std::vector<uint64_t> copy = buffer;
+      SampleFormat::Header header;
+      std::memcpy(&header, copy.data(), sizeof(header));
+      change(header);
+      std::memcpy(copy.data(), &header, sizeof(header));
+      SampleCache cache(reinterpret_cast<const char*>(copy.data()), size);
+      Classifier cached(10, 3, {4, 4, 4, 4});
+      cached.fit(cache);
+    };
+    EXPECT_NO_THROW(modify([](SampleFormat::Header &) { }));
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.version++; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.byteOrder = 0x0807060504030201ul; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.bytesPerBin = 3; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.nEvents++; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.nSignals = header.nEvents + 1; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.nFeatures--; header.nSpectators++; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.arrays[SampleFormat::bins].size += 1000000; }), std::runtime_error);
+    EXPECT_THROW(modify([](SampleFormat::Header &header) { header.arrays[SampleFormat::preprocessing].size -= 1; }), std::runtime_error);
+
+}
@@ -0,0 +1,147 @@
+/**
+ * Thomas Keck 2017
+ */
+
+#include "FastBDT_Serve.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace FastBDT;
+
+class PredictionServerTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+
+          socketPath = "/tmp/fastbdt_test_" + std::to_string(getpid()) + ".sock";
+
+          std::fstream weightfile(FastBDT_FILES_DIR "/iris.weightfile", std::ios_base::in);
+          ASSERT_TRUE(weightfile.good());
+          classifier = Classifier(weightfile);
+
+          std::fstream data(FastBDT_FILES_DIR "/iris.txt", std::ios_base::in);
+          ASSERT_TRUE(data.good());
+          std::string header;
+          std::getline(data, header);
+          float a, b, c, d;
+          int label;
+          while(data >> a >> b >> c >> d >> label) {
+            matrix.insert(matrix.end(), {a, b, c, d});
+            expected.push_back(classifier.predict({a, b, c, d}));
+          }
+        }
+
+        std::string socketPath;
+        Classifier classifier;
+        std::vector<float> matrix;
+        std::vector<float> expected;
+
+};
+
+TEST_F(PredictionServerTest, ClientGetsSameScoresAsClassifier) {
+
+    PredictionServer server(socketPath, {FastBDT_FILES_DIR "/iris.weightfile"});
+    EXPECT_EQ(server.GetNModels(), 1u);
+
+    PredictionClient client(socketPath);
+    std::vector<float> out(expected.size());
+    client.predict(0, matrix.data(), expected.size(), 4, out.data());
+    EXPECT_EQ(out, expected);
+    EXPECT_EQ(client.predict(0, {matrix.begin(), matrix.begin() + 4}), expected[0]);
+
+}
+
+TEST_F(PredictionServerTest, InvalidRequestsAreRejected) {
+
+    PredictionServerOptions options;
+    options.maxRequestEvents = 100;
+    PredictionServer server(socketPath, {FastBDT_FILES_DIR "/iris.weightfile"}, options);
+
+    float out[150];
+    {
+      PredictionClient client(socketPath);
+      EXPECT_THROW(client.predict(1, matrix.data(), 1, 4, out), std::runtime_error);
+      // The server closes the connection after a rejected request
+      EXPECT_THROW(client.predict(0, {matrix.begin(), matrix.begin() + 4}), std::runtime_error);
+    }
+    {
+      PredictionClient client(socketPath);
+      EXPECT_THROW(client.predict(0, matrix.data(), 1, 3, out), std::runtime_error);
+    }
+    {
+      PredictionClient client(socketPath);
+      EXPECT_THROW(client.predict(0, matrix.data(), 150, 4, out), std::runtime_error);
+    }
+
+    // A header which announces petabytes of events is rejected before the events are read
+    {
+      const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un address;
+      std::memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+      ASSERT_EQ(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+      const ServeProtocol::RequestHeader request = {ServeProtocol::magic, 0, 100, 0xFFFFFFFFu};
+      ASSERT_EQ(send(fd, &request, sizeof(request), 0), static_cast<ssize_t>(sizeof(request)));
+      ServeProtocol::ResponseHeader response;
+      ASSERT_EQ(recv(fd, &response, sizeof(response), MSG_WAITALL), static_cast<ssize_t>(sizeof(response)));
+      EXPECT_EQ(response.status, ServeProtocol::wrongNumberOfFeatures);
+      close(fd);
+    }
+
+    // The server is still running
+    PredictionClient client(socketPath);
+    EXPECT_EQ(client.predict(0, {matrix.begin(), matrix.begin() + 4}), expected[0]);
+
+    EXPECT_THROW(PredictionClient("/tmp/this/socket/does/not/exist"), std::runtime_error);
+
+}
+
+TEST_F(PredictionServerTest, ConcurrentRequestsAreBatched) {
+
+    // A long delay makes sure that the requests of all clients end up in few batches
+    PredictionServerOptions options;
+    options.maxDelayMicroseconds = 20000;
+    options.maxBatchEvents = 150;
+    PredictionServer server(socketPath, {FastBDT_FILES_DIR "/iris.weightfile", FastBDT_FILES_DIR "/iris.weightfile"}, options);
+
+    const unsigned long nClients = 6;
+    const unsigned long nRequests = 10;
+    std::vector<unsigned long> nWrong(nClients, 0);
+    std::vector<std::thread> clients;
+    for(unsigned long iClient = 0; iClient < nClients; ++iClient) {
+      clients.emplace_back([&, iClient]() {
+        PredictionClient client(socketPath);
+        for(unsigned long iRequest = 0; iRequest < nRequests; ++iRequest) {
+          const unsigned long iEvent = (iClient * nRequests + iRequest) % expected.size();
+          const unsigned long nEvents = std::min(5ul, expected.size() - iEvent);
+          std::vector<float> out(nEvents);
+          client.predict(iClient % 2, &matrix[4*iEvent], nEvents, 4, out.data());
+          for(unsigned long i = 0; i < nEvents; ++i) {
+            if(out[i] != expected[iEvent + i])
+              nWrong[iClient]++;
+          }
+        }
+      });
+    }
+    for(auto &thread : clients)
+      thread.join();
+
+    for(auto &n : nWrong)
+      EXPECT_EQ(n, 0u);
+    EXPECT_LT(server.GetNBatches(), nClients * nRequests);
+
+    server.Reload(1, FastBDT_FILES_DIR "/iris.weightfile");
+    EXPECT_THROW(server.Reload(2, FastBDT_FILES_DIR "/iris.weightfile"), std::runtime_error);
+    PredictionClient client(socketPath);
+    EXPECT_EQ(client.predict(1, {matrix.begin(), matrix.begin() + 4}), expected[0]);
+
+}
@@ -3,6 +3,8 @@
  */
 
 #include "FastBDT.h"
+#include "FastBDT_Inference.h"
+#include "FastBDT_IO.h"
 
 #include <gtest/gtest.h>
 
@@ -11,9 +13,22 @@
 #include <random>
 #include <algorithm>
 #include <functional>
+#include <sstream>
 
 using namespace FastBDT;
 
+/**
+ * Returns the runtime of the given function in microseconds
+ */
+template<typename Function>
+double MeasureTime(Function function) {
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    function();
+    std::chrono::high_resolution_clock::time_point stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::micro> time = stop - start;
+    return time.count();
+}
+
 class PerformanceFeatureBinningTest : public ::testing::Test {
     protected:
         virtual void SetUp() {
@@ -239,3 +254,241 @@ TEST_F(PerformanceTreeBuilderTest, TreeBuilderScalesLinearForSmallNumberOfLayers
       EXPECT_LT(time_ratio,  size_ratio * 2.0);
     }
 }
+
+class PerformanceInferenceTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            std::uniform_real_distribution<float> uniform(0.0, 1.0);
+            events.resize(nEvents, std::vector<float>(nFeatures));
+            for(auto &event : events)
+              for(auto &value : event)
+                value = uniform(generator);
+        }
+
+        /**
+         * Random forest with complete trees of the given depth,
+         * the structure of the trees does not matter for the runtime
+         */
+        Forest<float> GetRandomForest(unsigned long nLayers) {
+            return GetRandomForest(nLayers, nTrees);
+        }
+
+        Forest<float> GetRandomForest(unsigned long nLayers, unsigned long nForestTrees) {
+            std::uniform_real_distribution<float> uniform(0.0, 1.0);
+            std::uniform_int_distribution<unsigned long> feature(0, nFeatures - 1);
+            Forest<float> forest(0.1, 0.0, true);
+            for(unsigned long iTree = 0; iTree < nForestTrees; ++iTree) {
+              std::vector<Cut<float>> cuts((1 << nLayers) - 1);
+              for(auto &cut : cuts) {
+                cut.feature = feature(generator);
+                cut.index = uniform(generator);
+                cut.valid = true;
+              }
+              std::vector<Weight> weights((1 << (nLayers + 1)) - 1);
+              for(auto &weight : weights)
+                weight = uniform(generator) - 0.5;
+              forest.AddTree(Tree<float>(cuts, weights, weights, weights));
+            }
+            return forest;
+        }
+
+        std::default_random_engine generator;
+        const unsigned long nFeatures = 20;
+        const unsigned long nTrees = 1000;
+        const unsigned long nEvents = 10000;
+        std::vector<std::vector<float>> events;
+};
+
+TEST_F(PerformanceInferenceTest, QuickScorerVersusForest) {
+
+    for(unsigned long nLayers : {3, 4, 6}) {
+      Forest<float> forest = GetRandomForest(nLayers);
+      QuickScorerForest quickscorer(forest);
+
+      std::vector<double> forest_F(nEvents);
+      double forest_time = MeasureTime([&]() {
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+          forest_F[iEvent] = forest.GetF(events[iEvent]);
+      });
+
+      std::vector<double> quickscorer_F(nEvents);
+      double quickscorer_time = MeasureTime([&]() {
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+          quickscorer_F[iEvent] = quickscorer.GetF(events[iEvent].data());
+      });
+
+      // Both implementations must give exactly the same result, this also
+      // ensures that the compiler cannot optimize out the evaluation
+      EXPECT_EQ(forest_F, quickscorer_F);
+
+      // The bitvectors grow with the number of leaves, so QuickScorer is only faster for shallow trees
+      if(nLayers <= 4) {
+        double time_ratio = quickscorer_time / forest_time;
+        EXPECT_LT(time_ratio, 1.5);
+      }
+    }
+
+}
+
+TEST_F(PerformanceInferenceTest, UnrolledVersusGenericTraversal) {
+
+    for(unsigned long nLayers : {3, 6, 8}) {
+      Forest<float> forest = GetRandomForest(nLayers);
+      CompiledForest unrolled(forest);
+      EXPECT_EQ(unrolled.GetDepth(), nLayers);
+
+      // Adding a tree with a different depth disables the depth-specialised kernels
+      Forest<float> mixed(forest);
+      mixed.AddTree(Tree<float>({Cut<float>()}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}));
+      CompiledForest generic(mixed);
+      EXPECT_EQ(generic.GetDepth(), 0u);
+
+      std::vector<double> generic_F(nEvents);
+      double generic_time = MeasureTime([&]() {
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+          generic_F[iEvent] = generic.GetF(events[iEvent].data());
+      });
+
+      std::vector<double> unrolled_F(nEvents);
+      double unrolled_time = MeasureTime([&]() {
+        for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+          unrolled_F[iEvent] = unrolled.GetF(events[iEvent].data());
+      });
+
+      EXPECT_EQ(generic_F, unrolled_F);
+
+      // The unrolled kernels should not be slower, we allow for a deviation of 50%
+      double time_ratio = unrolled_time / generic_time;
+      EXPECT_LT(time_ratio, 1.5);
+    }
+
+}
+
+TEST_F(PerformanceInferenceTest, TiledVersusBlockedBatch) {
+
+    // 2000 trees with depth 6 need about 1.5MB, so the forest does not fit into most L2 caches
+    Forest<float> forest = GetRandomForest(6, 2000);
+    CompiledForest tiled(forest);
+    CompiledForest blocked(forest);
+    // One tile containing all trees and one block of events reproduces the evaluation without tiles
+    blocked.SetTileSizes(blocked.GetNTrees(), CompiledForest::blockSize);
+
+    std::vector<float> matrix;
+    matrix.reserve(nEvents * nFeatures);
+    for(auto &event : events)
+      matrix.insert(matrix.end(), event.begin(), event.end());
+
+    std::vector<double> blocked_F(nEvents);
+    double blocked_time = MeasureTime([&]() { blocked.GetF(matrix.data(), nEvents, nFeatures, blocked_F.data()); });
+
+    std::vector<double> tiled_F(nEvents);
+    double tiled_time = MeasureTime([&]() { tiled.GetF(matrix.data(), nEvents, nFeatures, tiled_F.data()); });
+
+    EXPECT_EQ(blocked_F, tiled_F);
+
+    // The gain depends on the cache sizes of the machine, but the tiles should never be slower, we allow for a deviation of 50%
+    double time_ratio = tiled_time / blocked_time;
+    EXPECT_LT(time_ratio, 1.5);
+
+}
+
+TEST_F(PerformanceInferenceTest, PredictAboveVersusAnalyse) {
+
+    // The early exit needs forests in which the first trees dominate the sum, like forests trained with a large shrinkage.
+    // Therefore the boost weights of the random forest are scaled down with each tree.
+    Forest<float> random_forest = GetRandomForest(4);
+    Forest<float> forest(random_forest.GetShrinkage(), random_forest.GetF0(), random_forest.GetTransform2Probability());
+    double scale = 1.0;
+    for(auto &tree : random_forest.GetForest()) {
+      std::vector<Weight> weights = tree.GetBoostWeights();
+      for(auto &weight : weights)
+        weight *= scale;
+      forest.AddTree(Tree<float>(tree.GetCuts(), weights, weights, weights));
+      scale *= 0.99;
+    }
+    CompiledForest compiled(forest);
+
+    std::vector<float> outputs(nEvents);
+    double analyse_time = MeasureTime([&]() {
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+        outputs[iEvent] = compiled.Analyse(events[iEvent].data());
+    });
+
+    // Typical trigger threshold, which rejects 90% of the events
+    std::vector<float> sorted_outputs(outputs);
+    std::sort(sorted_outputs.begin(), sorted_outputs.end());
+    const float threshold = sorted_outputs[nEvents * 9 / 10];
+
+    std::vector<char> above(nEvents);
+    double above_time = MeasureTime([&]() {
+      for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+        above[iEvent] = compiled.PredictAbove(events[iEvent].data(), threshold);
+    });
+
+    for(unsigned long iEvent = 0; iEvent < nEvents; ++iEvent)
+      EXPECT_EQ(above[iEvent], outputs[iEvent] > threshold);
+
+    // Most events leave the forest after a fraction of the trees
+    double time_ratio = above_time / analyse_time;
+    EXPECT_LT(time_ratio, 1.0);
+
+}
+
+class PerformanceWeightfileTest : public ::testing::Test {
+    protected:
+        virtual void SetUp() {
+            // Weightfile section of a model with many features and fine binnings
+            std::uniform_real_distribution<float> uniform(0.0, 1.0);
+            std::vector<float> values(10000);
+            for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature) {
+              for(auto &value : values)
+                value = uniform(generator);
+              featureBinnings.push_back(FeatureBinning<float>(nLevels, values));
+            }
+            std::stringstream stream;
+            stream << featureBinnings;
+            weightfile = stream.str();
+        }
+
+        std::default_random_engine generator;
+        const unsigned long nFeatures = 1000;
+        const unsigned long nLevels = 10;
+        std::vector<FeatureBinning<float>> featureBinnings;
+        std::string weightfile;
+};
+
+TEST_F(PerformanceWeightfileTest, RestoringFeatureBinningIsFasterThanBinningAgain) {
+
+    std::vector<unsigned long> levels;
+    std::vector<std::vector<float>> boundaries;
+    std::stringstream stream(weightfile);
+    TextReader reader(stream);
+    const unsigned long size = reader.Read<unsigned long>();
+    for(unsigned long iFeature = 0; iFeature < size; ++iFeature) {
+      levels.push_back(reader.Read<unsigned long>());
+      boundaries.emplace_back();
+      readText(reader, boundaries.back());
+    }
+    ASSERT_EQ(boundaries.size(), nFeatures);
+
+    std::vector<FeatureBinning<float>> restored;
+    double restore_time = MeasureTime([&]() {
+      for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature)
+        restored.push_back(FeatureBinning<float>::Restore(levels[iFeature], boundaries[iFeature]));
+    });
+
+    // This is how the FeatureBinnings were loaded before, the stored boundaries were binned again
+    std::vector<FeatureBinning<float>> rebinned;
+    double rebin_time = MeasureTime([&]() {
+      for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature)
+        rebinned.push_back(FeatureBinning<float>(levels[iFeature], boundaries[iFeature]));
+    });
+
+    for(unsigned long iFeature = 0; iFeature < nFeatures; ++iFeature)
+      EXPECT_EQ(restored[iFeature].GetBinning(), featureBinnings[iFeature].GetBinning());
+
+    // Restoring checks the order in one pass, binning again sorts the boundaries
+    double time_ratio = restore_time / rebin_time;
+    EXPECT_LT(time_ratio, 1.0);
+
+}
@@ -4,7 +4,7 @@
 
 #include <gtest/gtest.h>
 
-int main(long argc, char **argv) {
+int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }